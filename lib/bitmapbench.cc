@@ -0,0 +1,112 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Times the bitmap encoder on a screen-sized image.
+ *
+ * Usage: bitmapbench [rounds]
+ *
+ * For a blank page, a line drawing and noise, prints the size of the
+ * encoded bitmap with and without RLE, and how long encoding takes.
+ */
+#include "config.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bufferstore.h"
+#include "psibitmap.h"
+
+using namespace std;
+
+#define WIDTH 640
+#define HEIGHT 480
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+fill(const string &kind, vector<unsigned char> &img)
+{
+    uint32_t seed = 1;
+
+    img.assign(WIDTH * HEIGHT, 255);
+    for (int y = 0; y < HEIGHT; y++)
+	for (int x = 0; x < WIDTH; x++) {
+	    unsigned char &g = img[y * WIDTH + x];
+	    if (kind == "drawing") {
+		// A frame, a grid and a diagonal, in two shades.
+		if ((x < 4) || (x >= WIDTH - 4) || (y < 4) || (y >= HEIGHT - 4))
+		    g = 0;
+		else if (!(x % 40) || !(y % 40))
+		    g = 170;
+		else if ((x - y < 2) && (y - x < 2))
+		    g = 0;
+	    } else if (kind == "noise") {
+		seed = seed * 1103515245 + 12345;
+		g = seed >> 24;
+	    }
+	}
+}
+
+static void
+run(const string &kind, int rounds)
+{
+    vector<unsigned char> img;
+
+    fill(kind, img);
+    cout << kind << ":";
+    for (int rle = 0; rle < 2; rle++) {
+	bufferStore out;
+	double start = now();
+	for (int i = 0; i < rounds; i++) {
+	    out.init();
+	    encodeBitmap(WIDTH, HEIGHT, img.data(), WIDTH, rle, out);
+	}
+	cout << (rle ? "  rle " : "  raw ") << out.getLen() << " bytes "
+	     << (now() - start) / rounds << " ms";
+    }
+    cout << endl;
+}
+
+int
+main(int argc, char **argv)
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 100;
+
+    if (rounds < 1)
+	rounds = 1;
+    cout << WIDTH << "x" << HEIGHT << ", " << rounds << " rounds" << endl;
+    run("blank", rounds);
+    run("drawing", rounds);
+    run("noise", rounds);
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Round-trip check of the bitmap encoder.
+ *
+ * Every image is encoded with and without RLE and decoded again, and
+ * must come back as the four gray levels the encoder quantises to.
+ * The widths cover the vector paths of packGrayRow2, the scalar tail
+ * after them and the scanline padding.
+ */
+#include "config.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bufferstore.h"
+#include "psibitmap.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static uint32_t
+le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* A fixed generator, so that a failure can be reproduced. */
+static uint32_t seed;
+
+static int
+next()
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+static void
+fill(const string &kind, int w, int h, vector<unsigned char> &img)
+{
+    img.assign(w * h, 0);
+    seed = w * 131 + h;
+    for (int y = 0; y < h; y++)
+	for (int x = 0; x < w; x++) {
+	    unsigned char &g = img[y * w + x];
+	    if (kind == "blank")
+		g = 255;
+	    else if (kind == "noise")
+		g = next() & 0xff;
+	    else if (kind == "hstripes")
+		g = (y & 1) ? 0 : 255;
+	    else if (kind == "vstripes")
+		g = ((x / 3) & 3) * 85;
+	    else if (kind == "runs")
+		g = (x == 0) ? (next() & 0xff) : img[y * w + x - 1];
+	}
+    // Break the runs up at random places.
+    if (kind == "runs")
+	for (int i = 0; i < w * h / 16; i++)
+	    img[next() % (w * h)] = next() & 0xff;
+}
+
+/*
+ * Encodes one image and checks what comes back.
+ *
+ * @returns the RLE flag of the encoded bitmap, or -1 on failure.
+ */
+static int
+roundTrip(const string &kind, int w, int h, bool rle)
+{
+    vector<unsigned char> img;
+    bufferStore enc;
+    bufferStore dec;
+    int dw, dh;
+    string what = kind + " " + to_string(w) + "x" + to_string(h) +
+	(rle ? " rle" : " raw");
+
+    fill(kind, w, h, img);
+    encodeBitmap(w, h, img.data(), w, rle, enc);
+    const unsigned char *p = (const unsigned char *)enc.getString(0);
+    if ((enc.getLen() < 0x28) || (le32(p) != enc.getLen())) {
+	cerr << "bitmaptest: " << what << ": bad total length" << endl;
+	failures++;
+	return -1;
+    }
+    if (!decodeBitmap(p, dw, dh, dec) || (dw != w) || (dh != h) ||
+	(dec.getLen() != (unsigned long)(w * h))) {
+	cerr << "bitmaptest: " << what << ": does not decode" << endl;
+	failures++;
+	return -1;
+    }
+    const unsigned char *d = (const unsigned char *)dec.getString(0);
+    for (int i = 0; i < w * h; i++)
+	if (d[i] != (img[i] / 85) * 85) {
+	    cerr << "bitmaptest: " << what << ": pixel " << i % w << ","
+		 << i / w << " is " << (int)d[i] << ", expected "
+		 << (img[i] / 85) * 85 << endl;
+	    failures++;
+	    return -1;
+	}
+    return le32(p + 36);
+}
+
+static void
+expect(bool ok, const string &what)
+{
+    if (!ok) {
+	cerr << "bitmaptest: " << what << endl;
+	failures++;
+    }
+}
+
+int
+main()
+{
+    static const char *kinds[] = {
+	"blank", "noise", "hstripes", "vstripes", "runs"
+    };
+    static const int widths[] = {
+	1, 2, 3, 5, 7, 13, 15, 16, 17, 31, 33, 63, 64, 65,
+	127, 128, 129, 130, 191, 255, 256, 257, 640
+    };
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+	for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++)
+	    for (int h = 1; h <= 9; h += 4) {
+		int w = widths[i];
+		expect(roundTrip(kinds[k], w, h, false) == 0,
+		       string(kinds[k]) + ": RLE used when not asked for");
+		int flag = roundTrip(kinds[k], w, h, true);
+		// Without padding at the end of the scanlines, there is
+		// nothing in noise that RLE could shrink.
+		if ((string(kinds[k]) == "noise") && !(w % 16))
+		    expect(flag == 0, "noise " + to_string(w) + "x" +
+			   to_string(h) + ": not stored raw");
+	    }
+
+    // A blank page must shrink, and be marked as compressed.
+    bufferStore raw, rle;
+    vector<unsigned char> img;
+    fill("blank", 640, 240, img);
+    encodeBitmap(640, 240, img.data(), 640, false, raw);
+    encodeBitmap(640, 240, img.data(), 640, true, rle);
+    expect(le32((const unsigned char *)rle.getString(0) + 36) == 1,
+	   "blank: not RLE compressed");
+    expect(rle.getLen() < raw.getLen(), "blank: RLE did not shrink it");
+    expect(roundTrip("blank", 640, 240, true) == 1,
+	   "blank: does not round-trip compressed");
+
+    if (failures) {
+	cerr << "bitmaptest: " << failures << " failures" << endl;
+	return 1;
+    }
+    cout << "bitmaptest: OK" << endl;
+    return 0;
+}
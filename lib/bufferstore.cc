@@ -197,6 +197,13 @@ void bufferStore::addDWord(long a) {
     buff[len++] = (a>>24) & 0xff;
 }
 
+unsigned char *bufferStore::addSpace(long l) {
+    checkAllocd(len + l);
+    unsigned char *p = &buff[len];
+    len += l;
+    return p;
+}
+
 void bufferStore::truncate(long newLen) {
     if (newLen < len)
 	len = newLen;
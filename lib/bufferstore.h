@@ -215,6 +215,17 @@ public:
     */
     void addBuff(const bufferStore &b, long maxLen = -1);
 
+    /**
+    * Appends uninitialized space to the content of this instance,
+    * to be filled in place.
+    *
+    * @param len Length of the space to append.
+    *
+    * @returns A pointer to the new space. It is valid until the
+    *          content of this instance is changed again.
+    */
+    unsigned char *addSpace(long len);
+
     /**
     * Truncates the buffer.
     * If the buffer is smaller, does nothing.
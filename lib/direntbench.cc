@@ -0,0 +1,154 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Compares PlpDir and PlpDirList on a big listing.
+ *
+ * Usage: direntbench [entries]
+ *
+ * Builds a listing of the given number of entries (10000 by default)
+ * with 47-character names both ways, and prints the memory each one
+ * takes per entry and how long it takes to build. It then times
+ * converting the time and attributes of every entry, as a directory
+ * listing would. Memory is what is held from operator new once the
+ * listing is built, so allocator overhead is not included.
+ */
+#include "config.h"
+
+#include <iostream>
+#include <new>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "plpdirent.h"
+#include "rfsv.h"
+
+using namespace std;
+
+#define NAMELEN 47
+
+/*
+ * Every allocation carries its size in front of it, so that the bytes
+ * in use can be counted.
+ */
+#define HEADER 16
+
+static size_t inUse = 0;
+
+void *
+operator new(size_t n)
+{
+    char *p = (char *)malloc(n + HEADER);
+
+    if (!p)
+	throw bad_alloc();
+    *(size_t *)p = n;
+    inUse += n;
+    return p + HEADER;
+}
+
+void
+operator delete(void *p) noexcept
+{
+    if (p) {
+	char *h = (char *)p - HEADER;
+	inUse -= *(size_t *)h;
+	free(h);
+    }
+}
+
+void
+operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+makeName(int i, char *buf)
+{
+    snprintf(buf, NAMELEN + 1, "Document %08u with a rather long file name.",
+	     (unsigned)i % 100000000);
+}
+
+int
+main(int argc, char **argv)
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 10000;
+    char name[NAMELEN + 1];
+    char attr[16];
+    unsigned long sum = 0;
+    double start;
+    size_t before;
+    PlpDir dir;
+    PlpDirList list;
+
+    if (count < 1)
+	count = 1;
+    cout << count << " entries, " << NAMELEN << "-character names" << endl;
+
+    // Both are built the way rfsv32 gets them: one entry at a time.
+    before = inUse;
+    start = now();
+    for (int i = 0; i < count; i++) {
+	makeName(i, name);
+	dir.push_back(PlpDirent(i * 13, 0x20, 0x00e0f000, i, name));
+    }
+    cout << "PlpDir:      " << (inUse - before + sizeof(dir)) / count
+	 << " bytes/entry, " << now() - start << " ms to build" << endl;
+
+    before = inUse;
+    start = now();
+    for (int i = 0; i < count; i++) {
+	makeName(i, name);
+	list.add(i * 13, 0x20, 0x00e0f000, i, 0, 0, 0, name, NAMELEN);
+    }
+    cout << "PlpDirList:  " << (inUse - before + sizeof(list)) / count
+	 << " bytes/entry, " << now() - start << " ms to build" << endl;
+
+    start = now();
+    for (PlpDir::iterator i = dir.begin(); i != dir.end(); i++) {
+	sum += i->getPsiTime().getTime();
+	sum += rfsv::attr2String(i->getAttr(), attr)[0];
+    }
+    cout << "PlpDir:      " << now() - start
+	 << " ms for the time and attribute string of every entry" << endl;
+
+    start = now();
+    for (size_t i = 0; i < list.size(); i++) {
+	sum += list.getTime(i);
+	sum += list.getAttrString(i, attr)[0];
+    }
+    cout << "PlpDirList:  " << now() - start
+	 << " ms for the time and attribute string of every entry" << endl;
+
+    // Keeps the conversions from being optimised away.
+    return (sum == 0) ? 1 : 0;
+}
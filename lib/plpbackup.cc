@@ -0,0 +1,908 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include "plpbackup.h"
+
+#include <deque>
+#include <set>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define TAR_BLOCK 512
+
+/**
+ * Amount of file data read from or written to the Psion
+ * per call; a multiple of the link's request size.
+ */
+#define BK_CHUNK (RFSV_SENDLEN * 16)
+
+/**
+ * Upper limit of data buffered between the Psion side
+ * and the archive side.
+ */
+#define BK_QUEUE_LIMIT (1024 * 1024)
+
+/**
+ * Prefix of the pax keywords holding EPOC metadata. They are
+ * stored as user extended attributes in the form used by star
+ * and GNU tar, so that other tar programs either ignore them
+ * quietly or, with --xattrs, keep them on the extracted files.
+ */
+#define PAX_PLPTOOLS "SCHILY.xattr.user.plptools."
+
+/** Attributes which can be restored with fsetattr. */
+#define BK_ATTR_MASK (rfsv::PSI_A_RDONLY | rfsv::PSI_A_HIDDEN | \
+		      rfsv::PSI_A_SYSTEM | rfsv::PSI_A_ARCHIVE)
+
+/**
+ * An element passed between the two threads.
+ * @internal
+ */
+struct bkItem {
+    enum kind {
+	BK_DATA,
+	BK_FILE,
+	BK_DIR,
+	BK_END,
+	BK_ERROR
+    };
+
+    bkItem(kind k = BK_DATA) : type(k), epocAttr(false) { }
+
+    kind type;
+    std::string data;
+    std::string name;
+    PlpManifestEntry e;
+    bool epocAttr;
+};
+
+/**
+ * A queue of @ref bkItem limited by the amount of data it holds.
+ * @internal
+ */
+class bkQueue {
+public:
+    bkQueue() : used(0), aborted(false) {
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+    }
+
+    ~bkQueue() {
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+    }
+
+    /**
+    * Appends an item, blocking while the queue is full.
+    * Returns false if the consumer has given up, unless
+    * @p force is set.
+    */
+    bool push(bkItem &i, bool force = false) {
+	pthread_mutex_lock(&lock);
+	while (!aborted && !force && (used > 0) &&
+	       (used + i.data.size() > BK_QUEUE_LIMIT))
+	    pthread_cond_wait(&cond, &lock);
+	bool ok = force || !aborted;
+	if (ok) {
+	    used += i.data.size();
+	    q.push_back(bkItem(i.type));
+	    q.back().data.swap(i.data);
+	    q.back().name.swap(i.name);
+	    q.back().e = i.e;
+	    q.back().epocAttr = i.epocAttr;
+	    pthread_cond_broadcast(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+	return ok;
+    }
+
+    /**
+    * Removes the oldest item, blocking while the queue is empty.
+    */
+    void pop(bkItem &i) {
+	pthread_mutex_lock(&lock);
+	while (q.empty())
+	    pthread_cond_wait(&cond, &lock);
+	i.type = q.front().type;
+	i.data.swap(q.front().data);
+	i.name.swap(q.front().name);
+	i.e = q.front().e;
+	i.epocAttr = q.front().epocAttr;
+	used -= i.data.size();
+	q.pop_front();
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+    }
+
+    /**
+    * Called by the consumer to make the producer stop.
+    */
+    void abort() {
+	pthread_mutex_lock(&lock);
+	aborted = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+    }
+
+private:
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    std::deque<bkItem> q;
+    size_t used;
+    bool aborted;
+};
+
+static bool
+writeAll(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+	ssize_t r = write(fd, p, len);
+	if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return false;
+	}
+	p += r;
+	len -= r;
+    }
+    return true;
+}
+
+static bool
+readAll(int fd, char *p, size_t len)
+{
+    while (len > 0) {
+	ssize_t r = read(fd, p, len);
+	if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return false;
+	}
+	if (r == 0)
+	    return false;
+	p += r;
+	len -= r;
+    }
+    return true;
+}
+
+void *
+bkWriter(void *arg)
+{
+    PlpBackup *b = (PlpBackup *)arg;
+    bkItem i;
+
+    do {
+	b->queue->pop(i);
+	if (!b->writeError && !i.data.empty() &&
+	    !writeAll(b->outFd, i.data.data(), i.data.size())) {
+	    b->writeError = true;
+	    b->queue->abort();
+	}
+    } while (i.type != bkItem::BK_END);
+    return NULL;
+}
+
+PlpBackup::PlpBackup(rfsv &_a)
+    : a(_a), cbPtr(NULL), cbFunc(NULL), window(4), queue(NULL),
+      running(false), outFd(-1), writeError(false), broken(false), files(0), skipped(0),
+      failed(0), bytes(0)
+{
+}
+
+PlpBackup::~PlpBackup()
+{
+    if (running)
+	close();
+}
+
+string PlpBackup::
+archivePath(const string &psionPath)
+{
+    string ret;
+    size_t i = 0;
+
+    if ((psionPath.size() >= 2) && (psionPath[1] == ':')) {
+	ret += toupper(psionPath[0]);
+	i = 2;
+	if ((i < psionPath.size()) && ((psionPath[i] == '\\') || (psionPath[i] == '/')))
+	    i++;
+	ret += '/';
+    }
+    for (; i < psionPath.size(); i++)
+	ret += (psionPath[i] == '\\') ? '/' : psionPath[i];
+    return ret;
+}
+
+string PlpBackup::
+psionPath(const string &archivePath)
+{
+    string ret;
+    size_t i = 0;
+
+    if ((archivePath.size() >= 2) && (archivePath[1] == '/')) {
+	ret += archivePath[0];
+	ret += ":\\";
+	i = 2;
+    }
+    for (; i < archivePath.size(); i++)
+	ret += (archivePath[i] == '/') ? '\\' : archivePath[i];
+    return ret;
+}
+
+/**
+ * Formats a numeric ustar header field.
+ */
+static void
+tarOctal(char *field, size_t len, uint64_t val)
+{
+    snprintf(field, len, "%0*llo", (int)(len - 1), (unsigned long long)val);
+}
+
+static uint64_t
+tarNumber(const char *field, size_t len)
+{
+    uint64_t val = 0;
+    size_t i = 0;
+
+    while ((i < len) && (field[i] == ' '))
+	i++;
+    for (; (i < len) && (field[i] >= '0') && (field[i] <= '7'); i++)
+	val = (val << 3) | (field[i] - '0');
+    return val;
+}
+
+static void
+tarChecksum(char *hdr)
+{
+    unsigned int sum = 0;
+
+    memset(hdr + 148, ' ', 8);
+    for (int i = 0; i < TAR_BLOCK; i++)
+	sum += (unsigned char)hdr[i];
+    snprintf(hdr + 148, 8, "%06o", sum);
+    hdr[155] = ' ';
+}
+
+static bool
+tarVerify(const char *hdr)
+{
+    unsigned int sum = 0;
+
+    for (int i = 0; i < TAR_BLOCK; i++)
+	sum += ((i >= 148) && (i < 156)) ? ' ' : (unsigned char)hdr[i];
+    return sum == tarNumber(hdr + 148, 8);
+}
+
+/**
+ * Appends a ustar header block to @p out.
+ */
+static void
+tarHeader(string &out, const string &name, char type, uint32_t mode,
+	  uint64_t size, time_t mtime)
+{
+    char hdr[TAR_BLOCK];
+
+    memset(hdr, 0, sizeof(hdr));
+    if (name.size() <= 100)
+	memcpy(hdr, name.data(), name.size());
+    else {
+	// Try to split into prefix and name, otherwise truncate.
+	// pax readers use the path record anyway.
+	size_t p = name.find('/', name.size() - 101);
+	if ((p != string::npos) && (p <= 155) && (p > 0)) {
+	    memcpy(hdr + 345, name.data(), p);
+	    memcpy(hdr, name.data() + p + 1, name.size() - p - 1);
+	} else
+	    memcpy(hdr, name.data(), 100);
+    }
+    tarOctal(hdr + 100, 8, mode);
+    tarOctal(hdr + 108, 8, 0);
+    tarOctal(hdr + 116, 8, 0);
+    tarOctal(hdr + 124, 12, size);
+    tarOctal(hdr + 136, 12, (mtime < 0) ? 0 : mtime);
+    hdr[156] = type;
+    memcpy(hdr + 257, "ustar", 6);
+    memcpy(hdr + 263, "00", 2);
+    tarChecksum(hdr);
+    out.append(hdr, TAR_BLOCK);
+}
+
+static void
+tarPad(string &out, uint64_t len)
+{
+    if (len % TAR_BLOCK)
+	out.append(TAR_BLOCK - (len % TAR_BLOCK), '\0');
+}
+
+/**
+ * Appends a pax record "<len> <key>=<value>\n" to @p out.
+ * The length includes its own digits.
+ */
+static void
+paxRecord(string &out, const char *key, const string &value)
+{
+    size_t len = strlen(key) + value.size() + 3;
+    size_t total = len + 1;
+    char buf[32];
+
+    for (;;) {
+	size_t d = snprintf(buf, sizeof(buf), "%zu ", total) - 1;
+	if (len + d == total)
+	    break;
+	total = len + d;
+    }
+    out += buf;
+    out += key;
+    out += '=';
+    out += value;
+    out += '\n';
+}
+
+bool PlpBackup::
+push(string &data)
+{
+    bkItem i(bkItem::BK_DATA);
+    i.data.swap(data);
+    if (!queue->push(i))
+	broken = true;
+    return !broken;
+}
+
+bool PlpBackup::
+emit(const string &name, const PlpManifestEntry &e)
+{
+    string pax;
+    string out;
+    char buf[64];
+    PsiTime t = e.getPsiTime();
+    struct timeval &tv = t.getTimeval();
+
+    if (name.size() > 100)
+	paxRecord(pax, "path", name);
+    snprintf(buf, sizeof(buf), "%ld.%06ld", (long)tv.tv_sec, (long)tv.tv_usec);
+    paxRecord(pax, "mtime", buf);
+    snprintf(buf, sizeof(buf), "%x", e.attr);
+    paxRecord(pax, PAX_PLPTOOLS "attr", buf);
+    snprintf(buf, sizeof(buf), "%08x%08x", e.timeHi, e.timeLo);
+    paxRecord(pax, PAX_PLPTOOLS "psitime", buf);
+    if (!e.isDir()) {
+	snprintf(buf, sizeof(buf), "%08x,%08x,%08x", e.uid[0], e.uid[1], e.uid[2]);
+	paxRecord(pax, PAX_PLPTOOLS "uid", buf);
+    }
+
+    string base = name;
+    if (!base.empty() && (base[base.size() - 1] == '/'))
+	base.erase(base.size() - 1);
+    size_t p = base.rfind('/');
+    if (p != string::npos)
+	base.erase(0, p + 1);
+    tarHeader(out, ("PaxHeaders/" + base).substr(0, 100), 'x', 0644,
+	      pax.size(), tv.tv_sec);
+    out += pax;
+    tarPad(out, pax.size());
+
+    uint32_t mode = e.isDir() ? 0755 : 0644;
+    if (e.attr & rfsv::PSI_A_RDONLY)
+	mode &= ~0222;
+    tarHeader(out, name, e.isDir() ? '5' : '0', mode,
+	      e.isDir() ? 0 : e.size, tv.tv_sec);
+    return push(out);
+}
+
+Enum<rfsv::errs> PlpBackup::
+emitFile(const string &psionName, const string &name, PlpManifestEntry &e)
+{
+    Enum<rfsv::errs> res;
+    uint32_t handle;
+
+    res = a.fopen(a.opMode(rfsv::PSI_O_RDONLY | rfsv::PSI_O_SHARE),
+		  psionName.c_str(), handle);
+    if (res != rfsv::E_PSI_GEN_NONE)
+	return res;
+    if (!emit(name, e)) {
+	a.fclose(handle);
+	return rfsv::E_PSI_GEN_FAIL;
+    }
+
+    // The size in the header is fixed now. If the file shrinks
+    // or cannot be read any more, the rest is padded with zeroes
+    // and the file is counted as failed.
+    uint32_t remaining = e.size;
+    while (remaining > 0) {
+	uint32_t n = (remaining > BK_CHUNK) ? BK_CHUNK : remaining;
+	uint32_t count = 0;
+	string data(n, '\0');
+
+	if (res == rfsv::E_PSI_GEN_NONE) {
+	    res = a.freadPipelined(handle, (unsigned char *)&data[0], n, count, window);
+	    if ((res == rfsv::E_PSI_GEN_NONE) && (count < n))
+		res = rfsv::E_PSI_FILE_EOF;
+	    bytes += count;
+	}
+	remaining -= n;
+	if (remaining == 0)
+	    tarPad(data, e.size);
+	// Padding goes on after a disconnect too, or the archive
+	// would be corrupt rather than just missing data.
+	if (!push(data)) {
+	    res = rfsv::E_PSI_GEN_FAIL;
+	    break;
+	}
+    }
+    a.fclose(handle);
+    return res;
+}
+
+bool PlpBackup::
+open(int fd)
+{
+    if (running)
+	return false;
+    outFd = fd;
+    writeError = false;
+    broken = false;
+    queue = new bkQueue();
+    if (pthread_create(&thread, NULL, bkWriter, this) != 0) {
+	delete queue;
+	queue = NULL;
+	return false;
+    }
+    running = true;
+    return true;
+}
+
+bool PlpBackup::
+close()
+{
+    if (!running)
+	return false;
+    bkItem i(bkItem::BK_END);
+    i.data.assign(TAR_BLOCK * 2, '\0');
+    // Even if the writer has given up, it waits for the end marker.
+    queue->push(i, true);
+    pthread_join(thread, NULL);
+    delete queue;
+    queue = NULL;
+    running = false;
+    return !writeError;
+}
+
+Enum<rfsv::errs> PlpBackup::
+backup(const char * const root, PlpManifest *snapshot)
+{
+    PlpManifest cur;
+    Enum<rfsv::errs> res;
+
+    if (!running || broken)
+	return rfsv::E_PSI_GEN_FAIL;
+    if ((res = cur.scan(a, root)) != rfsv::E_PSI_GEN_NONE)
+	return res;
+
+    string prefix = archivePath(root);
+    if (!prefix.empty() && (prefix[prefix.size() - 1] != '/'))
+	prefix += '/';
+
+    if (snapshot) {
+	// Forget files which have been deleted since the last run.
+	vector<string> gone;
+	for (PlpManifest::iterator i = snapshot->begin(); i != snapshot->end(); i++)
+	    if (!i->first.compare(0, prefix.size(), prefix) &&
+		(cur.find(i->first.substr(prefix.size())) == cur.end()))
+		gone.push_back(i->first);
+	for (size_t i = 0; i < gone.size(); i++)
+	    snapshot->erase(gone[i]);
+    }
+
+    for (PlpManifest::iterator i = cur.begin(); i != cur.end(); i++) {
+	string name = prefix + i->first;
+	PlpManifestEntry &e = i->second;
+
+	if (e.isDir()) {
+	    // Directories are always stored, so that a restore of
+	    // an incremental archive recreates empty ones as well.
+	    if (cbFunc && !cbFunc(cbPtr, name + "/", 0))
+		return rfsv::E_PSI_FILE_CANCEL;
+	    if (!emit(name + "/", e))
+		return rfsv::E_PSI_GEN_FAIL;
+	    if (snapshot)
+		snapshot->set(name, e);
+	    continue;
+	}
+	if (snapshot) {
+	    PlpManifest::iterator s = snapshot->find(name);
+	    if ((s != snapshot->end()) && (s->second == e)) {
+		skipped++;
+		continue;
+	    }
+	}
+	if (cbFunc && !cbFunc(cbPtr, name, e.size))
+	    return rfsv::E_PSI_FILE_CANCEL;
+	res = emitFile(PlpManifest::psionPath(root, i->first), name, e);
+	if (broken)
+	    return rfsv::E_PSI_GEN_FAIL;
+	if (res == rfsv::E_PSI_FILE_DISC)
+	    return res;
+	if (res == rfsv::E_PSI_GEN_NONE) {
+	    files++;
+	    if (snapshot)
+		snapshot->set(name, e);
+	} else {
+	    failed++;
+	    if (snapshot)
+		snapshot->erase(name);
+	}
+    }
+    return rfsv::E_PSI_GEN_NONE;
+}
+
+/**
+ * Arguments of the archive reader thread.
+ * @internal
+ */
+struct bkReaderArgs {
+    int fd;
+    bkQueue *queue;
+};
+
+/**
+ * Reads from the archive. The reader thread can only be
+ * cancelled while waiting here, never while it holds the
+ * queue's lock.
+ */
+static bool
+readBlocks(int fd, char *p, size_t len)
+{
+    int old;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old);
+    bool ret = readAll(fd, p, len);
+    pthread_setcancelstate(old, NULL);
+    return ret;
+}
+
+/**
+ * Applies the records of a pax extended header to @p i.
+ */
+static void
+paxParse(const string &pax, bkItem &i, uint64_t &size)
+{
+    size_t p = 0;
+
+    while (p < pax.size()) {
+	size_t sp = pax.find(' ', p);
+	if (sp == string::npos)
+	    break;
+	size_t len = strtoul(pax.c_str() + p, NULL, 10);
+	if ((len == 0) || (p + len > pax.size()))
+	    break;
+	size_t eq = pax.find('=', sp);
+	if ((eq == string::npos) || (eq >= p + len)) {
+	    p += len;
+	    continue;
+	}
+	string key = pax.substr(sp + 1, eq - sp - 1);
+	string value = pax.substr(eq + 1, p + len - eq - 2);
+	p += len;
+
+	if (key == "path")
+	    i.name = value;
+	else if (key == "size")
+	    size = strtoull(value.c_str(), NULL, 10);
+	else if (key == "mtime") {
+	    PsiTime t((time_t)strtol(value.c_str(), NULL, 10));
+	    i.e.timeHi = t.getPsiTimeHi();
+	    i.e.timeLo = t.getPsiTimeLo();
+	} else if (key == PAX_PLPTOOLS "attr") {
+	    i.e.attr = strtoul(value.c_str(), NULL, 16);
+	    i.epocAttr = true;
+	} else if ((key == PAX_PLPTOOLS "psitime") && (value.size() == 16)) {
+	    i.e.timeHi = strtoul(value.substr(0, 8).c_str(), NULL, 16);
+	    i.e.timeLo = strtoul(value.substr(8).c_str(), NULL, 16);
+	} else if (key == PAX_PLPTOOLS "uid")
+	    sscanf(value.c_str(), "%x,%x,%x", &i.e.uid[0], &i.e.uid[1], &i.e.uid[2]);
+    }
+}
+
+/**
+ * Reads the archive and feeds its entries to the queue.
+ * Records from an extended header override those of the
+ * following ustar header, so the plptools keys win over
+ * the values derived from mode and mtime.
+ */
+static void *
+bkReader(void *arg)
+{
+    bkReaderArgs *r = (bkReaderArgs *)arg;
+    char hdr[TAR_BLOCK];
+    string pax;
+    bool havePax = false;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    for (;;) {
+	bkItem i(bkItem::BK_ERROR);
+
+	if (!readBlocks(r->fd, hdr, TAR_BLOCK)) {
+	    r->queue->push(i, true);
+	    break;
+	}
+	bool zero = true;
+	for (int n = 0; zero && (n < TAR_BLOCK); n++)
+	    zero = (hdr[n] == 0);
+	if (zero) {
+	    i.type = bkItem::BK_END;
+	    r->queue->push(i, true);
+	    break;
+	}
+	if (!tarVerify(hdr)) {
+	    r->queue->push(i, true);
+	    break;
+	}
+
+	char type = hdr[156];
+	uint64_t size = tarNumber(hdr + 124, 12);
+	uint32_t mode = tarNumber(hdr + 100, 8);
+
+	if (hdr[345]) {
+	    i.name.assign(hdr + 345, strnlen(hdr + 345, 155));
+	    i.name += '/';
+	}
+	i.name.append(hdr, strnlen(hdr, 100));
+	PsiTime t((time_t)tarNumber(hdr + 136, 12));
+	i.e.timeHi = t.getPsiTimeHi();
+	i.e.timeLo = t.getPsiTimeLo();
+	i.e.attr = (mode & 0222) ? 0 : rfsv::PSI_A_RDONLY;
+	if (havePax) {
+	    paxParse(pax, i, size);
+	    havePax = false;
+	}
+
+	switch (type) {
+	    case 'x':
+	    case 'g':
+		pax.resize((size + TAR_BLOCK - 1) & ~(uint64_t)(TAR_BLOCK - 1));
+		if (!readBlocks(r->fd, &pax[0], pax.size())) {
+		    i.type = bkItem::BK_ERROR;
+		    r->queue->push(i, true);
+		    return NULL;
+		}
+		pax.resize(size);
+		// Global headers apply to all entries; nothing we
+		// store is meaningful there, so they are ignored.
+		havePax = (type == 'x');
+		continue;
+	    case '5':
+		i.type = bkItem::BK_DIR;
+		i.e.attr |= rfsv::PSI_A_DIR;
+		break;
+	    case '0':
+	    case '\0':
+		i.type = bkItem::BK_FILE;
+		i.e.size = size;
+		break;
+	    default:
+		// Links, devices etc. have no equivalent on the Psion.
+		i.type = bkItem::BK_DATA;
+		break;
+	}
+	if ((i.type != bkItem::BK_DATA) && !r->queue->push(i))
+	    return NULL;
+
+	// Pass on the data in chunks, strip the padding.
+	uint64_t remaining = (size + TAR_BLOCK - 1) & ~(uint64_t)(TAR_BLOCK - 1);
+	bool pass = (type == '0') || (type == '\0');
+	while (remaining > 0) {
+	    bkItem d(bkItem::BK_DATA);
+	    size_t n = (remaining > BK_CHUNK) ? BK_CHUNK : remaining;
+	    d.data.resize(n);
+	    if (!readBlocks(r->fd, &d.data[0], n)) {
+		d.type = bkItem::BK_ERROR;
+		d.data.clear();
+		r->queue->push(d, true);
+		return NULL;
+	    }
+	    remaining -= n;
+	    if (!pass)
+		continue;
+	    if (size < n)
+		d.data.resize(size);
+	    size -= d.data.size();
+	    if (!r->queue->push(d))
+		return NULL;
+	}
+    }
+    return NULL;
+}
+
+void PlpBackup::
+setAttributes(const string &name, const PlpManifestEntry &e, bool epocAttr)
+{
+    uint32_t mask = epocAttr ? BK_ATTR_MASK : rfsv::PSI_A_RDONLY;
+    if (e.isDir())
+	mask &= ~(rfsv::PSI_A_RDONLY | rfsv::PSI_A_ARCHIVE);
+    a.fsetattr(name.c_str(), e.attr & mask, ~e.attr & mask);
+}
+
+Enum<rfsv::errs> PlpBackup::
+restoreFile(const string &name, const PlpManifestEntry &e, bool epocAttr)
+{
+    Enum<rfsv::errs> res;
+    uint32_t handle = 0;
+    uint32_t mode = a.opMode(rfsv::PSI_O_RDWR);
+
+    res = a.fcreatefile(mode, name.c_str(), handle);
+    if (res == rfsv::E_PSI_FILE_EXIST) {
+	res = a.freplacefile(mode, name.c_str(), handle);
+	if (res == rfsv::E_PSI_FILE_ACCESS) {
+	    // Read-only files cannot be replaced.
+	    a.fsetattr(name.c_str(), 0, rfsv::PSI_A_RDONLY);
+	    res = a.freplacefile(mode, name.c_str(), handle);
+	}
+    }
+    bool open = (res == rfsv::E_PSI_GEN_NONE);
+
+    // The data must be consumed even if the file could not be
+    // created, to get to the next entry.
+    uint32_t remaining = e.size;
+    while (remaining > 0) {
+	bkItem d;
+	queue->pop(d);
+	if (d.type != bkItem::BK_DATA) {
+	    if (open)
+		a.fclose(handle);
+	    return rfsv::E_PSI_FILE_CORRUPT;
+	}
+	remaining -= d.data.size();
+	if (open && (res == rfsv::E_PSI_GEN_NONE)) {
+	    uint32_t count;
+	    res = a.fwritePipelined(handle, (const unsigned char *)d.data.data(),
+				    d.data.size(), count, window);
+	    bytes += count;
+	}
+    }
+    if (!open)
+	return res;
+    a.fclose(handle);
+    if (res == rfsv::E_PSI_GEN_NONE)
+	res = a.fsetmtime(name.c_str(), e.getPsiTime());
+    if (res == rfsv::E_PSI_GEN_NONE)
+	setAttributes(name, e, epocAttr);
+    return res;
+}
+
+Enum<rfsv::errs> PlpBackup::
+restore(int fd, const char * const dest)
+{
+    Enum<rfsv::errs> res = rfsv::E_PSI_GEN_NONE;
+    bkReaderArgs args;
+    set<string> dirs;
+    vector<bkItem> dirAttrs;
+
+    if (running)
+	return rfsv::E_PSI_GEN_FAIL;
+    queue = new bkQueue();
+    args.fd = fd;
+    args.queue = queue;
+    if (pthread_create(&thread, NULL, bkReader, &args) != 0) {
+	delete queue;
+	queue = NULL;
+	return rfsv::E_PSI_GEN_FAIL;
+    }
+
+    for (;;) {
+	bkItem i;
+	queue->pop(i);
+	if (i.type == bkItem::BK_END)
+	    break;
+	if (i.type == bkItem::BK_ERROR) {
+	    res = rfsv::E_PSI_FILE_CORRUPT;
+	    break;
+	}
+	if (i.type == bkItem::BK_DATA)
+	    continue;
+
+	string name = i.name;
+	while (!name.empty() && (name[name.size() - 1] == '/'))
+	    name.erase(name.size() - 1);
+	string target = dest ? PlpManifest::psionPath(dest, name) : psionPath(name);
+	// Refuse to write outside of the destination.
+	if (name.empty() || (name[0] == '/') || (name == "..") ||
+	    !name.compare(0, 3, "../") || (name.find("/../") != string::npos) ||
+	    ((name.size() >= 3) && !name.compare(name.size() - 3, 3, "/..")) ||
+	    (target.size() < 4) || (target[1] != ':')) {
+	    failed++;
+	    if (i.type == bkItem::BK_FILE) {
+		for (uint32_t remaining = i.e.size; remaining > 0; ) {
+		    bkItem d;
+		    queue->pop(d);
+		    if (d.type != bkItem::BK_DATA) {
+			res = rfsv::E_PSI_FILE_CORRUPT;
+			break;
+		    }
+		    remaining -= d.data.size();
+		}
+		if (res != rfsv::E_PSI_GEN_NONE)
+		    break;
+	    }
+	    continue;
+	}
+	if (cbFunc && !cbFunc(cbPtr, (i.type == bkItem::BK_DIR) ? name + "/" : name,
+			      i.e.size)) {
+	    res = rfsv::E_PSI_FILE_CANCEL;
+	    break;
+	}
+
+	// Make sure the parent exists. mkdir creates all
+	// missing components, so each is only needed once.
+	string parent = target.substr(0, target.rfind('\\') + 1);
+	string dir = (i.type == bkItem::BK_DIR) ? target + "\\" : parent;
+	if ((dir.size() > 3) && !dirs.count(dir)) {
+	    Enum<rfsv::errs> r = a.mkdir(dir.c_str());
+	    if ((r == rfsv::E_PSI_GEN_NONE) || (r == rfsv::E_PSI_FILE_EXIST)) {
+		for (size_t p = dir.size() - 1; (p != string::npos) && (p > 2); p = dir.rfind('\\', p - 1))
+		    dirs.insert(dir.substr(0, p + 1));
+	    } else if (r == rfsv::E_PSI_FILE_DISC) {
+		res = r;
+		break;
+	    }
+	}
+	if (i.type == bkItem::BK_DIR) {
+	    // Attributes of directories are set at the end, since
+	    // read-only directories would not take new files.
+	    i.name = target;
+	    dirAttrs.push_back(i);
+	    continue;
+	}
+
+	Enum<rfsv::errs> r = restoreFile(target, i.e, i.epocAttr);
+	if (r == rfsv::E_PSI_GEN_NONE)
+	    files++;
+	else if ((r == rfsv::E_PSI_FILE_DISC) || (r == rfsv::E_PSI_FILE_CORRUPT)) {
+	    res = r;
+	    break;
+	} else
+	    failed++;
+    }
+
+    // On errors, the reader might still be waiting for data
+    // or for room in the queue.
+    if (res != rfsv::E_PSI_GEN_NONE) {
+	queue->abort();
+	pthread_cancel(thread);
+    }
+    pthread_join(thread, NULL);
+    delete queue;
+    queue = NULL;
+
+    for (size_t n = dirAttrs.size(); (res == rfsv::E_PSI_GEN_NONE) && (n > 0); n--) {
+	bkItem &i = dirAttrs[n - 1];
+	a.fsetmtime(i.name.c_str(), i.e.getPsiTime());
+	setAttributes(i.name, i.e, i.epocAttr);
+    }
+    return res;
+}
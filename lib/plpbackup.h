@@ -0,0 +1,173 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _PLPBACKUP_H_
+#define _PLPBACKUP_H_
+
+#include <string>
+
+#include <pthread.h>
+
+#include <rfsv.h>
+#include <plpmanifest.h>
+
+class bkQueue;
+
+/**
+ * Defines the callback procedure for progress indication
+ * of @ref PlpBackup . It is called once for every file or
+ * directory before it is transferred. If it returns 0, the
+ * operation is aborted.
+ */
+typedef int (*bkCallback_t)(void *, const std::string &, uint32_t);
+
+/**
+ * Backup and restore of Psion files to and from pax archives.
+ *
+ * PlpBackup walks a tree on the Psion with @ref rfsv directly and
+ * writes a POSIX pax (extended ustar) stream to a file descriptor.
+ * Files are stored as "C/Documents/Word", i.e. with the drive
+ * letter as first path component. EPOC attributes, UIDs and the
+ * exact Psion modification time are kept in pax extended headers
+ * as the extended attributes user.plptools.attr, user.plptools.uid
+ * and user.plptools.psitime, which other tar implementations ignore
+ * or restore as extended attributes.
+ *
+ * Reading from the Psion and writing the archive run in separate
+ * threads connected by a bounded queue, and file data is fetched
+ * with several read requests in flight, so the link is kept busy
+ * while the archive is being written (or compressed by a pipe).
+ * @ref restore works the same way in the opposite direction.
+ *
+ * For incremental backups, a @ref PlpManifest snapshot, keyed by
+ * archive path, records the state of every file when it was last
+ * saved. Files which still match their snapshot entry are skipped.
+ */
+class PlpBackup {
+public:
+    PlpBackup(rfsv &a);
+    ~PlpBackup();
+
+    /**
+    * Sets a callback which is invoked for every entry.
+    */
+    void setCallback(void *ptr, bkCallback_t cb) { cbPtr = ptr; cbFunc = cb; }
+
+    /**
+    * Sets the number of outstanding read or write requests
+    * on the link. 1 disables pipelining.
+    */
+    void setWindow(int w) { window = (w < 1) ? 1 : w; }
+
+    /**
+    * Starts writing an archive to a file descriptor.
+    *
+    * @param fd The descriptor to write to.
+    *
+    * @returns true on success, false if the writer thread could
+    *          not be started.
+    */
+    bool open(int fd);
+
+    /**
+    * Adds a directory tree on the Psion to the archive started
+    * with @ref open .
+    *
+    * @param root The directory on the Psion, e.g. "C:\".
+    * @param snapshot If non-NULL, only files which differ from their
+    *        entry in @p snapshot are saved and @p snapshot is updated
+    *        to describe the tree as saved. Files which could not be
+    *        read are removed from it, so that they are retried next time.
+    *
+    * @returns A Psion error code (One of enum @ref rfsv::errs ).
+    *          Errors reading single files are only counted (see
+    *          @ref getFailed ); an error is returned only if the tree
+    *          could not be listed or the archive could not be written.
+    */
+    Enum<rfsv::errs> backup(const char * const root, PlpManifest *snapshot);
+
+    /**
+    * Terminates the archive and waits for all data to be written.
+    *
+    * @returns true if the whole archive was written successfully.
+    */
+    bool close();
+
+    /**
+    * Restores the files of an archive to the Psion.
+    *
+    * @param fd The descriptor to read the archive from.
+    * @param dest If non-NULL, the directory on the Psion below which
+    *        the archived paths (including their drive component)
+    *        are recreated. Otherwise, files are restored to their
+    *        original location.
+    *
+    * @returns A Psion error code (One of enum @ref rfsv::errs ).
+    *          Errors writing single files are only counted; an error
+    *          is returned only for a corrupt or unreadable archive
+    *          or a broken connection.
+    */
+    Enum<rfsv::errs> restore(int fd, const char * const dest);
+
+    /**
+    * Converts a Psion path like "C:\Documents\Word" to the
+    * corresponding path in the archive, "C/Documents/Word".
+    */
+    static std::string archivePath(const std::string &psionPath);
+
+    /**
+    * Converts an archive path back to a Psion path.
+    */
+    static std::string psionPath(const std::string &archivePath);
+
+    uint32_t getFiles() const { return files; }
+    uint32_t getSkipped() const { return skipped; }
+    uint32_t getFailed() const { return failed; }
+    uint64_t getBytes() const { return bytes; }
+
+private:
+    friend void *bkWriter(void *);
+
+    bool emit(const std::string &name, const PlpManifestEntry &e);
+    Enum<rfsv::errs> emitFile(const std::string &psionName, const std::string &name,
+			      PlpManifestEntry &e);
+    bool push(std::string &data);
+    Enum<rfsv::errs> restoreFile(const std::string &name, const PlpManifestEntry &e,
+				 bool epocAttr);
+    void setAttributes(const std::string &name, const PlpManifestEntry &e, bool epocAttr);
+
+    rfsv &a;
+    void *cbPtr;
+    bkCallback_t cbFunc;
+    int window;
+
+    bkQueue *queue;
+    pthread_t thread;
+    bool running;
+    int outFd;
+    bool writeError;
+    bool broken;
+
+    uint32_t files;
+    uint32_t skipped;
+    uint32_t failed;
+    uint64_t bytes;
+};
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include "plpclip.h"
+#include "plpdirent.h"
+#include "bufferstore.h"
+
+#include <string.h>
+
+using namespace std;
+
+const char * const PlpClipboard::CLIPFILE = "C:\\System\\Data\\Clpboard.cbd";
+
+/**
+ * UIDs and checksum of a clipboard store file.
+ */
+static const uint32_t clipHeader[4] = {
+    0x10000037, 0x1000003b, 0, 0x4739d53b
+};
+
+/**
+ * Section type of plain text.
+ */
+#define CLIP_TEXT 0x10000033
+
+/**
+ * Byte translation tables for clipboard text. Everything maps to
+ * itself, except the Psion's special characters.
+ */
+static struct clipTables {
+    unsigned char toHost[256];
+    unsigned char toPsi[256];
+
+    clipTables() {
+	for (int i = 0; i < 256; i++)
+	    toHost[i] = toPsi[i] = i;
+	toHost[6] = toHost[7] = '\n';	// paragraph, line break
+	toHost[8] = '\f';		// page break
+	toHost[10] = '\t';
+	toHost[11] = toHost[12] = '-';	// hard and soft hyphen
+	toHost[15] = toHost[16] = ' ';	// hard spaces
+	toPsi[0] = ' ';
+	toPsi[(unsigned char)'\n'] = 6;
+	toPsi[(unsigned char)'\f'] = 8;
+	toPsi[(unsigned char)'-'] = 11;
+    }
+} tables;
+
+static void
+translate(string &s, const unsigned char *table)
+{
+    char *p = &s[0];
+    char *end = p + s.size();
+
+    for (; p < end; p++)
+	*p = table[(unsigned char)*p];
+}
+
+static uint32_t
+le32(const string &s, size_t pos)
+{
+    const unsigned char *p = (const unsigned char *)s.data() + pos;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+PlpClipboard::PlpClipboard(rfsv &_a)
+    : a(_a), lastSize(0), known(false)
+{
+}
+
+void PlpClipboard::
+psiToHost(string &text)
+{
+    translate(text, tables.toHost);
+}
+
+void PlpClipboard::
+hostToPsi(string &text)
+{
+    translate(text, tables.toPsi);
+}
+
+bool PlpClipboard::
+stat(uint32_t &attr)
+{
+    PlpDirent e;
+
+    if (a.fgeteattr(CLIPFILE, e) != rfsv::E_PSI_GEN_NONE)
+	return false;
+    attr = e.getAttr();
+    lastSize = e.getSize();
+    lastTime = e.getPsiTime();
+    known = true;
+    return true;
+}
+
+bool PlpClipboard::
+changed()
+{
+    PlpDirent e;
+
+    if (a.fgeteattr(CLIPFILE, e) != rfsv::E_PSI_GEN_NONE)
+	return false;
+    if (!(e.getAttr() & rfsv::PSI_A_ARCHIVE))
+	return false;
+    PsiTime t = e.getPsiTime();
+    return !known || (e.getSize() != lastSize) || !(t == lastTime);
+}
+
+Enum<rfsv::errs> PlpClipboard::
+getText(string &text)
+{
+    Enum<rfsv::errs> res;
+    uint32_t attr;
+    uint32_t handle;
+    uint32_t count;
+    string data;
+
+    text.clear();
+    if (!stat(attr))
+	return rfsv::E_PSI_FILE_NXIST;
+    if (!(attr & rfsv::PSI_A_ARCHIVE))
+	return rfsv::E_PSI_FILE_EOF;
+    if (lastSize < 0x15)
+	return rfsv::E_PSI_FILE_CORRUPT;
+    data.resize(lastSize);
+    res = a.fopen(a.opMode(rfsv::PSI_O_RDONLY | rfsv::PSI_O_SHARE), CLIPFILE, handle);
+    if (res != rfsv::E_PSI_GEN_NONE)
+	return res;
+    res = a.fread(handle, (unsigned char *)&data[0], lastSize, count);
+    a.fclose(handle);
+    if (res != rfsv::E_PSI_GEN_NONE)
+	return res;
+    if (count != lastSize)
+	return rfsv::E_PSI_FILE_CORRUPT;
+
+    for (int i = 0; i < 4; i++)
+	if (le32(data, i * 4) != clipHeader[i])
+	    return rfsv::E_PSI_FILE_CORRUPT;
+
+    // The section table: a length in dwords, then pairs
+    // of section type and offset.
+    uint32_t table = le32(data, 0x10);
+    if (table >= data.size())
+	return rfsv::E_PSI_FILE_CORRUPT;
+    uint32_t n = (unsigned char)data[table];
+    size_t pos = table + 1;
+    for (; n >= 2; n -= 2, pos += 8) {
+	if (pos + 8 > data.size())
+	    return rfsv::E_PSI_FILE_CORRUPT;
+	if (le32(data, pos) != CLIP_TEXT)
+	    continue;
+	uint32_t off = le32(data, pos + 4);
+	if ((off > data.size() - 4) || (le32(data, off) > data.size() - off - 4))
+	    return rfsv::E_PSI_FILE_CORRUPT;
+	const char *s = data.data() + off + 4;
+	text.append(s, strnlen(s, le32(data, off)));
+    }
+    psiToHost(text);
+    return rfsv::E_PSI_GEN_NONE;
+}
+
+Enum<rfsv::errs> PlpClipboard::
+putText(const string &text)
+{
+    Enum<rfsv::errs> res;
+    uint32_t handle;
+    uint32_t count;
+    uint32_t attr;
+    bufferStore b;
+    string t(text);
+
+    hostToPsi(t);
+    for (int i = 0; i < 4; i++)
+	b.addDWord(clipHeader[i]);   // @00 UIDs and checksum
+    b.addDWord(0x00000014);          // @10 Offset of Section Table
+    b.addByte(2);                    // @14 Section Table, length in DWords
+    b.addDWord(CLIP_TEXT);           // @15 Section Type
+    b.addDWord(0x0000001d);          // @19 Section Offset
+    b.addDWord(t.size());            // @1d Section (String) length
+    b.addStringT(t.c_str());         // @21 Data (Psion Word seems to need a
+                                     //     terminating 0.
+
+    res = a.freplacefile(a.opMode(rfsv::PSI_O_RDWR), CLIPFILE, handle);
+    if (res != rfsv::E_PSI_GEN_NONE)
+	return res;
+    res = a.fwrite(handle, (const unsigned char *)b.getString(0), b.getLen(), count);
+    a.fclose(handle);
+    if (res != rfsv::E_PSI_GEN_NONE)
+	return res;
+    res = a.fsetattr(CLIPFILE, rfsv::PSI_A_ARCHIVE,
+		     rfsv::PSI_A_RDONLY | rfsv::PSI_A_HIDDEN | rfsv::PSI_A_SYSTEM);
+    // Remember our own version, so it isn't mistaken for a change.
+    stat(attr);
+    return res;
+}
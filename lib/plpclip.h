@@ -0,0 +1,104 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _PLPCLIP_H_
+#define _PLPCLIP_H_
+
+#include <string>
+
+#include <rfsv.h>
+#include <psitime.h>
+
+/**
+ * Access to the text on the Psion's clipboard.
+ *
+ * The EPOC clipboard is the store file C:\System\Data\Clpboard.cbd,
+ * which is read and written with @ref rfsv . Notifications about
+ * changes of that file are handled by @ref rclip .
+ *
+ * PlpClipboard remembers the size and modification time of the
+ * clipboard file as it was last read or written, so @ref changed
+ * can tell a real change from a notification caused by our own
+ * write, or from a file which has been read already.
+ */
+class PlpClipboard {
+public:
+    /**
+    * The clipboard file on the Psion.
+    */
+    static const char * const CLIPFILE;
+
+    PlpClipboard(rfsv &a);
+
+    /**
+    * Checks whether the clipboard has been changed on the Psion
+    * since it was last read or written by this object. This costs
+    * a single request.
+    *
+    * @returns true if the archive bit of the clipboard file is set
+    *          and its size or modification time differ from what
+    *          was seen last.
+    */
+    bool changed();
+
+    /**
+    * Reads the text sections of the clipboard.
+    *
+    * @param text The text, converted to host conventions (see
+    *        @ref psiToHost ), is returned here. It is empty if
+    *        the clipboard holds no text.
+    *
+    * @returns A Psion error code (One of enum @ref rfsv::errs ).
+    *          E_PSI_FILE_CORRUPT if the file is not a clipboard store,
+    *          E_PSI_FILE_EOF if its archive bit is clear, that is, it
+    *          holds nothing new. The file is not read then.
+    */
+    Enum<rfsv::errs> getText(std::string &text);
+
+    /**
+    * Replaces the clipboard with a text.
+    *
+    * @param text The text in host conventions.
+    *
+    * @returns A Psion error code (One of enum @ref rfsv::errs ).
+    */
+    Enum<rfsv::errs> putText(const std::string &text);
+
+    /**
+    * Converts Psion text in place: paragraph and line breaks become
+    * newlines, page breaks form feeds, special hyphens and spaces
+    * plain ones.
+    */
+    static void psiToHost(std::string &text);
+
+    /**
+    * The reverse of @ref psiToHost .
+    */
+    static void hostToPsi(std::string &text);
+
+private:
+    bool stat(uint32_t &attr);
+
+    rfsv &a;
+    uint32_t lastSize;
+    PsiTime lastTime;
+    bool known;
+};
+
+#endif
@@ -122,6 +122,78 @@ operator<<(ostream &o, const PlpDirent &e) {
     return o;
 }
 
+void PlpDirList::
+clear() {
+    entries.clear();
+    names.clear();
+}
+
+void PlpDirList::
+reserve(size_t n, size_t nameBytes) {
+    entries.reserve(n);
+    names.reserve(nameBytes + n);
+}
+
+void PlpDirList::
+add(uint32_t size, uint32_t attr, uint32_t timeHi, uint32_t timeLo,
+    uint32_t uid1, uint32_t uid2, uint32_t uid3, const char *name, size_t len) {
+    entry e;
+
+    e.size = size;
+    e.attr = attr;
+    e.timeHi = timeHi;
+    e.timeLo = timeLo;
+    e.uid[0] = uid1;
+    e.uid[1] = uid2;
+    e.uid[2] = uid3;
+    e.name = names.size();
+    names.insert(names.end(), name, name + len);
+    names.push_back('\0');
+    entries.push_back(e);
+}
+
+void PlpDirList::
+add(PlpDirent &e) {
+    PsiTime t = e.getPsiTime();
+
+    add(e.size, e.attr, t.getPsiTimeHi(), t.getPsiTimeLo(),
+	e.UID[0], e.UID[1], e.UID[2], e.name.data(), e.name.size());
+}
+
+time_t PlpDirList::
+getTime(size_t i) const {
+    return PsiTime::psiToUnix(entries[i].timeHi, entries[i].timeLo);
+}
+
+PsiTime PlpDirList::
+getPsiTime(size_t i) const {
+    return PsiTime(entries[i].timeHi, entries[i].timeLo);
+}
+
+const char *PlpDirList::
+getAttrString(size_t i, char *buf) const {
+    rfsv::attr2String(entries[i].attr, buf);
+    return buf;
+}
+
+void PlpDirList::
+get(size_t i, PlpDirent &e) const {
+    const entry &d = entries[i];
+    char buf[11];
+
+    e.size = d.size;
+    e.attr = d.attr;
+    e.time = PsiTime(d.timeHi, d.timeLo);
+    e.UID = PlpUID(d.uid[0], d.uid[1], d.uid[2]);
+    e.name = getName(i);
+    e.attrstr = rfsv::attr2String(d.attr, buf);
+}
+
+size_t PlpDirList::
+memoryUsed() const {
+    return sizeof(*this) + entries.capacity() * sizeof(entry) + names.capacity();
+}
+
 PlpDrive::PlpDrive() {
 }
 
@@ -22,6 +22,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <cstring>
 
 #include <psitime.h>
@@ -60,7 +61,7 @@ public:
     uint32_t operator[](int idx);
 
 private:
-    long uid[3];
+    uint32_t uid[3];
 };
 
 inline bool operator<(const PlpUID &u1, const PlpUID &u2) {
@@ -78,6 +79,7 @@ inline bool operator<(const PlpUID &u1, const PlpUID &u2) {
 class PlpDirent {
     friend class rfsv32;
     friend class rfsv16;
+    friend class PlpDirList;
 
 public:
     /**
@@ -185,6 +187,105 @@ private:
     std::string  name;
 };
 
+/**
+ * A compact list of directory entries, as returned by
+ * @ref rfsv::dir . Meant for big listings: every entry
+ * is a fixed record of 32-bit fields, the names of all
+ * entries are kept one after another in a single buffer,
+ * and times are kept in Psion format until they are
+ * asked for. Attribute strings are made on demand.
+ * A single entry can be converted into a @ref PlpDirent .
+ */
+class PlpDirList {
+public:
+    /**
+    * A single entry.
+    */
+    struct entry {
+	uint32_t size;
+	uint32_t attr;
+	uint32_t timeHi;
+	uint32_t timeLo;
+	uint32_t uid[3];
+	/**
+	* Offset of the zero terminated name in the name buffer.
+	*/
+	uint32_t name;
+    };
+
+    /**
+    * Removes all entries.
+    */
+    void clear();
+
+    /**
+    * Reserves space.
+    *
+    * @param n The number of entries.
+    * @param nameBytes The total length of their names.
+    */
+    void reserve(size_t n, size_t nameBytes);
+
+    /**
+    * Appends an entry.
+    *
+    * @param name The name of the entry, of length @p len .
+    */
+    void add(uint32_t size, uint32_t attr, uint32_t timeHi, uint32_t timeLo,
+	     uint32_t uid1, uint32_t uid2, uint32_t uid3,
+	     const char *name, size_t len);
+
+    /**
+    * Appends a copy of a @ref PlpDirent .
+    */
+    void add(PlpDirent &e);
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    const entry &operator[](size_t i) const { return entries[i]; }
+
+    /**
+    * Retrieves the name of an entry. The pointer stays valid
+    * until the next entry is added.
+    */
+    const char *getName(size_t i) const { return &names[entries[i].name]; }
+
+    /**
+    * Retrieves the modification time of an entry,
+    * converted to Unix time.
+    */
+    time_t getTime(size_t i) const;
+
+    /**
+    * Retrieves the modification time of an entry.
+    */
+    PsiTime getPsiTime(size_t i) const;
+
+    /**
+    * Retrieves the attributes of an entry in human readable
+    * form, like @ref rfsv::attr2String .
+    *
+    * @param buf A buffer of at least 11 bytes.
+    *
+    * @returns @p buf .
+    */
+    const char *getAttrString(size_t i, char *buf) const;
+
+    /**
+    * Converts an entry into a @ref PlpDirent .
+    */
+    void get(size_t i, PlpDirent &e) const;
+
+    /**
+    * Returns the number of bytes used by the list.
+    */
+    size_t memoryUsed() const;
+
+private:
+    std::vector<entry> entries;
+    std::vector<char> names;
+};
+
 /**
  * A class representing information about
  * a Disk drive on the psion. An Object of this type
@@ -0,0 +1,155 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include "plpmanifest.h"
+
+#include <deque>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define MANIFEST_MAGIC "#plptools manifest 1"
+
+PlpManifestEntry::PlpManifestEntry()
+    : attr(0), size(0), timeHi(0), timeLo(0) {
+    uid[0] = uid[1] = uid[2] = 0;
+}
+
+PlpManifestEntry::PlpManifestEntry(PlpDirent &e) {
+    PsiTime t = e.getPsiTime();
+
+    attr = e.getAttr();
+    size = e.getSize();
+    timeHi = t.getPsiTimeHi();
+    timeLo = t.getPsiTimeLo();
+    for (int i = 0; i < 3; i++)
+	uid[i] = e.getUID(i);
+}
+
+PsiTime PlpManifestEntry::
+getPsiTime() const {
+    return PsiTime(timeHi, timeLo);
+}
+
+bool PlpManifestEntry::
+operator==(const PlpManifestEntry &e) const {
+    return ((size == e.size) && (timeHi == e.timeHi) &&
+	    (timeLo == e.timeLo) && (uid[0] == e.uid[0]) &&
+	    (uid[1] == e.uid[1]) && (uid[2] == e.uid[2]) &&
+	    ((attr & rfsv::PSI_A_DIR) == (e.attr & rfsv::PSI_A_DIR)));
+}
+
+string PlpManifest::
+psionPath(const string &root, const string &path) {
+    string tmp = root;
+    if (!tmp.empty() && (tmp[tmp.size() - 1] != '\\') && (tmp[tmp.size() - 1] != '/'))
+	tmp += '\\';
+    tmp += path;
+    return rfsv::convertSlash(tmp);
+}
+
+Enum<rfsv::errs> PlpManifest::
+scan(rfsv &a, const char * const root) {
+    deque<string> todo;
+
+    entries.clear();
+    todo.push_back("");
+    while (!todo.empty()) {
+	string rel = todo.front();
+	todo.pop_front();
+
+	PlpDir files;
+	string dname = psionPath(root, rel);
+	if (dname[dname.size() - 1] != '\\')
+	    dname += '\\';
+	Enum<rfsv::errs> res = a.dir(dname.c_str(), files);
+	if (res != rfsv::E_PSI_GEN_NONE)
+	    return res;
+	for (PlpDir::iterator i = files.begin(); i != files.end(); i++) {
+	    if (i->getAttr() & rfsv::PSI_A_VOLUME)
+		continue;
+	    string path = rel + i->getName();
+	    entries[path] = PlpManifestEntry(*i);
+	    if (i->getAttr() & rfsv::PSI_A_DIR)
+		todo.push_back(path + "/");
+	}
+    }
+    return rfsv::E_PSI_GEN_NONE;
+}
+
+bool PlpManifest::
+load(const char * const file) {
+    FILE *fp = fopen(file, "r");
+    char line[1024];
+
+    entries.clear();
+    if (fp == NULL)
+	return false;
+    if ((fgets(line, sizeof(line), fp) == NULL) ||
+	strncmp(line, MANIFEST_MAGIC "\n", sizeof(MANIFEST_MAGIC))) {
+	fclose(fp);
+	return false;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	PlpManifestEntry e;
+	int n = 0;
+
+	if (sscanf(line, "%x %x %x %x %x %x %x %n", &e.attr, &e.size,
+		   &e.timeHi, &e.timeLo, &e.uid[0], &e.uid[1], &e.uid[2], &n) < 7 ||
+	    n == 0)
+	    continue;
+	string path(line + n);
+	if (!path.empty() && path[path.size() - 1] == '\n')
+	    path.erase(path.size() - 1);
+	if (!path.empty())
+	    entries[path] = e;
+    }
+    fclose(fp);
+    return true;
+}
+
+bool PlpManifest::
+save(const char * const file) const {
+    string tmp = string(file) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+
+    if (fp == NULL)
+	return false;
+    fputs(MANIFEST_MAGIC "\n", fp);
+    for (const_iterator i = entries.begin(); i != entries.end(); i++) {
+	const PlpManifestEntry &e = i->second;
+	fprintf(fp, "%08x %08x %08x %08x %08x %08x %08x %s\n", e.attr, e.size,
+		e.timeHi, e.timeLo, e.uid[0], e.uid[1], e.uid[2], i->first.c_str());
+    }
+    if (ferror(fp)) {
+	fclose(fp);
+	unlink(tmp.c_str());
+	return false;
+    }
+    if (fclose(fp) != 0 || ::rename(tmp.c_str(), file) != 0) {
+	unlink(tmp.c_str());
+	return false;
+    }
+    return true;
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _PLPMANIFEST_H_
+#define _PLPMANIFEST_H_
+
+#include <map>
+#include <string>
+
+#include <rfsv.h>
+#include <plpdirent.h>
+#include <psitime.h>
+
+/**
+ * The recorded state of a single file or directory on the Psion.
+ * Two entries compare equal if size, modification time and UIDs
+ * match; this is what tools use to decide that a file has not
+ * changed since it was last seen.
+ */
+class PlpManifestEntry {
+public:
+    /**
+    * Default constructor.
+    */
+    PlpManifestEntry();
+
+    /**
+    * Constructs an entry from a directory entry as
+    * returned by @ref rfsv::dir or @ref rfsv::fgeteattr .
+    */
+    PlpManifestEntry(PlpDirent &e);
+
+    /**
+    * Retrieves the modification time of the entry.
+    */
+    PsiTime getPsiTime() const;
+
+    /**
+    * Checks whether this entry represents a directory.
+    */
+    bool isDir() const { return (attr & rfsv::PSI_A_DIR) != 0; }
+
+    bool operator==(const PlpManifestEntry &e) const;
+    bool operator!=(const PlpManifestEntry &e) const { return !(*this == e); }
+
+    uint32_t attr;
+    uint32_t size;
+    uint32_t timeHi;
+    uint32_t timeLo;
+    uint32_t uid[3];
+};
+
+/**
+ * A snapshot of a directory tree on the Psion.
+ *
+ * PlpManifest maps paths, relative to the root of the scanned
+ * tree and using '/' as separator, to @ref PlpManifestEntry
+ * objects. A manifest can be filled by walking the Psion
+ * with @ref scan and saved to, or loaded from, a file on the
+ * local machine, so that tools like plpsync can find out what
+ * has changed without transferring any file data.
+ */
+class PlpManifest {
+public:
+    typedef std::map<std::string, PlpManifestEntry> entryMap;
+    typedef entryMap::iterator iterator;
+    typedef entryMap::const_iterator const_iterator;
+
+    /**
+    * Walks a directory tree on the Psion and records
+    * every file and directory found. Existing entries
+    * are discarded.
+    *
+    * @param a    The rfsv connection to use.
+    * @param root The directory on the Psion to start from.
+    *
+    * @returns A Psion error code (One of enum @ref rfsv::errs ).
+    */
+    Enum<rfsv::errs> scan(rfsv &a, const char * const root);
+
+    /**
+    * Loads a manifest from a local file.
+    *
+    * @param file The name of the file.
+    *
+    * @returns true on success, false if the file could not be
+    *          read or is not a manifest.
+    */
+    bool load(const char * const file);
+
+    /**
+    * Saves the manifest to a local file.
+    * The file is written to a temporary name first and then
+    * renamed, so an interrupted save leaves the old manifest
+    * intact.
+    *
+    * @param file The name of the file.
+    *
+    * @returns true on success, false otherwise.
+    */
+    bool save(const char * const file) const;
+
+    /**
+    * Converts a relative manifest path to a Psion path
+    * below @p root .
+    */
+    static std::string psionPath(const std::string &root, const std::string &path);
+
+    iterator find(const std::string &path) { return entries.find(path); }
+    const_iterator find(const std::string &path) const { return entries.find(path); }
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+    iterator lower_bound(const std::string &path) { return entries.lower_bound(path); }
+    void set(const std::string &path, const PlpManifestEntry &e) { entries[path] = e; }
+    void erase(const std::string &path) { entries.erase(path); }
+    void clear() { entries.clear(); }
+    size_t size() const { return entries.size(); }
+
+private:
+    entryMap entries;
+};
+
+#endif
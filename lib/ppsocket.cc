@@ -86,11 +86,11 @@ ppsocket::~ppsocket()
 
 void ppsocket::
 setWatch(IOWatch *watch) {
-    if (watch) {
-	if (myWatch && (m_Socket != INVALID_SOCKET))
-	   myWatch->remIO(m_Socket);
-	myWatch = watch;
-    }
+    if (myWatch && (m_Socket != INVALID_SOCKET))
+	myWatch->remIO(m_Socket);
+    myWatch = watch;
+    if (myWatch && (m_Socket != INVALID_SOCKET))
+	myWatch->addIO(m_Socket);
 }
 
 bool ppsocket::
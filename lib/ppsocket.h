@@ -196,9 +196,11 @@ public:
     /**
     * Registers an @ref IOWatch for this socket.
     * This IOWatch gets the socket added/removed
-    * automatically.
+    * automatically, and an open socket is moved
+    * to it from the previous one.
     *
-    * @param watch The IOWatch to register.
+    * @param watch The IOWatch to register, or NULL
+    *              to stop watching the socket.
     */
     void setWatch(IOWatch *watch);
 	
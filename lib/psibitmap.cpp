@@ -20,196 +20,426 @@
 #include "config.h"
 
 #include <stdint.h>
+#include <string.h>
+#include <vector>
+
 #include "psibitmap.h"
 
-void
-encodeBitmap(int width, int height, getPixelFunction_t getPixel, bool /*rle*/,
-	     bufferStore &out) {
-    bufferStore ib;
-
-    ib.addDWord(0x00000028);   // hdrlen
-    ib.addDWord(width);        // xPixels
-    ib.addDWord(height);       // yPixels
-    ib.addDWord(0);            // xTwips (unspecified)
-    ib.addDWord(0);            // yTwips (unspecified)
-    ib.addDWord(2);            // bitsPerPixel
-    ib.addDWord(0);            // unknown1
-    ib.addDWord(0);            // unknown2
-    ib.addDWord(0);            // RLEflag
-
-    bufferStore rawBuf;
-    for (int y = 0; y < height; y++) {
-	int ov = 0;
-	int shift = 0;
-	int bc = 0;
+#if defined(__GNUC__) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PSIBITMAP_X86
+#endif
 
-	for (int x = 0; x < width; x++) {
-	    int v = getPixel(x, y) / 85;
-	    ov |= (v << shift);
-	    if (shift == 6) {
-		rawBuf.addByte(ov);
-		bc++;
-		shift = 0;
-		ov = 0;
-	    } else
-		shift += 2;
+/**
+ * Lookup tables for converting between gray values and packed pixels.
+ * The Psion keeps the leftmost pixel in the least significant bits.
+ */
+static struct pixelTables {
+    // A byte expanded to 8, 4 or 2 gray pixels.
+    unsigned char gray1[256][8];
+    unsigned char gray2[256][4];
+    unsigned char gray4[256][2];
+    // A gray value reduced to 2 bits.
+    unsigned char quant2[256];
+    // A byte with its pixels in reverse order.
+    unsigned char reverse1[256];
+    unsigned char reverse2[256];
+    unsigned char reverse4[256];
+
+    pixelTables() {
+	for (int i = 0; i < 256; i++) {
+	    int r1 = 0;
+	    int r2 = 0;
+	    for (int j = 0; j < 8; j++) {
+		gray1[i][j] = ((i >> j) & 1) * 255;
+		if (i & (1 << j))
+		    r1 |= 0x80 >> j;
+	    }
+	    for (int j = 0; j < 4; j++) {
+		gray2[i][j] = ((i >> (j * 2)) & 3) * 85;
+		r2 |= ((i >> (j * 2)) & 3) << (6 - j * 2);
+	    }
+	    gray4[i][0] = (i & 15) * 17;
+	    gray4[i][1] = (i >> 4) * 17;
+	    quant2[i] = i / 85;
+	    reverse1[i] = r1;
+	    reverse2[i] = r2;
+	    reverse4[i] = (i >> 4) | (i << 4);
 	}
-	if (shift != 0) {
-	    rawBuf.addByte(ov);
-	    shift = 0;
-	    ov = 0;
-	    bc++;
+    }
+} tables;
+
+#ifdef PSIBITMAP_X86
+/*
+ * The SIMD kernels quantize 16 or 32 gray pixels at a time by
+ * comparing them with the thresholds 85, 170 and 255, then merge
+ * neighbouring 2-bit values with shifts within 16- and 32-bit lanes,
+ * and finally pack the resulting bytes together. They return the
+ * number of pixels done; the caller does the rest.
+ */
+static int
+packGray2SSE2(const unsigned char *gray, int width, unsigned char *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i t1 = _mm_set1_epi8(85);
+    const __m128i t2 = _mm_set1_epi8((char)170);
+    const __m128i t3 = _mm_set1_epi8((char)255);
+    const __m128i m16 = _mm_set1_epi16(0x000f);
+    const __m128i m32 = _mm_set1_epi32(0x00ff);
+    int x;
+
+    for (x = 0; x + 64 <= width; x += 64, out += 16) {
+	__m128i r[4];
+	for (int k = 0; k < 4; k++) {
+	    __m128i v = _mm_loadu_si128((const __m128i *)(gray + x + k * 16));
+	    // 0xff where v >= t, i.e. where t - v saturates to zero.
+	    __m128i q = _mm_add_epi8(
+		_mm_add_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(t1, v), zero),
+			     _mm_cmpeq_epi8(_mm_subs_epu8(t2, v), zero)),
+		_mm_cmpeq_epi8(_mm_subs_epu8(t3, v), zero));
+	    q = _mm_sub_epi8(zero, q);
+	    __m128i w = _mm_and_si128(_mm_or_si128(q, _mm_srli_epi16(q, 6)), m16);
+	    r[k] = _mm_and_si128(_mm_or_si128(w, _mm_srli_epi32(w, 12)), m32);
 	}
-	while (bc % 4) {
-	    rawBuf.addByte(0);
-	    bc++;
+	_mm_storeu_si128((__m128i *)out,
+			 _mm_packus_epi16(_mm_packs_epi32(r[0], r[1]),
+					  _mm_packs_epi32(r[2], r[3])));
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) static int
+packGray2AVX2(const unsigned char *gray, int width, unsigned char *out)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i t1 = _mm256_set1_epi8(85);
+    const __m256i t2 = _mm256_set1_epi8((char)170);
+    const __m256i t3 = _mm256_set1_epi8((char)255);
+    const __m256i m16 = _mm256_set1_epi16(0x000f);
+    const __m256i m32 = _mm256_set1_epi32(0x00ff);
+    // The packs work within 128-bit lanes; this restores the order.
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int x;
+
+    for (x = 0; x + 128 <= width; x += 128, out += 32) {
+	__m256i r[4];
+	for (int k = 0; k < 4; k++) {
+	    __m256i v = _mm256_loadu_si256((const __m256i *)(gray + x + k * 32));
+	    __m256i q = _mm256_add_epi8(
+		_mm256_add_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(t1, v), zero),
+				_mm256_cmpeq_epi8(_mm256_subs_epu8(t2, v), zero)),
+		_mm256_cmpeq_epi8(_mm256_subs_epu8(t3, v), zero));
+	    q = _mm256_sub_epi8(zero, q);
+	    __m256i w = _mm256_and_si256(_mm256_or_si256(q, _mm256_srli_epi16(q, 6)), m16);
+	    r[k] = _mm256_and_si256(_mm256_or_si256(w, _mm256_srli_epi32(w, 12)), m32);
 	}
+	__m256i p = _mm256_packus_epi16(_mm256_packs_epi32(r[0], r[1]),
+					_mm256_packs_epi32(r[2], r[3]));
+	_mm256_storeu_si256((__m256i *)out, _mm256_permutevar8x32_epi32(p, order));
     }
+    return x;
+}
 
-#if 1
-    ib.addBuff(rawBuf);
-#else
-    //TODO: RLE encoding
-
-    int rawLen = rawBuf.getLen();
-    int eqCount = 1;
-    int lastByte = rawBuf.getByte(0);
-    bufferStore diBuf;
-
-    for (int i = 1; i <= rawLen; i++) {
-	int v;
-	if (i < rawLen)
-	    v = rawBuf.getByte(i);
-	else
-	    v = lastByte + 1;
-	if (v == lastByte) {
-	    if (diBuf.getLen()) {
-		ib.addByte(0x100 - diBuf.getLen());
-		ib.addBuff(diBuf);
-		diBuf.init();
-	    }
-	    eqCount++;
-	    if (eqCount > 0x7f) {
-		ib.addByte(0x7f);
-		ib.addByte(v);
-		eqCount = 1;
+static int
+packGray2SIMD(const unsigned char *gray, int width, unsigned char *out)
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+
+    int x = avx2 ? packGray2AVX2(gray, width, out) : 0;
+    return x + packGray2SSE2(gray + x, width - x, out + x / 4);
+}
+#endif
+
+void
+packGrayRow2(const unsigned char *gray, int width, unsigned char *out)
+{
+    const unsigned char *q = tables.quant2;
+    int x = 0;
+
+#ifdef PSIBITMAP_X86
+    x = packGray2SIMD(gray, width, out);
+    out += x / 4;
+#endif
+    for (; x + 4 <= width; x += 4)
+	*out++ = q[gray[x]] | (q[gray[x+1]] << 2) | (q[gray[x+2]] << 4) |
+	    (q[gray[x+3]] << 6);
+    if (x < width) {
+	int v = 0;
+	for (int shift = 0; x < width; x++, shift += 2)
+	    v |= q[gray[x]] << shift;
+	*out = v;
+    }
+}
+
+bool
+unpackGrayRow(const unsigned char *in, int width, int bitsPerPixel,
+	      unsigned char *out)
+{
+    int n;
+
+    switch (bitsPerPixel) {
+	case 1:
+	    for (n = width / 8; n > 0; n--, out += 8)
+		memcpy(out, tables.gray1[*in++], 8);
+	    if (width % 8)
+		memcpy(out, tables.gray1[*in], width % 8);
+	    break;
+	case 2:
+	    for (n = width / 4; n > 0; n--, out += 4)
+		memcpy(out, tables.gray2[*in++], 4);
+	    if (width % 4)
+		memcpy(out, tables.gray2[*in], width % 4);
+	    break;
+	case 4:
+	    for (n = width / 2; n > 0; n--, out += 2)
+		memcpy(out, tables.gray4[*in++], 2);
+	    if (width % 2)
+		memcpy(out, tables.gray4[*in], width % 2);
+	    break;
+	case 8:
+	    memcpy(out, in, width);
+	    break;
+	default:
+	    return false;
+    }
+    return true;
+}
+
+/**
+ * Appends a literal of n bytes to RLE compressed data.
+ */
+static inline void
+addLiteral(unsigned char *&o, const unsigned char *p, uint32_t n)
+{
+    *o++ = 0x100 - n;
+    memcpy(o, p, n);
+    o += n;
+}
+
+/**
+ * Compresses Psion bitmap data with the EPOC RLE scheme: a byte
+ * below 0x80 repeats the next byte that many times plus one, a byte
+ * b from 0x80 on is followed by 0x100 - b literal bytes. Runs may
+ * span scanlines.
+ *
+ * @returns the compressed length, or 0 if the data does not get
+ *          shorter than @p limit bytes.
+ */
+static uint32_t
+compressRLE(const unsigned char *p, uint32_t len, unsigned char *out,
+	    uint32_t limit)
+{
+    unsigned char *o = out;
+    uint32_t i = 0;
+    uint32_t lit = 0;
+
+    while (i < len) {
+	// Each step adds at most two bytes to the output,
+	// counting the pending literal with its length byte.
+	if ((o - out) + (lit ? lit + 1 : 0) + 2 >= limit)
+	    return 0;
+	unsigned char b = p[i];
+	uint32_t max = ((len - i) < 128) ? (len - i) : 128;
+	uint32_t run = 1;
+	while ((run < max) && (p[i + run] == b))
+	    run++;
+	// A run of two only pays off if it doesn't split a literal.
+	if ((run >= 3) || ((run == 2) && (lit == 0))) {
+	    if (lit) {
+		addLiteral(o, p + i - lit, lit);
+		lit = 0;
 	    }
+	    *o++ = run - 1;
+	    *o++ = b;
+	    i += run;
 	} else {
-	    if (eqCount > 1) {
-		ib.addByte(eqCount);
-		ib.addByte(lastByte);
-		eqCount = 1;
-	    } else {
-		diBuf.addByte(lastByte);
-		if ((diBuf.getLen() > 0x7f) || (i == rawLen)) {
-		    ib.addByte(0x100 - diBuf.getLen());
-		    ib.addBuff(diBuf);
-		    diBuf.init();
-		}
+	    i++;
+	    if (++lit == 128) {
+		addLiteral(o, p + i - lit, lit);
+		lit = 0;
 	    }
 	}
-	lastByte = v;
     }
-#endif
+    if (lit)
+	addLiteral(o, p + i - lit, lit);
+    return o - out;
+}
+
+void
+encodeBitmap(int width, int height, const unsigned char *gray, int stride,
+	     bool rle, bufferStore &out)
+{
+    // Psion scanlines are padded to a multiple of four bytes.
+    int used = (width + 3) / 4;
+    int linelen = (used + 3) & ~3;
+    uint32_t datlen = (uint32_t)linelen * height;
+    std::vector<unsigned char> raw(datlen);
+    std::vector<unsigned char> packed;
+
+    unsigned char *o = raw.data();
+    for (int y = 0; y < height; y++, gray += stride, o += linelen) {
+	packGrayRow2(gray, width, o);
+	memset(o + used, 0, linelen - used);
+    }
+
+    // Use RLE only if it saves space.
+    uint32_t rlelen = 0;
+    if (rle && datlen) {
+	packed.resize(datlen);
+	rlelen = compressRLE(raw.data(), datlen, packed.data(), datlen);
+    }
+
+    out.addDWord((rlelen ? rlelen : datlen) + 0x28); // totlen
+    out.addDWord(0x00000028);    // hdrlen
+    out.addDWord(width);         // xPixels
+    out.addDWord(height);        // yPixels
+    out.addDWord(0);             // xTwips (unspecified)
+    out.addDWord(0);             // yTwips (unspecified)
+    out.addDWord(2);             // bitsPerPixel
+    out.addDWord(0);             // unknown1
+    out.addDWord(0);             // unknown2
+    out.addDWord(rlelen ? 1 : 0); // RLEflag
+    if (rlelen)
+	out.addBytes(packed.data(), rlelen);
+    else
+	out.addBytes(raw.data(), datlen);
+}
+
+void
+encodeBitmap(int width, int height, getPixelFunction_t getPixel, bool rle,
+	     bufferStore &out)
+{
+    std::vector<unsigned char> gray((size_t)width * height);
+    unsigned char *p = gray.data();
 
-    out.addDWord(ib.getLen() + 4);
-    out.addBuff(ib);
+    for (int y = 0; y < height; y++)
+	for (int x = 0; x < width; x++) {
+	    int v = getPixel(x, y);
+	    *p++ = (v < 0) ? 0 : ((v > 255) ? 255 : v);
+	}
+    encodeBitmap(width, height, gray.data(), width, rle, out);
+}
+
+static inline uint32_t
+le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Undoes the RLE compression of Psion bitmap data.
+ */
+static bool
+expandRLE(const unsigned char *p, uint32_t len, std::vector<unsigned char> &out)
+{
+    uint32_t offset = 0;
+
+    while (offset < len) {
+	unsigned char b = p[offset++];
+	if (b >= 0x80) {
+	    uint32_t n = 0x100 - b;
+	    if (offset + n > len)
+		return false;
+	    out.insert(out.end(), p + offset, p + offset + n);
+	    offset += n;
+	} else {
+	    if (offset >= len)
+		return false;
+	    out.insert(out.end(), b + 1, p[offset++]);
+	}
+    }
+    return true;
 }
 
-#define splitByte(v)                                \
-do {                                                \
-    int j;                                          \
-                                                    \
-    if (x < bytesPerLine)                           \
-	for (j = 0; j < pixelsPerByte; j++) {       \
-	    if (j && ((oidx % xPixels) == 0))       \
-		break;                              \
-	    else                                    \
-              if (oidx >= picsize)                  \
-		return false;                       \
-	    else {                                  \
-		out.addByte((v & mask) * grayVal);  \
-                v >>= bitsPerPixel;                 \
-		oidx++;                             \
-	    }                                       \
-	}                                           \
-    if (++x >= linelen)                             \
-	x = 0;                                      \
-} while (0)
+/**
+ * Checks the header of a Psion bitmap and locates its scanlines,
+ * undoing RLE compression if necessary.
+ */
+static bool
+parseBitmap(const unsigned char *p, uint32_t &xPixels, uint32_t &yPixels,
+	    uint32_t &bpp, const unsigned char *&data, uint32_t &linelen,
+	    std::vector<unsigned char> &expanded)
+{
+    uint32_t totlen = le32(p);
+    uint32_t hdrlen = le32(p + 4);
+    uint32_t RLEflag = le32(p + 36);
+
+    xPixels = le32(p + 8);
+    yPixels = le32(p + 12);
+    bpp = le32(p + 24);
+    if ((bpp != 1) && (bpp != 2) && (bpp != 4) && (bpp != 8))
+	return false;
+    if ((hdrlen < 0x28) || (totlen < hdrlen) || (xPixels == 0) ||
+	(yPixels == 0) || (xPixels > 0xffff) || (yPixels > 0xffff))
+	return false;
+
+    data = p + hdrlen;
+    uint32_t datlen = totlen - hdrlen;
+    if (RLEflag) {
+	if (!expandRLE(data, datlen, expanded))
+	    return false;
+	data = expanded.data();
+	datlen = expanded.size();
+    }
+    // Psion scanlines are padded to a multiple of four bytes.
+    linelen = datlen / yPixels;
+    return (linelen >= (xPixels * bpp + 7) / 8);
+}
 
 bool
 decodeBitmap(const unsigned char *p, int &width, int &height, bufferStore &out)
 {
-    uint32_t totlen = *((const uint32_t*)p); p += 4;
-    uint32_t hdrlen = *((const uint32_t*)p); p += 4;
-    uint32_t datlen = totlen - hdrlen;
-    uint32_t xPixels = *((const uint32_t*)p); p += 4;
-    uint32_t yPixels = *((const uint32_t*)p); p += 4;
-    uint32_t xTwips = *((const uint32_t*)p); p += 4;
-    uint32_t yTwips = *((const uint32_t*)p); p += 4;
-    uint32_t bitsPerPixel = *((const uint32_t*)p); p += 4;
-    uint32_t unknown1 = *((const uint32_t*)p); p += 4;
-    uint32_t unknown2 = *((const uint32_t*)p); p += 4;
-    uint32_t RLEflag = *((const uint32_t*)p); p += 4;
+    uint32_t xPixels, yPixels, bpp, linelen;
+    const unsigned char *data;
+    std::vector<unsigned char> expanded;
 
+    if (!parseBitmap(p, xPixels, yPixels, bpp, data, linelen, expanded))
+	return false;
     width = xPixels;
     height = yPixels;
 
-    uint32_t picsize = xPixels * yPixels;
-    uint32_t linelen;
-    int pixelsPerByte = (8 / bitsPerPixel);
-    int nColors = 1 << bitsPerPixel;
-    int grayVal = 255 / (nColors - 1);
-    int bytesPerLine = (xPixels + pixelsPerByte - 1) / pixelsPerByte;
-    int mask = (bitsPerPixel << 1) - 1;
+    unsigned char *o = out.addSpace(xPixels * yPixels);
+    for (uint32_t y = 0; y < yPixels; y++, data += linelen, o += xPixels)
+	unpackGrayRow(data, xPixels, bpp, o);
+    return true;
+}
 
-    int oidx = 0;
-    int x = 0;
-    int y = 0;
-    int offset = 0;
+bool
+decodeBitmapPacked(const unsigned char *p, int &width, int &height,
+		   int &bitsPerPixel, bufferStore &out)
+{
+    uint32_t xPixels, yPixels, bpp, linelen;
+    const unsigned char *data;
+    const unsigned char *table = NULL;
+    std::vector<unsigned char> expanded;
 
-    if (RLEflag) {
-	int i = 0;
-	while (offset < datlen) {
-	    unsigned char b = *(p + offset);
-	    if (b >= 0x80) {
-		offset += 0x100 - b + 1;
-		i += 0x100 - b;
-	    } else {
-		offset += 2;
-		i += b + 1;
-	    }
-	}
-	linelen = i / yPixels;
-	offset = 0;
-	while (offset < datlen) {
-	    unsigned char b = *(p + offset++);
-	    if (b >= 0x80) {
-		for (i = 0; i < 0x100 - b; i++, offset++) {
-		    if (offset >= datlen)
-			return false; // data corrupted
-		    unsigned char b2 = *(p + offset);
-		    splitByte(b2);
-		}
-	    } else {
-		if (offset >= datlen)
-		    return false;
-		else {
-		    unsigned char b2 = *(p + offset);
-		    unsigned char bs = b2;
-		    for (i = 0; i <= b; i++) {
-			splitByte(b2);
-			b2 = bs;
-		    }
-		}
-		offset++;
-	    }
-	}
-    } else {
-	linelen = datlen / yPixels;
-	while (offset < datlen) {
-	    unsigned char b = *(p + offset++);
-	    splitByte(b);
+    if (!parseBitmap(p, xPixels, yPixels, bpp, data, linelen, expanded))
+	return false;
+    width = xPixels;
+    height = yPixels;
+    bitsPerPixel = bpp;
+    switch (bpp) {
+	case 1:
+	    table = tables.reverse1;
+	    break;
+	case 2:
+	    table = tables.reverse2;
+	    break;
+	case 4:
+	    table = tables.reverse4;
+	    break;
+    }
+
+    uint32_t bytesPerLine = (xPixels * bpp + 7) / 8;
+    unsigned char *o = out.addSpace(bytesPerLine * yPixels);
+    for (uint32_t y = 0; y < yPixels; y++, data += linelen) {
+	if (table)
+	    for (uint32_t x = 0; x < bytesPerLine; x++)
+		*o++ = table[data[x]];
+	else {
+	    memcpy(o, data, bytesPerLine);
+	    o += bytesPerLine;
 	}
     }
     return true;
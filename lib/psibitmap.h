@@ -33,13 +33,34 @@
  */
 typedef int (*getPixelFunction_t)(int x, int y);
 
+/**
+ * Convert an 8bit/pixel grayscale image into a bitmap in Psion format.
+ *
+ * @param width    The width of the image to convert.
+ * @param height   The height of the image to convert.
+ * @param gray     The image data: height scanlines of width bytes, starting
+ *                 with the topmost scanline. 0 is black and 255 is white.
+ * @param stride   The distance between the starts of two scanlines in bytes.
+ * @param rle      Flag: Perform RLE compression if that makes the
+ *                 bitmap smaller.
+ * @param out      Output buffer; gets filled with the Psion representation
+ *                 of the converted image.
+ */
+extern void
+encodeBitmap(int width, int height, const unsigned char *gray, int stride,
+	     bool rle, bufferStore &out);
+
 /**
  * Convert an image into a bitmap in Psion format.
  *
+ * This calls @p getPixel for every pixel; the variant which takes the
+ * whole image at once is faster.
+ *
  * @param width    The width of the image to convert.
  * @param height   The height of the image to convert.
  * @param getPixel Pointer to a function for retrieving pixel values.
- * @param rle      Flag: Perform RLE compression (currently ignored).
+ * @param rle      Flag: Perform RLE compression if that makes the
+ *                 bitmap smaller.
  * @param out      Output buffer; gets filled with the Psion representation
  *                 of the converted image.
  */
@@ -47,6 +68,32 @@ extern void
 encodeBitmap(int width, int height, getPixelFunction_t getPixel,
 	     bool rle, bufferStore &out);
 
+/**
+ * Pack a scanline of 8bit/pixel gray values into 2 bits per pixel, the
+ * leftmost pixel in the least significant bits, as the Psion stores it.
+ * Uses SSE2 or AVX2 where available.
+ *
+ * @param gray  The width gray values of the scanline.
+ * @param width The number of pixels.
+ * @param out   Gets (width + 3) / 4 bytes.
+ */
+extern void
+packGrayRow2(const unsigned char *gray, int width, unsigned char *out);
+
+/**
+ * Expand a scanline of a Psion bitmap to 8bit/pixel gray values.
+ *
+ * @param in           The packed pixels.
+ * @param width        The number of pixels.
+ * @param bitsPerPixel The depth of the bitmap: 1, 2, 4 or 8.
+ * @param out          Gets width bytes.
+ *
+ * @returns false if the depth is not supported.
+ */
+extern bool
+unpackGrayRow(const unsigned char *in, int width, int bitsPerPixel,
+	      unsigned char *out);
+
 /**
  * Convert a Psion bitmap to a 8bit/pixel grayscale image.
  *
@@ -64,4 +111,29 @@ encodeBitmap(int width, int height, getPixelFunction_t getPixel,
 extern bool
 decodeBitmap(const unsigned char *p, int &width, int &height, bufferStore &out);
 
+/**
+ * Unpack a Psion bitmap without changing its depth.
+ *
+ * The pixels of each scanline are packed with the leftmost pixel in
+ * the most significant bits of a byte, as PostScript and most image
+ * formats expect it, and scanlines are padded to a full byte only.
+ * Gray values keep their meaning: 0 is black and the highest value
+ * white.
+ *
+ * @param p Pointer to an input buffer which contains the Psion-formatted
+ *          bitmap to convert. Must start with a Psion bitmap header.
+ * @param width  On return, the image width in pixels is returned here.
+ * @param height On return, the image height in pixels is returned here.
+ * @param bitsPerPixel On return, the depth of the image (1, 2, 4 or 8)
+ *               is returned here.
+ * @param out    Buffer which gets filled with height scanlines of
+ *               (width * bitsPerPixel + 7) / 8 bytes each, starting with
+ *               the topmost scanline.
+ *
+ * @returns      true on success, false if input data is inconsistent.
+ */
+extern bool
+decodeBitmapPacked(const unsigned char *p, int &width, int &height,
+		   int &bitsPerPixel, bufferStore &out);
+
 #endif // !_PSIBITMAP_H_
@@ -65,10 +65,11 @@ getProcId() {
     ostringstream tmp;
 
     if (s5mx)
-	tmp << name << ".$" << setw(2) << setfill('0') << pid << '\0';
+	tmp << name << ".$" << setw(2) << setfill('0') << pid;
     else
-	tmp << name << ".$" << pid << '\0';
-    return tmp.str().c_str();
+	tmp << name << ".$" << pid;
+    procId = tmp.str();
+    return procId.c_str();
 }
 
 void PsiProcess::
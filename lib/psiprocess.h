@@ -112,6 +112,7 @@ private:
     int pid;
     std::string  name;
     std::string  args;
+    std::string  procId;
     bool s5mx;
 };
 
@@ -21,6 +21,9 @@
 
 #include "psitime.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -36,7 +39,7 @@ PsiTime::PsiTime(void) {
 
 PsiTime::PsiTime(time_t time) {
     ptzValid = false;
-    gettimeofday(&utv, &utz);
+    utz.tz_minuteswest = utz.tz_dsttime = 0;
     setUnixTime(time);
 }
 
@@ -50,8 +53,7 @@ PsiTime::PsiTime(psi_timeval *_ptv, psi_timezone *_ptz) {
 	ptzValid = false;
 	tryPsiZone();
     }
-    /* get our own timezone */
-    gettimeofday(&utv, &utz);
+    utz.tz_minuteswest = utz.tz_dsttime = 0;
     psi2unix();
 }
 
@@ -60,8 +62,7 @@ PsiTime::PsiTime(const uint32_t _ptvHi, const uint32_t _ptvLo) {
     ptv.tv_low = _ptvLo;
     ptzValid = false;
     tryPsiZone();
-    /* get our own timezone */
-    gettimeofday(&utv, &utz);
+    utz.tz_minuteswest = utz.tz_dsttime = 0;
     psi2unix();
 }
 
@@ -70,6 +71,7 @@ PsiTime::PsiTime(struct timeval *_utv, struct timezone *_utz) {
 	utv = *_utv;
     if (_utz != 0L)
 	utz = *_utz;
+    ptzValid = false;
     tryPsiZone();
     unix2psi();
 }
@@ -84,7 +86,6 @@ PsiTime::PsiTime(const PsiTime &t) {
 }
 
 PsiTime::~PsiTime() {
-    tryPsiZone();
 }
 
 void PsiTime::setUnixTime(struct timeval *_utv) {
@@ -193,6 +194,95 @@ ostream &operator<<(ostream &s, const PsiTime &t) {
  */
 #define EPOCH_DIFF 0x00dcddb30f2f8000ULL
 
+/**
+ * The UTC offsets of the local machine, as a table of the times at
+ * which they change, so converting a time needs no call to localtime.
+ * The table is built on first use, by sampling the offset once a week
+ * and searching for the exact second where it changes. It covers 1980
+ * up to 20 years from now; other times are looked up directly.
+ */
+class hostZone {
+public:
+    hostZone() {
+	const time_t week = 7 * 86400;
+	time_t t = 315532800; // 01.01.1980 00:00:00
+	time_t now = time(0);
+
+	end = std::max(now, t) + 20 * 365 * 86400;
+	long off = gmtoff(t);
+	starts.push_back(t);
+	offsets.push_back(off);
+	while (t < end) {
+	    time_t next = std::min(t + week, end);
+	    long o = gmtoff(next);
+	    if (o != off) {
+		time_t lo = t;
+		time_t hi = next;
+		while (hi - lo > 1) {
+		    time_t mid = lo + (hi - lo) / 2;
+		    if (gmtoff(mid) == off)
+			lo = mid;
+		    else
+			hi = mid;
+		}
+		starts.push_back(hi);
+		offsets.push_back(o);
+		off = o;
+	    }
+	    t = next;
+	}
+    }
+
+    long offset(time_t t) const {
+	if ((t < starts[0]) || (t >= end))
+	    return gmtoff(t);
+	size_t i = std::upper_bound(starts.begin(), starts.end(), t) - starts.begin();
+	return offsets[i - 1];
+    }
+
+    static long gmtoff(time_t t) {
+	struct tm tm;
+	if (localtime_r(&t, &tm) == 0)
+	    return 0;
+	return tm.tm_gmtoff;
+    }
+
+private:
+    std::vector<time_t> starts;
+    std::vector<long> offsets;
+    time_t end;
+};
+
+static const hostZone &
+getHostZone() {
+    static hostZone hz;
+    return hz;
+}
+
+/**
+ * The fallback for the Psion's UTC offset, from the
+ * environment variable PSI_TZ, read once.
+ */
+struct envZone {
+    envZone() : valid(false), offset(0) {
+	const char *offstr = getenv("PSI_TZ");
+	if (offstr != 0) {
+	    char *err = 0;
+	    offset = strtol(offstr, &err, 0);
+	    valid = (err == 0 || *err == '\0');
+	}
+    }
+
+    bool valid;
+    int64_t offset;
+};
+
+static const envZone &
+getEnvZone() {
+    static envZone ez;
+    return ez;
+}
+
 /* evalOffset()
  * Returns the difference between the Psion's timezone and the PC's timezone, in
  * microseconds
@@ -209,15 +299,10 @@ static long long evalOffset(psi_timezone ptz, time_t time, bool valid) {
      * Fallback. If no Psion zone given, use
      * environment variable PSI_TZ
      */
-    const char *offstr = getenv("PSI_TZ");
-    if (offstr != 0) {
-      char *err = 0;
-      offset = strtol(offstr, &err, 0);
-      if (err != 0 && *err != '\0') {
-        offset = 0;
-      } else {
-        flg = true;
-      }
+    const envZone &ez = getEnvZone();
+    if (ez.valid) {
+      offset = ez.offset;
+      flg = true;
     }
   }
 
@@ -225,8 +310,7 @@ static long long evalOffset(psi_timezone ptz, time_t time, bool valid) {
   // offset should still be 0 at this point.
 
   if (flg) {
-    struct tm *tm = localtime(&time);
-    offset -= tm->tm_gmtoff; // Subtract out local timezone
+    offset -= getHostZone().offset(time); // Subtract out local timezone
     offset *= 1000000;       // Turn it into microseconds
   }
 
@@ -272,6 +356,45 @@ void PsiTime::unix2psi(void) {
     ptv.tv_high = (micro >> 32) & 0x0ffffffff;
 }
 
+time_t PsiTime::
+psiToUnix(const uint32_t ptvHi, const uint32_t ptvLo) {
+    psi_timeval ptv;
+    time_t t;
+
+    ptv.tv_high = ptvHi;
+    ptv.tv_low = ptvLo;
+    psiToUnix(&ptv, &t, 1);
+    return t;
+}
+
+void PsiTime::
+psiToUnix(const psi_timeval *ptv, time_t *t, size_t n) {
+    psi_timezone ptz;
+    bool valid = PsiZone::getInstance().getZone(ptz);
+
+    for (size_t i = 0; i < n; i++) {
+	uint64_t micro = ptv[i].tv_high;
+	micro = (micro << 32) | ptv[i].tv_low;
+	micro -= EPOCH_DIFF;
+	micro -= evalOffset(ptz, micro / 1000000, valid);
+	t[i] = micro / 1000000;
+    }
+}
+
+void PsiTime::
+unixToPsi(const time_t *t, psi_timeval *ptv, size_t n) {
+    psi_timezone ptz;
+    bool valid = PsiZone::getInstance().getZone(ptz);
+
+    for (size_t i = 0; i < n; i++) {
+	uint64_t micro = (uint64_t)t[i] * 1000000ULL;
+	micro += evalOffset(ptz, t[i], valid);
+	micro += EPOCH_DIFF;
+	ptv[i].tv_low = micro & 0x0ffffffff;
+	ptv[i].tv_high = (micro >> 32) & 0x0ffffffff;
+    }
+}
+
 void PsiTime::tryPsiZone() {
     if (ptzValid)
 	return;
@@ -120,6 +120,11 @@ typedef struct psi_timezone_t {
  * that both Psion and local machine have the same
  * time zone and daylight settings.
  *
+ * The local machine's UTC offsets are looked up in a table of
+ * their changes, which is built on first use. Apart from that,
+ * and from getting the current time, conversions make no calls
+ * into the C library's time functions.
+ *
  * @author Fritz Elfert <felfert@to.com>
  */
 class PsiTime {
@@ -293,6 +298,36 @@ public:
     bool operator<(const PsiTime &t);
     bool operator>(const PsiTime &t);
 
+    /**
+    * Converts a Psion time to a Unix time, without constructing
+    * a PsiTime. Like all conversions, this uses the Psion's time
+    * zone from @ref PsiZone , or the fallbacks described above.
+    *
+    * @param ptvHi The high 32 bits of a Psion time value.
+    * @param ptvLo The low 32 bits of a Psion time value.
+    *
+    * @returns The Unix time, in seconds.
+    */
+    static time_t psiToUnix(const uint32_t ptvHi, const uint32_t ptvLo);
+
+    /**
+    * Converts an array of Psion times to Unix times.
+    *
+    * @param ptv The Psion time values.
+    * @param t The Unix times are returned here.
+    * @param n The number of values.
+    */
+    static void psiToUnix(const psi_timeval *ptv, time_t *t, size_t n);
+
+    /**
+    * Converts an array of Unix times to Psion times.
+    *
+    * @param t The Unix times.
+    * @param ptv The Psion time values are returned here.
+    * @param n The number of values.
+    */
+    static void unixToPsi(const time_t *t, psi_timeval *ptv, size_t n);
+
     enum zone {
 	PSI_TZ_NONE = 0,
 	PSI_TZ_EUROPEAN = 1,
@@ -28,9 +28,16 @@
 #include <stdlib.h>
 #include <time.h>
 
-rclip::rclip(ppsocket * _skt)
+rclip::rclip(ppsocket * _skt, const char *_device)
 {
     skt = _skt;
+    if (_device)
+	device = _device;
+    if (!device.empty() &&
+	(rfsv::selectDevice(skt, device.c_str()) != rfsv::E_PSI_GEN_NONE)) {
+	status = rfsv::E_PSI_FILE_DISC;
+	return;
+    }
     reset();
 }
 
@@ -47,6 +54,11 @@ reconnect(void)
 {
     //skt->closeSocket();
     skt->reconnect();
+    if (!device.empty() &&
+	(rfsv::selectDevice(skt, device.c_str()) != rfsv::E_PSI_GEN_NONE)) {
+	status = rfsv::E_PSI_FILE_DISC;
+	return;
+    }
     reset();
 }
 
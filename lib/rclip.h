@@ -46,8 +46,10 @@ public:
     * Constructs a new rclip object.
     *
     * @param skt The socket to be used by this object.
+    * @param device The name of the Psion to talk to, on an ncpd
+    * serving more than one, or NULL for its default one.
     */
-    rclip(ppsocket *skt);
+    rclip(ppsocket *skt, const char *device = NULL);
 
     /**
     * destructor.
@@ -154,6 +156,11 @@ protected:
     */
     Enum<rfsv::errs> status;
 
+    /**
+    * The device to select on every connection, if any.
+    */
+    std::string device;
+
    /**
     * Sends a command to the remote side.
     *
@@ -26,6 +26,17 @@
 #include "bufferstore.h"
 #include "Enum.h"
 
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 
 ENUM_DEFINITION_BEGIN(rfsv::errs, rfsv::E_PSI_GEN_NONE)
@@ -118,6 +129,12 @@ void rfsv::reconnect(void)
 {
     skt->reconnect();
     serNum = 0;
+    // Without its device, ncpd would connect us to another Psion.
+    if (!device.empty() &&
+	(selectDevice(skt, device.c_str()) != E_PSI_GEN_NONE)) {
+	status = E_PSI_FILE_DISC;
+	return;
+    }
     reset();
 }
 
@@ -146,27 +163,81 @@ convertSlash(const string &name)
     return tmp;
 }
 
+/**
+ * The textual attributes for the lower ten attribute bits. The SIBO
+ * specific bits are filled in by attr2String.
+ */
+static struct attrTable {
+    char s[1024][10];
+
+    attrTable() {
+	for (uint32_t attr = 0; attr < 1024; attr++) {
+	    char *p = s[attr];
+	    p[0] = (attr & rfsv::PSI_A_DIR) ? 'd' : '-';
+	    p[1] = (attr & rfsv::PSI_A_READ) ? 'r' : '-';
+	    p[2] = (attr & rfsv::PSI_A_RDONLY) ? '-' : 'w';
+	    p[3] = (attr & rfsv::PSI_A_HIDDEN) ? 'h' : '-';
+	    p[4] = (attr & rfsv::PSI_A_SYSTEM) ? 's' : '-';
+	    p[5] = (attr & rfsv::PSI_A_ARCHIVE) ? 'a' : '-';
+	    p[6] = (attr & rfsv::PSI_A_VOLUME) ? 'v' : '-';
+	    // EPOC
+	    p[7] = (attr & rfsv::PSI_A_NORMAL) ? 'n' : '-';
+	    p[8] = (attr & rfsv::PSI_A_TEMP) ? 't' : '-';
+	    p[9] = (attr & rfsv::PSI_A_COMPRESSED) ? 'c' : '-';
+	}
+    }
+} attrTable;
+
+const char *rfsv::
+attr2String(const uint32_t attr, char *buf)
+{
+    memcpy(buf, attrTable.s[attr & 1023], 10);
+    // SIBO
+    if (attr & PSI_A_EXEC)
+	buf[7] = 'x';
+    if (attr & PSI_A_STREAM)
+	buf[8] = 'b';
+    if (attr & PSI_A_TEXT)
+	buf[9] = 't';
+    buf[10] = '\0';
+    return buf;
+}
+
 string rfsv::
 attr2String(const uint32_t attr)
 {
-    string tmp = "";
-    tmp += ((attr & PSI_A_DIR) ? 'd' : '-');
-    tmp += ((attr & PSI_A_READ) ? 'r' : '-');
-    tmp += ((attr & PSI_A_RDONLY) ? '-' : 'w');
-    tmp += ((attr & PSI_A_HIDDEN) ? 'h' : '-');
-    tmp += ((attr & PSI_A_SYSTEM) ? 's' : '-');
-    tmp += ((attr & PSI_A_ARCHIVE) ? 'a' : '-');
-    tmp += ((attr & PSI_A_VOLUME) ? 'v' : '-');
-
-    // EPOC
-    tmp += ((attr & PSI_A_NORMAL) ? 'n' : '-');
-    tmp += ((attr & PSI_A_TEMP) ? 't' : '-');
-    tmp += ((attr & PSI_A_COMPRESSED) ? 'c' : '-');
-    // SIBO
-    tmp[7] = ((attr & PSI_A_EXEC) ? 'x' : tmp[7]);
-    tmp[8] = ((attr & PSI_A_STREAM) ? 'b' : tmp[8]);
-    tmp[9] = ((attr & PSI_A_TEXT) ? 't' : tmp[9]);
-    return tmp;
+    char buf[11];
+    return attr2String(attr, buf);
+}
+
+Enum<rfsv::errs> rfsv::
+dir(const char * const name, PlpDirList &ret)
+{
+    PlpDir files;
+    Enum<rfsv::errs> res = dir(name, files);
+
+    ret.clear();
+    ret.reserve(files.size(), 0);
+    for (PlpDir::iterator i = files.begin(); i != files.end(); i++)
+	ret.add(*i);
+    return res;
+}
+
+Enum<rfsv::errs> rfsv::
+selectDevice(ppsocket *skt, const char *name)
+{
+    bufferStore a;
+    a.addString("NCP$SDEV");
+    a.addStringT(name);
+    if (!skt->sendBufferStore(a))
+	return E_PSI_FILE_DISC;
+    if (skt->getBufferStore(a) != 1)
+	return E_PSI_FILE_DISC;
+    if ((a.getLen() > 8) && !strncmp(a.getString(), "No Psion", 8))
+	return E_PSI_FILE_NOTREADY;
+    if (a.getLen() != 1)
+	return E_PSI_GEN_NSUP;
+    return (enum errs)(signed char)a.getByte(0);
 }
 
 int rfsv::
@@ -184,3 +255,505 @@ getSpeed()
 	return -1;
     return a.getDWord(1);
 }
+
+Enum<rfsv::errs> rfsv::
+freadPipelined(const uint32_t handle, unsigned char * const buf, const uint32_t len, uint32_t &count, const int)
+{
+    return fread(handle, buf, len, count);
+}
+
+Enum<rfsv::errs> rfsv::
+fwritePipelined(const uint32_t handle, const unsigned char * const buf, const uint32_t len, uint32_t &count, const int)
+{
+    return fwrite(handle, buf, len, count);
+}
+
+const char * const rfsv::RESUME_SUFFIX = ".plpresume";
+
+/**
+ * Bytes transferred between two checkpoints of a resumable copy.
+ */
+#define RESUME_CHECKPOINT (RFSV_SENDLEN * 32)
+
+/**
+ * Bytes before the checkpoint which are compared on both
+ * sides before a copy is resumed.
+ */
+#define RESUME_VERIFY RFSV_SENDLEN
+
+#define RESUME_MAGIC "#plptools resume 1"
+
+/**
+ * The state of a resumable copy, as kept in its sidecar file.
+ * The fingerprint identifies the version of the source file.
+ */
+struct resumeInfo {
+    resumeInfo() : size(0), fpHi(0), fpLo(0), offset(0) { }
+
+    bool load(const string &file) {
+	FILE *fp = fopen(file.c_str(), "r");
+	char line[1024];
+	bool ok = false;
+
+	if (fp == NULL)
+	    return false;
+	if (fgets(line, sizeof(line), fp) &&
+	    !strncmp(line, RESUME_MAGIC "\n", sizeof(RESUME_MAGIC)) &&
+	    fgets(line, sizeof(line), fp) &&
+	    (sscanf(line, "%x %x %x %x", &size, &fpHi, &fpLo, &offset) == 4) &&
+	    fgets(line, sizeof(line), fp)) {
+	    src = line;
+	    if (fgets(line, sizeof(line), fp)) {
+		dst = line;
+		ok = true;
+	    }
+	}
+	fclose(fp);
+	if (!src.empty() && src[src.size() - 1] == '\n')
+	    src.erase(src.size() - 1);
+	if (!dst.empty() && dst[dst.size() - 1] == '\n')
+	    dst.erase(dst.size() - 1);
+	return ok;
+    }
+
+    bool save(const string &file) const {
+	string tmp = file + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "w");
+
+	if (fp == NULL)
+	    return false;
+	fprintf(fp, RESUME_MAGIC "\n%08x %08x %08x %08x\n%s\n%s\n",
+		size, fpHi, fpLo, offset, src.c_str(), dst.c_str());
+	if ((fclose(fp) != 0) || (::rename(tmp.c_str(), file.c_str()) != 0)) {
+	    unlink(tmp.c_str());
+	    return false;
+	}
+	return true;
+    }
+
+    bool sameSource(const resumeInfo &o) const {
+	return (src == o.src) && (dst == o.dst) && (size == o.size) &&
+	    (fpHi == o.fpHi) && (fpLo == o.fpLo);
+    }
+
+    string src;
+    string dst;
+    uint32_t size;
+    uint32_t fpHi;
+    uint32_t fpLo;
+    uint32_t offset;
+};
+
+/**
+ * Reads exactly @p len bytes at @p offset from a local file.
+ */
+static bool
+preadAll(int fd, unsigned char *buf, uint32_t len, off_t offset)
+{
+    while (len > 0) {
+	ssize_t r = pread(fd, buf, len, offset);
+	if (r <= 0)
+	    return false;
+	buf += r;
+	len -= r;
+	offset += r;
+    }
+    return true;
+}
+
+static bool
+writeAll(int fd, const unsigned char *buf, uint32_t len)
+{
+    while (len > 0) {
+	ssize_t r = write(fd, buf, len);
+	if (r <= 0)
+	    return false;
+	buf += r;
+	len -= r;
+    }
+    return true;
+}
+
+/**
+ * Checks that the @ref RESUME_VERIFY bytes before @p offset
+ * are the same in the local file and in the open Psion file.
+ */
+static bool
+resumeVerify(rfsv &a, uint32_t handle, int fd, uint32_t offset)
+{
+    unsigned char local[RESUME_VERIFY];
+    unsigned char remote[RESUME_VERIFY];
+    uint32_t len = (offset > RESUME_VERIFY) ? RESUME_VERIFY : offset;
+    uint32_t pos;
+    uint32_t count;
+
+    if (len == 0)
+	return true;
+    if (!preadAll(fd, local, len, offset - len))
+	return false;
+    if ((a.fseek(handle, offset - len, rfsv::PSI_SEEK_SET, pos) != rfsv::E_PSI_GEN_NONE) ||
+	(pos != offset - len))
+	return false;
+    if ((a.fread(handle, remote, len, count) != rfsv::E_PSI_GEN_NONE) ||
+	(count != len))
+	return false;
+    return memcmp(local, remote, len) == 0;
+}
+
+Enum<rfsv::errs> rfsv::
+copyFromPsionResume(const char * const from, const char * const to, void *ptr, cpCallback_t cb)
+{
+    Enum<rfsv::errs> res;
+    PlpDirent e;
+    resumeInfo want;
+    resumeInfo have;
+    string side = string(to) + RESUME_SUFFIX;
+    uint32_t handle;
+    uint32_t offset = 0;
+    uint32_t pos;
+
+    if ((res = fgeteattr(from, e)) != E_PSI_GEN_NONE)
+	return res;
+    PsiTime t = e.getPsiTime();
+    want.src = from;
+    want.dst = to;
+    want.size = e.getSize();
+    want.fpHi = t.getPsiTimeHi();
+    want.fpLo = t.getPsiTimeLo();
+    if (have.load(side) && have.sameSource(want) && (have.offset <= want.size))
+	offset = have.offset;
+
+    int fd = ::open(to, O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+	return E_PSI_GEN_FAIL;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)offset))
+	offset = 0;
+    if ((res = fopen(opMode(PSI_O_RDONLY), from, handle)) != E_PSI_GEN_NONE) {
+	::close(fd);
+	return res;
+    }
+    if (!resumeVerify(*this, handle, fd, offset))
+	offset = 0;
+    if (((res = fseek(handle, offset, PSI_SEEK_SET, pos)) != E_PSI_GEN_NONE) ||
+	(ftruncate(fd, offset) != 0) || (lseek(fd, offset, SEEK_SET) != (off_t)offset)) {
+	if (res == E_PSI_GEN_NONE)
+	    res = E_PSI_GEN_FAIL;
+	fclose(handle);
+	::close(fd);
+	return res;
+    }
+
+    unsigned char *buff = new unsigned char[RESUME_CHECKPOINT];
+    uint32_t total = offset;
+    uint32_t len;
+    want.offset = total;
+    do {
+	if ((res = freadPipelined(handle, buff, RESUME_CHECKPOINT, len, 4)) != E_PSI_GEN_NONE)
+	    break;
+	if (!writeAll(fd, buff, len)) {
+	    res = E_PSI_GEN_FAIL;
+	    break;
+	}
+	total += len;
+	// Only data which has reached the disk counts as
+	// transferred, otherwise a crash could leave a hole.
+	if ((len > 0) && (fsync(fd) == 0)) {
+	    want.offset = total;
+	    want.save(side);
+	}
+	if (cb && !cb(ptr, total))
+	    res = E_PSI_FILE_CANCEL;
+    } while ((len == RESUME_CHECKPOINT) && (res == E_PSI_GEN_NONE));
+    delete [] buff;
+    fclose(handle);
+    if ((::close(fd) != 0) && (res == E_PSI_GEN_NONE))
+	res = E_PSI_GEN_FAIL;
+    if (res == E_PSI_GEN_NONE)
+	unlink(side.c_str());
+    return res;
+}
+
+Enum<rfsv::errs> rfsv::
+copyToPsionResume(const char * const from, const char * const to, void *ptr, cpCallback_t cb)
+{
+    Enum<rfsv::errs> res;
+    resumeInfo want;
+    resumeInfo have;
+    string side = string(from) + RESUME_SUFFIX;
+    uint32_t handle;
+    uint32_t offset = 0;
+    uint32_t pos;
+    struct stat st;
+
+    int fd = ::open(from, O_RDONLY);
+    if (fd < 0)
+	return E_PSI_FILE_NXIST;
+    if (fstat(fd, &st) != 0) {
+	::close(fd);
+	return E_PSI_GEN_FAIL;
+    }
+    want.src = from;
+    want.dst = to;
+    want.size = st.st_size;
+    want.fpHi = (uint64_t)st.st_mtime >> 32;
+    want.fpLo = (uint64_t)st.st_mtime & 0xffffffff;
+    if (have.load(side) && have.sameSource(want) && (have.offset <= want.size)) {
+	PlpDirent e;
+	if ((fgeteattr(to, e) == E_PSI_GEN_NONE) && (e.getSize() >= have.offset))
+	    offset = have.offset;
+    }
+
+    if (offset > 0) {
+	if ((fopen(opMode(PSI_O_RDWR), to, handle) != E_PSI_GEN_NONE))
+	    offset = 0;
+	else if (!resumeVerify(*this, handle, fd, offset)) {
+	    fclose(handle);
+	    offset = 0;
+	}
+    }
+    if (offset == 0) {
+	res = fcreatefile(opMode(PSI_O_RDWR), to, handle);
+	if (res != E_PSI_GEN_NONE)
+	    res = freplacefile(opMode(PSI_O_RDWR), to, handle);
+	if (res != E_PSI_GEN_NONE) {
+	    ::close(fd);
+	    return res;
+	}
+    }
+    if (((res = fsetsize(handle, offset)) != E_PSI_GEN_NONE) ||
+	((res = fseek(handle, offset, PSI_SEEK_SET, pos)) != E_PSI_GEN_NONE) ||
+	(lseek(fd, offset, SEEK_SET) != (off_t)offset)) {
+	if (res == E_PSI_GEN_NONE)
+	    res = E_PSI_GEN_FAIL;
+	fclose(handle);
+	::close(fd);
+	return res;
+    }
+
+    unsigned char *buff = new unsigned char[RESUME_CHECKPOINT];
+    uint32_t total = offset;
+    want.offset = total;
+    while (res == E_PSI_GEN_NONE) {
+	ssize_t len = read(fd, buff, RESUME_CHECKPOINT);
+	uint32_t count;
+	if (len < 0) {
+	    res = E_PSI_GEN_FAIL;
+	    break;
+	}
+	if (len == 0)
+	    break;
+	if ((res = fwritePipelined(handle, buff, len, count, 4)) != E_PSI_GEN_NONE)
+	    break;
+	// Every write has been acknowledged by the Psion.
+	total += count;
+	want.offset = total;
+	want.save(side);
+	if (cb && !cb(ptr, total))
+	    res = E_PSI_FILE_CANCEL;
+    }
+    delete [] buff;
+    fclose(handle);
+    ::close(fd);
+    if (res == E_PSI_GEN_NONE)
+	unlink(side.c_str());
+    return res;
+}
+
+Enum<rfsv::errs> rfsv::
+copyToPsion(const uint8_t *buf, size_t len, const char * const to, void *ptr, cpCallback_t cb)
+{
+    Enum<rfsv::errs> res;
+    uint32_t handle;
+    size_t total = 0;
+
+    res = fcreatefile(opMode(PSI_O_RDWR), to, handle);
+    if (res != E_PSI_GEN_NONE)
+	res = freplacefile(opMode(PSI_O_RDWR), to, handle);
+    if (res != E_PSI_GEN_NONE)
+	return res;
+    while ((total < len) && (res == E_PSI_GEN_NONE)) {
+	uint32_t n = ((len - total) > RESUME_CHECKPOINT) ? RESUME_CHECKPOINT : (len - total);
+	uint32_t count;
+	if ((res = fwritePipelined(handle, buf + total, n, count, 4)) != E_PSI_GEN_NONE)
+	    break;
+	total += count;
+	if (cb && !cb(ptr, total))
+	    res = E_PSI_FILE_CANCEL;
+    }
+    fclose(handle);
+    return res;
+}
+
+/**
+ * Progress of a tree copy, for turning the per-file
+ * counts of copyOnPsion into a running total.
+ */
+struct treeProgress {
+    void *ptr;
+    cpCallback_t cb;
+    uint32_t base;
+};
+
+static int
+treeCallback(void *p, uint32_t n)
+{
+    treeProgress *t = (treeProgress *)p;
+    return t->cb(t->ptr, t->base + n);
+}
+
+static string
+dirName(const string &name)
+{
+    string ret = rfsv::convertSlash(name);
+    if (ret.empty() || ret[ret.size() - 1] != '\\')
+	ret += '\\';
+    return ret;
+}
+
+Enum<rfsv::errs> rfsv::
+copyTreeOnPsion(const char * const from, const char * const to, void *ptr, cpCallback_t cb)
+{
+    Enum<rfsv::errs> res;
+    PlpDirent e;
+    treeProgress tp;
+    deque<string> todo;
+
+    tp.ptr = ptr;
+    tp.cb = cb;
+    tp.base = 0;
+
+    string src = convertSlash(from);
+    string dst = convertSlash(to);
+    while ((src.size() > 3) && (src[src.size() - 1] == '\\'))
+	src.erase(src.size() - 1);
+    while ((dst.size() > 3) && (dst[dst.size() - 1] == '\\'))
+	dst.erase(dst.size() - 1);
+    if ((res = fgeteattr(src.c_str(), e)) != E_PSI_GEN_NONE)
+	return res;
+    if (!(e.getAttr() & PSI_A_DIR)) {
+	res = copyOnPsion(src.c_str(), dst.c_str(), cb ? (void *)&tp : NULL,
+			  cb ? treeCallback : NULL);
+	if (res == E_PSI_GEN_NONE)
+	    res = fsetmtime(dst.c_str(), e.getPsiTime());
+	if (res == E_PSI_GEN_NONE) {
+	    uint32_t keep = PSI_A_RDONLY | PSI_A_HIDDEN | PSI_A_SYSTEM;
+	    uint32_t attr = e.getAttr() & keep;
+	    res = fsetattr(dst.c_str(), attr, keep & ~attr);
+	}
+	return res;
+    }
+    // EPOC file names are case insensitive.
+    if ((dirName(dst).size() >= dirName(src).size()) &&
+	!strncasecmp(dirName(dst).c_str(), dirName(src).c_str(), dirName(src).size()))
+	return E_PSI_GEN_ARG;
+
+    // Breadth first, so parents are always created before
+    // their contents. Directory attributes are applied last,
+    // a read-only directory would not take new entries.
+    vector<pair<string, PlpDirent> > dirs;
+    todo.push_back("");
+    dirs.push_back(make_pair(string(), e));
+    while (!todo.empty()) {
+	string rel = todo.front();
+	todo.pop_front();
+
+	if ((res = mkdir(dirName(dst + rel).c_str())) != E_PSI_GEN_NONE)
+	    return res;
+	PlpDir files;
+	if ((res = dir(dirName(src + rel).c_str(), files)) != E_PSI_GEN_NONE)
+	    return res;
+	for (PlpDir::iterator i = files.begin(); i != files.end(); i++) {
+	    uint32_t attr = i->getAttr();
+	    string name = rel + "\\" + i->getName();
+
+	    if (attr & PSI_A_VOLUME)
+		continue;
+	    if (attr & PSI_A_DIR) {
+		todo.push_back(name);
+		dirs.push_back(make_pair(name, *i));
+		continue;
+	    }
+	    string f = dst + name;
+	    res = copyOnPsion((src + name).c_str(), f.c_str(),
+			      cb ? (void *)&tp : NULL, cb ? treeCallback : NULL);
+	    if (res == E_PSI_GEN_NONE)
+		res = fsetmtime(f.c_str(), i->getPsiTime());
+	    if ((res == E_PSI_GEN_NONE) && (attr & (PSI_A_RDONLY | PSI_A_HIDDEN | PSI_A_SYSTEM)))
+		res = fsetattr(f.c_str(), attr & (PSI_A_RDONLY | PSI_A_HIDDEN | PSI_A_SYSTEM), 0);
+	    if (res != E_PSI_GEN_NONE)
+		return res;
+	    tp.base += i->getSize();
+	}
+    }
+    for (size_t n = dirs.size(); n > 0; n--) {
+	string d = dirName(dst + dirs[n - 1].first);
+	uint32_t attr = dirs[n - 1].second.getAttr() & (PSI_A_RDONLY | PSI_A_HIDDEN | PSI_A_SYSTEM);
+	if (attr)
+	    fsetattr(d.c_str(), attr, 0);
+	fsetmtime(d.c_str(), dirs[n - 1].second.getPsiTime());
+    }
+    return E_PSI_GEN_NONE;
+}
+
+Enum<rfsv::errs> rfsv::
+removeTree(const char * const name)
+{
+    Enum<rfsv::errs> res;
+    PlpDirent e;
+    string top = convertSlash(name);
+
+    while ((top.size() > 3) && (top[top.size() - 1] == '\\'))
+	top.erase(top.size() - 1);
+    if ((res = fgeteattr(top.c_str(), e)) != E_PSI_GEN_NONE)
+	return res;
+    if (e.getAttr() & PSI_A_RDONLY)
+	fsetattr(top.c_str(), 0, PSI_A_RDONLY);
+    if (!(e.getAttr() & PSI_A_DIR))
+	return remove(top.c_str());
+
+    PlpDir files;
+    if ((res = dir(dirName(top).c_str(), files)) != E_PSI_GEN_NONE)
+	return res;
+    for (PlpDir::iterator i = files.begin(); i != files.end(); i++) {
+	if (i->getAttr() & PSI_A_VOLUME)
+	    continue;
+	string f = top + "\\" + i->getName();
+	if (i->getAttr() & PSI_A_DIR)
+	    res = removeTree(f.c_str());
+	else {
+	    if (i->getAttr() & PSI_A_RDONLY)
+		fsetattr(f.c_str(), 0, PSI_A_RDONLY);
+	    res = remove(f.c_str());
+	}
+	if (res != E_PSI_GEN_NONE)
+	    return res;
+    }
+    return rmdir(dirName(top).c_str());
+}
+
+Enum<rfsv::errs> rfsv::
+moveTree(const char * const from, const char * const to, void *ptr, cpCallback_t cb)
+{
+    Enum<rfsv::errs> res;
+    string src = convertSlash(from);
+    string dst = convertSlash(to);
+
+    if ((src.size() < 2) || (dst.size() < 2) || (src[1] != ':') || (dst[1] != ':'))
+	return E_PSI_GEN_ARG;
+    if (toupper(src[0]) == toupper(dst[0]))
+	return rename(src.c_str(), dst.c_str());
+    PlpDirent e;
+    string top = dst;
+    while ((top.size() > 3) && (top[top.size() - 1] == '\\'))
+	top.erase(top.size() - 1);
+    bool existed = (fgeteattr(top.c_str(), e) == E_PSI_GEN_NONE);
+    if ((res = copyTreeOnPsion(src.c_str(), dst.c_str(), ptr, cb)) != E_PSI_GEN_NONE) {
+	// Don't leave half a copy behind, but never touch
+	// anything which existed before.
+	if (!existed)
+	    removeTree(dst.c_str());
+	return res;
+    }
+    return removeTree(src.c_str());
+}
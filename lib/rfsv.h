@@ -29,6 +29,7 @@
 #include <bufferstore.h>
 
 typedef std::deque<class PlpDirent> PlpDir;
+class PlpDirList;
 
 class ppsocket;
 class PlpDrive;
@@ -73,6 +74,8 @@ private:
  * currently connected.
  */
 class rfsv {
+    friend class rfsvfactory;
+
 public:
     /**
     * The kown modes for seek.
@@ -293,6 +296,20 @@ public:
     */
     virtual Enum<errs> dir(const char * const name, PlpDir &ret) = 0;
 
+    /**
+    * Reads a directory on the Psion into a compact
+    * @ref PlpDirList , which is cheaper than a @ref PlpDir
+    * for big directories.
+    * The default implementation converts the result of
+    * @ref dir .
+    *
+    * @param name The name of the directory
+    * @param ret  The entries are returned here.
+    *
+    * @returns A Psion error code (One of enum @ref rfsv::errs ).
+    */
+    virtual Enum<errs> dir(const char * const name, PlpDirList &ret);
+
     /**
     * Retrieves the modification time of a file on the Psion.
     *
@@ -396,6 +413,37 @@ public:
     */
     virtual Enum<errs> fwrite(const uint32_t handle, const unsigned char * const buffer, const uint32_t len, uint32_t &count) = 0;
 
+    /**
+    * Reads from a file on the Psion, keeping up to @p window
+    * read requests outstanding, so that the round trip time
+    * of the link is paid only once per @p window requests.
+    * The default implementation simply calls @ref fread .
+    *
+    * @param handle Handle of the file to read from.
+    * @param buffer The area where to store the data read.
+    * @param len The number of bytes to read.
+    * @param count The number of bytes actually read is returned here.
+    * @param window The maximum number of outstanding requests.
+    *
+    * @returns A Psion error code (One of enum @ref #errs ).
+    */
+    virtual Enum<errs> freadPipelined(const uint32_t handle, unsigned char * const buffer, const uint32_t len, uint32_t &count, const int window);
+
+    /**
+    * Writes to a file on the Psion, keeping up to @p window
+    * write requests outstanding.
+    * The default implementation simply calls @ref fwrite .
+    *
+    * @param handle Handle of the file to write to.
+    * @param buffer The area to be written.
+    * @param len The number of bytes to write.
+    * @param count The number of bytes actually written is returned here.
+    * @param window The maximum number of outstanding requests.
+    *
+    * @returns A Psion error code (One of enum @ref #errs ).
+    */
+    virtual Enum<errs> fwritePipelined(const uint32_t handle, const unsigned char * const buffer, const uint32_t len, uint32_t &count, const int window);
+
     /**
     * Copies a file from the Psion to the local machine.
     *
@@ -429,6 +477,107 @@ public:
     */
     virtual Enum<errs> copyToPsion(const char * const from, const char * const to, void *, cpCallback_t func) = 0;
 
+    /**
+    * Copies a file or a whole directory tree from the Psion to the
+    * Psion. Files are copied with @ref copyOnPsion , so on EPOC no
+    * file data crosses the link. Modification times and attributes
+    * are preserved. @p to must not exist yet, or be a file if
+    * @p from is a file.
+    *
+    * @param from Name of the file or directory to be copied.
+    * @param to Name of the copy.
+    * @param func Pointer to a function which gets called during the
+    *   copy with the total number of bytes copied so far. If it
+    *   returns 0, the operation is aborted and E_PSI_FILE_CANCEL
+    *   is returned.
+    *
+    * @returns A Psion error code (One of enum @ref #errs ).
+    */
+    Enum<errs> copyTreeOnPsion(const char * const from, const char * const to, void *, cpCallback_t func);
+
+    /**
+    * Moves a file or directory tree on the Psion. Within a drive,
+    * this is a plain @ref rename . Across drives, the tree is copied
+    * with @ref copyTreeOnPsion and the original is only deleted when
+    * the whole copy has succeeded. If the copy fails, whatever was
+    * already copied is removed again.
+    *
+    * @param from Name of the file or directory to be moved.
+    * @param to New name.
+    * @param func Progress callback as in @ref copyTreeOnPsion .
+    *
+    * @returns A Psion error code (One of enum @ref #errs ).
+    */
+    Enum<errs> moveTree(const char * const from, const char * const to, void *, cpCallback_t func);
+
+    /**
+    * Deletes a file or a whole directory tree on the Psion,
+    * including read-only files.
+    *
+    * @param name Name of the file or directory.
+    *
+    * @returns A Psion error code (One of enum @ref #errs ).
+    */
+    Enum<errs> removeTree(const char * const name);
+
+    /**
+    * Copies a file from the Psion to the local machine, so that
+    * an interrupted transfer can be continued later.
+    *
+    * Progress is recorded, together with the size and modification
+    * time of the source, in a sidecar file named like the
+    * destination with @ref RESUME_SUFFIX appended. If a matching
+    * sidecar is found, the last data checkpointed is compared on
+    * both sides and, if it matches, the copy continues from there.
+    * Otherwise, it starts from the beginning. The sidecar is
+    * removed when the copy completes.
+    *
+    * @param from Name of the file on the Psion to be copied.
+    * @param to Name of the destination file on the local machine.
+    * @param func Pointer to a function which gets called on every read,
+    *   with the total number of bytes present in the destination.
+    *   If it returns 0, the operation is aborted and E_PSI_FILE_CANCEL
+    *   is returned.
+    *
+    * @returns A Psion error code (One of enum @ref #errs ).
+    */
+    Enum<errs> copyFromPsionResume(const char * const from, const char * const to, void *, cpCallback_t func);
+
+    /**
+    * Copies a file from the local machine to the Psion, so that
+    * an interrupted transfer can be continued later.
+    * The sidecar file is kept next to the local source file;
+    * otherwise this works like @ref copyFromPsionResume .
+    *
+    * @param from Name of the file on the local machine to be copied.
+    * @param to Name of the destination file on the Psion.
+    * @param func Pointer to a function which gets called on every write.
+    *
+    * @returns A Psion error code (One of enum @ref #errs ).
+    */
+    Enum<errs> copyToPsionResume(const char * const from, const char * const to, void *, cpCallback_t func);
+
+    /**
+    * Copies data from memory to a file on the Psion. The data
+    * is sent straight from @p buf with pipelined writes, so e.g.
+    * a memory mapped file needs no intermediate copy.
+    *
+    * @param buf The data to be copied.
+    * @param len The length of the data.
+    * @param to Name of the destination file on the Psion.
+    * @param func Pointer to a function which gets called regularly
+    *   with the total number of bytes written. If it returns 0,
+    *   the operation is aborted and E_PSI_FILE_CANCEL is returned.
+    *
+    * @returns A Psion error code (One of enum @ref #errs ).
+    */
+    Enum<errs> copyToPsion(const uint8_t *buf, size_t len, const char * const to, void *, cpCallback_t func);
+
+    /**
+    * The suffix of the sidecar files of resumable transfers.
+    */
+    static const char * const RESUME_SUFFIX;
+
     /**
     * Copies a file from the Psion to the Psion.
     * On the EPOC variants, this runs much faster than reading
@@ -582,6 +731,17 @@ public:
     */
     std::string attr2String(const uint32_t attr);
 
+    /**
+    * Like the above, but without allocating a string.
+    *
+    * @param attr the generic file attribute.
+    * @param buf A buffer of at least 11 bytes, where the zero
+    *        terminated result is stored.
+    *
+    * @returns @p buf .
+    */
+    static const char *attr2String(const uint32_t attr, char *buf);
+
     /**
     * Converts an open-mode (A combination of the PSI_O_ constants.)
     * from generic representation to the machine-specific representation.
@@ -598,6 +758,21 @@ public:
     */
     static std::string convertSlash(const std::string &name);
 
+    /**
+     * Selects the Psion to talk to, on an ncpd serving more than one.
+     * This must be sent on a new connection to ncpd, before anything
+     * else.
+     *
+     * @param skt  The socket connected to ncpd.
+     * @param name The name ncpd knows the device by.
+     *
+     * @returns E_PSI_GEN_NONE on success, E_PSI_FILE_NXIST if ncpd
+     * knows no such device, E_PSI_FILE_NOTREADY if no Psion is
+     * connected to it, E_PSI_GEN_NSUP if ncpd does not support
+     * selecting a device, or E_PSI_FILE_DISC if ncpd does not answer.
+     */
+    static Enum<errs> selectDevice(ppsocket *skt, const char *name);
+
     /**
      * Retrieve speed of serial link.
      *
@@ -623,6 +798,12 @@ protected:
     ppsocket *skt;
     Enum<errs> status;
     int32_t serNum;
+
+    /**
+    * The device selected by the @ref rfsvfactory , if any.
+    * It is selected again on a reconnect.
+    */
+    std::string device;
 };
 
 #endif
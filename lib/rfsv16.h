@@ -46,6 +46,7 @@ public:
     Enum<rfsv::errs> freplacefile(const uint32_t, const char * const, uint32_t &);
     Enum<rfsv::errs> fclose(const uint32_t);
     Enum<rfsv::errs> dir(const char * const, PlpDir &);
+    using rfsv::dir;
     Enum<rfsv::errs> fgetmtime(const char * const, PsiTime &);
     Enum<rfsv::errs> fsetmtime(const char * const, const PsiTime);
     Enum<rfsv::errs> fgetattr(const char * const, uint32_t &);
@@ -59,6 +60,7 @@ public:
     Enum<rfsv::errs> copyFromPsion(const char * const, const char * const, void *, cpCallback_t);
     Enum<rfsv::errs> copyFromPsion(const char *from, int fd, cpCallback_t cb);
     Enum<rfsv::errs> copyToPsion(const char * const, const char * const, void *, cpCallback_t);
+    using rfsv::copyToPsion;
     Enum<rfsv::errs> copyOnPsion(const char *, const char *, void *, cpCallback_t);
     Enum<rfsv::errs> fsetsize(const uint32_t, const uint32_t);
     Enum<rfsv::errs> fseek(const uint32_t, const int32_t, const uint32_t, uint32_t &);
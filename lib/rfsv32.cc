@@ -26,10 +26,12 @@
 #include "bufferarray.h"
 #include "plpdirent.h"
 
+#include <deque>
 #include <iostream>
 #include <fstream>
 
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "ignore-value.h"
@@ -183,6 +185,47 @@ readdir(rfsvDirhandle &dH, PlpDirent &e) {
     return res;
 }
 
+Enum<rfsv::errs> rfsv32::
+dir(const char * const name, PlpDirList &files)
+{
+    rfsvDirhandle h;
+    files.clear();
+    Enum<rfsv::errs> res = opendir(PSI_A_HIDDEN | PSI_A_SYSTEM | PSI_A_DIR, name, h);
+    while (res == E_PSI_GEN_NONE) {
+	h.b.init();
+	h.b.addDWord(h.h);
+	if (!sendCommand(READ_DIR, h.b)) {
+	    res = E_PSI_FILE_DISC;
+	    break;
+	}
+	if ((res = getResponse(h.b)) != E_PSI_GEN_NONE)
+	    break;
+
+	// Every response holds as many entries as fit, which are
+	// added straight from the buffer. See readdir.
+	const char *p = h.b.getString(0);
+	long len = h.b.getLen();
+	long d = 0;
+	while (len - d > 16) {
+	    long shortLen = h.b.getDWord(d);
+	    long longLen = h.b.getDWord(d + 32);
+
+	    if (d + 36 + longLen > len)
+		break;
+	    files.add(h.b.getDWord(d + 8), attr2std(h.b.getDWord(d + 4)),
+		      h.b.getDWord(d + 16), h.b.getDWord(d + 12),
+		      h.b.getDWord(d + 20), h.b.getDWord(d + 24),
+		      h.b.getDWord(d + 28), p + d + 36, longLen);
+	    d += 36 + ((longLen + 3) & ~3L);
+	    d += (shortLen + 3) & ~3L;
+	}
+    }
+    closedir(h);
+    if (res == E_PSI_FILE_EOF)
+	res = E_PSI_GEN_NONE;
+    return res;
+}
+
 Enum<rfsv::errs> rfsv32::
 dir(const char *name, PlpDir &files)
 {
@@ -474,6 +517,91 @@ fwrite(const uint32_t handle, const unsigned char * const buf, const uint32_t le
     return res;
 }
 
+Enum<rfsv::errs> rfsv32::
+freadPipelined(const uint32_t handle, unsigned char * const buf, const uint32_t len, uint32_t &count, const int window)
+{
+    Enum<rfsv::errs> res = E_PSI_GEN_NONE;
+    deque<uint32_t> pending;
+    uint32_t sent = 0;
+    bool eof = false;
+
+    count = 0;
+    while (!pending.empty() || (!eof && (sent < len) && (res == E_PSI_GEN_NONE))) {
+	// Keep the pipe full ...
+	while (!eof && (sent < len) && (res == E_PSI_GEN_NONE) &&
+	       (((int)pending.size() < window) || pending.empty())) {
+	    bufferStore a;
+	    uint32_t n = ((len - sent) > RFSV_SENDLEN)?RFSV_SENDLEN:(len - sent);
+	    a.addDWord(handle);
+	    a.addDWord(n);
+	    if (!sendCommand(READ_FILE, a))
+		return E_PSI_FILE_DISC;
+	    pending.push_back(n);
+	    sent += n;
+	}
+	// ... and collect the oldest answer. Replies are always
+	// drained completely, even after an error, so the next
+	// request sees its own response.
+	bufferStore a;
+	Enum<rfsv::errs> r = getResponse(a);
+	if (r == E_PSI_FILE_DISC)
+	    return r;
+	uint32_t n = pending.front();
+	pending.pop_front();
+	if (r != E_PSI_GEN_NONE) {
+	    if (res == E_PSI_GEN_NONE)
+		res = r;
+	    continue;
+	}
+	uint32_t l = a.getLen();
+	if (eof || (res != E_PSI_GEN_NONE))
+	    continue;
+	if (l > n)
+	    l = n;
+	memcpy(buf + count, a.getString(), l);
+	count += l;
+	if (l < n)
+	    eof = true;
+    }
+    return res;
+}
+
+Enum<rfsv::errs> rfsv32::
+fwritePipelined(const uint32_t handle, const unsigned char * const buf, const uint32_t len, uint32_t &count, const int window)
+{
+    Enum<rfsv::errs> res = E_PSI_GEN_NONE;
+    deque<uint32_t> pending;
+    uint32_t sent = 0;
+
+    count = 0;
+    while (!pending.empty() || ((sent < len) && (res == E_PSI_GEN_NONE))) {
+	while ((sent < len) && (res == E_PSI_GEN_NONE) &&
+	       (((int)pending.size() < window) || pending.empty())) {
+	    uint32_t n = ((len - sent) > RFSV_SENDLEN)?RFSV_SENDLEN:(len - sent);
+	    bufferStore a;
+	    bufferStore tmp(buf + sent, n);
+	    a.addDWord(handle);
+	    a.addBuff(tmp);
+	    if (!sendCommand(WRITE_FILE, a))
+		return E_PSI_FILE_DISC;
+	    pending.push_back(n);
+	    sent += n;
+	}
+	bufferStore a;
+	Enum<rfsv::errs> r = getResponse(a);
+	if (r == E_PSI_FILE_DISC)
+	    return r;
+	uint32_t n = pending.front();
+	pending.pop_front();
+	if (r != E_PSI_GEN_NONE) {
+	    if (res == E_PSI_GEN_NONE)
+		res = r;
+	} else if (res == E_PSI_GEN_NONE)
+	    count += n;
+    }
+    return res;
+}
+
 Enum<rfsv::errs> rfsv32::
 copyFromPsion(const char *from, const char *to, void *ptr, cpCallback_t cb)
 {
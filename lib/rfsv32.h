@@ -43,10 +43,12 @@ class rfsv32 : public rfsv {
 
 public:
     Enum<rfsv::errs> dir(const char * const, PlpDir &);
+    Enum<rfsv::errs> dir(const char * const, PlpDirList &);
     Enum<rfsv::errs> dircount(const char * const, uint32_t &);
     Enum<rfsv::errs> copyFromPsion(const char * const, const char * const, void *, cpCallback_t);
     Enum<rfsv::errs> copyFromPsion(const char *from, int fd, cpCallback_t cb);
     Enum<rfsv::errs> copyToPsion(const char * const, const char * const, void *, cpCallback_t);
+    using rfsv::copyToPsion;
     Enum<rfsv::errs> copyOnPsion(const char * const, const char * const, void *, cpCallback_t);
     Enum<rfsv::errs> mkdir(const char * const);
     Enum<rfsv::errs> rmdir(const char * const);
@@ -64,6 +66,8 @@ public:
     Enum<rfsv::errs> fseek(const uint32_t, const int32_t, const uint32_t, uint32_t &);
     Enum<rfsv::errs> fread(const uint32_t, unsigned char * const, const uint32_t, uint32_t &);
     Enum<rfsv::errs> fwrite(const uint32_t, const unsigned char * const, const uint32_t, uint32_t &);
+    Enum<rfsv::errs> freadPipelined(const uint32_t, unsigned char * const, const uint32_t, uint32_t &, const int);
+    Enum<rfsv::errs> fwritePipelined(const uint32_t, const unsigned char * const, const uint32_t, uint32_t &, const int);
     Enum<rfsv::errs> fsetsize(uint32_t, uint32_t);
     Enum<rfsv::errs> fclose(const uint32_t);
 
@@ -39,12 +39,15 @@ ENUM_DEFINITION_BEGIN(rfsvfactory::errs, rfsvfactory::FACERR_NONE)
     stringRep.add(rfsvfactory::FACERR_NOPSION,        N_("no EPOC device connected"));
     stringRep.add(rfsvfactory::FACERR_PROTVERSION,    N_("wrong protocol version"));
     stringRep.add(rfsvfactory::FACERR_NORESPONSE,     N_("no response from ncpd"));
+    stringRep.add(rfsvfactory::FACERR_NODEVICE,       N_("no such device"));
 ENUM_DEFINITION_END(rfsvfactory::errs)
 
-rfsvfactory::rfsvfactory(ppsocket *_skt) : serNum(0)
+rfsvfactory::rfsvfactory(ppsocket *_skt, const char *_device) : serNum(0)
 {
     err = FACERR_NONE;
     skt = _skt;
+    if (_device)
+	device = _device;
 }
 
 rfsv * rfsvfactory::create(bool reconnect)
@@ -57,10 +60,25 @@ rfsv * rfsvfactory::create(bool reconnect)
     // RFSV module will also announce itself.
 
     bufferStore a;
+    Enum<rfsv::errs> res = rfsv::E_PSI_GEN_NONE;
 
     err = FACERR_NONE;
+    // On an ncpd serving several Psions, pick ours first.
+    if (!device.empty())
+	res = rfsv::selectDevice(skt, device.c_str());
+    if (res == rfsv::E_PSI_FILE_NOTREADY) {
+	skt->closeSocket();
+	serNum = 0;
+	skt->reconnect();
+	err = FACERR_NOPSION;
+	return NULL;
+    }
+    if ((res != rfsv::E_PSI_GEN_NONE) && (res != rfsv::E_PSI_FILE_DISC)) {
+	err = FACERR_NODEVICE;
+	return NULL;
+    }
     a.addStringT("NCP$INFO");
-    if (!skt->sendBufferStore(a)) {
+    if ((res == rfsv::E_PSI_FILE_DISC) || !skt->sendBufferStore(a)) {
 	if (!reconnect)
 	    err = FACERR_COULD_NOT_SEND;
 	else {
@@ -72,11 +90,16 @@ rfsv * rfsvfactory::create(bool reconnect)
 	return NULL;
     }
     if (skt->getBufferStore(a) == 1) {
+	rfsv *r = NULL;
 	if (a.getLen() > 8 && !strncmp(a.getString(), "Series 3", 8)) {
-	    return new rfsv16(skt);
+	    r = new rfsv16(skt);
 	}
 	else if (a.getLen() > 8 && !strncmp(a.getString(), "Series 5", 8)) {
-	    return new rfsv32(skt);
+	    r = new rfsv32(skt);
+	}
+	if (r) {
+	    r->device = device;
+	    return r;
 	}
 	if ((a.getLen() > 8) && !strncmp(a.getString(), "No Psion", 8)) {
 	    skt->closeSocket();
@@ -42,7 +42,8 @@ public:
 	FACERR_AGAIN = 2,
 	FACERR_NOPSION = 3,
 	FACERR_PROTVERSION = 4,
-	FACERR_NORESPONSE = 5
+	FACERR_NORESPONSE = 5,
+	FACERR_NODEVICE = 6
     };
 
     /**
@@ -50,8 +51,10 @@ public:
     *
     * @param skt The socket to be used for connecting
     * to the ncpd daemon.
+    * @param device The name of the Psion to talk to, on an ncpd
+    * serving more than one, or NULL for its default one.
     */
-    rfsvfactory(ppsocket * skt);
+    rfsvfactory(ppsocket * skt, const char *device = NULL);
 
     /**
     * Creates a new @ref rfsv instance.
@@ -80,6 +83,11 @@ private:
     ppsocket *skt;
     int serNum;
     Enum<errs> err;
+
+    /**
+    * The device to select before anything else, if any.
+    */
+    std::string device;
 };
 
 #endif
@@ -32,6 +32,12 @@
 
 using namespace std;
 
+/**
+ * The number of requests which @ref rpcs::sendCommands keeps
+ * in flight.
+ */
+#define RPCS_WINDOW 8
+
 ENUM_DEFINITION_BEGIN(rpcs::machs, rpcs::PSI_MACH_UNKNOWN)
     stringRep.add(rpcs::PSI_MACH_UNKNOWN,   N_("Unknown device"));
     stringRep.add(rpcs::PSI_MACH_PC,        N_("PC"));
@@ -98,6 +104,11 @@ void rpcs::
 reconnect(void)
 {
     skt->reconnect();
+    if (!device.empty() &&
+	(rfsv::selectDevice(skt, device.c_str()) != rfsv::E_PSI_GEN_NONE)) {
+	status = rfsv::E_PSI_FILE_DISC;
+	return;
+    }
     reset();
 }
 
@@ -106,6 +117,7 @@ reset(void)
 {
     bufferStore a;
     mtCacheS5mx = 0;
+    driveCache.clear();
     status = rfsv::E_PSI_FILE_DISC;
     a.addStringT(getConnectName());
     if (skt->sendBufferStore(a)) {
@@ -175,6 +187,39 @@ getResponse(bufferStore & data, bool statusIsFirstByte)
     return status;
 }
 
+bool rpcs::
+sendCommands(enum commands cc, vector<bufferStore> &data,
+	     bool statusIsFirstByte, vector<Enum<rfsv::errs> > &res)
+{
+    size_t sent = 0;
+    size_t got = 0;
+
+    res.resize(data.size());
+    while (got < data.size()) {
+	while ((sent < data.size()) && (sent - got < RPCS_WINDOW)) {
+	    if (sent == got) {
+		// Nothing outstanding, so a reconnect is harmless.
+		if (!sendCommand(cc, data[sent]))
+		    return false;
+	    } else {
+		bufferStore a;
+		a.addByte(cc);
+		a.addBuff(data[sent]);
+		if (!skt->sendBufferStore(a)) {
+		    status = rfsv::E_PSI_FILE_DISC;
+		    return false;
+		}
+	    }
+	    sent++;
+	}
+	res[got] = getResponse(data[got], statusIsFirstByte);
+	if (status == rfsv::E_PSI_FILE_DISC)
+	    return false;
+	got++;
+    }
+    return true;
+}
+
 //
 // APIs, identical on SIBO and EPOC
 //
@@ -244,28 +289,31 @@ queryProgram(const char *program)
 }
 
 Enum<rfsv::errs> rpcs::
-queryPrograms(processList &ret)
+queryPrograms(processList &ret, bool withArgs)
 {
     bufferStore a;
-    const char *drives;
-    const char *dptr;
     bool anySuccess = false;
-    Enum<rfsv::errs> res;
+    vector<bufferStore> req;
+    vector<Enum<rfsv::errs> > res;
 
-    // First, check how many drives we need to query
-    a.addStringT("M:"); // Drive M only exists on a SIBO
-    if (!sendCommand(rpcs::GET_UNIQUEID, a))
-        return rfsv::E_PSI_FILE_DISC;
-    if (getResponse(a, false) == rfsv::E_PSI_GEN_NONE)
-        // A SIBO; Must query all possible drives
-        drives = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    else
-        // A Series 5; Query of C is sufficient
-        drives = "C";
-
-    dptr = drives;
     ret.clear();
 
+    // First, check how many drives we need to query.
+    // This can't change while we are connected.
+    if (driveCache.empty()) {
+        a.addStringT("M:"); // Drive M only exists on a SIBO
+        if (!sendCommand(rpcs::GET_UNIQUEID, a))
+            return rfsv::E_PSI_FILE_DISC;
+        if (getResponse(a, false) == rfsv::E_PSI_GEN_NONE)
+            // A SIBO; Must query all possible drives
+            driveCache = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        else if (status == rfsv::E_PSI_FILE_DISC)
+            return status;
+        else
+            // A Series 5; Query of C is sufficient
+            driveCache = "C";
+    }
+
     if ((mtCacheS5mx & 4) == 0) {
         Enum<machs> tmp;
         if (getMachineType(tmp) != rfsv::E_PSI_GEN_NONE)
@@ -278,47 +326,79 @@ queryPrograms(processList &ret)
             return rfsv::E_PSI_FILE_DISC;
     }
     bool s5mx = (mtCacheS5mx == 15);
-    while (*dptr) {
-        a.init();
-        a.addByte(*dptr);
-        if (!sendCommand(rpcs::QUERY_DRIVE, a))
-            return rfsv::E_PSI_FILE_DISC;
-        if (getResponse(a, false) == rfsv::E_PSI_GEN_NONE) {
-            anySuccess = true;
-            int l = a.getLen();
-            while (l > 0) {
-                const char *s;
-                char *p;
-                int pid;
-                int sl;
-
-                s = a.getString(0);
-                sl = strlen(s) + 1;
-                l -= sl;
-                a.discardFirstBytes(sl);
-                if ((p = strstr((char *)s, ".$"))) {
-                    *p = '\0'; p += 2;
-                    sscanf(p, "%d", &pid);
-                } else
-                    pid = 0;
-                PsiProcess proc(pid, s, a.getString(0), s5mx);
-                ret.push_back(proc);
-                sl = strlen(a.getString(0)) + 1;
-                l -= sl;
-                a.discardFirstBytes(sl);
-            }
+
+    req.resize(driveCache.size());
+    for (size_t i = 0; i < driveCache.size(); i++)
+        req[i].addByte(driveCache[i]);
+    if (!sendCommands(rpcs::QUERY_DRIVE, req, false, res))
+        return rfsv::E_PSI_FILE_DISC;
+    for (size_t i = 0; i < req.size(); i++) {
+        if (res[i] != rfsv::E_PSI_GEN_NONE)
+            continue;
+        anySuccess = true;
+        bufferStore &b = req[i];
+        int l = b.getLen();
+        while (l > 0) {
+            const char *s;
+            char *p;
+            int pid;
+            int sl;
+
+            s = b.getString(0);
+            sl = strlen(s) + 1;
+            l -= sl;
+            b.discardFirstBytes(sl);
+            if ((p = strstr((char *)s, ".$"))) {
+                *p = '\0'; p += 2;
+                sscanf(p, "%d", &pid);
+            } else
+                pid = 0;
+            PsiProcess proc(pid, s, b.getString(0), s5mx);
+            ret.push_back(proc);
+            sl = strlen(b.getString(0)) + 1;
+            l -= sl;
+            b.discardFirstBytes(sl);
         }
-        dptr++;
     }
-    if (anySuccess && !ret.empty())
-        for (processList::iterator i = ret.begin(); i != ret.end(); i++) {
-            string cmdline;
-            if (getCmdLine(i->getProcId(), cmdline) == rfsv::E_PSI_GEN_NONE)
-                i->setArgs(cmdline + " " + i->getArgs());
-        }
+    if (withArgs && anySuccess && !ret.empty()) {
+        req.clear();
+        req.resize(ret.size());
+        for (size_t i = 0; i < ret.size(); i++)
+            req[i].addStringT(ret[i].getProcId());
+        if (!sendCommands(rpcs::GET_CMDLINE, req, true, res))
+            return rfsv::E_PSI_FILE_DISC;
+        for (size_t i = 0; i < ret.size(); i++)
+            if (res[i] == rfsv::E_PSI_GEN_NONE)
+                ret[i].setArgs(string(req[i].getString(0)) + " " + ret[i].getArgs());
+    }
     return anySuccess ? rfsv::E_PSI_GEN_NONE : rfsv::E_PSI_GEN_FAIL;
 }
 
+bool rpcs::
+diffPrograms(const processList &before, const processList &after,
+             processList &started, processList &stopped)
+{
+    started.clear();
+    stopped.clear();
+    for (processList::const_iterator i = after.begin(); i != after.end(); i++) {
+        processList::const_iterator j;
+        for (j = before.begin(); j != before.end(); j++)
+            if ((j->pid == i->pid) && (j->name == i->name))
+                break;
+        if (j == before.end())
+            started.push_back(*i);
+    }
+    for (processList::const_iterator i = before.begin(); i != before.end(); i++) {
+        processList::const_iterator j;
+        for (j = after.begin(); j != after.end(); j++)
+            if ((j->pid == i->pid) && (j->name == i->name))
+                break;
+        if (j == after.end())
+            stopped.push_back(*i);
+    }
+    return !started.empty() || !stopped.empty();
+}
+
 Enum<rfsv::errs> rpcs::
 formatOpen(const char drive, int &handle, int &count)
 {
@@ -49,6 +49,8 @@ typedef std::vector<PsiProcess> processList;
  * @author Fritz Elfert <felfert@to.com>
  */
 class rpcs {
+    friend class rpcsfactory;
+
 public:
     /**
     * The known machine types.
@@ -318,12 +320,36 @@ public:
      * Retrieves a list of all running Programs.
      *
      * This function works with both SIBO and EPOC.
+     * Whether the remote side is a SIBO, and therefore which drives
+     * have to be asked, is only found out on the first call of a
+     * session. The per drive and per process requests are sent
+     * without waiting for each reply, so a call costs about two
+     * round trips regardless of the number of processes.
      *
      * @param ret The list of currently running processes is returned here.
+     * @param withArgs If false, the command lines of the processes are
+     *        not fetched, which saves a round trip. Use this when
+     *        polling, e.g. for programs to terminate.
      *
      * @returns A psion error code. 0 = Ok.
      */
-    Enum<rfsv::errs> queryPrograms(processList &ret);
+    Enum<rfsv::errs> queryPrograms(processList &ret, bool withArgs = true);
+
+    /**
+     * Compares two lists returned by @ref queryPrograms .
+     * Processes are identified by name and PID.
+     *
+     * @param before The earlier list.
+     * @param after The later list.
+     * @param started Processes in @p after but not in @p before are
+     *        returned here.
+     * @param stopped Processes in @p before but not in @p after are
+     *        returned here.
+     *
+     * @returns true if there was any change.
+     */
+    static bool diffPrograms(const processList &before, const processList &after,
+			     processList &started, processList &stopped);
 
     /**
     * Retrieves the command line of a running process.
@@ -427,6 +453,12 @@ protected:
     */
     Enum<rfsv::errs> status;
 
+    /**
+    * The device selected by the @ref rpcsfactory , if any.
+    * It is selected again on a reconnect.
+    */
+    std::string device;
+
    /**
     * The possible commands.
     */
@@ -465,6 +497,12 @@ protected:
      */
     int mtCacheS5mx;
 
+    /**
+     * The drives to be asked by @ref queryPrograms , or empty
+     * if not yet known for this session.
+     */
+    std::string driveCache;
+
     /**
      * Prepare scratch RAM in Series 5 for read/write
      *
@@ -502,6 +540,22 @@ protected:
     */
     bool sendCommand(enum commands cc, bufferStore &data);
     Enum<rfsv::errs> getResponse(bufferStore &data, bool statusIsFirstByte);
+
+    /**
+    * Sends the same command with several different arguments,
+    * keeping a few of them in flight instead of waiting for
+    * every reply before sending the next request.
+    *
+    * @param cc The command to execute on the remote side.
+    * @param data The arguments, one per request. Each is replaced
+    *        by the corresponding reply.
+    * @param statusIsFirstByte As for @ref getResponse .
+    * @param res The result of every request is returned here.
+    *
+    * @returns true on success, false if the connection broke.
+    */
+    bool sendCommands(enum commands cc, std::vector<bufferStore> &data,
+		      bool statusIsFirstByte, std::vector<Enum<rfsv::errs> > &res);
     const char *getConnectName();
 };
 
@@ -36,12 +36,15 @@ ENUM_DEFINITION_BEGIN(rpcsfactory::errs, rpcsfactory::FACERR_NONE)
     stringRep.add(rpcsfactory::FACERR_NOPSION,        N_("no EPOC device connected"));
     stringRep.add(rpcsfactory::FACERR_PROTVERSION,    N_("wrong protocol version"));
     stringRep.add(rpcsfactory::FACERR_NORESPONSE,     N_("no response from ncpd"));
+    stringRep.add(rpcsfactory::FACERR_NODEVICE,       N_("no such device"));
 ENUM_DEFINITION_END(rpcsfactory::errs)
 
-rpcsfactory::rpcsfactory(ppsocket *_skt)
+rpcsfactory::rpcsfactory(ppsocket *_skt, const char *_device)
 {
     err = FACERR_NONE;
     skt = _skt;
+    if (_device)
+	device = _device;
 }
 
 rpcs * rpcsfactory::create(bool reconnect)
@@ -54,10 +57,24 @@ rpcs * rpcsfactory::create(bool reconnect)
     // rpcs module will also announce itself.
 
     bufferStore a;
+    Enum<rfsv::errs> res = rfsv::E_PSI_GEN_NONE;
 
     err = FACERR_NONE;
+    // On an ncpd serving several Psions, pick ours first.
+    if (!device.empty())
+	res = rfsv::selectDevice(skt, device.c_str());
+    if (res == rfsv::E_PSI_FILE_NOTREADY) {
+	skt->closeSocket();
+	skt->reconnect();
+	err = FACERR_NOPSION;
+	return NULL;
+    }
+    if ((res != rfsv::E_PSI_GEN_NONE) && (res != rfsv::E_PSI_FILE_DISC)) {
+	err = FACERR_NODEVICE;
+	return NULL;
+    }
     a.addStringT("NCP$INFO");
-    if (!skt->sendBufferStore(a)) {
+    if ((res == rfsv::E_PSI_FILE_DISC) || !skt->sendBufferStore(a)) {
 	if (!reconnect)
 	    err = FACERR_COULD_NOT_SEND;
 	else {
@@ -68,11 +85,16 @@ rpcs * rpcsfactory::create(bool reconnect)
 	return NULL;
     }
     if (skt->getBufferStore(a) == 1) {
+	rpcs *r = NULL;
 	if (a.getLen() > 8 && !strncmp(a.getString(), "Series 3", 8)) {
-	    return new rpcs16(skt);
+	    r = new rpcs16(skt);
 	}
 	else if (a.getLen() > 8 && !strncmp(a.getString(), "Series 5", 8)) {
-	    return new rpcs32(skt);
+	    r = new rpcs32(skt);
+	}
+	if (r) {
+	    r->device = device;
+	    return r;
 	}
 	if ((a.getLen() > 8) && !strncmp(a.getString(), "No Psion", 8)) {
 	    skt->closeSocket();
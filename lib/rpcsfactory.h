@@ -41,7 +41,8 @@ class rpcsfactory {
 	FACERR_AGAIN = 2,
 	FACERR_NOPSION = 3,
 	FACERR_PROTVERSION = 4,
-	FACERR_NORESPONSE = 5
+	FACERR_NORESPONSE = 5,
+	FACERR_NODEVICE = 6
     };
 
     /**
@@ -49,8 +50,10 @@ class rpcsfactory {
     *
     * @param skt The socket to be used for connecting
     * to the ncpd daemon.
+    * @param device The name of the Psion to talk to, on an ncpd
+    * serving more than one, or NULL for its default one.
     */
-    rpcsfactory(ppsocket * skt);
+    rpcsfactory(ppsocket * skt, const char *device = NULL);
 
     /**
     * Creates a new rpcs instance.
@@ -78,6 +81,11 @@ class rpcsfactory {
     */
     ppsocket *skt;
     Enum<errs> err;
+
+    /**
+    * The device to select before anything else, if any.
+    */
+    std::string device;
 };
 
 #endif
@@ -29,7 +29,12 @@
 SISFile::SISFile()
 {
 	m_buf = 0;
+	m_len = 0;
 	m_ownBuffer = false;
+	m_hasRecords = false;
+	m_langRecords = 0;
+	m_fileRecords = 0;
+	m_reqRecords = 0;
 }
 
 SISFile::~SISFile()
@@ -46,10 +51,21 @@ SISFile::compareApp(SISFile* other)
 
 SisRC
 SISFile::fillFrom(uint8_t* buf, off_t len)
+{
+	SisRC rc = fillHeader(buf, len);
+	if (rc != SIS_OK)
+		return rc;
+	return fillRecords();
+}
+
+SisRC
+SISFile::fillHeader(uint8_t* buf, off_t len)
 {
 	m_end = 0;
 	int ix = 0;
 	m_buf = buf;
+	m_len = len;
+	m_hasRecords = false;
 	SisRC rc = m_header.fillFrom(buf, &ix, len);
 	if (rc != SIS_OK)
 		{
@@ -58,6 +74,18 @@ SISFile::fillFrom(uint8_t* buf, off_t len)
 		}
 	if (logLevel >= 2)
 		printf(_("Ate header, got ix = %d\n"), ix);
+	return SIS_OK;
+}
+
+SisRC
+SISFile::fillRecords()
+{
+	if (m_hasRecords)
+		return SIS_OK;
+	uint8_t* buf = m_buf;
+	off_t len = m_len;
+	SisRC rc;
+	int ix;
 	int n;
 
 	// Read languages.
@@ -129,10 +157,38 @@ SISFile::fillFrom(uint8_t* buf, off_t len)
 			}
 		}
 	updateEnd(ix);
+	m_hasRecords = true;
 
 	return SIS_OK;
 }
 
+SisRC
+SISFile::verify()
+{
+	// The checksum is computed with its own field set to 0.
+	//
+	static const uint8_t zero[2] = { 0, 0 };
+	if (m_len < 18)
+		return SIS_TRUNCATED;
+	for (int i = 0; i < m_header.m_nfiles; ++i)
+		if (!m_fileRecords[i].hasAllData(m_header.m_nlangs))
+			{
+			if (logLevel >= 1)
+				printf(_("File %d is truncated.\n"), i);
+			return SIS_TRUNCATEDDATA;
+			}
+	uint16_t crc = updateCrc(0, m_buf, 16);
+	crc = updateCrc(crc, zero, 2);
+	crc = updateCrc(crc, m_buf + 18, m_len - 18);
+	if (crc != m_header.m_crc)
+		{
+		if (logLevel >= 1)
+			printf(_("Bad checksum %04x, wanted %04x.\n"), crc, m_header.m_crc);
+		return SIS_BADCRC;
+		}
+	return SIS_OK;
+}
+
 int
 SISFile::getLanguage()
 {
@@ -55,6 +55,32 @@ public:
 	 */
 	SisRC fillFrom(uint8_t* buf, off_t len);
 
+	/**
+	 * Populate only the header, which is enough for comparing
+	 * applications. The other records are read by fillRecords().
+	 *
+	 * @param buf The buffer to read from, which must be kept.
+	 * @param len The length of the buffer.
+	 */
+	SisRC fillHeader(uint8_t* buf, off_t len);
+
+	/**
+	 * Populate the language, requisite, component name and file
+	 * records, after fillHeader(). Does nothing if that has been
+	 * done already.
+	 */
+	SisRC fillRecords();
+
+	/**
+	 * Check the checksum of the whole file in the header, and that
+	 * the data of all file records is inside the file. This has to
+	 * be done after fillFrom(), but before anything is patched.
+	 *
+	 * The file records themselves carry no checksums; the data of
+	 * the files is covered by the one in the header.
+	 */
+	SisRC verify();
+
 	/**
 	 * Return the currently selected installation language.
 	 */
@@ -118,6 +144,10 @@ private:
 
 	uint8_t* m_buf;
 
+	off_t m_len;
+
+	bool m_hasRecords;
+
 	uint32_t m_end;
 
 	void updateEnd(uint32_t pos);
@@ -135,6 +135,27 @@ SISFileRecord::getFilePtr(int fileNo)
 	return &m_buf[m_filePtrs[fileNo]];
 }
 
+bool
+SISFileRecord::hasAllData(int nlangs)
+{
+	int n;
+	switch (m_flags)
+		{
+		case 0:
+			n = 1;
+			break;
+		case 1:
+			n = nlangs;
+			break;
+		default:
+			return true;
+		}
+	for (int i = 0; i < n; ++i)
+		if ((uint64_t)m_filePtrs[i] + m_fileLengths[i] > (uint64_t)m_len)
+			return false;
+	return true;
+}
+
 void
 SISFileRecord::setMainDrive(char drive)
 {
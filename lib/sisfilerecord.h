@@ -56,6 +56,14 @@ public:
 	 */
 	uint8_t* getFilePtr(int fileNo);
 
+	/**
+	 * Check that the file data for all languages is inside the
+	 * buffer.
+	 *
+	 * @param nlangs The number of languages of the SIS file.
+	 */
+	bool hasAllData(int nlangs);
+
 	void setMainDrive(char drive);
 
 	/**
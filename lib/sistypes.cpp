@@ -22,6 +22,12 @@
 
 static unsigned int s_crcTable[256];
 
+/**
+ * s_crcTables[k][b] is the checksum of byte b followed by k zero
+ * bytes, for checking eight bytes per step.
+ */
+static uint16_t s_crcTables[8][256];
+
 int logLevel = 0;
 
 void createCRCTable()
@@ -36,6 +42,14 @@ void createCRCTable()
 		s_crcTable[index * 2 + (carry ? 0 : 1)] = temp ^ polynomial;
 		s_crcTable[index * 2 + (carry ? 1 : 0)] = temp;
 		}
+	for (index = 0; index < 256; index++)
+		s_crcTables[0][index] = s_crcTable[index];
+	for (int k = 1; k < 8; k++)
+		for (index = 0; index < 256; index++)
+			{
+			uint16_t prev = s_crcTables[k - 1][index];
+			s_crcTables[k][index] = (prev << 8) ^ s_crcTable[prev >> 8];
+			}
 }
 
 uint16_t updateCrc(uint16_t crc, uint8_t value)
@@ -43,17 +57,31 @@ uint16_t updateCrc(uint16_t crc, uint8_t value)
 	return (crc << 8) ^ s_crcTable[((crc >> 8) ^ value) & 0xff];
 }
 
-uint16_t calcCRC(uint8_t* data, int len)
+uint16_t updateCrc(uint16_t crc, const uint8_t* data, size_t len)
 {
-	uint16_t crc = 0;
-	for (int i = 0; i < len; ++i)
+	while (len >= 8)
 		{
-		uint8_t value = data[i];
-		crc = (crc << 8) ^ s_crcTable[((crc >> 8) ^ value) & 0xff];
+		crc = s_crcTables[7][data[0] ^ (crc >> 8)] ^
+			s_crcTables[6][data[1] ^ (crc & 0xff)] ^
+			s_crcTables[5][data[2]] ^
+			s_crcTables[4][data[3]] ^
+			s_crcTables[3][data[4]] ^
+			s_crcTables[2][data[5]] ^
+			s_crcTables[1][data[6]] ^
+			s_crcTables[0][data[7]];
+		data += 8;
+		len -= 8;
 		}
+	while (len-- > 0)
+		crc = updateCrc(crc, *data++);
 	return crc;
 }
 
+uint16_t calcCRC(uint8_t* data, int len)
+{
+	return updateCrc(0, data, len);
+}
+
 uint16_t read16(uint8_t* p)
 {
 	return p[0] | (p[1] << 8);
@@ -31,6 +31,7 @@ enum SisRC {
 	SIS_TRUNCATED,
 	SIS_TRUNCATEDDATA,
 	SIS_CORRUPTED,
+	SIS_BADCRC,
 	SIS_FAILED,
 	SIS_ABORTED,
 	SIS_DIFFERENT_APP,
@@ -45,10 +46,19 @@ extern uint32_t read32(uint8_t* p);
 
 extern void write16(uint8_t* p, int val);
 
+/**
+ * Set up the checksum tables. Must be called before any of the
+ * checksum functions, and before starting any threads.
+ */
 extern void createCRCTable();
 
 extern uint16_t updateCrc(uint16_t crc, uint8_t value);
 
+/**
+ * Add a block of data to a checksum, eight bytes at a time.
+ */
+extern uint16_t updateCrc(uint16_t crc, const uint8_t* data, size_t len);
+
 extern int logLevel;
 
 /**
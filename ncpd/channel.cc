@@ -38,6 +38,8 @@ channel::channel(ncp * _ncpController)
 
 channel::~channel()
 {
+    if (ncpController)
+	ncpController->release(this);
     if (connectName)
 	free((void *)connectName);
 }
@@ -132,6 +134,12 @@ newNcpController(ncp * _ncpController)
     ncpController = _ncpController;
 }
 
+ncp *channel::
+getNcpController()
+{
+    return ncpController;
+}
+
 void channel::
 setVerbose(short int _verbose)
 {
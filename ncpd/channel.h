@@ -34,6 +34,7 @@ public:
     channel(ncp *ncpController);
     virtual ~channel() = 0;
     void newNcpController(ncp *ncpController);
+    ncp *getNcpController();
 
     void setNcpChannel(int chan);
     int getNcpChannel(void);
@@ -23,6 +23,8 @@
 #include <string>
 #include <cstring>
 #include <iostream>
+#include <deque>
+#include <vector>
 
 #include <bufferstore.h>
 #include <ppsocket.h>
@@ -37,6 +39,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <time.h>
 #include <plpintl.h>
 
 #include "ignore-value.h"
@@ -46,6 +49,8 @@
 #include "linkchan.h"
 #include "link.h"
 #include "packet.h"
+#include "transport.h"
+#include "main.h"
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -58,12 +63,38 @@ static bool verbose = false;
 static bool active = true;
 static bool autoexit = false;
 
-static ncp *theNCP = NULL;
+/**
+ * A Psion on a serial device, with its own NCP stack, and a thread
+ * which restarts the stack when the link fails.
+ */
+struct device {
+    string name;
+    const char *serial;
+    ncp *theNCP;
+    pthread_t thread;
+};
+
+static vector<device> devices;
+static int numLinks = 0; // link threads still running
+static pthread_mutex_t linksMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * A client which has connected, but is not served yet.
+ */
+struct pendingClient {
+    ppsocket *skt;
+    time_t since;
+};
+
 static IOWatch iow;
 static IOWatch accept_iow;
+static IOWatch park_iow; // holds the pending clients; nobody waits on it
 static ppsocket skt;
 static int numScp = 0;
-static socketChan *scp[257]; // MAX_CHANNELS_PSION + 1
+static int maxScp = 0;
+static socketChan **scp;
+static deque<pendingClient> pending;
+static pthread_mutex_t pendingMutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 logbuf ilog(LOG_INFO, STDOUT_FILENO);
@@ -89,6 +120,73 @@ int_handler(int)
     active = false;
 };
 
+ncp *
+findDevice(const char *name)
+{
+    for (size_t i = 0; i < devices.size(); i++)
+	if (devices[i].name == name)
+	    return devices[i].theNCP;
+    return NULL;
+}
+
+void
+listDevices(bufferStore &a)
+{
+    for (size_t i = 0; i < devices.size(); i++)
+	a.addStringT(devices[i].name.c_str());
+}
+
+ncp *
+defaultDevice()
+{
+    for (size_t i = 0; i < devices.size(); i++)
+	if (deviceReady(devices[i].theNCP))
+	    return devices[i].theNCP;
+    return NULL;
+}
+
+/*
+ * Only called from the socket thread, which owns scp.
+ */
+bool
+deviceReady(ncp *n)
+{
+    if (!n->gotLinkChannel())
+	return false;
+    // Clients of n which have not got a channel yet will want one.
+    int connecting = 0;
+    for (int i = 0; i < numScp; i++)
+	if ((scp[i]->getNcpController() == n) && !scp[i]->isConnected() &&
+	    (scp[i]->getNcpChannel() == 0))
+	    connecting++;
+    return n->freeChannels() > connecting;
+}
+
+static void
+reject(ppsocket *next, bool wait)
+{
+    bufferStore a;
+
+    // Give the client time to send its version request.
+    if (wait)
+	next->dataToGet(1, 0);
+    next->getBufferStore(a, false);
+
+    a.init();
+    a.addStringT("No Psion Connected\n");
+    next->sendBufferStore(a);
+    delete next;
+    if (verbose)
+	lout << "rejected" << endl;
+}
+
+/**
+ * New clients are parked until there is room for them, so that many
+ * short sessions queue up rather than fail. A client is only rejected
+ * when the queue is full, or when it has waited for ADMIT_TIMEOUT
+ * seconds. Once admitted, a client waits for a Psion and a free
+ * channel on the device it talks to; see socketChan::selectDevice.
+ */
 void
 checkForNewSocketConnection()
 {
@@ -96,28 +194,44 @@ checkForNewSocketConnection()
     if (accept_iow.watch(5,0) <= 0) {
 	return;
     }
-    ppsocket *next = skt.accept(&peer, &iow);
+    pthread_mutex_lock(&pendingMutex);
+    ppsocket *next = skt.accept(&peer, &park_iow);
+    bool full = (pending.size() >= (size_t)maxScp);
+    if (next && full)
+	next->setWatch(NULL);
+    else if (next) {
+	pendingClient c = { next, time(NULL) };
+	pending.push_back(c);
+    }
+    pthread_mutex_unlock(&pendingMutex);
     if (next != NULL) {
-	next->setWatch(&iow);
 	// New connect
 	if (verbose)
 	    lout << "New socket connection from " << peer << endl;
-	if ((numScp >= theNCP->maxLinks()) || (!theNCP->gotLinkChannel())) {
-	    bufferStore a;
-
-	    // Give the client time to send its version request.
-	    next->dataToGet(1, 0);
-	    next->getBufferStore(a, false);
+	if (full)
+	    reject(next, true);
+    }
+}
 
-	    a.init();
-	    a.addStringT("No Psion Connected\n");
-	    next->sendBufferStore(a);
-	    delete next;
+static void
+admitClients()
+{
+    time_t now = time(NULL);
+    pthread_mutex_lock(&pendingMutex);
+    while (!pending.empty()) {
+	pendingClient c = pending.front();
+	if (numScp < maxScp) {
+	    c.skt->setWatch(&iow);
+	    scp[numScp++] = new socketChan(c.skt);
 	    if (verbose)
-		lout << "rejected" << endl;
-	} else
-	    scp[numScp++] = new socketChan(next, theNCP);
+		lout << "admitted after " << (now - c.since) << "s" << endl;
+	} else if (now - c.since >= ADMIT_TIMEOUT)
+	    reject(c.skt, false);
+	else
+	    break;
+	pending.pop_front();
     }
+    pthread_mutex_unlock(&pendingMutex);
 }
 
 void *
@@ -125,15 +239,13 @@ pollSocketConnections(void *)
 {
     while (active) {
         iow.watch(0, 10000);
+	admitClients();
         for (int i = 0; i < numScp; i++) {
 	    scp[i]->socketPoll();
 	    if (scp[i]->terminate()) {
 	        // Requested channel termination
 	        delete scp[i];
-	        numScp--;
-	        for (int j = i; j < numScp; j++)
-		    scp[j] = scp[j + 1];
-		i--;
+		scp[i--] = scp[--numScp];
 	    }
         }
     }
@@ -163,7 +275,8 @@ help()
 	"                           ph  - physical I/O handshake\n"
 	"                           pd  - physical I/O data dump\n"
 	"                           all - All of the above\n"
-	" -s, --serial=DEV        Use serial device DEV.\n"
+	" -s, --serial=[NAME=]DEV Use serial device DEV, called NAME.\n"
+	"                         May be given once for each Psion.\n"
 	" -b, --baudrate=RATE     Set serial speed to BAUD.\n"
 	);
     cout <<
@@ -229,23 +342,46 @@ parse_destination(const char *arg, const char **host, int *port)
 static void *
 link_thread(void *arg)
 {
+    device *d = (device *)arg;
+
     while (active) {
         // psion
         iow.watch(1, 0);
-        if (theNCP->hasFailed()) {
-            if (autoexit) {
-		active = false;
+        if (d->theNCP->hasFailed()) {
+            if (autoexit)
                 break;
-	    }
             iow.watch(5, 0);
             if (verbose)
-                lout << "ncp: restarting\n";
-            theNCP->reset();
+                lout << "ncp: restarting " << d->name << endl;
+            d->theNCP->reset();
         }
     }
+    // With --autoexit, we are done when all devices are.
+    pthread_mutex_lock(&linksMutex);
+    if (--numLinks == 0)
+	active = false;
+    pthread_mutex_unlock(&linksMutex);
     return NULL;
 }
 
+static void
+addDevice(const char *arg)
+{
+    device d;
+    const char *eq = strchr(arg, '=');
+
+    if (eq) {
+	d.name = string(arg, eq - arg);
+	d.serial = eq + 1;
+    } else {
+	const char *slash = strrchr(arg, '/');
+	d.name = slash ? slash + 1 : arg;
+	d.serial = arg;
+    }
+    d.theNCP = NULL;
+    devices.push_back(d);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -255,7 +391,6 @@ main(int argc, char **argv)
     int sockNum = DPORT;
     int baudRate = DSPEED;
     const char *host = "127.0.0.1";
-    const char *serialDevice = NULL;
     unsigned short nverbose = 0;
 
     struct servent *se = getservbyname("psion", "tcp");
@@ -316,7 +451,7 @@ main(int argc, char **argv)
 		    baudRate = atoi(optarg);
 		break;
 	    case 's':
-		serialDevice = optarg;
+		addDevice(optarg);
 		break;
 	    case 'p':
 		parse_destination(optarg, &host, &sockNum);
@@ -328,8 +463,22 @@ main(int argc, char **argv)
 	return -1;
     }
 
-    if (serialDevice == NULL)
-        serialDevice = DDEV;
+    if (devices.empty())
+	addDevice(DDEV);
+    for (size_t i = 0; i < devices.size(); i++) {
+	string err;
+
+	if (!transport::check(devices[i].serial, err)) {
+	    cerr << "ncpd: " << devices[i].serial << ": " << err << endl;
+	    return -1;
+	}
+	for (size_t j = 0; j < i; j++)
+	    if (devices[i].name == devices[j].name) {
+		cerr << _("ncpd: device name used twice: ") << devices[i].name
+		     << endl;
+		return -1;
+	    }
+    }
 
     if (dofork)
 	pid = fork();
@@ -350,8 +499,10 @@ main(int argc, char **argv)
 		    elog.setOn(true);
 		    ilog.setOn(true);
 		    linf << _("daemon started. Listening at ") << host << ":"
-			 << sockNum << _(" using device ") << serialDevice
-			 << endl;
+			 << sockNum << _(" using device");
+		    for (size_t i = 0; i < devices.size(); i++)
+			linf << " " << devices[i].serial;
+		    linf << endl;
 		    setsid();
 		    ignore_value(chdir("/"));
 		    int devnull =
@@ -364,17 +515,26 @@ main(int argc, char **argv)
 			    close(devnull);
 		    }
 		}
-		memset(scp, 0, sizeof(scp));
-		theNCP = new ncp(serialDevice, baudRate, nverbose);
-		if (!theNCP) {
-		    lerr << "Could not create NCP object" << endl;
-		    exit(-1);
-		}
-		pthread_t thr_a, thr_b;
-		if (pthread_create(&thr_a, NULL, link_thread, NULL) != 0) {
-		    lerr << "Could not create Link thread" << endl;
-		    exit(-1);
+		// Room for MAX_CHANNELS_PSION + 1 clients per device
+		maxScp = (MAX_CHANNELS_PSION + 1) * devices.size();
+		scp = new socketChan *[maxScp];
+		memset(scp, 0, maxScp * sizeof(socketChan *));
+		for (size_t i = 0; i < devices.size(); i++) {
+		    devices[i].theNCP =
+			new ncp(devices[i].serial, baudRate, nverbose);
+		    if (!devices[i].theNCP) {
+			lerr << "Could not create NCP object" << endl;
+			exit(-1);
+		    }
 		}
+		numLinks = devices.size();
+		for (size_t i = 0; i < devices.size(); i++)
+		    if (pthread_create(&devices[i].thread, NULL, link_thread,
+				       &devices[i]) != 0) {
+			lerr << "Could not create Link thread" << endl;
+			exit(-1);
+		    }
+		pthread_t thr_b;
 		if (pthread_create(&thr_b, NULL,
 				   pollSocketConnections, NULL) != 0) {
 		    lerr << "Could not create Socket thread" << endl;
@@ -384,11 +544,14 @@ main(int argc, char **argv)
 		    checkForNewSocketConnection();
 		linf << _("terminating") << endl;
 		void *ret;
-		pthread_join(thr_a, &ret);
-                linf << _("joined Link thread") << endl;
+		for (size_t i = 0; i < devices.size(); i++)
+		    pthread_join(devices[i].thread, &ret);
+                linf << _("joined Link threads") << endl;
 		pthread_join(thr_b, &ret);
                 linf << _("joined Socket thread") << endl;
-		delete theNCP;
+		for (size_t i = 0; i < devices.size(); i++)
+		    delete devices[i].theNCP;
+		delete [] scp;
                 linf << _("shut down NCP") << endl;
 	    }
 	    skt.closeSocket();
@@ -27,4 +27,32 @@ extern std::ostream lout;
 extern std::ostream lerr;
 extern std::ostream linf;
 
+class ncp;
+class bufferStore;
+
+/* How long a new client may wait for a Psion or a free channel, in seconds */
+#define ADMIT_TIMEOUT 30
+
+/**
+ * The NCP stack of the device called name, or NULL.
+ */
+extern ncp *findDevice(const char *name);
+
+/**
+ * The device clients talk to unless they select another one: the first
+ * one which is ready, or NULL.
+ */
+extern ncp *defaultDevice();
+
+/**
+ * Whether the device has a Psion connected, and a channel to spare
+ * for one more client.
+ */
+extern bool deviceReady(ncp *n);
+
+/**
+ * Append the names of all devices to a, each 0-terminated.
+ */
+extern void listDevices(bufferStore &a);
+
 #endif
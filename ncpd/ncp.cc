@@ -23,6 +23,7 @@
 #include <iostream>
 #include <string>
 
+#include <strings.h>
 #include <time.h>
 
 #include <bufferstore.h>
@@ -34,8 +35,6 @@
 #include "link.h"
 #include "main.h"
 
-#define MAX_CHANNELS_PSION 256
-#define MAX_CHANNELS_SIBO  8
 #define NCP_SENDLEN 250
 
 using namespace std;
@@ -58,8 +57,10 @@ ncp::ncp(const char *fname, int baud, unsigned short _verbose)
     lChan = NULL;
 
     // init channels
+    pthread_mutex_init(&chanMutex, NULL);
     for (int i = 0; i < MAX_CHANNELS_PSION; i++)
 	channelPtr[i] = NULL;
+    clearChannels();
 
     l = new Link(fname, baud, this, verbose);
     assert(l);
@@ -76,11 +77,13 @@ ncp::~ncp()
 	}
 	channelPtr[i] = NULL;
     }
+    clearChannels();
     controlChannel(0, NCON_MSG_NCP_END, b);
     delete l;
     delete [] channelPtr;
     delete [] remoteChanList;
     delete [] messageList;
+    pthread_mutex_destroy(&chanMutex);
 }
 
 int ncp::
@@ -88,6 +91,15 @@ maxLinks() {
     return maxChannels;
 }
 
+int ncp::
+freeChannels() {
+    // Channel 0 is the control channel.
+    pthread_mutex_lock(&chanMutex);
+    int n = maxLinks() - 1 - usedChans;
+    pthread_mutex_unlock(&chanMutex);
+    return (n > 0) ? n : 0;
+}
+
 void ncp::
 reset() {
     for (int i = 0; i < maxLinks(); i++) {
@@ -95,6 +107,7 @@ reset() {
 	    channelPtr[i]->terminateWhenAsked();
 	channelPtr[i] = NULL;
     }
+    clearChannels();
     failed = false;
     if (lChan)
 	delete(lChan);
@@ -250,8 +263,7 @@ decodeControlMessage(bufferStore & buff)
 		    localChan = getFirstUnusedChan();
 		    ok = s->clientConnect(localChan, remoteChan);
 		    if (!ok)
-			// release channel ptr
-			channelPtr[localChan] = NULL;
+			releaseChan(localChan);
 		}
 		b.addByte(remoteChan);
 		if (ok) {
@@ -364,24 +376,71 @@ decodeControlMessage(bufferStore & buff)
     }
 }
 
+/**
+ * Takes the lowest free channel off the free map. It is reserved
+ * until released, even before a channel object is put there.
+ */
 int ncp::
 getFirstUnusedChan()
 {
-    for (int cNum = 1; cNum < maxLinks(); cNum++) {
-	if (channelPtr[cNum] == NULL) {
-	    if (verbose & NCP_DEBUG_LOG)
-		lout << "ncp: getFirstUnusedChan=" << cNum << endl;
-	    channelPtr[cNum] = (channel *)0xdeadbeef;
-	    return cNum;
+    int cNum = 0;
+
+    pthread_mutex_lock(&chanMutex);
+    for (int w = 0; w * 32 < maxLinks(); w++) {
+	uint32_t bits = freeChans[w];
+	if (maxLinks() - w * 32 < 32)
+	    bits &= (1U << (maxLinks() - w * 32)) - 1;
+	if (bits) {
+	    cNum = w * 32 + ffs(bits) - 1;
+	    freeChans[w] &= ~(1U << (cNum % 32));
+	    usedChans++;
+	    break;
 	}
     }
-    return 0;
+    pthread_mutex_unlock(&chanMutex);
+    if (cNum && (verbose & NCP_DEBUG_LOG))
+	lout << "ncp: getFirstUnusedChan=" << cNum << endl;
+    return cNum;
+}
+
+void ncp::
+releaseChan(int chan)
+{
+    pthread_mutex_lock(&chanMutex);
+    freeChan(chan);
+    pthread_mutex_unlock(&chanMutex);
+}
+
+/**
+ * Puts a channel back on the free map. The caller holds chanMutex.
+ */
+void ncp::
+freeChan(int chan)
+{
+    if ((chan <= 0) || (chan >= MAX_CHANNELS_PSION))
+	return;
+    channelPtr[chan] = NULL;
+    if (!(freeChans[chan / 32] & (1U << (chan % 32)))) {
+	freeChans[chan / 32] |= 1U << (chan % 32);
+	usedChans--;
+    }
+}
+
+void ncp::
+clearChannels()
+{
+    pthread_mutex_lock(&chanMutex);
+    for (int w = 0; w < MAX_CHANNELS_PSION / 32; w++)
+	freeChans[w] = ~0U;
+    freeChans[0] &= ~1U; // the control channel
+    usedChans = 0;
+    pthread_mutex_unlock(&chanMutex);
 }
 
 bool ncp::
 isValidChannel(int channel)
 {
-    return (channelPtr[channel] && ((long)channelPtr[channel] != 0xdeadbeef));
+    return (channelPtr[channel] != NULL);
 }
 
 void ncp::
@@ -389,9 +448,9 @@ RegisterAck(int chan, const char *name)
 {
     if (verbose & NCP_DEBUG_LOG)
 	lout << "ncp: RegisterAck: chan=" << chan << endl;
-    for (int cNum = 1; cNum < maxLinks(); cNum++) {
-	channel *ch = channelPtr[cNum];
-	if (isValidChannel(cNum) && ch->getNcpChannel() == chan) {
+    if ((chan > 0) && (chan < maxLinks()) && isValidChannel(chan)) {
+	channel *ch = channelPtr[chan];
+	if (ch->getNcpChannel() == chan) {
 	    ch->setNcpConnectName(name);
 	    ch->ncpRegisterAck();
 	    return;
@@ -479,12 +538,29 @@ disconnect(int channel)
     channelPtr[channel]->terminateWhenAsked();
     if (verbose & NCP_DEBUG_LOG)
 	lout << "ncp: disconnect: channel=" << channel << endl;
-    channelPtr[channel] = NULL;
+    releaseChan(channel);
     bufferStore b;
     b.addByte(remoteChanList[channel]);
     controlChannel(channel, NCON_MSG_CHANNEL_DISCONNECT, b);
 }
 
+/**
+ * Called when a channel object goes away, to free the channel it
+ * still holds, such as one that was registered but never connected.
+ */
+void ncp::
+release(channel *ch)
+{
+    int chan = ch->getNcpChannel();
+
+    // Checked and freed in one go, as the link thread may hand the
+    // channel to someone else as soon as it is free.
+    pthread_mutex_lock(&chanMutex);
+    if ((chan > 0) && (chan < MAX_CHANNELS_PSION) && (channelPtr[chan] == ch))
+	freeChan(chan);
+    pthread_mutex_unlock(&chanMutex);
+}
+
 bool ncp::
 stuffToSend()
 {
@@ -502,7 +578,7 @@ hasFailed()
     failed |= lfailed;
     if (failed) {
 	if (lChan) {
-	    channelPtr[lChan->getNcpChannel()] = NULL;
+	    releaseChan(lChan->getNcpChannel());
 	    delete lChan;
 	}
 	lChan = NULL;
@@ -25,6 +25,9 @@
 
 #include <vector>
 
+#include <stdint.h>
+#include <pthread.h>
+
 #include "bufferstore.h"
 #include "linkchan.h"
 #include "ppsocket.h"
@@ -35,6 +38,9 @@ class channel;
 #define NCP_DEBUG_LOG  1
 #define NCP_DEBUG_DUMP 2
 
+#define MAX_CHANNELS_PSION 256
+#define MAX_CHANNELS_SIBO  8
+
 /**
  * Representation of a server process on the PC
  * A dummy which does not allow connects for now.
@@ -59,9 +65,11 @@ public:
     void Register(channel *c);
     void RegisterAck(int, const char *);
     void disconnect(int channel);
+    void release(channel *ch);
     void send(int channel, bufferStore &a);
     void reset();
     int  maxLinks();
+    int  freeChannels();
     bool stuffToSend();
     bool hasFailed();
     bool gotLinkChannel();
@@ -93,6 +101,9 @@ private:
     enum protocolVersionType { PV_SERIES_5 = 6, PV_SERIES_3 = 3 };
     void receive(bufferStore s);
     int getFirstUnusedChan();
+    void releaseChan(int);
+    void freeChan(int);
+    void clearChannels();
     bool isValidChannel(int);
     void decodeControlMessage(bufferStore &buff);
     void controlChannel(int chan, enum interControllerMessageType t, bufferStore &command);
@@ -101,6 +112,11 @@ private:
     Link *l;
     unsigned short verbose;
     channel **channelPtr;
+    // The link thread and the socket thread both take and free
+    // channels, so freeChans and usedChans are guarded by chanMutex.
+    pthread_mutex_t chanMutex;
+    uint32_t freeChans[MAX_CHANNELS_PSION / 32]; // bit set: channel is free
+    int usedChans;
     bufferStore *messageList;
     int *remoteChanList;
     bool failed;
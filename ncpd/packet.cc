@@ -32,11 +32,12 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <signal.h>
 
-#include "mp_serial.h"
 #include "packet.h"
+#include "transport.h"
 #include "link.h"
 #include "main.h"
 
@@ -50,6 +51,9 @@
 #define inc1(idx) inca(idx, 1)
 #define normalize(idx) do { idx &= BUFMASK; } while (0)
 
+/* How long the pump waits before retrying an idle connection, in usec */
+#define PUMP_TIMEOUT 100000
+
 static unsigned short pumpverbose = 0;
 
 extern "C" {
@@ -69,68 +73,41 @@ static void *pump_run(void *arg)
     packet *p = (packet *)arg;
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
     while (1) {
-	if (p->fd != -1) {
-	    fd_set r_set;
-	    fd_set w_set;
-	    int res;
-	    int count;
-
-	    FD_ZERO(&r_set);
-	    w_set = r_set;
-	    if (hasSpace(p->in))
-		FD_SET(p->fd, &r_set);
-	    if (hasData(p->out))
-		FD_SET(p->fd, &w_set);
-	    res = select(p->fd+1, &r_set, &w_set, NULL, NULL);
-	    switch (res) {
-		case 0:
-		    break;
-		case -1:
-		    break;
-		default:
-		    if (FD_ISSET(p->fd, &w_set)) {
-			count = p->outWrite - p->outRead;
-			if (count < 0)
-			    count = (BUFLEN - p->outRead);
-			res = write(p->fd, &p->outBuffer[p->outRead], count);
-			if (res > 0) {
-			    if (pumpverbose & PKT_DEBUG_DUMP) {
-				int i;
-				printf("pump: wrote %d bytes: (", res);
-				for (i = 0; i<res; i++)
-				    printf("%02x ",
-					   p->outBuffer[p->outRead + i]);
-				printf(")\n");
-			    }
-			    int hadSpace = hasSpace(p->out);
-			    inca(p->outRead, res);
-			    if (!hadSpace)
-				    pthread_kill(p->thisThread, SIGUSR1);
-			}
-		    }
-		    if (FD_ISSET(p->fd, &r_set)) {
-			count = p->inRead - p->inWrite;
-			if (count <= 0)
-			    count = (BUFLEN - p->inWrite);
-			res = read(p->fd, &p->inBuffer[p->inWrite], count);
-			if (res > 0) {
-			    if (pumpverbose & PKT_DEBUG_DUMP) {
-				int i;
-				printf("pump: read %d bytes: (", res);
-				for (i = 0; i<res; i++)
-				    printf("%02x ", p->inBuffer[p->inWrite + i]);
-				printf(")\n");
-			    }
-			    inca(p->inWrite, res);
-			    p->findSync();
-			}
-		    } else {
-			if (hasData(p->in))
-			    p->findSync();
-		    }
-		    break;
+	fd_set r_set;
+	fd_set w_set;
+	struct timeval tv = { 0, PUMP_TIMEOUT };
+	int fd = p->fd;
+
+	// While the transport is closed, or after a fatal error, nothing
+	// is read or written until the link is reset. While there is no
+	// peer, reading is retried when the timeout expires.
+	if ((fd == -1) || p->lastFatal) {
+	    if (hasData(p->out)) {
+		// Nobody to send to; don't keep a writer waiting.
+		int hadSpace = hasSpace(p->out);
+		p->outRead = p->outWrite;
+		if (!hadSpace)
+		    pthread_kill(p->thisThread, SIGUSR1);
 	    }
+	    select(0, NULL, NULL, NULL, &tv);
+	    if (hasData(p->in))
+		p->findSync();
+	    continue;
 	}
+	FD_ZERO(&r_set);
+	w_set = r_set;
+	if (hasSpace(p->in) && !p->idle)
+	    FD_SET(fd, &r_set);
+	if (hasData(p->out))
+	    FD_SET(fd, &w_set);
+	if (select(fd + 1, &r_set, &w_set, NULL, p->idle ? &tv : NULL) < 0)
+	    continue;
+	if (FD_ISSET(fd, &w_set))
+	    p->pumpWrite();
+	if (FD_ISSET(fd, &r_set) || p->idle)
+	    p->pumpRead();
+	if (hasData(p->in))
+	    p->findSync();
     }
 }
 
@@ -151,8 +128,7 @@ packet::
 packet(const char *fname, int _baud, Link *_link, unsigned short _verbose)
 {
     verbose = pumpverbose = _verbose;
-    devname = strdup(fname);
-    assert(devname);
+    tp = transport::create(fname);
     baud = _baud;
     theLINK = _link;
     isEPOC = false;
@@ -175,6 +151,7 @@ packet(const char *fname, int _baud, Link *_link, unsigned short _verbose)
 
     esc = false;
     lastFatal = false;
+    idle = false;
     serialStatus = -1;
     lastSYN = startPkt = -1;
     crcIn = crcOut = 0;
@@ -182,45 +159,40 @@ packet(const char *fname, int _baud, Link *_link, unsigned short _verbose)
     thisThread = pthread_self();
     realBaud = baud;
     if (baud < 0) {
-	baud_index = 1;
+	baud_index = tp->isSerial() ? 1 : 0;
 	realBaud = baud_table[0];
     }
-    fd = init_serial(devname, realBaud, 0);
+    signal(SIGUSR1, usr1handler);
+    fd = tp->open(realBaud);
     if (fd == -1)
 	lastFatal = true;
-    else {
-	signal(SIGUSR1, usr1handler);
-	pthread_create(&datapump, NULL, pump_run, this);
-    }
+    // Started even without a connection, which a reset may bring.
+    pthread_create(&datapump, NULL, pump_run, this);
 }
 
 packet::
 ~packet()
 {
-    if (fd != -1) {
-	pthread_cancel(datapump);
-	pthread_join(datapump, NULL);
-	ser_exit(fd);
-    }
+    pthread_cancel(datapump);
+    pthread_join(datapump, NULL);
+    if (fd != -1)
+	tp->close(fd);
     fd = -1;
     delete []inBuffer;
     delete []outBuffer;
-    free(devname);
+    delete tp;
 }
 
 void packet::
 reset()
 {
-    if (fd != -1) {
-	pthread_cancel(datapump);
-	pthread_join(datapump, NULL);
-    }
+    pthread_cancel(datapump);
+    pthread_join(datapump, NULL);
     outRead = outWrite = 0;
     internalReset();
-    if (fd != -1) {
-	pthread_create(&datapump, NULL, pump_run, this);
+    pthread_create(&datapump, NULL, pump_run, this);
+    if (fd != -1)
 	realWrite();
-    }
 }
 
 void packet::
@@ -228,31 +200,35 @@ internalReset()
 {
     if (verbose & PKT_DEBUG_LOG)
 	lout << "resetting serial connection" << endl;
+    // Down until the transport has been reopened.
+    lastFatal = true;
     if (fd != -1) {
-	ser_exit(fd);
+	tp->close(fd);
 	fd = -1;
     }
     usleep(100000);
     inRead = inWrite = 0;
     esc = false;
-    lastFatal = false;
+    idle = false;
     serialStatus = -1;
     lastSYN = startPkt = -1;
     crcIn = crcOut = 0;
     realBaud = baud;
     justStarted = true;
     if (baud < 0) {
-	realBaud = baud_table[baud_index++];
-	if (baud_index >= BAUD_TABLE_SIZE)
+	realBaud = baud_table[baud_index];
+	// Only a serial line has a speed to guess.
+	if (tp->isSerial() && (++baud_index >= BAUD_TABLE_SIZE))
 	    baud_index = 0;
     }
 
-    fd = init_serial(devname, realBaud, 0);
-    if (verbose & PKT_DEBUG_LOG)
+    fd = tp->open(realBaud);
+    if ((verbose & PKT_DEBUG_LOG) && tp->isSerial())
 	lout << "serial connection set to " << dec << realBaud
 	     << " baud, fd=" << fd << endl;
-    if (fd != -1)
-	lastFatal = false;
+    else if (verbose & PKT_DEBUG_LOG)
+	lout << "connection reopened, fd=" << fd << endl;
+    lastFatal = (fd == -1);
 }
 
 short int packet::
@@ -345,6 +321,11 @@ opCByte(unsigned char a, unsigned short *crc)
 void packet::
 realWrite()
 {
+    if (fd == -1) {
+	// Not connected; there is no pump to send this.
+	outRead = outWrite;
+	return;
+    }
     pthread_kill(datapump, SIGUSR1);
     while (!hasSpace(out)) {
 	sigset_t sigs;
@@ -355,6 +336,114 @@ realWrite()
     }
 }
 
+/**
+ * Writes as much of the output buffer as the transport takes,
+ * both parts of it at once if it wraps.
+ */
+void packet::
+pumpWrite()
+{
+    while (hasData(out)) {
+	int rd = outRead;
+	int wr = outWrite;
+	struct iovec iov[2];
+	int iovcnt = 1;
+
+	iov[0].iov_base = &outBuffer[rd];
+	if (wr > rd)
+	    iov[0].iov_len = wr - rd;
+	else {
+	    iov[0].iov_len = BUFLEN - rd;
+	    iov[1].iov_base = outBuffer;
+	    iov[1].iov_len = wr;
+	    iovcnt = (wr > 0) ? 2 : 1;
+	}
+	ssize_t res = writev(fd, iov, iovcnt);
+	if (res < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+		transportError(errno);
+	    return;
+	}
+	if (pumpverbose & PKT_DEBUG_DUMP) {
+	    printf("pump: wrote %d bytes: (", (int)res);
+	    for (int i = 0; i < res; i++)
+		printf("%02x ", outBuffer[(rd + i) & BUFMASK]);
+	    printf(")\n");
+	}
+	int hadSpace = hasSpace(out);
+	inca(outRead, res);
+	if (!hadSpace)
+	    pthread_kill(thisThread, SIGUSR1);
+	if (res < (ssize_t)(iov[0].iov_len + ((iovcnt > 1) ? iov[1].iov_len : 0)))
+	    return;
+    }
+}
+
+/**
+ * Reads whatever the transport has into the free part of the
+ * input buffer, leaving one byte free to tell full from empty.
+ */
+void packet::
+pumpRead()
+{
+    while (hasSpace(in)) {
+	int rd = inRead;
+	int wr = inWrite;
+	struct iovec iov[2];
+	int iovcnt = 1;
+
+	iov[0].iov_base = &inBuffer[wr];
+	if (rd > wr)
+	    iov[0].iov_len = rd - wr - 1;
+	else if (rd == 0)
+	    iov[0].iov_len = BUFLEN - wr - 1;
+	else {
+	    iov[0].iov_len = BUFLEN - wr;
+	    iov[1].iov_base = inBuffer;
+	    iov[1].iov_len = rd - 1;
+	    iovcnt = (rd > 1) ? 2 : 1;
+	}
+	ssize_t res = readv(fd, iov, iovcnt);
+	if (res == 0) {
+	    transportError(0);
+	    return;
+	}
+	if (res < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+		transportError(errno);
+	    else
+		idle = false;
+	    return;
+	}
+	idle = false;
+	if (pumpverbose & PKT_DEBUG_DUMP) {
+	    printf("pump: read %d bytes: (", (int)res);
+	    for (int i = 0; i < res; i++)
+		printf("%02x ", inBuffer[(wr + i) & BUFMASK]);
+	    printf(")\n");
+	}
+	inca(inWrite, res);
+	if (res < (ssize_t)(iov[0].iov_len + ((iovcnt > 1) ? iov[1].iov_len : 0)))
+	    return;
+    }
+}
+
+void packet::
+transportError(int err)
+{
+    if (tp->isFatal(err)) {
+	if ((verbose & PKT_DEBUG_LOG) && !lastFatal)
+	    lout << "packet: " << (err ? strerror(err) : "connection closed")
+		 << endl;
+	lastFatal = true;
+    } else
+	idle = true;
+}
+
 void packet::
 findSync()
 {
@@ -456,7 +545,7 @@ findSync()
 	// 15 bytes, the baudrate is obviously wrong.
 	// (or the connected device is not an EPOC device). Reset the
 	// serial connection and try next baudrate, if auto-baud is set.
-	if (justStarted) {
+	if (justStarted && tp->isSerial()) {
 	    int rx_amount = (inw > inRead) ?
 		inw - inRead : BUFLEN - inRead + inw;
 	    if (rx_amount > 15)
@@ -473,7 +562,15 @@ linkFailed()
     bool failed = false;
 
     if (fd == -1)
-	return false;
+	return tp->isSerial() ? false : lastFatal;
+    if (!tp->isSerial()) {
+	// Without modem control lines, a missing peer counts as a failure.
+	if ((verbose & PKT_DEBUG_LOG) && lastFatal)
+	    lout << "packet: linkFATAL\n";
+	if ((verbose & PKT_DEBUG_LOG) && idle)
+	    lout << "packet: linkFAILED\n";
+	return (lastFatal || idle);
+    }
     res = ioctl(fd, TIOCMGET, &arg);
     if (res < 0)
 	lastFatal = true;
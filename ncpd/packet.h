@@ -37,6 +37,7 @@ extern "C" {
 }
 
 class Link;
+class transport;
 
 class packet
 {
@@ -68,6 +69,9 @@ private:
     void opCByte(unsigned char a, unsigned short *crc);
     void realWrite();
     void internalReset();
+    void pumpRead();
+    void pumpWrite();
+    void transportError(int err);
 
     Link *theLINK;
     pthread_t datapump;
@@ -100,10 +104,11 @@ private:
     short int verbose;
     bool esc;
     bool lastFatal;
+    bool idle;
     bool isEPOC;
     bool justStarted;
 
-    char *devname;
+    transport *tp;
     int baud;
 };
 
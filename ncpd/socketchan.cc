@@ -34,13 +34,14 @@
 
 using namespace std;
 
-socketChan:: socketChan(ppsocket * _skt, ncp * _ncpController):
-    channel(_ncpController)
+socketChan:: socketChan(ppsocket * _skt):
+    channel(NULL)
 {
     skt = _skt;
     registerName = 0;
     connectTry = 0;
     connected = false;
+    since = 0;
 }
 
 socketChan::~socketChan()
@@ -118,6 +119,28 @@ ncpCommand(bufferStore & a)
 	a.addDWord(ncpGetSpeed());
 	skt->sendBufferStore(a);
 	ok = true;
+    } else if (!strncmp(str, "SDEV", 4)) {
+	// Select the device to talk to, before connecting to any
+	// process on it. selectDevice has switched to it if it could.
+	ncp *n = findDevice(a.getString(8));
+	a.init();
+	if (registerName)
+	    a.addByte(rfsv::E_PSI_GEN_INUSE);
+	else if (!n)
+	    a.addByte(rfsv::E_PSI_FILE_NXIST);
+	else if (n != getNcpController())
+	    a.addByte(rfsv::E_PSI_FILE_NOTREADY);
+	else
+	    a.addByte(rfsv::E_PSI_GEN_NONE);
+	skt->sendBufferStore(a);
+	ok = true;
+    } else if (!strncmp(str, "LDEV", 4)) {
+	// List the names of the devices
+	a.init();
+	a.addByte(rfsv::E_PSI_GEN_NONE);
+	listDevices(a);
+	skt->sendBufferStore(a);
+	ok = true;
     } else if (!strncmp(str, "REGS", 4)) {
 	// Register a server-process on the PC side.
 	a.init();
@@ -179,6 +202,45 @@ ncpConnectNak()
     }
 }
 
+/**
+ * A client is bound to a device by its first request which needs one:
+ * NCP$SDEV picks the device by name, anything else but NCP$LDEV gets
+ * the default one. That way, only the clients of a device wait for it.
+ * While the device has no Psion connected or no channel to spare, the
+ * request is held and tried again, for up to ADMIT_TIMEOUT seconds.
+ *
+ * @returns true if the request can be handled now.
+ */
+bool socketChan::
+selectDevice(bufferStore &a)
+{
+    const char *str = a.getString();
+    bool sdev = !strncmp(str, "NCP$SDEV", 8);
+    ncp *n;
+
+    held.init();
+    if (!sdev && (getNcpController() || !strncmp(str, "NCP$LDEV", 8)))
+	return true;
+    n = sdev ? findDevice(str + 8) : defaultDevice();
+    if (sdev && (!n || (n == getNcpController())))
+	return true;
+    if (n && deviceReady(n)) {
+	newNcpController(n);
+	return true;
+    }
+    if (time(0) - since < ADMIT_TIMEOUT) {
+	held = a;
+	return false;
+    }
+    if (sdev)
+	return true;
+    a.init();
+    a.addStringT("No Psion Connected\n");
+    skt->sendBufferStore(a);
+    terminateWhenAsked();
+    return false;
+}
+
 void socketChan::
 socketPoll()
 {
@@ -186,7 +248,11 @@ socketPoll()
 
     if (registerName == 0) {
 	bufferStore a;
-	res = skt->getBufferStore(a, false);
+	if (held.getLen()) {
+	    a = held;
+	    res = 1;
+	} else if ((res = skt->getBufferStore(a, false)) == 1)
+	    since = time(0);
 	switch (res) {
 	    case 1:
 		// A client has connected, and is announcing who it
@@ -214,6 +280,9 @@ socketPoll()
 			return;
 		}
 
+		if (!selectDevice(a))
+		    return;
+
 		// There is a magic process name called "NCP$INFO.*"
 		// which is announced by the rfsvfactory. This causes a
 		// response to be issued containing the NCP version
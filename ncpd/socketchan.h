@@ -22,12 +22,14 @@
 #define _socketchan_h_
 
 #include "config.h"
+#include <time.h>
+#include "bufferstore.h"
 #include "channel.h"
 class ppsocket;
 
 class socketChan : public channel {
 public:
-  socketChan(ppsocket* comms, ncp* ncpController);
+  socketChan(ppsocket* comms);
   virtual ~socketChan();
 
   void ncpDataCallback(bufferStore& a);
@@ -43,7 +45,10 @@ public:
 private:
   enum protocolVersionType { PV_SERIES_5 = 6, PV_SERIES_3 = 3 };
   bool ncpCommand(bufferStore &a);
+  bool selectDevice(bufferStore &a);
   ppsocket* skt;
+  bufferStore held;
+  time_t since;
   char* registerName;
   bool connected;
   int connectTry;
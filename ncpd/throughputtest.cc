@@ -0,0 +1,537 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Throughput check of one ncpd serving several Psions at once.
+ *
+ * Usage: throughputtest [DEVICES [CLIENTS [ROUNDS]]]
+ *
+ * Each emulated Psion listens on a local port, which ncpd reaches over
+ * its tcp: transport, and echoes whatever is sent to its SYS$RFSV.
+ * ncpd (./ncpd, or $NCPD) is started with all of them. Every device
+ * gets CLIENTS clients at once, which select it with NCP$SDEV and send
+ * ROUNDS buffers each. The check fails if a buffer comes back changed,
+ * or if a device gets another amount of data than its clients sent.
+ * The time taken and the data rate are printed.
+ */
+#include "config.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <bufferstore.h>
+#include <ppsocket.h>
+#include <rfsv.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "ignore-value.h"
+
+using namespace std;
+
+/* The whole check must be done by then, in seconds */
+#define TEST_TIMEOUT 120
+
+/* The size of the buffers the clients send */
+#define BUFSIZE 2000
+
+#define SYN 0x16
+#define DLE 0x10
+#define STX 0x02
+#define ETX 0x03
+#define EOT 0x04
+
+static pid_t ncpd = 0;
+
+static void
+fail(const string &what)
+{
+    cerr << "throughputtest: FAIL: " << what << endl;
+    if (ncpd > 0)
+	kill(ncpd, SIGKILL);
+    exit(1);
+}
+
+static void
+timeout(int)
+{
+    if (ncpd > 0)
+	kill(ncpd, SIGKILL);
+    static const char msg[] = "throughputtest: FAIL: timed out\n";
+    ignore_value(write(STDERR_FILENO, msg, sizeof(msg) - 1));
+    _exit(1);
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+listenOn(int port)
+{
+    struct sockaddr_in sa;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = htons(port);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) ||
+	(listen(fd, 1) == -1))
+	fail(string("listen: ") + strerror(errno));
+    return fd;
+}
+
+static int
+portOf(int fd)
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+
+    getsockname(fd, (struct sockaddr *)&sa, &len);
+    return ntohs(sa.sin_port);
+}
+
+static unsigned short
+crc16(const unsigned char *p, size_t len)
+{
+    unsigned short crc = 0;
+
+    while (len--) {
+	crc ^= *p++ << 8;
+	for (int i = 0; i < 8; i++)
+	    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/*
+ * Just enough of an EPOC machine for ncpd: it confirms the link,
+ * announces itself, accepts every connection to a server and echoes
+ * the data of those to SYS$RFSV.
+ */
+struct fakePsion {
+    string name;
+    int lfd;
+    int port;
+    int fd;
+    int tx;
+    int rx;
+    bool echo[256];
+    unsigned long received;
+    volatile bool stop;
+    pthread_t thread;
+};
+
+static void
+sendFrame(fakePsion *f, const vector<unsigned char> &p)
+{
+    vector<unsigned char> out;
+    unsigned short crc = crc16(p.data(), p.size());
+
+    out.push_back(SYN);
+    out.push_back(DLE);
+    out.push_back(STX);
+    for (size_t i = 0; i < p.size(); i++)
+	if (p[i] == DLE) {
+	    out.push_back(DLE);
+	    out.push_back(DLE);
+	} else if (p[i] == ETX) {
+	    out.push_back(DLE);
+	    out.push_back(EOT);
+	} else
+	    out.push_back(p[i]);
+    out.push_back(DLE);
+    out.push_back(ETX);
+    out.push_back(crc >> 8);
+    out.push_back(crc & 0xff);
+    if (write(f->fd, out.data(), out.size()) != (ssize_t)out.size())
+	fail(f->name + ": write to ncpd failed");
+}
+
+static void
+addSeq(vector<unsigned char> &p, int type, int seq)
+{
+    if (seq > 7) {
+	p.push_back(type | (seq & 7) | 8);
+	p.push_back(seq >> 3);
+    } else
+	p.push_back(type | seq);
+}
+
+static void
+sendData(fakePsion *f, const unsigned char *ncp, size_t len)
+{
+    vector<unsigned char> p;
+
+    addSeq(p, 0x30, f->tx);
+    f->tx = (f->tx + 1) & 0x7ff;
+    p.insert(p.end(), ncp, ncp + len);
+    sendFrame(f, p);
+}
+
+static void
+sendControl(fakePsion *f, int src, int type, const unsigned char *body,
+	    size_t len)
+{
+    vector<unsigned char> p;
+
+    p.push_back(0);
+    p.push_back(src);
+    p.push_back(type);
+    p.insert(p.end(), body, body + len);
+    sendData(f, p.data(), p.size());
+}
+
+static void
+handleNcp(fakePsion *f, const unsigned char *b, size_t len)
+{
+    if (len < 3)
+	return;
+    if (b[0] == 0) {
+	int src = b[1];
+	if (b[2] == 3) {
+	    // Connect to a server
+	    unsigned char reply[2] = { (unsigned char)src, 0 };
+	    f->echo[src] = (len >= 11) && !memcmp(b + 3, "SYS$RFSV", 8);
+	    sendControl(f, src, 4, reply, 2);
+	} else if (b[2] == 7)
+	    f->echo[src] = false;
+	return;
+    }
+    // Data: our channel, ncpd's channel, last fragment flag.
+    if (!f->echo[b[1]])
+	return;
+    vector<unsigned char> out(b, b + len);
+    out[0] = b[1];
+    out[1] = b[0];
+    f->received += len - 3;
+    sendData(f, out.data(), out.size());
+}
+
+static void
+handlePacket(fakePsion *f, const vector<unsigned char> &p)
+{
+    int type = p[0] & 0xf0;
+    int seq = p[0] & 0x0f;
+    size_t hdr = 1;
+
+    if (seq & 8) {
+	seq = (p[1] << 3) + (seq & 7);
+	hdr = 2;
+    }
+    if (type == 0x20) {
+	// Link request: confirm it, then say hello, and connect to
+	// ncpd's LINK server.
+	static const unsigned char con[] = { 0x24, 1, 2, 3, 4 };
+	static const unsigned char info[] = { 6, 0, 0, 0, 0 };
+	static const char link[] = "LINK.*";
+	sendFrame(f, vector<unsigned char>(con, con + sizeof(con)));
+	usleep(50000);
+	sendControl(f, 0, 6, info, sizeof(info));
+	sendControl(f, 1, 3, (const unsigned char *)link, sizeof(link));
+    } else if (type == 0x30) {
+	vector<unsigned char> ack;
+	addSeq(ack, 0x00, seq);
+	sendFrame(f, ack);
+	// Retransmissions are acked again, but not handled twice.
+	if (seq == ((f->rx + 1) & 0x7ff)) {
+	    f->rx = seq;
+	    handleNcp(f, p.data() + hdr, p.size() - hdr);
+	}
+    }
+    // Acks are not checked.
+}
+
+/*
+ * Takes complete frames off the front of buf.
+ */
+static void
+deframe(fakePsion *f, vector<unsigned char> &buf)
+{
+    for (;;) {
+	size_t i = 0;
+	while ((i + 2 < buf.size()) &&
+	       !((buf[i] == SYN) && (buf[i + 1] == DLE) && (buf[i + 2] == STX)))
+	    i++;
+	if (i + 2 >= buf.size())
+	    return;
+	vector<unsigned char> p;
+	size_t j = i + 3;
+	bool done = false;
+	while (j < buf.size()) {
+	    if (buf[j] != DLE) {
+		p.push_back(buf[j++]);
+		continue;
+	    }
+	    if (j + 1 >= buf.size())
+		break;
+	    if (buf[j + 1] == ETX) {
+		if (j + 3 < buf.size()) {
+		    unsigned short crc = (buf[j + 2] << 8) | buf[j + 3];
+		    if (crc != crc16(p.data(), p.size()))
+			fail(f->name + ": bad CRC from ncpd");
+		    done = true;
+		    j += 4;
+		}
+		break;
+	    }
+	    p.push_back((buf[j + 1] == EOT) ? ETX : buf[j + 1]);
+	    j += 2;
+	}
+	if (!done)
+	    return;
+	buf.erase(buf.begin(), buf.begin() + j);
+	if (!p.empty())
+	    handlePacket(f, p);
+    }
+}
+
+static void *
+psion_run(void *arg)
+{
+    fakePsion *f = (fakePsion *)arg;
+    vector<unsigned char> buf;
+
+    while (!f->stop) {
+	struct pollfd pfd;
+	unsigned char rd[4096];
+
+	pfd.fd = (f->fd == -1) ? f->lfd : f->fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 50) <= 0)
+	    continue;
+	if (f->fd == -1) {
+	    f->fd = accept(f->lfd, NULL, NULL);
+	    f->tx = 1;
+	    f->rx = 0;
+	    memset(f->echo, 0, sizeof(f->echo));
+	    buf.clear();
+	    continue;
+	}
+	ssize_t n = read(f->fd, rd, sizeof(rd));
+	if (n <= 0) {
+	    close(f->fd);
+	    f->fd = -1;
+	    continue;
+	}
+	buf.insert(buf.end(), rd, rd + n);
+	deframe(f, buf);
+    }
+    if (f->fd != -1)
+	close(f->fd);
+    close(f->lfd);
+    return NULL;
+}
+
+struct client {
+    int id;
+    int port;
+    const char *device;
+    int rounds;
+    string error;
+    pthread_t thread;
+};
+
+/* ppsocket::connect looks the host up with gethostbyname */
+static pthread_mutex_t connectMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Selects the device and the echoing server, and sends the buffers.
+ *
+ * @returns what went wrong, or an empty string.
+ */
+static string
+talk(client *c, ppsocket *skt)
+{
+    bufferStore a;
+
+    Enum<rfsv::errs> res = rfsv::selectDevice(skt, c->device);
+    if (res != rfsv::E_PSI_GEN_NONE)
+	return string("could not select ") + c->device + ": " +
+	    res.toString();
+    a.addStringT("SYS$RFSV");
+    if (!skt->sendBufferStore(a) || (skt->getBufferStore(a) != 1) ||
+	strcmp(a.getString(0), "Ok"))
+	return "could not connect to SYS$RFSV";
+    for (int r = 0; r < c->rounds; r++) {
+	bufferStore b;
+	// Anything but NCP$, which ncpd would take as a command.
+	b.addByte(0xff);
+	for (int i = 1; i < BUFSIZE; i++)
+	    b.addByte((c->id * 7 + r * 13 + i) & 0xff);
+	if (!skt->sendBufferStore(b) || (skt->getBufferStore(a) != 1))
+	    return "lost connection";
+	if ((a.getLen() != b.getLen()) ||
+	    memcmp(a.getString(0), b.getString(0), b.getLen()))
+	    return "data came back changed";
+    }
+    return "";
+}
+
+static void *
+client_run(void *arg)
+{
+    client *c = (client *)arg;
+    ppsocket *skt;
+
+    // ncpd may not be listening yet. A ppsocket which failed to
+    // connect cannot be used again.
+    for (int i = 0; ; i++) {
+	bool ok;
+	skt = new ppsocket();
+	pthread_mutex_lock(&connectMutex);
+	ok = skt->connect("127.0.0.1", c->port);
+	pthread_mutex_unlock(&connectMutex);
+	if (ok)
+	    break;
+	delete skt;
+	if (i == 100) {
+	    c->error = "could not connect to ncpd";
+	    return NULL;
+	}
+	usleep(50000);
+    }
+    c->error = talk(c, skt);
+    delete skt;
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int numDevices = (argc > 1) ? atoi(argv[1]) : 4;
+    int numClients = (argc > 2) ? atoi(argv[2]) : 4;
+    int rounds = (argc > 3) ? atoi(argv[3]) : 50;
+    const char *prog = getenv("NCPD") ? getenv("NCPD") : "./ncpd";
+
+    if ((numDevices < 1) || (numClients < 1) || (rounds < 1)) {
+	cerr << "Usage: throughputtest [DEVICES [CLIENTS [ROUNDS]]]" << endl;
+	return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGALRM, timeout);
+    alarm(TEST_TIMEOUT);
+
+    vector<fakePsion> psions(numDevices);
+    for (int i = 0; i < numDevices; i++) {
+	fakePsion &f = psions[i];
+	f.name = "psion" + to_string(i);
+	f.lfd = listenOn(0);
+	f.port = portOf(f.lfd);
+	f.fd = -1;
+	f.tx = 1;
+	f.rx = 0;
+	f.received = 0;
+	f.stop = false;
+	memset(f.echo, 0, sizeof(f.echo));
+	pthread_create(&f.thread, NULL, psion_run, &f);
+    }
+
+    // A port for ncpd, which nobody listens on yet.
+    int lfd = listenOn(0);
+    int port = portOf(lfd);
+    close(lfd);
+
+    vector<string> args;
+    args.push_back(prog);
+    args.push_back("-d");
+    args.push_back("-p");
+    args.push_back("127.0.0.1:" + to_string(port));
+    for (int i = 0; i < numDevices; i++) {
+	args.push_back("-s");
+	args.push_back(psions[i].name + "=tcp:127.0.0.1:" +
+		       to_string(psions[i].port));
+    }
+    vector<char *> av;
+    for (size_t i = 0; i < args.size(); i++)
+	av.push_back((char *)args[i].c_str());
+    av.push_back(NULL);
+    ncpd = fork();
+    if (ncpd == 0) {
+	execv(prog, av.data());
+	perror(prog);
+	_exit(1);
+    }
+    if (ncpd == -1)
+	fail("fork failed");
+
+    vector<client> clients(numDevices * numClients);
+    double start = now();
+    for (size_t i = 0; i < clients.size(); i++) {
+	client &c = clients[i];
+	c.id = i;
+	c.port = port;
+	c.device = psions[i % numDevices].name.c_str();
+	c.rounds = rounds;
+	pthread_create(&c.thread, NULL, client_run, &c);
+    }
+    for (size_t i = 0; i < clients.size(); i++)
+	pthread_join(clients[i].thread, NULL);
+    double took = now() - start;
+
+    kill(ncpd, SIGTERM);
+    waitpid(ncpd, NULL, 0);
+    ncpd = 0;
+    for (int i = 0; i < numDevices; i++) {
+	psions[i].stop = true;
+	pthread_join(psions[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < clients.size(); i++)
+	if (!clients[i].error.empty())
+	    fail("client " + to_string(i) + ": " + clients[i].error);
+    unsigned long total = 0;
+    for (int i = 0; i < numDevices; i++) {
+	unsigned long want = (unsigned long)numClients * rounds * BUFSIZE;
+	if (psions[i].received != want)
+	    fail(psions[i].name + " got " + to_string(psions[i].received) +
+		 " bytes, expected " + to_string(want));
+	total += psions[i].received;
+    }
+
+    printf("throughputtest: %d devices, %d clients each, %d rounds of %d "
+	   "bytes\n", numDevices, numClients, rounds, BUFSIZE);
+    printf("throughputtest: %.1f kB echoed in %.2f s, %.1f kB/s, "
+	   "%.1f kB/s per device\n", total / 1024.0, took,
+	   total / 1024.0 / took, total / 1024.0 / took / numDevices);
+    cout << "throughputtest: OK" << endl;
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include <string>
+#include <cstring>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "transport.h"
+#include "mp_serial.h"
+#include "main.h"
+
+/* How long to wait for a TCP connection, in seconds */
+#define CONNECT_TIMEOUT 5
+
+using namespace std;
+
+/**
+ * Splits the HOST:PORT part of tcp:HOST:PORT, where HOST may be an
+ * IPv6 address in brackets.
+ */
+static bool
+splitHostPort(const string &name, string &host, string &port)
+{
+    string addr = name.substr(4);
+    size_t colon = addr.rfind(':');
+
+    // The colon inside an IPv6 address doesn't count.
+    if ((colon == string::npos) || (addr.find(']', colon) != string::npos))
+	return false;
+    host = addr.substr(0, colon);
+    port = addr.substr(colon + 1);
+    if ((host.size() > 1) && (host[0] == '[') && (host[host.size() - 1] == ']'))
+	host = host.substr(1, host.size() - 2);
+    return !host.empty() && !port.empty();
+}
+
+static bool
+setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return (flags != -1) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+/**
+ * A local serial device.
+ */
+class ttyTransport : public transport {
+public:
+    ttyTransport(const char *_name) : transport(_name) { }
+
+    int open(int speed) {
+	int fd = init_serial(name.c_str(), speed, 0);
+	if ((fd != -1) && !setNonBlocking(fd)) {
+	    ser_exit(fd);
+	    fd = -1;
+	}
+	return fd;
+    }
+
+    void close(int fd) {
+	ser_exit(fd);
+    }
+
+    bool isSerial() {
+	return true;
+    }
+
+    bool isFatal(int) {
+	// The modem control lines tell when the Psion is gone.
+	return false;
+    }
+};
+
+/**
+ * A raw TCP connection to a serial server.
+ */
+class tcpTransport : public transport {
+public:
+    tcpTransport(const char *name);
+
+    int open(int speed);
+
+    void close(int fd) {
+	::close(fd);
+    }
+
+private:
+    string host;
+    string port;
+};
+
+tcpTransport::
+tcpTransport(const char *_name) : transport(_name)
+{
+    // Already checked by transport::check()
+    splitHostPort(name, host, port);
+}
+
+int tcpTransport::
+open(int)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1;
+    int err;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res)) != 0) {
+	lerr << name << ": " << gai_strerror(err) << endl;
+	return -1;
+    }
+    err = 0;
+    for (ai = res; ai; ai = ai->ai_next) {
+	if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1)
+	    continue;
+	if (setNonBlocking(fd) &&
+	    ((connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) ||
+	     (errno == EINPROGRESS))) {
+	    fd_set w_set;
+	    struct timeval tv = { CONNECT_TIMEOUT, 0 };
+	    socklen_t len = sizeof(err);
+
+	    FD_ZERO(&w_set);
+	    FD_SET(fd, &w_set);
+	    if (select(fd + 1, NULL, &w_set, NULL, &tv) <= 0)
+		err = ETIMEDOUT;
+	    else if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+		err = errno;
+	    if (err == 0)
+		break;
+	} else
+	    err = errno;
+	::close(fd);
+	fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1) {
+	lerr << name << ": " << strerror(err) << endl;
+	return -1;
+    }
+
+    // PLP frames are small, and each one is waited for.
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    return fd;
+}
+
+/**
+ * A pseudo terminal, for an emulator to connect to. It is kept across
+ * resets, so that the emulator needn't reopen it.
+ */
+class ptyTransport : public transport {
+public:
+    ptyTransport(const char *name);
+    ~ptyTransport();
+
+    int open(int speed);
+
+    void close(int) { }
+
+    bool isFatal(int err) {
+	// The master reads EIO while the slave isn't open.
+	return err != EIO;
+    }
+
+private:
+    string link;
+    int master;
+};
+
+ptyTransport::
+ptyTransport(const char *_name) : transport(_name)
+{
+    if (name.size() > 4)
+	link = name.substr(4);
+    master = -1;
+}
+
+ptyTransport::
+~ptyTransport()
+{
+    if (master != -1) {
+	::close(master);
+	if (!link.empty())
+	    unlink(link.c_str());
+    }
+}
+
+int ptyTransport::
+open(int)
+{
+    struct termios ti;
+    const char *slave;
+
+    if (master != -1)
+	return master;
+    if (((master = posix_openpt(O_RDWR | O_NOCTTY)) == -1) ||
+	(grantpt(master) == -1) || (unlockpt(master) == -1) ||
+	!(slave = ptsname(master)) || !setNonBlocking(master)) {
+	lerr << "pty: " << strerror(errno) << endl;
+	if (master != -1)
+	    ::close(master);
+	return master = -1;
+    }
+    if (tcgetattr(master, &ti) == 0) {
+	cfmakeraw(&ti);
+	tcsetattr(master, TCSANOW, &ti);
+    }
+    if (!link.empty()) {
+	unlink(link.c_str());
+	if (symlink(slave, link.c_str()) == -1)
+	    lerr << "pty: " << link << ": " << strerror(errno) << endl;
+    }
+    linf << "pty: " << slave << endl;
+    return master;
+}
+
+transport::
+transport(const char *_name) : name(_name)
+{
+}
+
+transport::
+~transport()
+{
+}
+
+bool transport::
+isSerial()
+{
+    return false;
+}
+
+bool transport::
+isFatal(int)
+{
+    return true;
+}
+
+bool transport::
+check(const char *name, string &err)
+{
+    string host, port;
+
+    if (!strncmp(name, "tcp:", 4) && !splitHostPort(name, host, port)) {
+	err = "expected tcp:HOST:PORT";
+	return false;
+    }
+    return true;
+}
+
+transport *transport::
+create(const char *name)
+{
+    if (!strncmp(name, "tcp:", 4))
+	return new tcpTransport(name);
+    if (!strcmp(name, "pty") || !strncmp(name, "pty:", 4))
+	return new ptyTransport(name);
+    return new ttyTransport(name);
+}
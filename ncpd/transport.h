@@ -0,0 +1,93 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _transport_h_
+#define _transport_h_
+
+#include "config.h"
+
+#include <string>
+
+/**
+ * The physical connection to a Psion, as used by @ref packet .
+ *
+ * A transport hands out a non-blocking file descriptor, which the
+ * packet pump reads and writes. Which kind of transport is used
+ * depends on the device name:
+ *
+ * - tcp:HOST:PORT connects to a raw TCP port of a serial server,
+ *   such as ser2net.
+ * - pty[:LINK] makes a pseudo terminal for an emulator to open,
+ *   and points the symbolic link LINK to it.
+ * - anything else is a serial device.
+ */
+class transport {
+public:
+    /**
+     * Make the transport for a device name.
+     */
+    static transport *create(const char *name);
+
+    /**
+     * Check a device name before any transport is made for it.
+     *
+     * @param name The device name.
+     * @param err  Set to the reason, if the name is not usable.
+     *
+     * @returns true if the name is usable.
+     */
+    static bool check(const char *name, std::string &err);
+
+    virtual ~transport();
+
+    /**
+     * Open the connection.
+     *
+     * @param speed The speed of a serial line, in baud.
+     *
+     * @returns A non-blocking file descriptor, or -1 on failure.
+     */
+    virtual int open(int speed) = 0;
+
+    /**
+     * Close the connection opened by @ref open .
+     */
+    virtual void close(int fd) = 0;
+
+    /**
+     * Query whether this is a serial line, with a speed and modem
+     * control lines.
+     */
+    virtual bool isSerial();
+
+    /**
+     * Query whether an error while reading or writing means that the
+     * connection is gone, rather than that the peer is not there yet.
+     *
+     * @param err The errno value, or 0 for end of file.
+     */
+    virtual bool isFatal(int err);
+
+protected:
+    transport(const char *name);
+
+    std::string name;
+};
+
+#endif
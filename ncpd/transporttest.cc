@@ -0,0 +1,302 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Loopback check of the tcp: transport and the packet layer above it.
+ *
+ * A local listener stands in for a serial server and echoes whatever
+ * it gets, so every SYN-framed packet sent comes back to the packet
+ * layer, which must deframe it to the same contents. The listener is
+ * also missing when the link starts, and goes away and comes back
+ * while it is up, and the packet layer must survive both.
+ */
+#include "config.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <bufferstore.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "link.h"
+#include "packet.h"
+#include "main.h"
+
+using namespace std;
+
+ostream lout(cout.rdbuf());
+ostream lerr(cerr.rdbuf());
+ostream linf(cout.rdbuf());
+
+/* How long to wait for an echo, in seconds */
+#define ECHO_TIMEOUT 5
+
+static pthread_mutex_t rcvMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rcvCond = PTHREAD_COND_INITIALIZER;
+static vector<bufferStore> received;
+
+/*
+ * The packet layer hands what it deframes to its Link. This one only
+ * collects it; nothing else of Link is used here.
+ */
+ENUM_DEFINITION_BEGIN(Link::link_type, Link::LINK_TYPE_UNKNOWN)
+    stringRep.add(Link::LINK_TYPE_UNKNOWN, "Unknown");
+ENUM_DEFINITION_END(Link::link_type)
+
+Link::
+Link(const char *, int, ncp *, unsigned short)
+{
+}
+
+Link::
+~Link()
+{
+}
+
+void Link::
+receive(bufferStore buf)
+{
+    pthread_mutex_lock(&rcvMutex);
+    received.push_back(buf);
+    pthread_cond_signal(&rcvCond);
+    pthread_mutex_unlock(&rcvMutex);
+}
+
+/*
+ * The stand-in serial server.
+ */
+struct echoServer {
+    int port;
+    int lfd;
+    volatile bool stop;
+    pthread_t thread;
+};
+
+static void *
+echo_run(void *arg)
+{
+    echoServer *s = (echoServer *)arg;
+    int cfd = -1;
+
+    while (!s->stop) {
+	struct pollfd pfd;
+	char buf[1024];
+
+	pfd.fd = (cfd == -1) ? s->lfd : cfd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 50) <= 0)
+	    continue;
+	if (cfd == -1) {
+	    cfd = accept(s->lfd, NULL, NULL);
+	    continue;
+	}
+	ssize_t n = read(cfd, buf, sizeof(buf));
+	if (n <= 0) {
+	    close(cfd);
+	    cfd = -1;
+	    continue;
+	}
+	if (write(cfd, buf, n) != n)
+	    break;
+    }
+    if (cfd != -1)
+	close(cfd);
+    return NULL;
+}
+
+static int
+listenOn(int port)
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = htons(port);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) ||
+	(listen(fd, 1) == -1) ||
+	(getsockname(fd, (struct sockaddr *)&sa, &len) == -1)) {
+	perror("listen");
+	exit(1);
+    }
+    return fd;
+}
+
+static int
+portOf(int fd)
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+
+    getsockname(fd, (struct sockaddr *)&sa, &len);
+    return ntohs(sa.sin_port);
+}
+
+static void
+startServer(echoServer &s)
+{
+    s.lfd = listenOn(s.port);
+    s.stop = false;
+    pthread_create(&s.thread, NULL, echo_run, &s);
+}
+
+/* Takes the listener and any connection away. */
+static void
+stopServer(echoServer &s)
+{
+    s.stop = true;
+    pthread_join(s.thread, NULL);
+    close(s.lfd);
+}
+
+static void
+fail(const char *what)
+{
+    cerr << "transporttest: FAIL: " << what << endl;
+    exit(1);
+}
+
+static bool
+waitFor(bool (*cond)(packet *), packet *p)
+{
+    for (int i = 0; i < ECHO_TIMEOUT * 20; i++) {
+	if (cond(p))
+	    return true;
+	usleep(50000);
+    }
+    return false;
+}
+
+static bool
+isDown(packet *p)
+{
+    return p->linkFailed();
+}
+
+/*
+ * Sends packets holding every byte the framing escapes, and checks
+ * that each comes back intact.
+ */
+static void
+exchange(packet *p, int count)
+{
+    pthread_mutex_lock(&rcvMutex);
+    received.clear();
+    pthread_mutex_unlock(&rcvMutex);
+
+    vector<bufferStore> sent;
+    for (int i = 0; i < count; i++) {
+	bufferStore b;
+	b.addByte(i);
+	b.addByte(0x10);
+	b.addByte(0x03);
+	b.addByte(0x16);
+	b.addByte(0x02);
+	for (int j = 0; j < i * 37; j++)
+	    b.addByte((j * 7 + i) & 0xff);
+	sent.push_back(b);
+	p->send(b);
+    }
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ECHO_TIMEOUT;
+    pthread_mutex_lock(&rcvMutex);
+    while ((received.size() < sent.size()) &&
+	   (pthread_cond_timedwait(&rcvCond, &rcvMutex, &until) != ETIMEDOUT))
+	;
+    vector<bufferStore> got = received;
+    pthread_mutex_unlock(&rcvMutex);
+
+    if (got.size() != sent.size())
+	fail("not every packet came back");
+    for (size_t i = 0; i < sent.size(); i++)
+	if ((got[i].getLen() != sent[i].getLen()) ||
+	    memcmp(got[i].getString(0), sent[i].getString(0), sent[i].getLen()))
+	    fail("a packet came back changed");
+}
+
+int
+main()
+{
+    echoServer srv;
+    bufferStore lost;
+    int lfd;
+
+    // A port nobody listens on, yet.
+    lfd = listenOn(0);
+    srv.port = portOf(lfd);
+    close(lfd);
+
+    string name = "tcp:127.0.0.1:" + to_string(srv.port);
+    Link link(name.c_str(), -1, NULL);
+    packet *p = new packet(name.c_str(), -1, &link);
+
+    // The listener is down at startup.
+    if (!p->linkFailed())
+	fail("link up without a listener");
+    lost.addStringT("lost");
+    p->send(lost);
+    usleep(300000);
+
+    startServer(srv);
+    p->reset();
+    if (p->linkFailed())
+	fail("link down after the listener came up");
+    exchange(p, 20);
+
+    // The listener goes away while the link is up, and is still
+    // gone when the link is reset.
+    stopServer(srv);
+    if (!waitFor(isDown, p))
+	fail("lost connection not noticed");
+    p->reset();
+    if (!p->linkFailed())
+	fail("link up after a failed reset");
+    p->send(lost);
+    usleep(300000);
+
+    startServer(srv);
+    p->reset();
+    if (p->linkFailed())
+	fail("link down after the listener came back");
+    exchange(p, 20);
+
+    delete p;
+    stopServer(srv);
+    cout << "transporttest: OK" << endl;
+    return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include <rfsv.h>
+#include <rfsvfactory.h>
+#include <plpintl.h>
+#include <plpbackup.h>
+#include <plpmanifest.h>
+#include <ppsocket.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <getopt.h>
+
+using namespace std;
+
+static void
+help()
+{
+    cout << _(
+	"Usage: plpbackup [OPTIONS]... [DRIVE|DIRECTORY]...\n"
+	"       plpbackup -x [OPTIONS]...\n"
+	"\n"
+	"Back up files from the Psion into a tar (pax) archive, or\n"
+	"restore them from such an archive. Without arguments, all\n"
+	"drives except the ROM drive Z: are backed up.\n"
+	"\n"
+	"Supported options:\n"
+	"\n"
+	" -h, --help              Display this text.\n"
+	" -V, --version           Print version and exit.\n"
+	" -p, --port=[HOST:]PORT  Connect to port PORT on host HOST.\n"
+	"                         Default for HOST is 127.0.0.1\n"
+	"                         Default for PORT is "
+	) << DPORT << "\n" << _(
+	" -f, --file=ARCHIVE      Write (or read) ARCHIVE instead of\n"
+	"                         standard output (input).\n"
+	" -x, --extract           Restore files from the archive.\n"
+	" -C, --directory=DIR     Restore below DIR on the Psion instead\n"
+	"                         of the original locations.\n"
+	" -g, --snapshot=FILE     Incremental backup: save only files which\n"
+	"                         changed since the snapshot in FILE, then\n"
+	"                         update FILE.\n"
+	" -F, --full              Save all files, but still update the\n"
+	"                         snapshot given with -g.\n"
+	" -w, --window=N          Keep N requests in flight (default 4).\n"
+	" -v, --verbose           List files while processing them.\n"
+	) << "\n";
+}
+
+static void
+usage() {
+    cerr << _("Try `plpbackup --help' for more information") << endl;
+}
+
+static struct option opts[] = {
+    {"help",      no_argument,       0, 'h'},
+    {"version",   no_argument,       0, 'V'},
+    {"port",      required_argument, 0, 'p'},
+    {"file",      required_argument, 0, 'f'},
+    {"extract",   no_argument,       0, 'x'},
+    {"directory", required_argument, 0, 'C'},
+    {"snapshot",  required_argument, 0, 'g'},
+    {"full",      no_argument,       0, 'F'},
+    {"window",    required_argument, 0, 'w'},
+    {"verbose",   no_argument,       0, 'v'},
+    {NULL,        0,                 0,  0 }
+};
+
+static void
+parse_destination(const char *arg, const char **host, int *port)
+{
+    if (!arg)
+	return;
+    // We don't want to modify argv, therefore copy it first ...
+    char *argcpy = strdup(arg);
+    char *pp = strchr(argcpy, ':');
+
+    if (pp) {
+	// host.domain:400
+	// 10.0.0.1:400
+	*pp ++= '\0';
+	*host = argcpy;
+    } else {
+	// 400
+	// host.domain
+	// host
+	// 10.0.0.1
+	if (strchr(argcpy, '.') || !isdigit(argcpy[0])) {
+	    *host = argcpy;
+	    pp = 0L;
+	} else
+	    pp = argcpy;
+    }
+    if (pp)
+	*port = atoi(pp);
+}
+
+static int
+showEntry(void *, const string &name, uint32_t)
+{
+    cerr << name << endl;
+    return 1;
+}
+
+/**
+ * Turns a command line argument like "c", "C:" or "C:\Documents"
+ * into the root of a tree to back up.
+ */
+static string
+backupRoot(const char *arg)
+{
+    string root = rfsv::convertSlash(arg);
+
+    if ((root.size() == 1) && isalpha(root[0]))
+	root += ':';
+    if ((root.size() < 2) || (root[1] != ':'))
+	return string();
+    root[0] = toupper(root[0]);
+    if (root[root.size() - 1] != '\\')
+	root += '\\';
+    return root;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    int sockNum = DPORT;
+    const char *archive = NULL;
+    const char *snapshotFile = NULL;
+    const char *dest = NULL;
+    bool extract = false;
+    bool full = false;
+    bool verbose = false;
+    int window = 4;
+
+    setlocale (LC_ALL, "");
+    textdomain(PACKAGE);
+
+    struct servent *se = getservbyname("psion", "tcp");
+    endservent();
+    if (se != 0L)
+	sockNum = ntohs(se->s_port);
+
+    while (1) {
+	int c = getopt_long(argc, argv, "hVp:f:xC:g:Fw:v", opts, NULL);
+	if (c == -1)
+	    break;
+	switch (c) {
+	    case '?':
+		usage();
+		return 2;
+	    case 'V':
+		cout << _("plpbackup Version ") << VERSION << endl;
+		return 0;
+	    case 'h':
+		help();
+		return 0;
+	    case 'p':
+		parse_destination(optarg, &host, &sockNum);
+		break;
+	    case 'f':
+		archive = optarg;
+		break;
+	    case 'x':
+		extract = true;
+		break;
+	    case 'C':
+		dest = optarg;
+		break;
+	    case 'g':
+		snapshotFile = optarg;
+		break;
+	    case 'F':
+		full = true;
+		break;
+	    case 'w':
+		window = atoi(optarg);
+		break;
+	    case 'v':
+		verbose = true;
+		break;
+	}
+    }
+    if (extract && ((optind < argc) || snapshotFile)) {
+	usage();
+	return 2;
+    }
+    if (!extract && dest) {
+	usage();
+	return 2;
+    }
+
+    vector<string> roots;
+    for (int i = optind; i < argc; i++) {
+	string root = backupRoot(argv[i]);
+	if (root.empty()) {
+	    cerr << _("plpbackup: not a drive or directory on the Psion: ")
+		 << argv[i] << endl;
+	    return 2;
+	}
+	roots.push_back(root);
+    }
+
+    int fd;
+    if (!archive || !strcmp(archive, "-"))
+	fd = extract ? 0 : 1;
+    else if (extract)
+	fd = ::open(archive, O_RDONLY);
+    else
+	fd = ::open(archive, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+	perror(archive);
+	return 2;
+    }
+    if (!extract && isatty(fd)) {
+	cerr << _("plpbackup: refusing to write an archive to a terminal") << endl;
+	return 2;
+    }
+
+    ppsocket *skt = new ppsocket();
+    if (!skt->connect(host, sockNum)) {
+	cerr << _("plpbackup: could not connect to ncpd") << endl;
+	return 2;
+    }
+    rfsvfactory *rf = new rfsvfactory(skt);
+    rfsv *a = rf->create(false);
+    if (a == NULL) {
+	cerr << "plpbackup: " << rf->getError() << endl;
+	delete rf;
+	delete skt;
+	return 2;
+    }
+
+    int status = 0;
+    PlpBackup b(*a);
+    Enum<rfsv::errs> res;
+    b.setWindow(window);
+    if (verbose)
+	b.setCallback(NULL, showEntry);
+
+    if (extract) {
+	res = b.restore(fd, dest);
+	if (res != rfsv::E_PSI_GEN_NONE) {
+	    cerr << _("plpbackup: restore failed: ") << res << endl;
+	    status = 2;
+	}
+    } else {
+	PlpManifest snapshot;
+
+	if (roots.empty()) {
+	    uint32_t devbits;
+	    if ((res = a->devlist(devbits)) != rfsv::E_PSI_GEN_NONE) {
+		cerr << _("plpbackup: could not list drives: ") << res << endl;
+		status = 2;
+	    } else {
+		// Z: is the ROM and never worth saving.
+		for (int i = 0; i < 25; i++) {
+		    PlpDrive drive;
+		    if ((devbits & (1 << i)) && (a->devinfo('A' + i, drive) == rfsv::E_PSI_GEN_NONE)) {
+			string root;
+			root += ('A' + i);
+			root += ":\\";
+			roots.push_back(root);
+		    }
+		}
+	    }
+	}
+	if (snapshotFile && !full)
+	    snapshot.load(snapshotFile);
+	if (status == 0 && !b.open(fd)) {
+	    cerr << _("plpbackup: could not start writing the archive") << endl;
+	    status = 2;
+	}
+	for (size_t i = 0; (status == 0) && (i < roots.size()); i++) {
+	    res = b.backup(roots[i].c_str(), snapshotFile ? &snapshot : NULL);
+	    if (res != rfsv::E_PSI_GEN_NONE) {
+		cerr << _("plpbackup: could not back up ") << roots[i] << ": "
+		     << res << endl;
+		status = 2;
+	    }
+	}
+	if (!b.close() && (status == 0)) {
+	    cerr << _("plpbackup: error writing the archive") << endl;
+	    status = 2;
+	}
+	if ((status == 0) && snapshotFile && !snapshot.save(snapshotFile)) {
+	    cerr << _("plpbackup: could not write snapshot ") << snapshotFile << endl;
+	    status = 2;
+	}
+    }
+    if ((fd > 1) && (::close(fd) != 0) && (status == 0)) {
+	perror(archive);
+	status = 2;
+    }
+
+    if (verbose || b.getFailed())
+	cerr << b.getFiles() << _(" files, ") << b.getBytes() << _(" bytes, ")
+	     << b.getSkipped() << _(" unchanged, ") << b.getFailed()
+	     << _(" failed") << endl;
+    if ((status == 0) && b.getFailed())
+	status = 1;
+
+    delete a;
+    delete rf;
+    delete skt;
+    return status;
+}
@@ -0,0 +1,580 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include <rfsv.h>
+#include <rfsvfactory.h>
+#include <rclip.h>
+#include <plpclip.h>
+#include <plpintl.h>
+#include <ppsocket.h>
+#include <iowatch.h>
+
+#include <iostream>
+#include <string>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "ignore-value.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <getopt.h>
+
+/**
+ * How often a regular input file is checked for changes, in seconds.
+ * Notifications from the Psion and data in a FIFO wake us up at once.
+ */
+#define FILE_POLL 2
+
+/**
+ * How long to wait before connecting again after the link was lost.
+ */
+#define RETRY_DELAY 5
+
+using namespace std;
+
+static bool debug = false;
+static int verbose = 0;
+static volatile sig_atomic_t running = 1;
+
+static void
+_log(int priority, const char *fmt, va_list ap)
+{
+    char *buf;
+    if (vasprintf(&buf, fmt, ap) == -1)
+        return;
+    if (debug)
+        cerr << buf << endl;
+    else
+        syslog(priority, "%s", buf);
+    free(buf);
+}
+
+static void
+debuglog(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    _log(LOG_DEBUG, fmt, ap);
+    va_end(ap);
+}
+
+static void
+errorlog(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    _log(LOG_ERR, fmt, ap);
+    va_end(ap);
+}
+
+static void
+infolog(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    _log(LOG_INFO, fmt, ap);
+    va_end(ap);
+}
+
+/**
+ * Makes a path absolute, as the daemon changes to the root directory.
+ */
+static const char *
+absPath(const char *path)
+{
+    char cwd[PATH_MAX];
+
+    if (!path || (path[0] == '/') || !getcwd(cwd, sizeof(cwd)))
+        return path;
+    return strdup((string(cwd) + "/" + path).c_str());
+}
+
+static void
+terminate(int)
+{
+    running = 0;
+}
+
+/**
+ * The host side of the clipboard: where text from the Psion
+ * goes to and where text for the Psion comes from. Both may be
+ * FIFOs or regular files, and may be the same file.
+ */
+class hostClip {
+public:
+    hostClip(const char *_in, const char *_out)
+        : in(_in), out(_out), inFd(-1), fifo(false), inSize(-1), inTime(0) { }
+
+    ~hostClip() { closeInput(); }
+
+    /**
+    * Opens the input side. A FIFO is opened without blocking, so
+    * it can be watched along with the link to the Psion.
+    */
+    bool openInput() {
+        struct stat st;
+
+        if (!in)
+            return true;
+        if (stat(in, &st) != 0) {
+            errorlog("%s: %s", in, strerror(errno));
+            return false;
+        }
+        fifo = S_ISFIFO(st.st_mode);
+        if (!fifo) {
+            // Whatever is there now is not news.
+            inSize = st.st_size;
+            inTime = st.st_mtime;
+            return true;
+        }
+        // O_RDWR keeps the FIFO from signalling EOF when no writer
+        // is connected, which would make it readable all the time.
+        if ((inFd = open(in, O_RDWR | O_NONBLOCK)) < 0) {
+            errorlog("%s: %s", in, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    void closeInput() {
+        if (inFd >= 0)
+            close(inFd);
+        inFd = -1;
+    }
+
+    int getFd() const { return inFd; }
+    bool isFifo() const { return fifo; }
+    bool hasInput() const { return in != NULL; }
+
+    /**
+    * Collects data arriving on the input FIFO. Text written to
+    * the FIFO in one go, i.e. until no more data is available,
+    * is one clipboard content.
+    *
+    * @returns true if a complete text has been read.
+    */
+    bool readFifo(string &text) {
+        char buf[4096];
+        ssize_t n;
+
+        text.clear();
+        while ((n = read(inFd, buf, sizeof(buf))) > 0) {
+            text.append(buf, n);
+            // Give a writer which is still busy a moment to continue.
+            if (n < (ssize_t)sizeof(buf)) {
+                IOWatch w;
+                w.addIO(inFd);
+                if (!w.watch(0, 50000))
+                    break;
+            }
+        }
+        return !text.empty();
+    }
+
+    /**
+    * Checks a regular input file for a change of size or
+    * modification time, and reads it if it has changed.
+    *
+    * @returns true if the file has changed.
+    */
+    bool readFile(string &text) {
+        struct stat st;
+
+        if (stat(in, &st) != 0)
+            return false;
+        if ((st.st_size == inSize) && (st.st_mtime == inTime))
+            return false;
+        inSize = st.st_size;
+        inTime = st.st_mtime;
+
+        FILE *fp = fopen(in, "r");
+        if (!fp)
+            return false;
+        text.clear();
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            text.append(buf, n);
+        fclose(fp);
+        return true;
+    }
+
+    /**
+    * Hands text from the Psion to the host. A FIFO without a
+    * reader drops the text. A regular file is replaced atomically.
+    */
+    bool write(const string &text) {
+        struct stat st;
+
+        if (!out)
+            return true;
+        if ((stat(out, &st) == 0) && S_ISFIFO(st.st_mode)) {
+            int fd = open(out, O_WRONLY | O_NONBLOCK);
+            if (fd < 0) {
+                if (errno == ENXIO)
+                    debuglog("nobody is reading %s", out);
+                else
+                    errorlog("%s: %s", out, strerror(errno));
+                return false;
+            }
+            // The reader is there, so we may block now.
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            bool ok = writeAll(fd, text);
+            close(fd);
+            return ok;
+        }
+
+        string tmp = string(out) + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            errorlog("%s: %s", tmp.c_str(), strerror(errno));
+            return false;
+        }
+        bool ok = writeAll(fd, text);
+        if ((close(fd) != 0) || !ok || (rename(tmp.c_str(), out) != 0)) {
+            errorlog("%s: %s", out, strerror(errno));
+            unlink(tmp.c_str());
+            return false;
+        }
+        // Don't send our own output back if input and output are
+        // the same file.
+        if (in && !fifo && (stat(in, &st) == 0)) {
+            inSize = st.st_size;
+            inTime = st.st_mtime;
+        }
+        return true;
+    }
+
+private:
+    static bool writeAll(int fd, const string &text) {
+        const char *p = text.data();
+        size_t left = text.size();
+
+        while (left > 0) {
+            ssize_t n = ::write(fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += n;
+            left -= n;
+        }
+        return true;
+    }
+
+    const char *in;
+    const char *out;
+    int inFd;
+    bool fifo;
+    off_t inSize;
+    time_t inTime;
+};
+
+/**
+ * Copies the Psion's clipboard to the host, if it has really changed.
+ */
+static void
+fromPsion(PlpClipboard &clip, hostClip &host)
+{
+    Enum<rfsv::errs> res;
+    string text;
+
+    if (!clip.changed()) {
+        if (verbose)
+            debuglog("clipboard notification without change");
+        return;
+    }
+    res = clip.getText(text);
+    if (res == rfsv::E_PSI_FILE_EOF) {
+        if (verbose)
+            debuglog("clipboard archive bit clear, nothing new");
+        return;
+    }
+    if (res != rfsv::E_PSI_GEN_NONE) {
+        errorlog("could not read the clipboard: %s", res.toString().c_str());
+        return;
+    }
+    if (verbose)
+        debuglog("%d bytes from the Psion", (int)text.size());
+    host.write(text);
+}
+
+static void
+toPsion(PlpClipboard &clip, const string &text)
+{
+    Enum<rfsv::errs> res;
+
+    if ((res = clip.putText(text)) != rfsv::E_PSI_GEN_NONE)
+        errorlog("could not write the clipboard: %s", res.toString().c_str());
+    else if (verbose)
+        debuglog("%d bytes to the Psion", (int)text.size());
+}
+
+/**
+ * Runs one session, until the link to the Psion is lost
+ * or we are told to terminate.
+ */
+static void
+session(rfsv &a, rclip &rc, ppsocket &clipSocket, hostClip &host)
+{
+    PlpClipboard clip(a);
+    IOWatch iow;
+    Enum<rfsv::errs> res;
+    string text;
+
+    clipSocket.setWatch(&iow);
+    if (host.getFd() >= 0)
+        iow.addIO(host.getFd());
+
+    // Bring the host up to date first.
+    fromPsion(clip, host);
+
+    if ((res = rc.sendListen()) != rfsv::E_PSI_GEN_NONE) {
+        errorlog("could not listen for clipboard changes: %s", res.toString().c_str());
+        clipSocket.setWatch(NULL);
+        return;
+    }
+    while (running) {
+        long timeout = (host.hasInput() && !host.isFifo()) ? FILE_POLL : 3600;
+
+        iow.watch(timeout, 0);
+        if (!running)
+            break;
+        res = rc.checkNotify();
+        if (res == rfsv::E_PSI_GEN_NONE) {
+            fromPsion(clip, host);
+            if ((res = rc.sendListen()) != rfsv::E_PSI_GEN_NONE)
+                break;
+        } else if (res != rfsv::E_PSI_FILE_EOF)
+            break;
+
+        if (host.isFifo()) {
+            if (host.readFifo(text))
+                toPsion(clip, text);
+        } else if (host.hasInput() && host.readFile(text))
+            toPsion(clip, text);
+
+        if (a.getStatus() != rfsv::E_PSI_GEN_NONE)
+            break;
+    }
+    clipSocket.setWatch(NULL);
+}
+
+static void
+help()
+{
+    cout << _(
+        "Usage: plpclipd [OPTIONS]...\n"
+        "\n"
+        "Keeps the clipboard of the Psion and a file or FIFO on the\n"
+        "host in step.\n"
+        "\n"
+        "Supported options:\n"
+        "\n"
+        " -d, --debug             Debugging, do not fork.\n"
+        " -h, --help              Display this text.\n"
+        " -v, --verbose           Increase verbosity.\n"
+        " -V, --version           Print version and exit.\n"
+        " -p, --port=[HOST:]PORT  Connect to port PORT on host HOST.\n"
+        "                         Default for HOST is 127.0.0.1\n"
+        "                         Default for PORT is "
+        ) << DPORT << "\n" << _(
+        " -i, --input=FILE        Copy text written to FILE to the Psion.\n"
+        " -o, --output=FILE       Copy the Psion's clipboard to FILE.\n"
+        ) << "\n";
+}
+
+static void
+usage() {
+    cerr << _("Try `plpclipd --help' for more information") << endl;
+}
+
+static struct option opts[] = {
+    {"debug",   no_argument,       nullptr, 'd'},
+    {"help",    no_argument,       nullptr, 'h'},
+    {"version", no_argument,       nullptr, 'V'},
+    {"verbose", no_argument,       nullptr, 'v'},
+    {"port",    required_argument, nullptr, 'p'},
+    {"input",   required_argument, nullptr, 'i'},
+    {"output",  required_argument, nullptr, 'o'},
+    {nullptr,   0,                 nullptr, 0 }
+};
+
+static void
+parse_destination(const char *arg, const char **host, int *port)
+{
+    if (!arg)
+        return;
+    // We don't want to modify argv, therefore copy it first ...
+    char *argcpy = strdup(arg);
+    char *pp = strchr(argcpy, ':');
+
+    if (pp) {
+        // host.domain:400
+        // 10.0.0.1:400
+        *pp ++= '\0';
+        *host = argcpy;
+    } else {
+        // 400
+        // host.domain
+        // host
+        // 10.0.0.1
+        if (strchr(argcpy, '.') || !isdigit(argcpy[0])) {
+            *host = argcpy;
+            pp = nullptr;
+        } else
+            pp = argcpy;
+    }
+    if (pp)
+        *port = atoi(pp);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    int sockNum = DPORT;
+    const char *in = NULL;
+    const char *out = NULL;
+    int ret = 0;
+
+    setlocale (LC_ALL, "");
+    textdomain(PACKAGE);
+
+    struct servent *se = getservbyname("psion", "tcp");
+    endservent();
+    if (se != nullptr)
+        sockNum = ntohs(se->s_port);
+
+    while (1) {
+        int c = getopt_long(argc, argv, "dhVvp:i:o:", opts, NULL);
+        if (c == -1)
+            break;
+        switch (c) {
+            case '?':
+                usage();
+                return 1;
+            case 'd':
+                debug = true;
+                break;
+            case 'v':
+                verbose++;
+                break;
+            case 'V':
+                cout << _("plpclipd Version ") << VERSION << endl;
+                return 0;
+            case 'h':
+                help();
+                return 0;
+            case 'p':
+                parse_destination(optarg, &host, &sockNum);
+                break;
+            case 'i':
+                in = absPath(optarg);
+                break;
+            case 'o':
+                out = absPath(optarg);
+                break;
+        }
+    }
+    if ((optind < argc) || (!in && !out)) {
+        usage();
+        return 1;
+    }
+
+    hostClip hc(in, out);
+    if (!hc.openInput())
+        return 1;
+
+    if (!debug)
+        ret = fork();
+    switch (ret) {
+        case 0:
+            break;
+        case -1:
+            cerr << "plpclipd: fork failed" << endl;
+            return 1;
+        default:
+            /* parent */
+            return 0;
+    }
+    if (!debug) {
+        setsid();
+        ignore_value(chdir("/"));
+        openlog("plpclipd", LOG_PID|LOG_CONS, LOG_DAEMON);
+        int devnull = open("/dev/null", O_RDWR, 0);
+        if (devnull != -1) {
+            dup2(devnull, STDIN_FILENO);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            if (devnull > 2)
+                close(devnull);
+        }
+    }
+    signal(SIGTERM, terminate);
+    signal(SIGINT, terminate);
+    signal(SIGPIPE, SIG_IGN);
+
+    infolog("started");
+    while (running) {
+        ppsocket skt;
+        ppsocket clipSocket;
+        rfsv *a = NULL;
+
+        if (skt.connect(host, sockNum) && clipSocket.connect(host, sockNum)) {
+            rfsvfactory rf(&skt);
+            if ((a = rf.create(false)) != NULL) {
+                rclip rc(&clipSocket);
+                Enum<rfsv::errs> res = rc.initClipbd();
+
+                if (res == rfsv::E_PSI_GEN_NONE) {
+                    infolog("connected");
+                    session(*a, rc, clipSocket, hc);
+                    infolog("disconnected");
+                } else if (res == rfsv::E_PSI_GEN_NSUP) {
+                    errorlog("the Psion has no clipboard server (C:\\System\\Libs\\clipsvr.rsy)");
+                    running = 0;
+                }
+                delete a;
+            }
+        }
+        for (int i = 0; running && (i < RETRY_DELAY); i++)
+            sleep(1);
+    }
+    infolog("terminated");
+    return 0;
+}
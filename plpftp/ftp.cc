@@ -23,8 +23,10 @@
 #include "config.h"
 
 #include <rfsv.h>
+#include <rfsvfactory.h>
 #include <rpcs.h>
 #include <rclip.h>
+#include <plpclip.h>
 #include <plpintl.h>
 #include <ppsocket.h>
 #include <bufferarray.h>
@@ -55,6 +57,7 @@
 #include "xvasprintf.h"
 
 #include "ftp.h"
+#include "xfer.h"
 
 extern "C"  {
 #include "yesno.h"
@@ -92,15 +95,37 @@ resetUnixWd()
 }
 
 ftp::ftp()
+    : host(NULL), port(0), device(NULL), jobs(1)
 {
     resetUnixWd();
 }
 
 ftp::~ftp()
 {
+    closeSessions();
     free(localDir);
 }
 
+void ftp::
+setConnection(const char *_host, int _port, const char *_device, int _jobs)
+{
+    host = _host;
+    port = _port;
+    device = _device;
+    jobs = (_jobs < 1) ? 1 : _jobs;
+}
+
+void ftp::
+closeSessions()
+{
+    for (size_t i = 0; i < sessions.size(); i++)
+	delete sessions[i];
+    for (size_t i = 0; i < sockets.size(); i++)
+	delete sockets[i];
+    sessions.clear();
+    sockets.clear();
+}
+
 void ftp::usage() {
     cout << _("Known FTP commands:") << endl << endl;
     cout << "  pwd" << endl;
@@ -116,11 +141,13 @@ void ftp::usage() {
     cout << "  cd <dir>" << endl;
     cout << "  lcd <dir>" << endl;
     cout << "  !<system command>" << endl;
-    cout << "  get <psionfile>" << endl;
-    cout << "  put <unixfile>" << endl;
+    cout << "  get [-c] <psionfile>" << endl;
+    cout << "  put [-c] <unixfile>" << endl;
     cout << "  mget <shellpattern>" << endl;
     cout << "  mput <shellpattern>" << endl;
+    cout << "  jobs [<n>]" << endl;
     cout << "  cp <psionfile> <psionfile>" << endl;
+    cout << "  cp -r <psionfile|psiondir> <psionfile|psiondir>" << endl;
     cout << "  del|rm <psionfile>" << endl;
     cout << "  mkdir <psiondir>" << endl;
     cout << "  rmdir <psiondir>" << endl;
@@ -170,6 +197,48 @@ checkAbortHash(void *, uint32_t)
     return continueRunning;
 }
 
+/**
+ * Runs a transfer queue on the main session and up to jobs - 1
+ * additional sessions, which are opened on first use and then
+ * kept for later transfers.
+ */
+int ftp::
+runQueue(rfsv & a, xferQueue & q)
+{
+    vector<rfsv *> use;
+
+    for (size_t i = 0; i < sessions.size(); i++)
+	if (sessions[i]->getStatus() != rfsv::E_PSI_GEN_NONE) {
+	    closeSessions();
+	    break;
+	}
+    while (host && ((int)sessions.size() < jobs - 1)) {
+	ppsocket *skt = new ppsocket();
+	if (!skt->connect(host, port)) {
+	    delete skt;
+	    break;
+	}
+	rfsvfactory rf(skt, device);
+	rfsv *s = rf.create(false);
+	if (s == NULL) {
+	    delete skt;
+	    break;
+	}
+	sockets.push_back(skt);
+	sessions.push_back(s);
+    }
+    use.push_back(&a);
+    for (size_t i = 0; (i < sessions.size()) && ((int)use.size() < jobs); i++)
+	use.push_back(sessions[i]);
+
+    int failed = q.run(use, checkAbortNoHash);
+    const vector<xferJob> &f = q.getFailed();
+    for (size_t i = 0; i < f.size(); i++)
+	cerr << _("Error: ") << f[i].from << ": " << f[i].res << endl;
+    continueRunning = 1;
+    return failed;
+}
+
 static void
 sigint_handler(int i) {
     continueRunning = 0;
@@ -204,8 +273,13 @@ stopPrograms(rpcs & r, const char *file) {
     }
     fclose(fp);
     time_t tstart = time(0) + 5;
+    time_t tresend = time(0) + 1;
+    processList stop = tmp;
     while (!tmp.empty()) {
-        for (processList::iterator i = tmp.begin(); i != tmp.end(); i++) {
+        processList now;
+        processList stopped;
+
+        for (processList::iterator i = stop.begin(); i != stop.end(); i++) {
             r.stopProgram(i->getProcId());
         }
         usleep(100000);
@@ -216,10 +290,18 @@ stopPrograms(rpcs & r, const char *file) {
             cin.getline((char *)&tstart, 1);
             tstart = time(0) + 5;
         }
-        if ((res = r.queryPrograms(tmp)) != rfsv::E_PSI_GEN_NONE) {
+        if ((res = r.queryPrograms(now, false)) != rfsv::E_PSI_GEN_NONE) {
             cerr << _("Could not get process list, Error: ") << res << endl;
             return 1;
         }
+        // Only programs which showed up since the last poll need
+        // to be told; the others are reminded once a second.
+        rpcs::diffPrograms(tmp, now, stop, stopped);
+        if (time(0) >= tresend) {
+            stop = now;
+            tresend = time(0) + 1;
+        }
+        tmp = now;
     }
     return 0;
 }
@@ -348,53 +430,6 @@ ftp::checkClipConnection(rfsv &a, rclip & rc, ppsocket & rclipSocket)
     return false;
 }
 
-static void
-psiText2ascii(char *buf, int len) {
-    char *p;
-
-    for (p = buf; len; len--, p++)
-	switch (*p) {
-	    case 6:
-	    case 7:
-		*p = '\n';
-		break;
-	    case 8:
-		*p = '\f';
-		break;
-	    case 10:
-		*p = '\t';
-		break;
-	    case 11:
-	    case 12:
-		*p = '-';
-		break;
-	    case 15:
-	    case 16:
-		*p = ' ';
-		break;
-	}
-}
-
-static void
-ascii2PsiText(char *buf, int len) {
-    char *p;
-
-    for (p = buf; len; len--, p++)
-	switch (*p) {
-            case '\0':
-                *p = ' ';
-	    case '\n':
-		*p = 6;
-		break;
-	    case '\f':
-		*p = 8;
-		break;
-	    case '-':
-		*p = 11;
-		break;
-	}
-}
-
 static char *
 slurp(FILE *fp, size_t *final_len)
 {
@@ -404,12 +439,6 @@ slurp(FILE *fp, size_t *final_len)
 int
 ftp::putClipText(rpcs & r, rfsv & a, rclip & rc, ppsocket & rclipSocket, const char *file)
 {
-    Enum<rfsv::errs> res;
-    uint32_t fh;
-    uint32_t l;
-    const unsigned char *p;
-    bufferStore b;
-    char *data;
     FILE *fp;
 
     if (!checkClipConnection(a, rc, rclipSocket))
@@ -419,36 +448,13 @@ ftp::putClipText(rpcs & r, rfsv & a, rclip & rc, ppsocket & rclipSocket, const c
         return 1;
 
     size_t len;
-    data = slurp(fp, &len);
+    char *data = slurp(fp, &len);
     fclose(fp);
-    ascii2PsiText(data, len);
-        
-    res = a.freplacefile(0x200, CLIPFILE, fh);
-    if (res == rfsv::E_PSI_GEN_NONE) {
-	// Base Header
-	b.addDWord(0x10000037);   // @00 UID 0
-	b.addDWord(0x1000003b);   // @04 UID 1
-	b.addDWord(0);            // @08 UID 3
-	b.addDWord(0x4739d53b);   // @0c Checksum the above
-
-	// Section Table
-	b.addDWord(0x00000014);   // @10 Offset of Section Table
-	b.addByte(2);             // @14 Section Table, length in DWords
-	b.addDWord(0x10000033);   // @15 Section Type (ASCII)
-	b.addDWord(0x0000001d);   // @19 Section Offset
-
-	// Data
-	b.addDWord(strlen(data)); // @1e Section (String) length
-	b.addStringT(data);       // @22 Data (Psion Word seems to need a
-                                  //     terminating 0.
-
-	p = (const unsigned char *)b.getString(0);
-	a.fwrite(fh, p, b.getLen(), l);
-	a.fclose(fh);
-	a.fsetattr(CLIPFILE, 0x20, 0x07);
-    }
+    string text(data, len);
+    free(data);
 
-    return 0;
+    PlpClipboard clip(a);
+    return (clip.putText(text) == rfsv::E_PSI_GEN_NONE) ? 0 : 1;
 }
 
 // FIXME: Make this work as putclipimg
@@ -531,89 +537,17 @@ ftp::putClipText(rpcs & r, rfsv & a, rclip & rc, ppsocket & rclipSocket, const c
 
 int
 ftp::getClipData(rpcs & r, rfsv & a, rclip & rc, ppsocket & rclipSocket, const char *file) {
-    Enum<rfsv::errs> res;
-    PlpDirent de;
-    uint32_t fh;
+    PlpClipboard clip(a);
     string clipText;
 
-    res = a.fgeteattr(CLIPFILE, de);
-    if (res == rfsv::E_PSI_GEN_NONE) {
-	if (de.getAttr() & rfsv::PSI_A_ARCHIVE) {
-	    uint32_t len = de.getSize();
-	    char *buf = (char *)malloc(len);
-
-	    if (!buf) {
-		cerr << "Out of memory in getClipData" << endl;
-		return 1;
-	    }
-	    res = a.fopen(a.opMode(rfsv::PSI_O_RDONLY | rfsv::PSI_O_SHARE),
-			   CLIPFILE, fh);
-	    if (res == rfsv::E_PSI_GEN_NONE) {
-		uint32_t tmp;
-		res = a.fread(fh, (unsigned char *)buf, len, tmp);
-		a.fclose(fh);
-
-		if ((res == rfsv::E_PSI_GEN_NONE) && (tmp == len)) {
-		    char *p = buf;
-		    int lcount;
-		    uint32_t     *ti = (uint32_t*)buf;
-
-		    // Check base header
-		    if (*ti++ != 0x10000037) {
-			free(buf);
-			return 1;
-		    }
-		    if (*ti++ != 0x1000003b) {
-			free(buf);
-			return 1;
-		    }
-		    if (*ti++ != 0) {
-			free(buf);
-			return 1;
-		    }
-		    if (*ti++ != 0x4739d53b) {
-			free(buf);
-			return 1;
-		    }
-
-		    // Start of section table
-		    p = buf + *ti;
-		    // Length of section table (in DWords)
-		    lcount = *p++;
-
-		    uint32_t *td = (uint32_t*)p;
-		    while (lcount > 0) {
-			uint32_t sType = *td++;
-			if (sType == 0x10000033) {
-			    // An ASCII section
-			    p = buf + *td;
-			    len = *((uint32_t*)p);
-			    p += 4;
-			    psiText2ascii(p, len);
-			    clipText += (char *)p;
-			}
-			if (sType == 0x1000003d) {
-// FIXME: Implement this
-// 			    // A paint data section
-// 			    p = buf + *td;
-// 			    if (clipImg)
-// 				delete clipImg;
-// 			    clipImg = decode_image((const unsigned char *)p);
-			}
-			td++;
-			lcount -= 2;
-		    }
-		}
-
-	    }
-	    free(buf);
-	}
-    }
+    // FIXME: Implement paint data sections (see decode_image above)
+    clip.getText(clipText);
 
     FILE *fp = fopen(file, "w");
     if (fp == NULL)
         return 1;
     fwrite(clipText.c_str(), 1, clipText.length(), fp);
+    fclose(fp);
     return 0;
 }
 
@@ -678,6 +612,7 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
     Enum<rfsv::errs> res;
     bool prompt = true;
     bool hash = false;
+    bool resume = false;
     cpCallback_t cab = checkAbortNoHash;
     bool once = false;
 
@@ -757,6 +692,14 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 	    cab = (hash) ? checkAbortHash : checkAbortNoHash;
 	    continue;
 	}
+	if (!strcmp(argv[0], "jobs") && (argc <= 2)) {
+	    if (argc == 2)
+		jobs = (atoi(argv[1]) < 1) ? 1 : atoi(argv[1]);
+	    if (jobs < (int)sessions.size() + 1)
+		closeSessions();
+	    cout << _("Transferring up to ") << jobs << _(" files at once") << endl;
+	    continue;
+	}
 	if (!strcmp(argv[0], "pwd")) {
 	    cout << _("Local dir: \"") << localDir << "\"" << endl;
 	    cout << _("Psion dir: \"") << psionDir << "\"" << endl;
@@ -777,6 +720,29 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 	    free(f2);
 	    continue;
 	}
+	if (!strcmp(argv[0], "cp") && (argc == 4) && !strcmp(argv[1], "-r")) {
+	    char *f1 = xasprintf("%s%s", psionDir, argv[2]);
+	    char *f2 = xasprintf("%s%s", psionDir, argv[3]);
+	    PlpDirent e;
+	    // Like cp -r, copy into an existing directory.
+	    if ((a.fgeteattr(f2, e) == rfsv::E_PSI_GEN_NONE) &&
+		(e.getAttr() & rfsv::PSI_A_DIR)) {
+		string base = rfsv::convertSlash(argv[2]);
+		while ((base.size() > 1) && (base[base.size() - 1] == '\\'))
+		    base.erase(base.size() - 1);
+		size_t p = base.rfind('\\');
+		if (p != string::npos)
+		    base.erase(0, p + 1);
+		char *f3 = xasprintf("%s\\%s", f2, base.c_str());
+		free(f2);
+		f2 = f3;
+	    }
+	    if ((res = a.copyTreeOnPsion(f1, f2, NULL, cab)) != rfsv::E_PSI_GEN_NONE)
+		cerr << _("Error: ") << res << endl;
+	    free(f1);
+	    free(f2);
+	    continue;
+	}
 	if (!strcmp(argv[0], "cp") && (argc == 3)) {
 	    char *f1 = xasprintf("%s%s", psionDir, argv[1]);
 	    char *f2 = xasprintf("%s%s", psionDir, argv[2]);
@@ -951,6 +917,13 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 	    }
 	    continue;
 	}
+	if ((!strcmp(argv[0], "get") || !strcmp(argv[0], "put")) &&
+	    (argc > 2) && !strcmp(argv[1], "-c")) {
+	    resume = true;
+	    argv.erase(argv.begin() + 1);
+	    argc--;
+	} else
+	    resume = false;
 	if ((!strcmp(argv[0], "get")) && (argc > 1)) {
 	    struct timeval stime;
 	    struct timeval etime;
@@ -959,11 +932,17 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 	    char *f1 = xasprintf("%s%s", psionDir, argv[1]);
 	    char *f2 = xasprintf("%s%s%s", localDir, "/", argc == 2 ? argv[1] : argv[2]);
 	    gettimeofday(&stime, 0L);
-	    if ((res = a.copyFromPsion(f1, f2, NULL, cab)) != rfsv::E_PSI_GEN_NONE) {
+	    if (resume)
+		res = a.copyFromPsionResume(f1, f2, NULL, cab);
+	    else
+		res = a.copyFromPsion(f1, f2, NULL, cab);
+	    if (res != rfsv::E_PSI_GEN_NONE) {
 		if (hash)
 		    cout << endl;
 		continueRunning = 1;
 		cerr << _("Error: ") << res << endl;
+		if (resume)
+		    cerr << _("Repeat the command to resume the transfer") << endl;
 	    } else {
 		if (hash)
 		    cout << endl;
@@ -990,6 +969,7 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 	} else if ((!strcmp(argv[0], "mget")) && (argc == 2)) {
 	    char *pattern = argv[1];
 	    PlpDir files;
+	    xferQueue q(true);
 	    if ((res = a.dir(psionDir, files)) != rfsv::E_PSI_GEN_NONE) {
 		cerr << _("Error: ") << res << endl;
 		continue;
@@ -1002,34 +982,20 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 		    continue;
 		if (fnmatch(pattern, e.getName(), FNM_NOESCAPE) == FNM_NOMATCH)
 		    continue;
-		cout << _("Get \"") << e.getName() << "\" (y,n): ";
-		bool yes = false;
 		if (prompt) {
+		    cout << _("Get \"") << e.getName() << "\" (y,n): ";
 		    cout.flush();
-		    yes = yesno();
-		} else {
-		    yes = true;
-		    cout << "y ";
-		    cout.flush();
-		}
-		if (yes) {
-		    char *f1 = xasprintf("%s%s", psionDir, e.getName());
-		    char *f2 = xasprintf("%s%s%s", localDir, "/", e.getName());
-		    if ((res = a.copyFromPsion(f1, f2, NULL, cab)) != rfsv::E_PSI_GEN_NONE) {
-			if (hash)
-			    cout << endl;
-			continueRunning = 1;
-			cerr << _("Error: ") << res << endl;
-			break;
-		    } else {
-			if (hash)
-			    cout << endl;
-			cout << _("Transfer complete\n");
-		    }
-		    free(f1);
-		    free(f2);
+		    if (!yesno())
+			continue;
 		}
+		char *f1 = xasprintf("%s%s", psionDir, e.getName());
+		char *f2 = xasprintf("%s%s%s", localDir, "/", e.getName());
+		q.add(f1, f2, e.getSize());
+		free(f1);
+		free(f2);
 	    }
+	    if (!q.empty())
+		runQueue(a, q);
 	    continue;
 	}
 	if (!strcmp(argv[0], "put") && (argc >= 2)) {
@@ -1040,11 +1006,17 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 	    char *f1 = xasprintf("%s%s%s", localDir, "/", argv[1]);
 	    char *f2 = xasprintf("%s%s", psionDir, argc == 2 ? argv[1] : argv[2]);
 	    gettimeofday(&stime, 0L);
-	    if ((res = a.copyToPsion(f1, f2, NULL, cab)) != rfsv::E_PSI_GEN_NONE) {
+	    if (resume)
+		res = a.copyToPsionResume(f1, f2, NULL, cab);
+	    else
+		res = a.copyToPsion(f1, f2, NULL, cab);
+	    if (res != rfsv::E_PSI_GEN_NONE) {
 		if (hash)
 		    cout << endl;
 		continueRunning = 1;
 		cerr << _("Error: ") << res << endl;
+		if (resume)
+		    cerr << _("Repeat the command to resume the transfer") << endl;
 	    } else {
 		if (hash)
 		    cout << endl;
@@ -1071,6 +1043,7 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 	}
 	if ((!strcmp(argv[0], "mput")) && (argc == 2)) {
 	    char *pattern = argv[1];
+	    xferQueue q(false);
 	    DIR *d = opendir(localDir);
 	    if (d) {
 		struct dirent *de;
@@ -1083,37 +1056,24 @@ session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, vector<char *> a
 			    continue;
 			char *f1 = xasprintf("%s%s%s", localDir, "/", de->d_name);
 			if (stat(f1, &st) == 0 && S_ISREG(st.st_mode)) {
-			    cout << _("Put \"") << de->d_name << "\" y,n: ";
-			    bool yes = false;
+			    bool yes = true;
 			    if (prompt) {
+				cout << _("Put \"") << de->d_name << "\" y,n: ";
 				cout.flush();
 				yes = yesno();
-			    } else {
-				cout << "y ";
-				cout.flush();
 			    }
 			    if (yes) {
 				char *f2 = xasprintf("%s%s", psionDir, de->d_name);
-				if ((res = a.copyToPsion(f1, f2, NULL, cab)) != rfsv::E_PSI_GEN_NONE) {
-				    if (hash)
-					cout << endl;
-				    continueRunning = 1;
-				    cerr << _("Error: ") << res << endl;
-				    free(f1);
-				    free(f2);
-				    break;
-				} else {
-				    if (hash)
-					cout << endl;
-				    free(f2);
-				    cout << _("Transfer complete\n");
-				}
+				q.add(f1, f2, st.st_size);
+				free(f2);
 			    }
 			}
 			free(f1);
 		    }
 		} while (de);
 		closedir(d);
+		if (!q.empty())
+		    runQueue(a, q);
 	    } else
 		cerr << _("Error in directory name \"") << localDir << "\"\n";
 	    continue;
@@ -1373,7 +1333,7 @@ static const char *all_commands[] = {
     "dir", "ls", "dircnt", "cd", "lcd", "get", "put", "mget", "mput",
     "del", "rm", "mkdir", "rmdir", "prompt", "bye", "cp", "volname",
     "ps", "kill", "killsave", "runrestore", "run", "machinfo",
-    "ownerinfo", "help", "settime", "setupinfo", NULL
+    "ownerinfo", "help", "settime", "setupinfo", "jobs", NULL
 };
 
 static const char *localfile_commands[] = {
@@ -32,6 +32,8 @@
 class rpcs;
 class bufferStore;
 class bufferArray;
+class ppsocket;
+class xferQueue;
 
 class ftp {
 	public:
@@ -40,6 +42,14 @@ class ftp {
         int session(rfsv & a, rpcs & r, rclip & rc, ppsocket & rclipSocket, std::vector<char *> argv);
         bool canClip;
 
+	/**
+	* Sets where additional rfsv sessions for mget and mput are
+	* connected to, and how many sessions to use at most.
+	* device is the Psion to select on ncpd, or NULL.
+	*/
+	void setConnection(const char *host, int port, const char *device,
+			   int jobs);
+
 	private:
 	std::vector<char *> getCommand();
 	void initReadline(void);
@@ -50,9 +60,18 @@ class ftp {
 	// utilities
 	void resetUnixWd();
 	void usage();
+	void closeSessions();
+	int runQueue(rfsv & a, xferQueue & q);
 
 	char defDrive[9];
 	char *localDir;
+
+	const char *host;
+	int port;
+	const char *device;
+	int jobs;
+	std::vector<ppsocket *> sockets;
+	std::vector<rfsv *> sessions;
 };
 
 #endif
@@ -63,7 +63,13 @@ help()
 	" -p, --port=[HOST:]PORT  Connect to port PORT on host HOST.\n"
 	"                         Default for HOST is 127.0.0.1\n"
 	"                         Default for PORT is "
-	) << DPORT << "\n\n";
+	) << DPORT << "\n" << _(
+	" -D, --device=NAME       Talk to the Psion ncpd calls NAME, if it\n"
+	"                         serves more than one.\n"
+	) << _(
+	" -j, --jobs=N            Transfer up to N files at once with\n"
+	"                         mget and mput (default 3).\n"
+	) << "\n";
 }
 
 static void
@@ -75,6 +81,8 @@ static struct option opts[] = {
     {"help",     no_argument,       0, 'h'},
     {"version",  no_argument,       0, 'V'},
     {"port",     required_argument, 0, 'p'},
+    {"device",   required_argument, 0, 'D'},
+    {"jobs",     required_argument, 0, 'j'},
     {NULL,       0,                 0,  0 }
 };
 
@@ -133,8 +141,10 @@ main(int argc, char **argv)
     rclip *rc;
     ftp f;
     const char *host = "127.0.0.1";
+    const char *device = NULL;
     int status = 0;
     int sockNum = DPORT;
+    int jobs = 3;
 
     setlocale (LC_ALL, "");
     textdomain(PACKAGE);
@@ -145,7 +155,7 @@ main(int argc, char **argv)
 	sockNum = ntohs(se->s_port);
 
     while (1) {
-	int c = getopt_long(argc, argv, "hVp:", opts, NULL);
+	int c = getopt_long(argc, argv, "hVp:D:j:", opts, NULL);
 	if (c == -1)
 	    break;
 	switch (c) {
@@ -161,6 +171,12 @@ main(int argc, char **argv)
 	    case 'p':
 		parse_destination(optarg, &host, &sockNum);
 		break;
+	    case 'D':
+		device = optarg;
+		break;
+	    case 'j':
+		jobs = atoi(optarg);
+		break;
 	}
     }
     if (optind == argc)
@@ -176,17 +192,18 @@ main(int argc, char **argv)
 	cout << _("plpftp: could not connect to ncpd") << endl;
 	return 1;
     }
-    rfsvfactory *rf = new rfsvfactory(skt);
-    rpcsfactory *rp = new rpcsfactory(skt2);
+    rfsvfactory *rf = new rfsvfactory(skt, device);
+    rpcsfactory *rp = new rpcsfactory(skt2, device);
     a = rf->create(false);
     r = rp->create(false);
     rclipSocket = new ppsocket();
     rclipSocket->connect(NULL, sockNum);
     if (rclipSocket)
-        rc = new rclip(rclipSocket);
+        rc = new rclip(rclipSocket, device);
     f.canClip = rclipSocket && rc ? true : false;
     if ((a != NULL) && (r != NULL)) {
         vector<char *> args(argv + optind, argv + argc);
+	f.setConnection(host, sockNum, device, jobs);
 	status = f.session(*a, *r, *rc, *rclipSocket, args);
 	delete r;
 	delete a;
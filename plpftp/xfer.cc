@@ -0,0 +1,251 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <plpintl.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "xfer.h"
+
+using namespace std;
+
+/**
+ * How often a file is tried before it is given up.
+ */
+#define XFER_TRIES 3
+
+static double
+now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static string
+humanSize(double n)
+{
+    static const char *units[] = { "B", "KB", "MB", "GB" };
+    char buf[32];
+    int u = 0;
+
+    while ((n >= 1024) && (u < 3)) {
+	n /= 1024;
+	u++;
+    }
+    snprintf(buf, sizeof(buf), u ? "%.1f %s" : "%.0f %s", n, units[u]);
+    return buf;
+}
+
+static bool
+bySize(const xferJob &a, const xferJob &b)
+{
+    return a.size < b.size;
+}
+
+int
+xferProgress(void *p, uint32_t n)
+{
+    xferQueue::worker *w = (xferQueue::worker *)p;
+    xferQueue *q = w->q;
+    int ret;
+
+    pthread_mutex_lock(&q->lock);
+    q->bytesInFlight += n - w->current;
+    w->current = n;
+    ret = !q->aborted && q->check(NULL, q->bytesDone + q->bytesInFlight);
+    if (!ret)
+	q->aborted = true;
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
+
+void *
+xferWorker(void *p)
+{
+    xferQueue::worker *w = (xferQueue::worker *)p;
+    xferQueue *q = w->q;
+    Enum<rfsv::errs> res;
+    xferJob job;
+
+    while (q->next(w, job)) {
+	if (q->get)
+	    res = w->a->copyFromPsion(job.from.c_str(), job.to.c_str(), w, xferProgress);
+	else
+	    res = w->a->copyToPsion(job.from.c_str(), job.to.c_str(), w, xferProgress);
+	q->finish(w, job, res);
+    }
+    return NULL;
+}
+
+xferQueue::
+xferQueue(bool _get)
+    : get(_get), check(NULL), aborted(false), running(0),
+      files(0), filesDone(0), bytes(0), bytesDone(0), bytesInFlight(0),
+      startTime(0)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cond, NULL);
+}
+
+xferQueue::
+~xferQueue()
+{
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+}
+
+void xferQueue::
+add(const string &from, const string &to, uint32_t size)
+{
+    xferJob job;
+
+    job.from = from;
+    job.to = to;
+    job.size = size;
+    job.tries = 0;
+    job.res = rfsv::E_PSI_GEN_NONE;
+    todo.push_back(job);
+    files++;
+    bytes += size;
+}
+
+bool xferQueue::
+next(worker *w, xferJob &job)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&lock);
+    if (w->a && !aborted && !todo.empty()) {
+	job = todo.front();
+	todo.pop_front();
+	w->current = 0;
+	ret = true;
+    } else {
+	running--;
+	pthread_cond_signal(&cond);
+    }
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+void xferQueue::
+finish(worker *w, xferJob &job, Enum<rfsv::errs> res)
+{
+    bool broken = false;
+
+    // Don't hold the lock while talking to the Psion.
+    if (res != rfsv::E_PSI_GEN_NONE)
+	broken = (w->a->getStatus() != rfsv::E_PSI_GEN_NONE);
+
+    pthread_mutex_lock(&lock);
+    bytesInFlight -= w->current;
+    w->current = 0;
+    if (res == rfsv::E_PSI_GEN_NONE) {
+	filesDone++;
+	bytesDone += job.size;
+    } else {
+	job.res = res;
+	if (aborted || (res == rfsv::E_PSI_FILE_CANCEL))
+	    failed.push_back(job);
+	else if (++job.tries < XFER_TRIES)
+	    todo.push_back(job);
+	else
+	    failed.push_back(job);
+    }
+    // A session whose link has gone is of no further use. Its
+    // last file has been requeued for the other sessions.
+    if (broken)
+	w->a = NULL;
+    pthread_mutex_unlock(&lock);
+}
+
+void xferQueue::
+status(bool last)
+{
+    double elapsed = now() - startTime;
+    uint64_t done = bytesDone + bytesInFlight;
+    double rate = (elapsed > 0) ? done / elapsed : 0;
+
+    cout << "\r" << filesDone << "/" << files << _(" files, ")
+	 << humanSize(done) << "/" << humanSize(bytes) << ", "
+	 << humanSize(rate) << "/s";
+    if (!last && (rate > 0)) {
+	long eta = (long)((bytes - done) / rate);
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%ld:%02ld", eta / 60, eta % 60);
+	cout << _(", ETA ") << buf;
+    }
+    cout << "    ";
+    if (last)
+	cout << endl;
+    cout.flush();
+}
+
+int xferQueue::
+run(vector<rfsv *> &sessions, cpCallback_t _check)
+{
+    vector<worker> workers(min(sessions.size(), todo.size()));
+    size_t started;
+
+    check = _check;
+    aborted = false;
+    stable_sort(todo.begin(), todo.end(), bySize);
+    startTime = now();
+
+    pthread_mutex_lock(&lock);
+    for (started = 0; started < workers.size(); started++) {
+	workers[started].q = this;
+	workers[started].a = sessions[started];
+	workers[started].current = 0;
+	if (pthread_create(&workers[started].thread, NULL, xferWorker, &workers[started]) != 0)
+	    break;
+	running++;
+    }
+    while (running > 0) {
+	struct timespec ts;
+	struct timeval tv;
+
+	status(false);
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec + 1;
+	ts.tv_nsec = tv.tv_usec * 1000;
+	pthread_cond_timedwait(&cond, &lock, &ts);
+    }
+    pthread_mutex_unlock(&lock);
+
+    for (size_t i = 0; i < started; i++)
+	pthread_join(workers[i].thread, NULL);
+    status(true);
+
+    // Whatever is left over had no session left to go to.
+    while (!todo.empty()) {
+	failed.push_back(todo.front());
+	todo.pop_front();
+    }
+    return failed.size();
+}
@@ -0,0 +1,128 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _xfer_h_
+#define _xfer_h_
+
+#include "config.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+#include "rfsv.h"
+#include "Enum.h"
+
+/**
+ * A single file transfer of a @ref xferQueue .
+ */
+struct xferJob {
+    std::string from;
+    std::string to;
+    uint32_t size;
+    int tries;
+    Enum<rfsv::errs> res;
+};
+
+/**
+ * A queue of file transfers in one direction, which is worked off
+ * by several @ref rfsv sessions in parallel.
+ *
+ * Each session gets its own thread and takes the next file from the
+ * queue when it is done with the previous one. The smallest files
+ * are sent first, so the open and close round trips of many small
+ * files overlap with each other and with the data of the big ones.
+ * A failed file is put back at the end of the queue and retried, on
+ * another session if there is one. A session whose connection has
+ * broken is not used any more.
+ *
+ * While the transfer runs, a single status line with the number of
+ * files and bytes done, the overall rate and the estimated time left
+ * is updated once a second.
+ */
+class xferQueue {
+public:
+    /**
+    * Constructs an empty queue.
+    *
+    * @param get true to copy from the Psion, false to copy to it.
+    */
+    xferQueue(bool get);
+    ~xferQueue();
+
+    /**
+    * Adds a file to the queue.
+    */
+    void add(const std::string &from, const std::string &to, uint32_t size);
+
+    /**
+    * Transfers all queued files.
+    *
+    * @param sessions The sessions to use, at least one.
+    * @param check Called regularly with the total number of bytes
+    *        transferred. If it returns 0, all transfers are aborted.
+    *
+    * @returns The number of files which could not be transferred.
+    */
+    int run(std::vector<rfsv *> &sessions, cpCallback_t check);
+
+    /**
+    * Returns the files which could not be transferred, with their
+    * last error, after @ref run .
+    */
+    const std::vector<xferJob> &getFailed() const { return failed; }
+
+    bool empty() const { return todo.empty(); }
+
+private:
+    struct worker {
+	xferQueue *q;
+	rfsv *a;
+	uint32_t current;
+	pthread_t thread;
+    };
+
+    friend void *xferWorker(void *);
+    friend int xferProgress(void *, uint32_t);
+
+    bool next(worker *w, xferJob &job);
+    void finish(worker *w, xferJob &job, Enum<rfsv::errs> res);
+    void status(bool last);
+
+    bool get;
+    std::deque<xferJob> todo;
+    std::vector<xferJob> failed;
+    cpCallback_t check;
+    bool aborted;
+    int running;
+
+    uint32_t files;
+    uint32_t filesDone;
+    uint64_t bytes;
+    uint64_t bytesDone;
+    uint64_t bytesInFlight;
+    double startTime;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+#endif
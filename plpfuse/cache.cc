@@ -0,0 +1,434 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <plpdirent.h>
+#include <plpmanifest.h>
+#include <psitime.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "rfsv_api.h"
+
+#ifndef ENOMEDIUM
+#define ENOMEDIUM ENODEV
+#endif
+
+/* How often the tree is written while it changes, in seconds */
+#define TREE_SAVE_INTERVAL 60
+
+using namespace std;
+
+/*
+ * A file opened through the cache.
+ */
+struct openFile {
+    int fd;
+    bool filling;	// being read from the Psion into tmp
+    uint32_t done;	// bytes of tmp filled so far
+    string key;
+    string tmp;
+    PlpManifestEntry entry;
+};
+
+static string cacheDir;
+static int64_t maxSize;
+static int64_t usedSize;
+static PlpManifest contents;	// by key
+static PlpManifest tree;	// everything seen, by path
+static bool treeDirty;
+static time_t treeSaved;
+
+/*
+ * Paths as used by plpfuse, with '/' as separator and no trailing
+ * separator. The tree is indexed with these, the contents with their
+ * lower case version, as EPOC file names are case insensitive.
+ */
+static string
+pathOf(const char *name)
+{
+    string path(name);
+
+    for (size_t i = 0; i < path.size(); i++)
+	if (path[i] == '\\')
+	    path[i] = '/';
+    while (!path.empty() && path[path.size() - 1] == '/')
+	path.erase(path.size() - 1);
+    return path;
+}
+
+static string
+keyOf(const char *name)
+{
+    string key = pathOf(name);
+
+    for (size_t i = 0; i < key.size(); i++)
+	key[i] = tolower(key[i]);
+    return key;
+}
+
+/*
+ * The file holding the contents of key, named by a 64 bit FNV-1a
+ * hash, so that deep paths don't hit name length limits.
+ */
+static string
+dataFile(const string &key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    char buf[20];
+
+    for (size_t i = 0; i < key.size(); i++)
+	h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return cacheDir + buf;
+}
+
+static void
+saveIndex()
+{
+    if (!contents.save((cacheDir + "index").c_str()))
+	debuglog("cache: could not save index");
+}
+
+static void
+saveTree(bool force)
+{
+    time_t now = time(NULL);
+
+    if (!treeDirty || (!force && now - treeSaved < TREE_SAVE_INTERVAL))
+	return;
+    if (tree.save((cacheDir + "tree").c_str())) {
+	treeDirty = false;
+	treeSaved = now;
+    } else
+	debuglog("cache: could not save tree");
+}
+
+static bool
+drop(const string &key)
+{
+    PlpManifest::iterator i = contents.find(key);
+
+    if (i == contents.end())
+	return false;
+    usedSize -= i->second.size;
+    unlink(dataFile(key).c_str());
+    contents.erase(key);
+    return true;
+}
+
+/*
+ * The keys of m below directory path, at any depth.
+ */
+static vector<string>
+keysBelow(PlpManifest &m, const string &path)
+{
+    string prefix = path + "/";
+    vector<string> keys;
+
+    for (PlpManifest::iterator i = m.lower_bound(prefix);
+	 i != m.end() && i->first.compare(0, prefix.size(), prefix) == 0; i++)
+	keys.push_back(i->first);
+    return keys;
+}
+
+/*
+ * Removes the least recently used files, by modification time of
+ * their data file, until the cache fits into maxSize.
+ */
+static void
+evict()
+{
+    vector<pair<time_t, string> > files;
+    struct stat st;
+
+    if (usedSize <= maxSize)
+	return;
+    for (PlpManifest::iterator i = contents.begin(); i != contents.end(); i++)
+	files.push_back(make_pair(stat(dataFile(i->first).c_str(), &st) ? 0 : st.st_mtime,
+				  i->first));
+    sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size() && usedSize > maxSize; i++) {
+	debuglog("cache: evicting %s", files[i].second.c_str());
+	drop(files[i].second);
+    }
+}
+
+int cache_init(const char *dir, int64_t maxsize) {
+    char *real;
+
+    // plpfuse changes to / when it becomes a daemon.
+    if ((mkdir(dir, 0700) != 0 && errno != EEXIST) || !(real = realpath(dir, NULL)))
+	return -errno;
+    cacheDir = string(real) + "/";
+    free(real);
+    maxSize = maxsize;
+    contents.load((cacheDir + "index").c_str());
+    tree.load((cacheDir + "tree").c_str());
+    treeSaved = time(NULL);
+    usedSize = 0;
+    for (PlpManifest::iterator i = contents.begin(); i != contents.end(); i++)
+	usedSize += i->second.size;
+    evict();
+    return 0;
+}
+
+int cache_enabled(void) {
+    return !cacheDir.empty();
+}
+
+void cache_save(void) {
+    if (!cache_enabled())
+	return;
+    saveIndex();
+    saveTree(true);
+}
+
+void cache_seen(const char *name, PlpDirent &e) {
+    if (!cache_enabled())
+	return;
+    tree.set(pathOf(name), PlpManifestEntry(e));
+    treeDirty = true;
+    saveTree(false);
+}
+
+void cache_listed(const char *dir, PlpDir &entries) {
+    if (!cache_enabled())
+	return;
+    string prefix = pathOf(dir) + "/";
+
+    // Forget the old children; grandchildren are kept, they go when
+    // their own directory is listed or found missing.
+    vector<string> gone;
+    for (PlpManifest::iterator i = tree.lower_bound(prefix);
+	 i != tree.end() && i->first.compare(0, prefix.size(), prefix) == 0; i++)
+	if (i->first.find('/', prefix.size()) == string::npos)
+	    gone.push_back(i->first);
+    for (size_t j = 0; j < gone.size(); j++)
+	tree.erase(gone[j]);
+    for (PlpDir::iterator d = entries.begin(); d != entries.end(); d++)
+	tree.set(prefix + d->getName(), PlpManifestEntry(*d));
+    treeDirty = true;
+    saveTree(false);
+}
+
+void cache_forget(const char *name) {
+    if (!cache_enabled())
+	return;
+    // A removed or renamed directory takes everything below it along.
+    string path = pathOf(name);
+    vector<string> gone = keysBelow(tree, path);
+    if (tree.find(path) != tree.end())
+	gone.push_back(path);
+    for (size_t j = 0; j < gone.size(); j++)
+	tree.erase(gone[j]);
+    if (!gone.empty())
+	treeDirty = true;
+
+    string key = keyOf(name);
+    bool dropped = drop(key);
+    gone = keysBelow(contents, key);
+    for (size_t j = 0; j < gone.size(); j++)
+	dropped |= drop(gone[j]);
+    if (dropped)
+	saveIndex();
+}
+
+int cache_open(const char *name, int flags, uint64_t *handle) {
+    PlpDirent e;
+    int ret;
+
+    *handle = 0;
+    if (!cache_enabled())
+	return 0;
+    ret = rfsv_geteattr(name, e);
+    if (ret == -ENODEV) {
+	// Offline: serve what we have, without checking.
+	if ((flags & O_ACCMODE) != O_RDONLY)
+	    return -EROFS;
+	string key = keyOf(name);
+	if (contents.find(key) == contents.end())
+	    return -ENOMEDIUM;
+	int fd = open(dataFile(key).c_str(), O_RDONLY);
+	if (fd == -1)
+	    return -ENOMEDIUM;
+	openFile *f = new openFile;
+	f->fd = fd;
+	f->filling = false;
+	*handle = (uintptr_t)f;
+	return 0;
+    }
+    if (ret != 0 || (flags & O_ACCMODE) != O_RDONLY)
+	return 0;
+
+    string key = keyOf(name);
+    PlpManifestEntry current(e);
+    PlpManifest::iterator i = contents.find(key);
+    openFile *f = new openFile;
+    f->key = key;
+    f->entry = current;
+    if (i != contents.end() && i->second == current &&
+	(f->fd = open(dataFile(key).c_str(), O_RDONLY)) != -1) {
+	debuglog("cache: %s is cached", name);
+	futimens(f->fd, NULL);	// for LRU
+	f->filling = false;
+	*handle = (uintptr_t)f;
+	return 1;
+    }
+    if (i != contents.end()) {
+	drop(key);
+	saveIndex();
+    }
+    if (current.size > maxSize / 2) {
+	delete f;
+	return 0;
+    }
+    f->tmp = dataFile(key) + ".tmp";
+    if ((f->fd = open(f->tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600)) == -1) {
+	delete f;
+	return 0;
+    }
+    f->filling = true;
+    f->done = 0;
+    *handle = (uintptr_t)f;
+    return 0;
+}
+
+int cache_read(uint64_t handle, char *buf, long offset, long len, const char *name) {
+    openFile *f = (openFile *)(uintptr_t)handle;
+    long ret;
+
+    if (!f->filling) {
+	ret = pread(f->fd, buf, len, offset);
+	return ret < 0 ? -errno : ret;
+    }
+    ret = rfsv_read(buf, offset, len, name);
+    // Only a read from start to end is kept.
+    if (ret > 0 && offset == (long)f->done) {
+	if (pwrite(f->fd, buf, ret, offset) == ret)
+	    f->done += ret;
+	else
+	    f->filling = false;
+    } else if (ret < 0 || offset > (long)f->done)
+	f->filling = false;
+    return ret;
+}
+
+void cache_release(uint64_t handle) {
+    openFile *f = (openFile *)(uintptr_t)handle;
+
+    if (f->filling) {
+	if (f->done == f->entry.size && close(f->fd) == 0 &&
+	    rename(f->tmp.c_str(), dataFile(f->key).c_str()) == 0) {
+	    debuglog("cache: stored %s", f->key.c_str());
+	    // Another key with the same hash has just been overwritten.
+	    string file = dataFile(f->key);
+	    vector<string> clash;
+	    for (PlpManifest::iterator i = contents.begin(); i != contents.end(); i++)
+		if (i->first != f->key && dataFile(i->first) == file)
+		    clash.push_back(i->first);
+	    for (size_t j = 0; j < clash.size(); j++) {
+		usedSize -= contents.find(clash[j])->second.size;
+		contents.erase(clash[j]);
+	    }
+	    contents.set(f->key, f->entry);
+	    usedSize += f->entry.size;
+	    evict();
+	    saveIndex();
+	} else {
+	    close(f->fd);
+	    unlink(f->tmp.c_str());
+	}
+    } else
+	close(f->fd);
+    delete f;
+}
+
+int cache_getattr(const char *name, long *attr, long *size, long *time) {
+    PlpManifest::iterator i = tree.find(pathOf(name));
+
+    if (i == tree.end())
+	return cache_enabled() ? -ENOENT : -ENODEV;
+    *attr = i->second.attr;
+    *size = i->second.size;
+    *time = PsiTime::psiToUnix(i->second.timeHi, i->second.timeLo);
+    return 0;
+}
+
+int cache_dir(const char *name, dentry **e) {
+    string prefix = pathOf(name) + "/";
+
+    if (!cache_enabled())
+	return -ENODEV;
+    for (PlpManifest::iterator i = tree.lower_bound(prefix);
+	 i != tree.end() && i->first.compare(0, prefix.size(), prefix) == 0; i++) {
+	if (i->first.find('/', prefix.size()) != string::npos)
+	    continue;
+	dentry *tmp = *e;
+	*e = (dentry *)calloc(1, sizeof(dentry));
+	if (!*e)
+	    return -ENOMEM;
+	(*e)->time = PsiTime::psiToUnix(i->second.timeHi, i->second.timeLo);
+	(*e)->size = i->second.size;
+	(*e)->attr = i->second.attr;
+	(*e)->name = strdup(i->first.c_str() + prefix.size());
+	(*e)->next = tmp;
+    }
+    return 0;
+}
+
+int cache_drivelist(int *cnt, device **dlist) {
+    bool seen[26] = { false };
+
+    *dlist = NULL;
+    if (!cache_enabled())
+	return -ENODEV;
+    for (PlpManifest::iterator i = tree.begin(); i != tree.end(); i++) {
+	int letter = toupper(i->first[0]) - 'A';
+	if (letter < 0 || letter >= 26 || seen[letter])
+	    continue;
+	seen[letter] = true;
+
+	device *next = *dlist;
+	*dlist = (device *)calloc(1, sizeof(device));
+	if (!*dlist)
+	    return -ENOMEM;
+	(*dlist)->next = next;
+	(*dlist)->name = strdup("");
+	(*dlist)->letter = 'A' + letter;
+	(*dlist)->attrib = PSI_A_DIR;
+	(*cnt)++;
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _cache_h_
+#define _cache_h_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "plpfuse.h"
+
+/*
+ * The optional on-disk cache of plpfuse.
+ *
+ * File contents are stored in a local directory, together with the
+ * size, modification time and UIDs of the file on the Psion when it
+ * was read. A file opened for reading is served from there if these
+ * still match; otherwise it is read from the Psion and stored on the
+ * way, if it is read from start to end. The least recently used
+ * files are removed when the cache grows beyond its size limit.
+ *
+ * The cache also remembers every file and directory seen, so that
+ * the last known tree can be shown, read-only, while the Psion is
+ * disconnected.
+ */
+
+extern int cache_init(const char *dir, int64_t maxsize);
+extern int cache_enabled(void);
+extern void cache_save(void);
+
+extern int cache_open(const char *name, int flags, uint64_t *handle);
+extern int cache_read(uint64_t handle, char *buf, long offset, long len, const char *name);
+extern void cache_release(uint64_t handle);
+
+/* Offline versions of the rfsv_api functions */
+extern int cache_getattr(const char *name, long *attr, long *size, long *time);
+extern int cache_dir(const char *name, dentry **e);
+extern int cache_drivelist(int *cnt, device **dlist);
+
+extern void cache_forget(const char *name);
+
+#ifdef __cplusplus
+}
+
+#include <rfsv.h>
+
+extern void cache_seen(const char *name, PlpDirent &e);
+extern void cache_listed(const char *dir, PlpDir &entries);
+#endif
+
+#endif
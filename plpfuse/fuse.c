@@ -16,8 +16,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/time.h>
 #include <syslog.h>
+#include <time.h>
 #ifdef HAVE_ATTR_XATTR_H
 #include <attr/xattr.h>
 #else
@@ -32,6 +37,7 @@
 
 #include "plpfuse.h"
 #include "rfsv_api.h"
+#include "cache.h"
 
 /* Name of our extended attribute */
 #define XATTR_NAME "user.epoc"
@@ -121,11 +127,7 @@ pattr2xattr(long psiattr, char *xattr)
 static void
 pattr2attr(long psiattr, long size, long ftime, struct stat *st, char *xattr)
 {
-  struct fuse_context *ct = fuse_get_context();
-
   memset(st, 0, sizeof(*st));
-  st->st_uid = ct->uid;
-  st->st_gid = ct->gid;
 
   if (psiattr & PSI_A_DIR) {
     st->st_mode = 0700 | S_IFDIR;
@@ -147,455 +149,1659 @@ pattr2attr(long psiattr, long size, long ftime, struct stat *st, char *xattr)
   pattr2xattr(psiattr, xattr);
 }
 
+/* How long the drive list is trusted, in seconds */
+#define DEVICE_TTL 30
+
+static double
+monotime(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9 + 1; /* never 0 */
+}
+
 static device *devices;
+static double devices_time; /* when devices was read; 0 if invalid */
+static double attrs_valid;  /* cached attributes older than this are invalid */
+
+static void neg_flush(void);
+
+static void
+invalidate_devices(void)
+{
+  devices_time = 0;
+  attrs_valid = monotime();
+  neg_flush();
+}
 
+/*
+ * Read the drive list, unless the cached one is younger than DEVICE_TTL.
+ * It is kept up to date between reads by account_space, as far as our
+ * own changes are concerned.
+ */
 static int
 query_devices(void)
 {
   device *dp, *np;
   int link_count = 2;	/* set the root link count */
+  double now = monotime();
 
+  if (devices_time && now - devices_time < DEVICE_TTL)
+    return 0;
+  debuglog("reading drive list");
   for (dp = devices; dp; dp = np) {
     np = dp->next;
     free(dp->name);
     free(dp);
   }
   devices = NULL;
+  invalidate_devices();
   if (rfsv_drivelist(&link_count, &devices))
     return 1;
+  devices_time = now;
   return 0;
 }
 
-static char *
-dirname(const char *dir)
+static device *
+find_device(const char *path)
 {
-  static char *namebuf = NULL;
-  if (namebuf)
-    free(namebuf);
-  if (asprintf(&namebuf, "%s\\", dir) == -1)
-    return NULL;
-  return namebuf;
-}
+  device *dp;
 
-static const char *
-filname(const char *dir)
-{
-  char *p;
-  if ((p = (char *) rindex(dir, '\\')))
-    return p + 1;
-  else
-    return dir;
+  for (dp = devices; dp; dp = dp->next)
+    if (dp->letter == toupper(path[0]))
+      break;
+  return dp;
 }
 
-static int
-dircount(const char *path, long *count)
+/*
+ * Adjust the cached free space of the drive of path by our own change,
+ * so that statfs needn't ask the Psion. Writes are counted in full,
+ * even when they overwrite existing data; the next read of the drive
+ * list corrects that.
+ */
+static void
+account_space(const char *path, long used)
 {
-  dentry *e = NULL;
-  long ret = 0;
-
-  *count = 0;
-  debuglog("dircount: %s", path);
-  debuglog("RFSV dir %s", path);
-  if ((ret = rfsv_dir(dirname(path), &e)) != 0)
-    return ret;
-  while (e) {
-    struct stat st;
-    dentry *o = e;
-    char xattr[XATTR_MAXLEN + 1];
-    pattr2attr(e->attr, e->size, e->time, &st, xattr);
-    free(e->name);
-    e = e->next;
-    free(o);
-    if (st.st_nlink > 1)
-      (*count)++;
-  }
+  device *dp;
 
-  debuglog("count %d", *count);
-  return ret;
+  if (!devices_time || !(dp = find_device(path)))
+    return;
+  dp->free -= used;
+  if (dp->free < 0)
+    dp->free = 0;
+  if (dp->free > dp->total)
+    dp->free = dp->total;
 }
 
-static int getlinks(const char *path, struct stat *st)
+/*
+ * Errors which mean that a drive has gone or changed.
+ */
+static int
+check_media(int ret)
 {
-  long dcount;
-  int ret = dircount(path, &dcount);
-  if (ret == 0)
-    st->st_nlink = dcount + 2;
+  if (ret == -ENODEV || ret == -EBUSY)
+    invalidate_devices();
   return ret;
 }
 
-static int plp_getattr(const char *path, struct stat *st)
+/*
+ * Negative lookup cache.
+ *
+ * File managers and shells look for lots of files which don't exist on
+ * an EPOC device, each costing a round trip. Names which getattr found
+ * missing are remembered for negative_ttl seconds, or until something
+ * is created in their directory by us. Every directory has a generation
+ * number, found by hashing its name, which is bumped on every change;
+ * an entry is only valid while the generation of its directory is the
+ * one it was made with. Directories with the same hash share their
+ * generation, which merely costs an extra lookup now and then.
+ *
+ * Names matching one of the ignore patterns are not even looked up,
+ * unless something has been created in their directory by us, or a
+ * listing of it has shown such a name to really exist there.
+ */
+#define NEG_BUCKETS 256
+#define NEG_MAX     1024
+#define GEN_BUCKETS 256
+
+typedef struct negentry {
+  char *path;
+  unsigned gen;
+  double when;
+  struct negentry *next;
+} negentry;
+
+int negative_ttl = 30;
+
+static negentry *negcache[NEG_BUCKETS];
+static int negcount;
+static unsigned dirgen[GEN_BUCKETS];
+
+static char *ignore_buf, **ignore_list;
+
+/* Case insensitive, like EPOC file names */
+static unsigned
+hash_name(const char *s, size_t len)
 {
-  char xattr[XATTR_MAXLEN + 1];
-  int ret = 0;
+  unsigned h = 2166136261u;
 
-  debuglog("plp_getattr `%s'", ++path);
-
-  if (strcmp(path, "") == 0) {
-    pattr2attr(PSI_A_DIR, 0, 0, st, xattr);
-    if (!query_devices()) {
-      device *dp;
-                
-      for (dp = devices; dp; dp = dp->next)
-        st->st_nlink++;
-      debuglog("root has %d links", st->st_nlink);
-    } else
-      return rfsv_isalive() ? -ENOENT : -ENOMEDIUM;
-  } else {
-    long pattr, psize, ptime;
-
-    if (strlen(path) == 2 && path[1] == ':') {
-      debuglog("getattr: device");
-      if (!query_devices()) {
-        device *dp;
-                
-        for (dp = devices; dp; dp = dp->next) {
-          debuglog("cmp '%c', '%c'", dp->letter,
-                   path[0]);
-          if (dp->letter == path[0])
-            break;
-        }
-        debuglog("device: %s", dp ? "exists" : "does not exist");
-        pattr2attr(PSI_A_DIR, 0, 0, st, xattr);
-        return getlinks(path, st);
-      } else
-        return rfsv_isalive() ? -ENOENT : -ENOMEDIUM;
-    }
+  while (len--)
+    h = (h ^ tolower((unsigned char)*s++)) * 16777619u;
+  return h;
+}
 
-    debuglog("getattr: fileordir");
-    if ((ret = rfsv_getattr(path, &pattr, &psize, &ptime)) == 0) {
-      pattr2attr(pattr, psize, ptime, st, xattr);
-      debuglog(" attrs Psion: %x %d %d, UNIX modes: %o, xattrs: %s", pattr, psize, ptime, st->st_mode, xattr);
-      if (st->st_nlink > 1)
-        ret = getlinks(path, st);
-    }
-  }
+static size_t
+parent_len(const char *path)
+{
+  const char *p = strrchr(path, '/');
 
-  debuglog("getattr: returned %d", ret);
-  return ret;
+  return p ? (size_t)(p - path) : 0;
 }
 
-static int plp_access(const char *path, int mask)
+static unsigned *
+dir_generation(const char *path)
 {
-  (void)mask;
-  debuglog("plp_access `%s'", ++path);
-  return 0;
+  return &dirgen[hash_name(path, parent_len(path)) % GEN_BUCKETS];
 }
 
-static int plp_readlink(const char *path, char *buf, size_t size)
+/* Something has been created in the directory of path */
+static void
+changed_dir(const char *path)
 {
-  (void)buf;
-  (void)size;
-  debuglog("plp_readlink `%s'", ++path);
-  return -EINVAL;
+  (*dir_generation(path))++;
 }
 
-
-static int plp_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                       off_t offset, struct fuse_file_info *fi)
+/* The generation of directory dir itself */
+static unsigned *
+generation_of(const char *dir)
 {
-  device *dp;
-  dentry *e = NULL;
-  char xattr[XATTR_MAXLEN + 1];
-
-  debuglog("plp_readdir `%s'", ++path);
-
-  (void)offset;
-  (void)fi;
+  return &dirgen[hash_name(dir, strlen(dir)) % GEN_BUCKETS];
+}
 
-  if (strcmp(path, "") == 0) {
-    debuglog("readdir root");
-    if (query_devices() == 0) {
-      for (dp = devices; dp; dp = dp->next) {
-        struct stat st;
-        unsigned char name[3];
+/* Something has changed in directory dir on the Psion */
+static void
+changed_in(const char *dir)
+{
+  (*generation_of(dir))++;
+}
 
-        name[0] = dp->letter;
-        name[1] = ':';
-        name[2] = '\0';
-        pattr2attr(dp->attrib, 1, 0, &st, xattr);
-        if (filler(buf, (char *)name, &st, 0))
-          break;
-      }
+static void
+neg_flush(void)
+{
+  int i;
+
+  for (i = 0; i < NEG_BUCKETS; i++)
+    while (negcache[i]) {
+      negentry *n = negcache[i];
+      negcache[i] = n->next;
+      free(n->path);
+      free(n);
     }
-  } else {
-    int ret;
-    debuglog("RFSV dir `%s'", dirname(path));
-    if ((ret = rfsv_dir(dirname(path), &e)) != 0)
-      return ret;
-
-    debuglog("scanning contents");
-    while (e) {
-      dentry *o;
-      struct stat st;
-      const char *name = filname(e->name);
+  negcount = 0;
+}
 
-      pattr2attr(e->attr, e->size, e->time, &st, xattr);
-      debuglog("  %s %o %d %d", name, st.st_mode, st.st_size, st.st_mtime);
-      if (filler(buf, name, &st, 0))
-        break;
-      free(e->name);
-      o = e;
-      e = e->next;
-      free(o);
+static int
+neg_lookup(const char *path)
+{
+  negentry **np = &negcache[hash_name(path, strlen(path)) % NEG_BUCKETS];
+  negentry *n;
+
+  for (; (n = *np); np = &n->next)
+    if (strcasecmp(n->path, path) == 0) {
+      if (n->gen == *dir_generation(path) &&
+          monotime() - n->when < negative_ttl)
+        return 1;
+      *np = n->next;
+      free(n->path);
+      free(n);
+      negcount--;
+      return 0;
     }
-  }
-
-  debuglog("readdir OK");
   return 0;
 }
 
-static int plp_mknod(const char *path, mode_t mode, dev_t dev)
+static void
+neg_add(const char *path)
 {
-  int ret = -EINVAL;
+  negentry *n;
+  unsigned h;
 
-  debuglog("plp_mknod `%s' %o", ++path, mode);
+  if (negative_ttl <= 0)
+    return;
+  if (negcount >= NEG_MAX)
+    neg_flush();
+  if (!(n = malloc(sizeof(*n))) || !(n->path = strdup(path))) {
+    free(n);
+    return;
+  }
+  h = hash_name(path, strlen(path)) % NEG_BUCKETS;
+  n->gen = *dir_generation(path);
+  n->when = monotime();
+  n->next = negcache[h];
+  negcache[h] = n;
+  negcount++;
+}
 
-  if (S_ISREG(mode) && dev == 0) {
-    uint32_t phandle;
-    if ((ret = rfsv_fcreate(0x200, path, &phandle)) == 0)
-      rfsv_fclose(phandle);
+/*
+ * Set the ignore patterns, separated by colons, which EPOC doesn't
+ * allow in file names.
+ */
+void
+set_ignore_patterns(const char *patterns)
+{
+  char *p, **ip;
+  int n = 1;
+
+  free(ignore_buf);
+  free(ignore_list);
+  for (p = (char *)patterns; *p; p++)
+    if (*p == ':')
+      n++;
+  ignore_buf = strdup(patterns);
+  ignore_list = ip = calloc(n + 1, sizeof(char *));
+  if (!ignore_buf || !ignore_list) {
+    free(ignore_buf);
+    free(ignore_list);
+    ignore_buf = NULL;
+    ignore_list = NULL;
+    return;
   }
+  for (p = ignore_buf; (*ip = strsep(&p, ":")); )
+    if (**ip)
+      ip++;
+}
 
-  return ret;
+static int
+matches_ignore(const char *name)
+{
+  char **ip;
+
+  if (!ignore_list)
+    set_ignore_patterns(DEFAULT_IGNORE);
+  if (!ignore_list)
+    return 0;
+  for (ip = ignore_list; *ip; ip++)
+    if (fnmatch(*ip, name, FNM_NOESCAPE | FNM_CASEFOLD) == 0)
+      return 1;
+  return 0;
 }
 
-static int plp_mkdir(const char *path, mode_t mode)
+static int
+is_ignored(const char *path)
 {
-  debuglog("plp_mkdir `%s' %o", ++path, mode);
-  return rfsv_mkdir(path);
+  const char *name = path + parent_len(path);
+
+  if (*dir_generation(path))
+    return 0;
+  if (*name == '/')
+    name++;
+  return matches_ignore(name);
 }
 
-static int plp_unlink(const char *path)
+
+/*
+ * The inode table.
+ *
+ * The kernel knows files by node ids, which are given out here and
+ * mapped to Psion paths. Each inode also holds the attributes last
+ * read for it, which answer lookup and getattr while they are younger
+ * than ATTR_TTL seconds, whatever the kernel is told to keep. Listing
+ * a directory fills in the attributes of all files in it, so that the
+ * lookups which follow a readdir, as in "ls -l", don't need a request
+ * each.
+ *
+ * Inodes are kept while the kernel holds a reference to them, and
+ * otherwise only as a cache of attributes, which is dropped when the
+ * table grows beyond INO_MAX.
+ */
+#define INO_BUCKETS 1024
+#define INO_MAX     8192
+#define ATTR_TTL    1.0
+
+typedef struct inode {
+  fuse_ino_t ino;
+  char *path;             /* NULL once the file has gone */
+  unsigned long nlookup;  /* references held by the kernel */
+  struct stat st;
+  long pattr;             /* Psion attributes */
+  double attr_time;       /* when st was read; 0 if never */
+  struct inode *ino_next, *path_next;
+} inode;
+
+double entry_timeout = 1.0;
+double attr_timeout = 1.0;
+
+static inode *by_ino[INO_BUCKETS], *by_path[INO_BUCKETS];
+static fuse_ino_t next_ino = FUSE_ROOT_ID + 1;
+static int ninodes;
+
+static unsigned
+path_bucket(const char *path)
 {
-  debuglog("plp_unlink `%s'", ++path);
-  return rfsv_remove(path);
+  return hash_name(path, strlen(path)) % INO_BUCKETS;
 }
 
-static int plp_rmdir(const char *path)
+static inode *
+ino_get(fuse_ino_t ino)
 {
-  debuglog("plp_rmdir `%s'", ++path);
-  return rfsv_rmdir(path);
+  inode *ip;
+
+  for (ip = by_ino[ino % INO_BUCKETS]; ip; ip = ip->ino_next)
+    if (ip->ino == ino)
+      return ip;
+  return NULL;
 }
 
-static int plp_symlink(const char *from, const char *to)
+static inode *
+ino_find(const char *path)
 {
-  debuglog("plp_symlink `%s' -> `'%s'", ++from, ++to);
-  return -EPERM;
+  inode *ip;
+
+  for (ip = by_path[path_bucket(path)]; ip; ip = ip->path_next)
+    if (strcasecmp(ip->path, path) == 0)
+      return ip;
+  return NULL;
 }
 
-static int plp_rename(const char *from, const char *to)
+static void
+hash_path(inode *ip, char *path)
 {
-  debuglog("plp_rename `%s' -> `%s'", ++from, ++to);
-  rfsv_remove(to);
-  return rfsv_rename(from, to);
+  unsigned h = path_bucket(path);
+
+  ip->path = path;
+  ip->path_next = by_path[h];
+  by_path[h] = ip;
 }
 
-static int plp_link(const char *from, const char *to)
+static void
+unhash_path(inode *ip)
 {
-  debuglog("plp_link `%s' -> `%s'", ++from, ++to);
-  return -EPERM;
+  inode **pp;
+
+  if (!ip->path)
+    return;
+  for (pp = &by_path[path_bucket(ip->path)]; *pp; pp = &(*pp)->path_next)
+    if (*pp == ip) {
+      *pp = ip->path_next;
+      break;
+    }
+  free(ip->path);
+  ip->path = NULL;
 }
 
-static int plp_chmod(const char *path, mode_t mode)
+static void
+ino_free(inode *ip)
 {
-  int ret;
-  long psisattr, psidattr, pattr, psize, ptime;
-  struct stat st;
-  char xattr[XATTR_MAXLEN + 1];
+  inode **pp;
 
-  debuglog("plp_chmod `%s'", ++path);
+  unhash_path(ip);
+  for (pp = &by_ino[ip->ino % INO_BUCKETS]; *pp; pp = &(*pp)->ino_next)
+    if (*pp == ip) {
+      *pp = ip->ino_next;
+      break;
+    }
+  free(ip);
+  ninodes--;
+}
 
-  if ((ret = rfsv_getattr(path, &pattr, &psize, &ptime)) == 0) {
-    pattr2attr(pattr, psize, ptime, &st, xattr);
-    attr2pattr(st.st_mode, mode, "", "", &psisattr, &psidattr);
-    debuglog("  UNIX old, new: %o, %o; Psion set, clear: %x, %x", st.st_mode, mode, psisattr, psidattr);
-    if ((ret = rfsv_setattr(path, psisattr, psidattr)) == 0)
-      debuglog("chmod succeeded");
-  }
+static inode *
+ino_new(fuse_ino_t ino, const char *path)
+{
+  inode *ip;
+  char *p;
 
-  return ret;
+  if (!(ip = calloc(1, sizeof(*ip))) || !(p = strdup(path))) {
+    free(ip);
+    return NULL;
+  }
+  ip->ino = ino;
+  ip->ino_next = by_ino[ino % INO_BUCKETS];
+  by_ino[ino % INO_BUCKETS] = ip;
+  hash_path(ip, p);
+  ninodes++;
+  return ip;
 }
 
-static int plp_getxattr(const char *path, const char *name, char *value, size_t size
-#ifdef __APPLE__
-                        , _GL_UNUSED uint32_t position
-#endif
-                        )
-{
-  debuglog("plp_getxattr `%s' %s", ++path, name);
-  if (strcmp(name, XATTR_NAME) == 0) {
-    if (size >= XATTR_MAXLEN) {
-      long pattr, psize, ptime;
-      int ret;
-      if ((ret = rfsv_getattr(path, &pattr, &psize, &ptime)) == 0) {
-        pattr2xattr(pattr, value);
-        debuglog("getxattr succeeded: %s", value);
-        return strlen(value);
-      } else
-        return ret;
-    } else {
-      debuglog("only gave %d bytes, need %d", size, XATTR_MAXLEN);
-      return XATTR_MAXLEN;
+/*
+ * The inode of path, made if needed. Making one may drop inodes the
+ * kernel doesn't know about.
+ */
+static inode *
+ino_make(const char *path)
+{
+  inode *ip = ino_find(path);
+  int i;
+
+  if (ip)
+    return ip;
+  if (ninodes >= INO_MAX) {
+    debuglog("pruning inode table");
+    for (i = 0; i < INO_BUCKETS; i++) {
+      inode *np;
+      for (ip = by_ino[i]; ip; ip = np) {
+        np = ip->ino_next;
+        if (!ip->nlookup && ip->ino != FUSE_ROOT_ID)
+          ino_free(ip);
+      }
     }
-  } 
-  return 0;
+  }
+  return ino_new(next_ino++, path);
 }
 
-static int plp_setxattr(const char *path, const char *name, const char *value, size_t size, int flags
-#ifdef __APPLE__
-                        , _GL_UNUSED uint32_t position
-#endif
-                        )
+/* Path of name in directory dp, allocated */
+static char *
+child_path(inode *dp, const char *name)
 {
-  debuglog("plp_setxattr `%s'", ++path);
-  if (strcmp(name, XATTR_NAME) == 0) {
-    int ret;
-    long psisattr, psidattr;
-    char oxattr[XATTR_MAXLEN + 1], nxattr[XATTR_MAXLEN + 1];
-
-    if (flags & XATTR_CREATE)
-      return -EEXIST;
+  char *path;
 
-    strncpy(nxattr, value, size < XATTR_MAXLEN ? size : XATTR_MAXLEN);
-    nxattr[XATTR_MAXLEN] = '\0';
-    /* Need to undo earlier increment of path when calling plp_getxattr */
-    plp_getxattr(path - 1, name, oxattr, XATTR_MAXLEN
-#ifdef __APPLE__
-                 , 0
-#endif
-                 );
-    psisattr = psidattr = 0;
-    xattr2pattr(&psisattr, &psidattr, oxattr, value);
-    debuglog("attrs set %x delete %x; %s, %s", psisattr, psidattr, oxattr, value);
-    if ((ret = rfsv_setattr(path, psisattr, psidattr)) != 0)
-      return ret;
+  if (!dp->path || asprintf(&path, "%s%s%s", dp->path, *dp->path ? "/" : "", name) == -1)
+    return NULL;
+  return path;
+}
 
-    debuglog("setxattr succeeded");
-    return 0;
-  } else {
-    if (flags & XATTR_REPLACE)
-      return -ENOATTR;
-    else
-      return -ENOTSUP;
+/*
+ * The inodes of path and everything below it now live at newpath.
+ */
+static void
+ino_moved(const char *path, const char *newpath)
+{
+  size_t len = strlen(path);
+  inode *ip, *moved = NULL;
+  int i;
+
+  for (i = 0; i < INO_BUCKETS; i++)
+    for (ip = by_ino[i]; ip; ip = ip->ino_next)
+      if (ip->path && strncasecmp(ip->path, path, len) == 0 &&
+          (ip->path[len] == '\0' || ip->path[len] == '/')) {
+        /* Chain through path_next until they are hashed again */
+        char *p;
+        if (asprintf(&p, "%s%s", newpath, ip->path + len) == -1)
+          p = NULL;
+        unhash_path(ip);
+        ip->path = p;
+        ip->path_next = moved;
+        moved = ip;
+      }
+  while ((ip = moved)) {
+    moved = ip->path_next;
+    if (ip->path)
+      hash_path(ip, ip->path);
   }
 }
 
-static int plp_listxattr(const char *path, char *list, size_t size)
+/* The file or directory at path has gone */
+static void
+ino_removed(const char *path)
 {
-  debuglog("plp_listxattr `%s'", ++path);
-  if (size > sizeof(XATTR_NAME))
-    strcpy(list, XATTR_NAME);
-  return sizeof(XATTR_NAME);
+  inode *ip = ino_find(path);
+
+  if (ip) {
+    unhash_path(ip);
+    if (!ip->nlookup)
+      ino_free(ip);
+  }
 }
 
-static int plp_removexattr(const char *path, const char *name)
+/*
+ * Change detection.
+ *
+ * The kernel keeps names and attributes for entry_timeout and
+ * attr_timeout seconds without asking, so these can only be long if
+ * changes made on the Psion itself are noticed some other way. The
+ * directories and open files used most recently are watched by a
+ * thread, which compares the modification time and number of entries
+ * of a directory, or the modification time and size of a file, with
+ * what it saw last, and tells the kernel to forget whatever changed.
+ *
+ * An inode is checked WATCH_MIN seconds after it was used, and then
+ * at intervals doubling up to watch_interval seconds while it stays
+ * unchanged. Inodes unused for WATCH_EXPIRE seconds are no longer
+ * watched, and nor are the least recently used ones beyond WATCH_MAX.
+ */
+#define WATCH_MAX    64
+#define WATCH_MIN    2
+#define WATCH_EXPIRE 600
+
+typedef struct watch {
+  fuse_ino_t ino;   /* 0 if unused */
+  long time;        /* as last seen; -1 if unknown */
+  long size;        /* number of entries of a directory; -1 if unknown */
+  double used, due, interval;
+} watch;
+
+int watch_interval = 30;
+
+static watch watches[WATCH_MAX];
+
+/* Held while a request is handled, and while the Psion is checked */
+static pthread_mutex_t plp_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static watch *
+watch_find(fuse_ino_t ino)
 {
-  debuglog("plp_removexattr `%s'", ++path);
-  (void)name;
-  return -ENOTSUP;
+  int i;
+
+  for (i = 0; i < WATCH_MAX; i++)
+    if (watches[i].ino == ino)
+      return &watches[i];
+  return NULL;
 }
 
-static int plp_chown(const char *path, uid_t uid, gid_t gid)
+/*
+ * Note that ip is in use. count is the number of entries of a
+ * directory just listed, or -1.
+ */
+static void
+watch_use(inode *ip, long count)
 {
-  (void)uid;
-  (void)gid;
-  debuglog("plp_chown `%s'", ++path);
-  return -EPERM;
+  watch *w;
+  double now = monotime();
+  int i;
+
+  if (watch_interval <= 0 || !ip->path || !*ip->path)
+    return;
+  if (!(w = watch_find(ip->ino))) {
+    for (w = &watches[0], i = 1; i < WATCH_MAX; i++)
+      if (watches[i].used < w->used)
+        w = &watches[i];
+    w->ino = ip->ino;
+    w->time = w->size = -1;
+  }
+  /* What the kernel has been told is what counts */
+  if (ip->attr_time) {
+    w->time = ip->st.st_mtime;
+    if (!S_ISDIR(ip->st.st_mode))
+      w->size = ip->st.st_size;
+  }
+  if (count >= 0)
+    w->size = count;
+  w->used = now;
+  w->interval = watch_interval < WATCH_MIN ? watch_interval : WATCH_MIN;
+  w->due = now + w->interval;
 }
 
-static int plp_truncate(const char *path, off_t size)
+/* ip has been changed by us; take it as it is at the next check */
+static void
+watch_reset(inode *ip)
 {
-  debuglog("plp_truncate `%s'", ++path);
-  return rfsv_setsize(path, size);
+  watch *w = watch_find(ip->ino);
+
+  if (w)
+    w->time = w->size = -1;
 }
 
-static int plp_utimens(const char *path, const struct timespec ts[2])
+static int
+fresh(inode *ip)
 {
-  debuglog("plp_utimens `%s'", ++path);
-  return rfsv_setmtime(path, ts[1].tv_sec);
+  return ip->attr_time > attrs_valid && monotime() - ip->attr_time < ATTR_TTL;
 }
 
-static int plp_open(const char *path, struct fuse_file_info *fi)
+static void
+set_attr(inode *ip, const struct stat *st, long pattr)
 {
-  debuglog("plp_open `%s'", ++path);
-  (void)fi;
-  return 0;
+  ip->st = *st;
+  ip->st.st_ino = ip->ino;
+  ip->pattr = pattr;
+  ip->attr_time = monotime();
 }
 
-static int plp_read(const char *path, char *buf, size_t size, off_t offset,
-                    struct fuse_file_info *fi)
+static void
+stale(inode *ip)
 {
-  long read;
-
-  (void)fi;
-  debuglog("plp_read `%s' offset %lld size %ld", ++path, offset, size);
-  read = rfsv_read(buf, (long)offset, size, path);
-  debuglog("read returned %ld", read);
-  return read;
+  if (ip) {
+    ip->attr_time = 0;
+    watch_reset(ip);
+  }
 }
 
-static int plp_write(const char *path, const char *buf, size_t size,
-                     off_t offset, struct fuse_file_info *fi)
+/* Attributes are reported as belonging to whoever asks */
+static void
+set_owner(fuse_req_t req, struct stat *st)
 {
-  long written;
+  const struct fuse_ctx *ctx = fuse_req_ctx(req);
 
-  (void)fi;
-  debuglog("plp_write `%s' offset %lld size %ld", ++path, offset, size);
-  written = rfsv_write(buf, offset, size, path);
-  debuglog("write returned %ld", written);
-  return written;
+  st->st_uid = ctx->uid;
+  st->st_gid = ctx->gid;
 }
 
-static int plp_statfs(const char *path, struct statvfs *stbuf)
+static const char *
+filname(const char *dir)
 {
-  device *dp;
+  char *p;
+  if ((p = (char *) rindex(dir, '\\')))
+    return p + 1;
+  else
+    return dir;
+}
 
-  (void)path;
-  debuglog("plp_statfs");
+static int
+dircount(const char *path, long *count)
+{
+  dentry *e = NULL;
+  char *dir;
+  long ret = 0;
 
-  stbuf->f_bsize = BLOCKSIZE;
-  stbuf->f_frsize = BLOCKSIZE;
-  if (query_devices() == 0) {
-    for (dp = devices; dp; dp = dp->next) {
-      stbuf->f_blocks += (dp->total + BLOCKSIZE - 1) / BLOCKSIZE;
-      stbuf->f_bfree += (dp->free + BLOCKSIZE - 1) / BLOCKSIZE;
-    }
+  *count = 0;
+  debuglog("dircount: %s", path);
+  if (asprintf(&dir, "%s\\", path) == -1)
+    return -ENOMEM;
+  debuglog("RFSV dir %s", dir);
+  ret = rfsv_dir(dir, &e);
+  free(dir);
+  while (e) {
+    dentry *o = e;
+    if (e->attr & PSI_A_DIR)
+      (*count)++;
+    free(e->name);
+    e = e->next;
+    free(o);
   }
-  stbuf->f_bavail = stbuf->f_bfree;
 
-  /* Don't have numbers for these */
-  stbuf->f_files = 0;
-  stbuf->f_ffree = stbuf->f_favail = 0;
+  debuglog("count %d", *count);
+  return ret;
+}
 
-  stbuf->f_fsid = FID;
-  stbuf->f_flag = 0;    /* don't have mount flags */
-  stbuf->f_namemax = 255; /* KDMaxFileNameLen% */
-    
-  return 0;
+static int getlinks(const char *path, struct stat *st)
+{
+  long dcount;
+  int ret = dircount(path, &dcount);
+  if (ret == 0)
+    st->st_nlink = dcount + 2;
+  return ret;
 }
 
-struct fuse_operations plp_oper = {
+/*
+ * Read the attributes of path from the Psion.
+ */
+static int
+read_attr(const char *path, struct stat *st, long *pattr)
+{
+  char xattr[XATTR_MAXLEN + 1];
+  long psize, ptime;
+  int ret = 0;
+
+  *pattr = PSI_A_DIR;
+  if (strcmp(path, "") == 0) {
+    pattr2attr(PSI_A_DIR, 0, 0, st, xattr);
+    if (!query_devices()) {
+      device *dp;
+
+      for (dp = devices; dp; dp = dp->next)
+        st->st_nlink++;
+      debuglog("root has %d links", st->st_nlink);
+    } else
+      return rfsv_isalive() ? -ENOENT : -ENOMEDIUM;
+  } else if (strlen(path) == 2 && path[1] == ':') {
+    debuglog("getattr: device");
+    if (!query_devices()) {
+      device *dp = find_device(path);
+
+      debuglog("device: %s", dp ? "exists" : "does not exist");
+      if (!dp)
+        return -ENOENT;
+      pattr2attr(PSI_A_DIR, 0, 0, st, xattr);
+      return getlinks(path, st);
+    } else
+      return rfsv_isalive() ? -ENOENT : -ENOMEDIUM;
+  } else {
+    debuglog("getattr: fileordir");
+    if (is_ignored(path) || neg_lookup(path)) {
+      debuglog("getattr: known not to exist");
+      return -ENOENT;
+    }
+    if ((ret = check_media(rfsv_getattr(path, pattr, &psize, &ptime))) == -ENOENT)
+      neg_add(path);
+    else if (ret == 0) {
+      pattr2attr(*pattr, psize, ptime, st, xattr);
+      debuglog(" attrs Psion: %x %d %d, UNIX modes: %o, xattrs: %s", *pattr, psize, ptime, st->st_mode, xattr);
+      if (st->st_nlink > 1)
+        ret = getlinks(path, st);
+    }
+  }
+
+  debuglog("getattr: returned %d", ret);
+  return ret;
+}
+
+/* Make sure the attributes of ip are up to date */
+static int
+get_attr(inode *ip)
+{
+  struct stat st;
+  long pattr;
+  int ret;
+
+  if (fresh(ip))
+    return 0;
+  if (!ip->path)
+    return ip->attr_time ? 0 : -ENOENT; /* still open, but gone */
+  if ((ret = read_attr(ip->path, &st, &pattr)) == 0)
+    set_attr(ip, &st, pattr);
+  return ret;
+}
+
+static void
+do_lookup(fuse_req_t req, inode *dp, const char *name)
+{
+  struct fuse_entry_param e;
+  inode *ip = NULL;
+  char *path;
+  int ret;
+
+  if (!(path = child_path(dp, name))) {
+    fuse_reply_err(req, dp->path ? ENOMEM : ENOENT);
+    return;
+  }
+  debuglog("lookup `%s'", path);
+  if (!(ip = ino_find(path)) || !fresh(ip)) {
+    struct stat st;
+    long pattr;
+
+    if ((ret = read_attr(path, &st, &pattr)) == 0) {
+      if ((ip = ino_make(path)))
+        set_attr(ip, &st, pattr);
+      else
+        ret = -ENOMEM;
+    }
+  } else
+    ret = 0;
+  free(path);
+  if (ret) {
+    fuse_reply_err(req, -ret);
+    return;
+  }
+  watch_use(dp, -1);
+  memset(&e, 0, sizeof(e));
+  ip->nlookup++;
+  e.ino = ip->ino;
+  e.attr = ip->st;
+  e.attr_timeout = attr_timeout;
+  e.entry_timeout = entry_timeout;
+  set_owner(req, &e.attr);
+  fuse_reply_entry(req, &e);
+}
+
+static void plp_init(void *data, struct fuse_conn_info *conn)
+{
+  inode *ip;
+
+  (void)data;
+  (void)conn;
+  if ((ip = ino_new(FUSE_ROOT_ID, "")))
+    ip->nlookup = 1;
+}
+
+static void plp_destroy(void *data)
+{
+  (void)data;
+  cache_save();
+}
+
+static void plp_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+  inode *dp = ino_get(parent);
+
+  if (!dp) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  do_lookup(req, dp, name);
+}
+
+static void plp_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+  inode *ip = ino_get(ino);
+
+  if (ip && ino != FUSE_ROOT_ID) {
+    ip->nlookup = ip->nlookup > nlookup ? ip->nlookup - nlookup : 0;
+    if (!ip->nlookup && !ip->path)
+      ino_free(ip);
+  }
+  fuse_reply_none(req);
+}
+
+static void plp_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+  inode *ip = ino_get(ino);
+  struct stat st;
+  int ret;
+
+  (void)fi;
+  if (!ip) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_getattr `%s'", ip->path ? ip->path : "(gone)");
+  if ((ret = get_attr(ip)) != 0) {
+    fuse_reply_err(req, -ret);
+    return;
+  }
+  st = ip->st;
+  set_owner(req, &st);
+  fuse_reply_attr(req, &st, attr_timeout);
+}
+
+static int set_mode(inode *ip, mode_t mode)
+{
+  int ret;
+  long psisattr, psidattr;
+
+  if ((ret = get_attr(ip)) == 0) {
+    attr2pattr(ip->st.st_mode, mode, "", "", &psisattr, &psidattr);
+    debuglog("  UNIX old, new: %o, %o; Psion set, clear: %x, %x", ip->st.st_mode, mode, psisattr, psidattr);
+    if ((ret = rfsv_setattr(ip->path, psisattr, psidattr)) == 0)
+      debuglog("chmod succeeded");
+  }
+
+  return ret;
+}
+
+static int set_size(inode *ip, off_t size)
+{
+  int ret;
+
+  if ((ret = rfsv_setsize(ip->path, size)) == 0 && ip->attr_time)
+    account_space(ip->path, size - ip->st.st_size);
+  return ret;
+}
+
+static void plp_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                        int to_set, struct fuse_file_info *fi)
+{
+  inode *ip = ino_get(ino);
+  struct stat st;
+  int ret = 0;
+
+  (void)fi;
+  if (!ip || !ip->path) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_setattr `%s' %x", ip->path, to_set);
+
+  if (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))
+    ret = -EPERM;
+  if (!ret && (to_set & FUSE_SET_ATTR_MODE))
+    ret = set_mode(ip, attr->st_mode);
+  if (!ret && (to_set & FUSE_SET_ATTR_SIZE))
+    ret = set_size(ip, attr->st_size);
+  if (!ret && (to_set & FUSE_SET_ATTR_MTIME))
+    ret = rfsv_setmtime(ip->path, attr->st_mtime);
+  stale(ip);
+  if (!ret)
+    ret = get_attr(ip);
+  if (ret) {
+    fuse_reply_err(req, -ret);
+    return;
+  }
+  st = ip->st;
+  set_owner(req, &st);
+  fuse_reply_attr(req, &st, attr_timeout);
+}
+
+static void plp_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+  (void)ino;
+  debuglog("plp_readlink");
+  fuse_reply_err(req, EINVAL);
+}
+
+/* Reply to a request which created name in dp */
+static void reply_created(fuse_req_t req, inode *dp, const char *name, int ret)
+{
+  if (ret) {
+    fuse_reply_err(req, -ret);
+    return;
+  }
+  stale(dp);
+  do_lookup(req, dp, name);
+}
+
+static void plp_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+                      mode_t mode, dev_t dev)
+{
+  inode *dp = ino_get(parent);
+  char *path;
+  int ret = -EINVAL;
+
+  if (!dp || !(path = child_path(dp, name))) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_mknod `%s' %o", path, mode);
+  changed_dir(path);
+
+  if (S_ISREG(mode) && dev == 0) {
+    uint32_t phandle;
+    if ((ret = rfsv_fcreate(0x200, path, &phandle)) == 0)
+      rfsv_fclose(phandle);
+  }
+
+  free(path);
+  reply_created(req, dp, name, ret);
+}
+
+static void plp_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+  inode *dp = ino_get(parent);
+  char *path;
+  int ret;
+
+  if (!dp || !(path = child_path(dp, name))) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_mkdir `%s' %o", path, mode);
+  changed_dir(path);
+  ret = rfsv_mkdir(path);
+  free(path);
+  reply_created(req, dp, name, ret);
+}
+
+static void plp_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+  inode *dp = ino_get(parent), *ip;
+  long pattr, psize = 0, ptime;
+  char *path;
+  int ret;
+
+  if (!dp || !(path = child_path(dp, name))) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_unlink `%s'", path);
+  if ((ip = ino_find(path)) && ip->attr_time)
+    psize = ip->st.st_size;
+  else if (devices_time)
+    rfsv_getattr(path, &pattr, &psize, &ptime);
+  if ((ret = rfsv_remove(path)) == 0) {
+    account_space(path, -psize);
+    ino_removed(path);
+    stale(dp);
+  }
+  free(path);
+  fuse_reply_err(req, -ret);
+}
+
+static void plp_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+  inode *dp = ino_get(parent);
+  char *path;
+  int ret;
+
+  if (!dp || !(path = child_path(dp, name))) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_rmdir `%s'", path);
+  if ((ret = rfsv_rmdir(path)) == 0) {
+    ino_removed(path);
+    stale(dp);
+  }
+  free(path);
+  fuse_reply_err(req, -ret);
+}
+
+static void plp_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
+{
+  (void)parent;
+  debuglog("plp_symlink `%s' -> `'%s'", name, link);
+  fuse_reply_err(req, EPERM);
+}
+
+static void plp_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                       fuse_ino_t newparent, const char *newname)
+{
+  inode *dp = ino_get(parent), *ndp = ino_get(newparent);
+  char *from = NULL, *to = NULL;
+  int ret;
+
+  if (!dp || !ndp || !(from = child_path(dp, name)) || !(to = child_path(ndp, newname))) {
+    free(from);
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_rename `%s' -> `%s'", from, to);
+  changed_dir(to);
+  rfsv_remove(to);
+  /* EPOC can't rename across drives, so move the data on the Psion. */
+  if (toupper(from[0]) != toupper(to[0])) {
+    invalidate_devices();
+    ret = rfsv_movetree(from, to);
+  } else
+    ret = rfsv_rename(from, to);
+  if (ret == 0) {
+    ino_removed(to);
+    ino_moved(from, to);
+    stale(dp);
+    stale(ndp);
+  }
+  free(from);
+  free(to);
+  fuse_reply_err(req, -ret);
+}
+
+static void plp_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname)
+{
+  (void)ino;
+  (void)newparent;
+  debuglog("plp_link `%s'", newname);
+  fuse_reply_err(req, EPERM);
+}
+
+static void plp_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size
+#ifdef __APPLE__
+                         , _GL_UNUSED uint32_t position
+#endif
+                         )
+{
+  inode *ip = ino_get(ino);
+  char value[XATTR_MAXLEN + 1];
+  int ret;
+
+  if (!ip) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_getxattr `%s' %s", ip->path, name);
+  if (strcmp(name, XATTR_NAME) != 0)
+    *value = '\0';
+  else if ((ret = get_attr(ip)) != 0) {
+    fuse_reply_err(req, -ret);
+    return;
+  } else {
+    pattr2xattr(ip->pattr, value);
+    debuglog("getxattr succeeded: %s", value);
+  }
+  if (size == 0)
+    fuse_reply_xattr(req, strlen(value));
+  else if (size < strlen(value)) {
+    debuglog("only gave %d bytes, need %d", size, strlen(value));
+    fuse_reply_err(req, ERANGE);
+  } else
+    fuse_reply_buf(req, value, strlen(value));
+}
+
+static void plp_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                         const char *value, size_t size, int flags
+#ifdef __APPLE__
+                         , _GL_UNUSED uint32_t position
+#endif
+                         )
+{
+  inode *ip = ino_get(ino);
+  int ret;
+  long psisattr, psidattr;
+  char oxattr[XATTR_MAXLEN + 1], nxattr[XATTR_MAXLEN + 1];
+
+  if (!ip || !ip->path) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_setxattr `%s'", ip->path);
+  if (strcmp(name, XATTR_NAME) != 0) {
+    fuse_reply_err(req, (flags & XATTR_REPLACE) ? ENOATTR : ENOTSUP);
+    return;
+  }
+  if (flags & XATTR_CREATE) {
+    fuse_reply_err(req, EEXIST);
+    return;
+  }
+  if ((ret = get_attr(ip)) != 0) {
+    fuse_reply_err(req, -ret);
+    return;
+  }
+
+  memset(nxattr, 0, sizeof(nxattr));
+  strncpy(nxattr, value, size < XATTR_MAXLEN ? size : XATTR_MAXLEN);
+  pattr2xattr(ip->pattr, oxattr);
+  psisattr = psidattr = 0;
+  xattr2pattr(&psisattr, &psidattr, oxattr, nxattr);
+  debuglog("attrs set %x delete %x; %s, %s", psisattr, psidattr, oxattr, nxattr);
+  ret = rfsv_setattr(ip->path, psisattr, psidattr);
+  stale(ip);
+  if (ret == 0)
+    debuglog("setxattr succeeded");
+  fuse_reply_err(req, -ret);
+}
+
+static void plp_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+  (void)ino;
+  debuglog("plp_listxattr");
+  if (size == 0)
+    fuse_reply_xattr(req, sizeof(XATTR_NAME));
+  else if (size < sizeof(XATTR_NAME))
+    fuse_reply_err(req, ERANGE);
+  else
+    fuse_reply_buf(req, XATTR_NAME, sizeof(XATTR_NAME));
+}
+
+static void plp_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+  (void)ino;
+  (void)name;
+  debuglog("plp_removexattr");
+  fuse_reply_err(req, ENOTSUP);
+}
+
+static void plp_access(fuse_req_t req, fuse_ino_t ino, int mask)
+{
+  (void)ino;
+  (void)mask;
+  fuse_reply_err(req, 0);
+}
+
+static void plp_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+  inode *ip = ino_get(ino);
+  int ret;
+
+  if (!ip || !ip->path) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_open `%s'", ip->path);
+  if ((ret = cache_open(ip->path, fi->flags, &fi->fh)) < 0) {
+    fuse_reply_err(req, -ret);
+    return;
+  }
+  if (ret > 0)
+    fi->keep_cache = 1; /* unchanged since we last read it */
+  watch_use(ip, -1);
+  fuse_reply_open(req, fi);
+}
+
+static void plp_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+  (void)ino;
+  debuglog("plp_release");
+  if (fi->fh)
+    cache_release(fi->fh);
+  fuse_reply_err(req, 0);
+}
+
+static void plp_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                     struct fuse_file_info *fi)
+{
+  inode *ip = ino_get(ino);
+  long read;
+  char *buf;
+
+  if (!ip || !ip->path) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_read `%s' offset %lld size %ld", ip->path, offset, size);
+  if (!(buf = malloc(size))) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+  if (fi->fh)
+    read = cache_read(fi->fh, buf, (long)offset, size, ip->path);
+  else
+    read = check_media(rfsv_read(buf, (long)offset, size, ip->path));
+  debuglog("read returned %ld", read);
+  if (read < 0)
+    fuse_reply_err(req, -read);
+  else
+    fuse_reply_buf(req, buf, read);
+  free(buf);
+}
+
+static void plp_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi)
+{
+  inode *ip = ino_get(ino);
+  long written;
+
+  (void)fi;
+  if (!ip || !ip->path) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_write `%s' offset %lld size %ld", ip->path, offset, size);
+  written = check_media(rfsv_write(buf, offset, size, ip->path));
+  debuglog("write returned %ld", written);
+  stale(ip);
+  if (written < 0) {
+    fuse_reply_err(req, -written);
+    return;
+  }
+  if (written > 0)
+    account_space(ip->path, written);
+  fuse_reply_write(req, written);
+}
+
+/*
+ * A directory listing, built by opendir and handed out by readdir.
+ */
+struct dirbuf {
+  char *p;
+  size_t size;
+};
+
+static int
+dirbuf_add(fuse_req_t req, struct dirbuf *b, const char *name, const struct stat *st)
+{
+  size_t oldsize = b->size;
+  char *p;
+
+  b->size += fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+  if (!(p = realloc(b->p, b->size))) {
+    b->size = oldsize;
+    return -ENOMEM;
+  }
+  b->p = p;
+  fuse_add_direntry(req, b->p + oldsize, b->size - oldsize, name, st, b->size);
+  return 0;
+}
+
+/*
+ * List a directory on the Psion. The attributes of the files found
+ * go into the inode table; directories are left to lookup, which
+ * counts their subdirectories for st_nlink.
+ */
+static int
+list_dir(fuse_req_t req, inode *dp, struct dirbuf *b)
+{
+  dentry *e = NULL;
+  char *dir;
+  long entries = 0, subdirs = 0;
+  int ret;
+
+  if (asprintf(&dir, "%s\\", dp->path) == -1)
+    return -ENOMEM;
+  debuglog("RFSV dir `%s'", dir);
+  ret = check_media(rfsv_dir(dir, &e));
+  free(dir);
+
+  debuglog("scanning contents");
+  while (e) {
+    dentry *o = e;
+
+    if (ret == 0) {
+      struct stat st;
+      char xattr[XATTR_MAXLEN + 1];
+      const char *name = filname(e->name);
+      char *path;
+      inode *ip;
+
+      pattr2attr(e->attr, e->size, e->time, &st, xattr);
+      debuglog("  %s %o %d %d", name, st.st_mode, st.st_size, st.st_mtime);
+      entries++;
+      /* It exists after all, so let lookup see it */
+      if (!*generation_of(dp->path) && matches_ignore(name))
+        changed_in(dp->path);
+      if (S_ISDIR(st.st_mode))
+        subdirs++;
+      else if ((path = child_path(dp, name))) {
+        if ((ip = ino_make(path))) {
+          set_attr(ip, &st, e->attr);
+          st.st_ino = ip->ino;
+        }
+        free(path);
+      }
+      ret = dirbuf_add(req, b, name, &st);
+    }
+    free(e->name);
+    e = e->next;
+    free(o);
+  }
+  if (ret == 0 && dp->attr_time)
+    dp->st.st_nlink = subdirs + 2;
+  if (ret == 0)
+    watch_use(dp, entries);
+  return ret;
+}
+
+static void plp_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+  inode *ip = ino_get(ino);
+  struct dirbuf *b;
+  struct stat st;
+  char xattr[XATTR_MAXLEN + 1];
+  int ret = 0;
+
+  if (!ip || !ip->path) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  debuglog("plp_opendir `%s'", ip->path);
+  if (!(b = calloc(1, sizeof(*b)))) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+
+  memset(&st, 0, sizeof(st));
+  st.st_mode = S_IFDIR;
+  st.st_ino = ip->ino;
+  if ((ret = dirbuf_add(req, b, ".", &st)) == 0)
+    ret = dirbuf_add(req, b, "..", &st);
+
+  if (ret == 0 && strcmp(ip->path, "") == 0) {
+    debuglog("readdir root");
+    if (query_devices() == 0) {
+      device *dp;
+
+      for (dp = devices; dp && ret == 0; dp = dp->next) {
+        char name[3];
+
+        name[0] = dp->letter;
+        name[1] = ':';
+        name[2] = '\0';
+        pattr2attr(dp->attrib, 1, 0, &st, xattr);
+        ret = dirbuf_add(req, b, name, &st);
+      }
+    }
+  } else if (ret == 0)
+    ret = list_dir(req, ip, b);
+
+  if (ret) {
+    free(b->p);
+    free(b);
+    fuse_reply_err(req, -ret);
+    return;
+  }
+  debuglog("readdir OK");
+  fi->fh = (uintptr_t)b;
+  fuse_reply_open(req, fi);
+}
+
+static void plp_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                        struct fuse_file_info *fi)
+{
+  struct dirbuf *b = (struct dirbuf *)(uintptr_t)fi->fh;
+
+  (void)ino;
+  if ((size_t)off < b->size)
+    fuse_reply_buf(req, b->p + off, b->size - off < size ? b->size - off : size);
+  else
+    fuse_reply_buf(req, NULL, 0);
+}
+
+static void plp_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+  struct dirbuf *b = (struct dirbuf *)(uintptr_t)fi->fh;
+
+  (void)ino;
+  free(b->p);
+  free(b);
+  fuse_reply_err(req, 0);
+}
+
+static void plp_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+  struct statvfs stbuf;
+  device *dp;
+
+  (void)ino;
+  debuglog("plp_statfs");
+
+  memset(&stbuf, 0, sizeof(stbuf));
+  stbuf.f_bsize = BLOCKSIZE;
+  stbuf.f_frsize = BLOCKSIZE;
+  if (query_devices() == 0) {
+    for (dp = devices; dp; dp = dp->next) {
+      stbuf.f_blocks += (dp->total + BLOCKSIZE - 1) / BLOCKSIZE;
+      stbuf.f_bfree += (dp->free + BLOCKSIZE - 1) / BLOCKSIZE;
+    }
+  }
+  stbuf.f_bavail = stbuf.f_bfree;
+
+  /* Don't have numbers for these */
+  stbuf.f_files = 0;
+  stbuf.f_ffree = stbuf.f_favail = 0;
+
+  stbuf.f_fsid = FID;
+  stbuf.f_flag = 0;    /* don't have mount flags */
+  stbuf.f_namemax = 255; /* KDMaxFileNameLen% */
+
+  fuse_reply_statfs(req, &stbuf);
+}
+
+#if FUSE_VERSION >= 28
+/*
+ * Invalidations found by check_watch, which are sent to the kernel
+ * once plp_lock has been released: the kernel may have to wait for an
+ * outstanding request to be answered before it can act on them.
+ */
+static struct inval {
+  fuse_ino_t ino;
+  char *name;     /* of an entry in directory ino, or NULL for ino itself */
+} *invals;
+static size_t ninvals, invals_size;
+
+static void
+add_inval(fuse_ino_t ino, const char *name)
+{
+  if (ninvals == invals_size) {
+    struct inval *iv = realloc(invals, (invals_size + 16) * sizeof(*iv));
+
+    if (!iv)
+      return;
+    invals = iv;
+    invals_size += 16;
+  }
+  invals[ninvals].ino = ino;
+  invals[ninvals].name = NULL;
+  if (name && !(invals[ninvals].name = strdup(name)))
+    return;
+  ninvals++;
+}
+
+/*
+ * Check whether the inode of w has changed on the Psion, and if so,
+ * forget what we know about it and everything in it.
+ */
+static void
+check_watch(watch *w)
+{
+  inode *ip = ino_get(w->ino), *cp;
+  long pattr, psize, ptime, count;
+  double now = monotime();
+  size_t len;
+  char *dir;
+  int ret, i;
+
+  if (!ip || !ip->path || now - w->used > WATCH_EXPIRE) {
+    memset(w, 0, sizeof(*w));
+    return;
+  }
+  len = strlen(ip->path);
+  if (len == 2 && ip->path[1] == ':') {
+    ret = 0;    /* drives have no modification time */
+    ptime = w->time;
+  } else
+    ret = rfsv_getattr(ip->path, &pattr, &psize, &ptime);
+  if (ret == 0 && S_ISDIR(ip->st.st_mode)) {
+    if (asprintf(&dir, "%s\\", ip->path) == -1)
+      return;
+    ret = rfsv_dircount(dir, &count);
+    psize = count;
+    free(dir);
+  }
+  if (ret != 0 && ret != -ENOENT) {
+    /* Most likely disconnected; try again later */
+    w->interval = watch_interval;
+    w->due = now + w->interval;
+    return;
+  }
+
+  if (ret == -ENOENT || (w->time != -1 && ptime != w->time) ||
+      (w->size != -1 && psize != w->size)) {
+    debuglog("`%s' has changed on the Psion", ip->path);
+    stale(ip);
+    add_inval(ip->ino, NULL);
+    if (S_ISDIR(ip->st.st_mode)) {
+      changed_in(ip->path);
+      for (i = 0; i < INO_BUCKETS; i++)
+        for (cp = by_ino[i]; cp; cp = cp->ino_next)
+          if (cp->path && strncasecmp(cp->path, ip->path, len) == 0 &&
+              cp->path[len] == '/' && !strchr(cp->path + len + 1, '/')) {
+            stale(cp);
+            if (cp->nlookup)
+              add_inval(ip->ino, cp->path + len + 1);
+          }
+    }
+    if (ret == -ENOENT) {
+      /* Let the kernel look it up again, and find it gone */
+      size_t plen = parent_len(ip->path);
+      char *parent = strndup(ip->path, plen);
+
+      if (parent && (cp = ino_find(parent)))
+        add_inval(cp->ino, ip->path + plen + (plen > 0));
+      free(parent);
+      memset(w, 0, sizeof(*w));
+      return;
+    }
+    w->interval = watch_interval < WATCH_MIN ? watch_interval : WATCH_MIN;
+  } else if ((w->interval *= 2) > watch_interval)
+    w->interval = watch_interval;
+  w->time = ptime;
+  w->size = psize;
+  w->due = now + w->interval;
+}
+
+static struct fuse_chan *notify_chan;
+static int watching;
+
+static void
+snooze(double secs)
+{
+  struct timespec ts;
+
+  ts.tv_sec = (time_t)secs;
+  ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+  nanosleep(&ts, NULL);
+}
+
+/*
+ * The change detector. Checks are spaced out by at least a tenth of a
+ * second, to leave the link to requests from the kernel.
+ */
+static void *
+watcher(void *arg)
+{
+  (void)arg;
+  pthread_mutex_lock(&plp_lock);
+  while (watching) {
+    watch *w = NULL;
+    double now = monotime(), wait = 1;
+    size_t i;
+
+    for (i = 0; i < WATCH_MAX; i++)
+      if (watches[i].ino && (!w || watches[i].due < w->due))
+        w = &watches[i];
+    if (w && w->due <= now) {
+      check_watch(w);
+      wait = 0.1;
+    } else if (w && w->due - now < wait)
+      wait = w->due - now;
+    pthread_mutex_unlock(&plp_lock);
+
+    for (i = 0; i < ninvals; i++) {
+      if (invals[i].name) {
+        fuse_lowlevel_notify_inval_entry(notify_chan, invals[i].ino,
+                                         invals[i].name, strlen(invals[i].name));
+        free(invals[i].name);
+      } else
+        fuse_lowlevel_notify_inval_inode(notify_chan, invals[i].ino, 0, 0);
+    }
+    ninvals = 0;
+    snooze(wait);
+    pthread_mutex_lock(&plp_lock);
+  }
+  pthread_mutex_unlock(&plp_lock);
+  return NULL;
+}
+#endif
+
+struct fuse_lowlevel_ops plp_oper = {
+  .init		= plp_init,
+  .destroy	= plp_destroy,
+  .lookup	= plp_lookup,
+  .forget	= plp_forget,
   .getattr	= plp_getattr,
-  .access	= plp_access,
+  .setattr	= plp_setattr,
   .readlink	= plp_readlink,
-  .readdir	= plp_readdir,
   .mknod	= plp_mknod,
   .mkdir	= plp_mkdir,
-  .symlink	= plp_symlink,
   .unlink	= plp_unlink,
   .rmdir	= plp_rmdir,
+  .symlink	= plp_symlink,
   .rename	= plp_rename,
   .link		= plp_link,
-  .chmod	= plp_chmod,
-  .setxattr	= plp_setxattr,
-  .getxattr	= plp_getxattr,
-  .listxattr	= plp_listxattr,
-  .removexattr	= plp_removexattr,
-  .chown	= plp_chown,
-  .truncate	= plp_truncate,
-  .utimens	= plp_utimens,
   .open		= plp_open,
   .read		= plp_read,
   .write	= plp_write,
+  .release	= plp_release,
+  .opendir	= plp_opendir,
+  .readdir	= plp_readdir,
+  .releasedir	= plp_releasedir,
   .statfs	= plp_statfs,
+  .setxattr	= plp_setxattr,
+  .getxattr	= plp_getxattr,
+  .listxattr	= plp_listxattr,
+  .removexattr	= plp_removexattr,
+  .access	= plp_access,
 };
+
+/*
+ * Handle requests until the file system is unmounted. This is what
+ * fuse_session_loop does, except that each request is handled under
+ * plp_lock, so that the change detector can run in between.
+ */
+int
+plp_loop(struct fuse_session *se, struct fuse_chan *ch)
+{
+#if FUSE_VERSION >= 28
+  size_t bufsize = fuse_chan_bufsize(ch);
+  pthread_t thread;
+  sigset_t all, old;
+  char *buf;
+  int res = 0;
+
+  if (watch_interval <= 0)
+    return fuse_session_loop(se);
+  if (!(buf = malloc(bufsize)))
+    return -1;
+
+  /* Signals are for the main thread, to end the loop */
+  notify_chan = ch;
+  watching = 1;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  if (pthread_create(&thread, NULL, watcher, NULL) != 0) {
+    debuglog("could not start the change detector");
+    watching = 0;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  while (!fuse_session_exited(se)) {
+    struct fuse_chan *tmpch = ch;
+
+    if ((res = fuse_chan_recv(&tmpch, buf, bufsize)) == -EINTR)
+      continue;
+    if (res <= 0)
+      break;
+    pthread_mutex_lock(&plp_lock);
+    fuse_session_process(se, buf, res, tmpch);
+    pthread_mutex_unlock(&plp_lock);
+  }
+
+  if (watching) {
+    pthread_mutex_lock(&plp_lock);
+    watching = 0;
+    pthread_mutex_unlock(&plp_lock);
+    pthread_join(thread, NULL);
+  }
+  free(buf);
+  fuse_session_reset(se);
+  return res < 0 ? -1 : 0;
+#else
+  (void)ch;
+  return fuse_session_loop(se);
+#endif
+}
@@ -32,12 +32,14 @@
 #include <iostream>
 #include <string>
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
 
+#include "cache.h"
 #include "rfsv_api.h"
 
 #ifndef _GNU_SOURCE
@@ -146,14 +148,25 @@ int rfsv_isalive(void) {
     return a->getStatus() == rfsv::E_PSI_GEN_NONE;
 }
 
+/* Whether an error means the Psion is not there, rather than the file */
+static bool
+offline(long err)
+{
+    return (err == rfsv::E_PSI_FILE_DISC) || (err == rfsv::E_PSI_FILE_CONNECT);
+}
+
 int rfsv_dir(const char *file, dentry **e) {
     PlpDir entries;
     dentry *tmp;
     long ret;
 
     if (!a)
-	return -ENODEV;
+	return cache_enabled() ? cache_dir(file, e) : -ENODEV;
     ret = a->dir(file, entries);
+    if (offline(ret) && cache_enabled())
+	return cache_dir(file, e);
+    if (ret == rfsv::E_PSI_GEN_NONE)
+	cache_listed(file, entries);
 
     for (int i = 0; i < entries.size(); i++) {
 	PlpDirent pe = entries[i];
@@ -170,15 +183,21 @@ int rfsv_dir(const char *file, dentry **e) {
     return epocerr_to_errno(ret);
 }
 
-int rfsv_dircount(const char *file, uint32_t *count) {
+int rfsv_dircount(const char *file, long *count) {
+    uint32_t n = 0;
+    long ret;
+
     if (!a)
 	return -ENODEV;
-    return epocerr_to_errno(a->dircount(file, *count));
+    ret = a->dircount(file, n);
+    *count = n;
+    return epocerr_to_errno(ret);
 }
 
 int rfsv_rmdir(const char *name) {
     if (!a)
 	return -ENODEV;
+    cache_forget(name);
     return epocerr_to_errno(a->rmdir(name));
 }
 
@@ -191,6 +210,7 @@ int rfsv_mkdir(const char *file) {
 int rfsv_remove(const char *file) {
     if (!a)
 	return -ENODEV;
+    cache_forget(file);
     return epocerr_to_errno(a->remove(file));
 }
 
@@ -281,25 +301,49 @@ int rfsv_setattr(const char *name, long sattr, long dattr) {
     return epocerr_to_errno(a->fsetattr(name, sattr, dattr));
 }
 
-int rfsv_getattr(const char *name, long *attr, long *size, long *time) {
+int rfsv_geteattr(const char *name, PlpDirent &e) {
     long res;
-    PlpDirent e;
 
     if (!a)
 	return -ENODEV;
     res = a->fgeteattr(name, e);
+    // Only forget what is known to be gone, not what is merely
+    // unreachable, locked or not ready for now.
+    if (res == rfsv::E_PSI_GEN_NONE)
+	cache_seen(name, e);
+    else if ((res == rfsv::E_PSI_FILE_NXIST) || (res == rfsv::E_PSI_FILE_DIR))
+	cache_forget(name);
+    return epocerr_to_errno(res);
+}
+
+int rfsv_getattr(const char *name, long *attr, long *size, long *time) {
+    long res;
+    PlpDirent e;
+
+    if ((res = rfsv_geteattr(name, e)) == -ENODEV && cache_enabled())
+	return cache_getattr(name, attr, size, time);
     *attr = e.getAttr();
     *size = e.getSize();
     *time = e.getPsiTime().getTime();
-    return epocerr_to_errno(res);
+    return res;
 }
 
 int rfsv_rename(const char *oldname, const char *newname) {
     if (!a)
 	return -ENODEV;
+    cache_forget(oldname);
+    cache_forget(newname);
     return epocerr_to_errno(a->rename(oldname, newname));
 }
 
+int rfsv_movetree(const char *oldname, const char *newname) {
+    if (!a)
+	return -ENODEV;
+    cache_forget(oldname);
+    cache_forget(newname);
+    return epocerr_to_errno(a->moveTree(oldname, newname, NULL, NULL));
+}
+
 int rfsv_drivelist(int *cnt, device **dlist) {
     *dlist = NULL;
     uint32_t devbits;
@@ -307,8 +351,10 @@ int rfsv_drivelist(int *cnt, device **dlist) {
     int i;
 
     if (!a)
-	return -ENODEV;
+	return cache_enabled() ? cache_drivelist(cnt, dlist) : -ENODEV;
     ret = a->devlist(devbits);
+    if (offline(ret) && cache_enabled())
+	return cache_drivelist(cnt, dlist);
     if (ret == 0)
 	for (i = 0; i < 26; i++) {
 	    PlpDrive drive;
@@ -345,7 +391,31 @@ help()
 	"    -p, --port=[HOST:]PORT  Connect to port PORT on host HOST\n"
 	"                            Default for HOST is 127.0.0.1\n"
 	"                            Default for PORT is "
-	) << DPORT << "\n\n";
+	) << DPORT << "\n" << _(
+	"    -D, --device=NAME       Talk to the Psion ncpd calls NAME, if it\n"
+	"                            serves more than one\n"
+	"    -n, --negative-timeout=SECS\n"
+	"                            Remember missing files for SECS seconds\n"
+	"                            Default is 30, 0 disables\n"
+	"    -i, --ignore=PATTERNS   Never look up files matching PATTERNS,\n"
+	"                            separated by colons\n"
+	"                            Default is "
+	) << DEFAULT_IGNORE << "\n" << _(
+	"    -c, --cache=DIR         Keep copies of files read in DIR, and show\n"
+	"                            the last known files while disconnected\n"
+	"    -C, --cache-size=MB     Limit the cache to MB megabytes\n"
+	"                            Default is "
+	) << DEFAULT_CACHE_SIZE << "\n" << _(
+	"    -w, --watch=SECS        Check the directories and files in use for\n"
+	"                            changes on the Psion at least every SECS\n"
+	"                            seconds, 0 disables\n"
+	"                            Default is 30\n"
+	"    -l, --long-timeouts     While watching, let the kernel keep names\n"
+	"                            and attributes for "
+	) << WATCH_TIMEOUT << _(" seconds\n"
+	"    -o entry_timeout=SECS   Let the kernel keep names for SECS seconds\n"
+	"    -o attr_timeout=SECS    Let the kernel keep attributes for SECS seconds\n"
+	"                            Default for both is 1\n") << "\n";
 }
 
 static struct option opts[] = {
@@ -353,6 +423,13 @@ static struct option opts[] = {
     {"debug",      no_argument,       nullptr, 'd'},
     {"version",    no_argument,       nullptr, 'V'},
     {"port",       required_argument, nullptr, 'p'},
+    {"device",     required_argument, nullptr, 'D'},
+    {"negative-timeout", required_argument, nullptr, 'n'},
+    {"ignore",     required_argument, nullptr, 'i'},
+    {"cache",      required_argument, nullptr, 'c'},
+    {"cache-size", required_argument, nullptr, 'C'},
+    {"watch",      required_argument, nullptr, 'w'},
+    {"long-timeouts", no_argument,    nullptr, 'l'},
     {nullptr,      0,                 nullptr,  0 }
 };
 
@@ -385,19 +462,50 @@ parse_destination(const char *arg, const char **host, int *port)
 	*port = atoi(pp);
 }
 
+/* Whether the kernel may cache for long while watching for changes */
+static bool long_timeouts = false;
+
+/* -o options of our own, which the FUSE library must not see */
+struct timeouts {
+    double entry;
+    double attr;
+};
+
+static struct fuse_opt timeout_opts[] = {
+    {"entry_timeout=%lf", offsetof(struct timeouts, entry), 0},
+    {"attr_timeout=%lf",  offsetof(struct timeouts, attr),  0},
+    FUSE_OPT_END
+};
+
 int fuse(int argc, char *argv[])
 {
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
     struct fuse_chan *ch;
+    struct timeouts t = { entry_timeout, attr_timeout };
     char *mountpoint;
     int err = -1, foreground;
 
-    if (fuse_parse_cmdline(&args, &mountpoint, NULL, &foreground) != -1 &&
+#if FUSE_VERSION < 28
+    watch_interval = 0;	// the kernel can't be told about changes
+#endif
+    if (long_timeouts && watch_interval > 0)
+        t.entry = t.attr = WATCH_TIMEOUT;
+    if (fuse_opt_parse(&args, &t, timeout_opts, NULL) != -1 &&
+        fuse_parse_cmdline(&args, &mountpoint, NULL, &foreground) != -1 &&
         (ch = fuse_mount(mountpoint, &args)) != NULL) {
+        entry_timeout = t.entry;
+        attr_timeout = t.attr;
         if (fuse_daemonize(foreground) != -1) {
-            struct fuse *fp = fuse_new(ch, &args, &plp_oper, sizeof(plp_oper), NULL);
-            if (fp != NULL)
-                err = fuse_loop(fp);
+            struct fuse_session *se = fuse_lowlevel_new(&args, &plp_oper, sizeof(plp_oper), NULL);
+            if (se != NULL) {
+                if (fuse_set_signal_handlers(se) != -1) {
+                    fuse_session_add_chan(se, ch);
+                    err = plp_loop(se, ch);
+                    fuse_remove_signal_handlers(se);
+                    fuse_session_remove_chan(ch);
+                }
+                fuse_session_destroy(se);
+            }
         }
         fuse_unmount(mountpoint, ch);
     }
@@ -409,7 +517,10 @@ int fuse(int argc, char *argv[])
 int main(int argc, char**argv) {
     ppsocket *skt, *skt2;
     const char *host = "127.0.0.1";
+    const char *device = nullptr;
     int sockNum = DPORT, i, c, oldoptind = 1;
+    const char *cachedir = nullptr;
+    long cachesize = DEFAULT_CACHE_SIZE;
 
     struct servent *se = getservbyname("psion", "tcp");
     endservent();
@@ -422,7 +533,7 @@ int main(int argc, char**argv) {
        about unknown options, but leave that to FUSE, and similarly we
        don't quit after issuing a version or help message. */
     opterr = 0; // Suppress errors from unknown options
-    while ((c = getopt_long(argc, argv, "hVp:d", opts, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "hVp:D:di:n:c:C:w:l", opts, NULL)) != -1) {
 	switch (c) {
         case 'V':
             cerr << _("plpfuse version ") << VERSION << endl;
@@ -433,8 +544,30 @@ int main(int argc, char**argv) {
         case 'd':
             debug++;
             break;
+        case 'c':
+        case 'C':
+        case 'w':
+        case 'l':
+        case 'n':
+        case 'i':
+        case 'D':
         case 'p':
-            parse_destination(optarg, &host, &sockNum);
+            if (c == 'l')
+                long_timeouts = true;
+            else if (c == 'c')
+                cachedir = optarg;
+            else if (c == 'C')
+                cachesize = atol(optarg);
+            else if (c == 'w')
+                watch_interval = atoi(optarg);
+            else if (c == 'n')
+                negative_ttl = atoi(optarg);
+            else if (c == 'i')
+                set_ignore_patterns(optarg);
+            else if (c == 'D')
+                device = optarg;
+            else
+                parse_destination(optarg, &host, &sockNum);
             argc -= optind - oldoptind;
             for (i = oldoptind; i < argc; i++)
               argv[i] = argv[i + (optind - oldoptind)];
@@ -444,6 +577,11 @@ int main(int argc, char**argv) {
             break;
     }
 
+    if (cachedir && cache_init(cachedir, (int64_t)cachesize * 1024 * 1024) != 0) {
+        cerr << _("plpfuse: could not use cache directory ") << cachedir << endl;
+        return 1;
+    }
+
     skt = new ppsocket();
     if (!skt->connect(host, sockNum)) {
         cerr << _("plpfuse: could not connect to ncpd") << endl;
@@ -455,8 +593,8 @@ int main(int argc, char**argv) {
         return 1;
     }
 
-    rf = new rfsvfactory(skt);
-    rp = new rpcsfactory(skt2);
+    rf = new rfsvfactory(skt, device);
+    rp = new rpcsfactory(skt2, device);
     a = rf->create(true);
     r = rp->create(true);
     if (a != NULL && r != NULL)
@@ -20,13 +20,7 @@
 #ifndef _plpfuse_h_
 #define _plpfuse_h_
 
-#include <fuse.h>
-
-typedef struct p_inode {
-	int inode;
-	char *name;
-	struct p_inode *nextnam, *nextnum;
-} p_inode;
+#include <fuse_lowlevel.h>
 
 /**
  * Description of a Psion-Device
@@ -54,12 +48,29 @@ typedef struct p_dentry
 } dentry;
 
 extern int debug;
+extern int negative_ttl;
+extern double entry_timeout;
+extern double attr_timeout;
+extern int watch_interval;
 
 extern void debuglog(const char *fmt, ...);
+extern void set_ignore_patterns(const char *patterns);
 
 #define BLOCKSIZE      512
 #define FID            7 /* File system id */
 
+/* Kernel cache timeouts with --long-timeouts, in seconds */
+#define WATCH_TIMEOUT 300
+
+/* Default limit of the on-disk cache, in megabytes */
+#define DEFAULT_CACHE_SIZE 64
+
+/* Names looked for by desktops and shells, which EPOC doesn't use */
+#define DEFAULT_IGNORE ".hidden:.Trash:.Trash-*:.git:.svn:.DS_Store:._*:" \
+  ".directory:.thumbnails:.xdg-volume-info:.localized:.metadata_never_index:" \
+  "autorun.inf:desktop.ini"
+
 #endif
 
-extern struct fuse_operations plp_oper;
+extern struct fuse_lowlevel_ops plp_oper;
+extern int plp_loop(struct fuse_session *se, struct fuse_chan *ch);
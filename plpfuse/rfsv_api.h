@@ -32,6 +32,7 @@ extern int rfsv_mkdir(const char *name);
 extern int rfsv_rmdir(const char *name);
 extern int rfsv_remove(const char *name);
 extern int rfsv_rename(const char *oldname, const char *newname);
+extern int rfsv_movetree(const char *oldname, const char *newname);
 extern int rfsv_open(const char *name, long mode, uint32_t *handle);
 extern int rfsv_fclose(long handle);
 extern int rfsv_fcreate(long attr, const char *name, uint32_t *handle);
@@ -62,6 +63,9 @@ extern int rfsv_isalive(void);
 
 #ifdef __cplusplus
 }
+
+class PlpDirent;
+extern int rfsv_geteattr(const char *name, PlpDirent &e);
 #endif
 
 #endif
@@ -23,9 +23,13 @@
 #include <wprt.h>
 #include <psibitmap.h>
 
+#include <deque>
 #include <iostream>
 #include <string>
 
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -33,6 +37,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 
 #include "ignore-value.h"
@@ -47,6 +52,9 @@
 #define SPOOLDIR "/var/spool/plpprint"
 #define PSDICT   "/prolog.ps"
 
+/* How long a cancelled print command may take to exit, in seconds */
+#define KILL_TIMEOUT 5
+
 using namespace std;
 
 const char *spooldir = SPOOLDIR;
@@ -262,26 +270,140 @@ ps_escape(string &text)
     }
 }
 
+/**
+ * Encodes data for the RunLengthDecode filter, including its EOD marker.
+ */
+static void
+ps_runlength(const unsigned char *p, size_t len, string &out)
+{
+    size_t i = 0;
+    size_t lit = 0;
+
+    out.reserve(out.size() + len + len / 128 + 2);
+    while (i < len) {
+        size_t run = 1;
+        while ((i + run < len) && (run < 128) && (p[i + run] == p[i]))
+            run++;
+        // A run of two only pays off if it doesn't split a literal.
+        if ((run >= 3) || ((run == 2) && (lit == 0))) {
+            if (lit) {
+                out += (char)(lit - 1);
+                out.append((const char *)p + i - lit, lit);
+                lit = 0;
+            }
+            out += (char)(257 - run);
+            out += (char)p[i];
+            i += run;
+        } else {
+            i++;
+            if (++lit == 128) {
+                out += (char)(lit - 1);
+                out.append((const char *)p + i - lit, lit);
+                lit = 0;
+            }
+        }
+    }
+    if (lit) {
+        out += (char)(lit - 1);
+        out.append((const char *)p + i - lit, lit);
+    }
+    out += (char)128;
+}
+
+/**
+ * The last two digits of every number below 85 * 85 in base 85.
+ */
+static struct a85Table {
+    char digits[85 * 85][2];
+
+    a85Table() {
+        for (int i = 0; i < 85 * 85; i++) {
+            digits[i][0] = '!' + i / 85;
+            digits[i][1] = '!' + i % 85;
+        }
+    }
+} a85;
+
+/**
+ * Encodes data for the ASCII85Decode filter, including its EOD marker.
+ * A group of four bytes takes two divisions and two table lookups.
+ */
+static void
+ps_ascii85(const string &in, string &out)
+{
+    const unsigned char *p = (const unsigned char *)in.data();
+    size_t len = in.size();
+    size_t start = out.size();
+
+    // Five characters for four bytes, a newline and maybe a blank
+    // for every 15 groups.
+    out.resize(start + len / 4 * 5 + len / 30 + 16);
+    char *o = &out[start];
+    char *line = o;
+
+    for (size_t i = 0; i < len; i += 4) {
+        size_t n = len - i;
+        uint32_t v;
+
+        if (n >= 4)
+            v = ((uint32_t)p[i] << 24) | (p[i+1] << 16) | (p[i+2] << 8) | p[i+3];
+        else {
+            v = (uint32_t)p[i] << 24;
+            if (n > 1)
+                v |= p[i+1] << 16;
+            if (n > 2)
+                v |= p[i+2] << 8;
+        }
+        if (o - line >= 75) {
+            *o++ = '\n';
+            line = o;
+        }
+        if ((v == 0) && (n >= 4)) {
+            *o++ = 'z';
+            continue;
+        }
+        uint32_t hi = v / (85 * 85);
+        const char *lo = a85.digits[v % (85 * 85)];
+        char group[5];
+        group[0] = '!' + hi / (85 * 85);
+        group[1] = a85.digits[hi % (85 * 85)][0];
+        group[2] = a85.digits[hi % (85 * 85)][1];
+        group[3] = lo[0];
+        group[4] = lo[1];
+        // Keep data lines from looking like DSC comments.
+        if ((o == line) && (group[0] == '%'))
+            *o++ = ' ';
+        size_t m = (n >= 4) ? 5 : n + 1;
+        memcpy(o, group, m);
+        o += m;
+    }
+    *o++ = '~';
+    *o++ = '>';
+    *o++ = '\n';
+    out.resize(o - &out[0]);
+}
+
 static void
 ps_bitmap(FILE *f, unsigned long llx, unsigned long lly, unsigned long urx,
           unsigned long ury, const char *buf)
 {
     bufferStore out;
-    int width, height;
-    if (decodeBitmap((const unsigned char *)buf, width, height, out)) {
-        fprintf(f, "%lu %lu %lu %lu %d %d I\n", llx, lly, urx, ury, width, height);
-        const unsigned char *p = (const unsigned char *)out.getString(0);
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++)
-                fprintf(f, "%02x", *p++);
-            fprintf(f, "\n");
-        }
+    int width, height, bpp;
+    if (decodeBitmapPacked((const unsigned char *)buf, width, height, bpp, out)) {
+        string rle;
+        string text;
+
+        fprintf(f, "%lu %lu %lu %lu %d %d %d I\n", llx, lly, urx, ury,
+                width, height, bpp);
+        ps_runlength((const unsigned char *)out.getString(0), out.getLen(), rle);
+        ps_ascii85(rle, text);
+        fwrite(text.data(), 1, text.size(), f);
     } else
         errorlog("Corrupted bitmap data");
 }
 
 static void
-convertPage(FILE *f, int page, bool last, bufferStore buf)
+convertPage(FILE *f, int page, bool last, const bufferStore &buf)
 {
     int len = buf.getLen();
     int i = 0;
@@ -756,131 +878,449 @@ convertPage(FILE *f, int page, bool last, bufferStore buf)
     }
 }
 
+/**
+ * Number of pages which may wait in each stage of a job's pipeline.
+ * This bounds the memory used by a job, whatever its length.
+ */
+#define PIPE_PAGES 4
+
+/**
+ * A bounded queue between two stages of the print pipeline.
+ *
+ * push() blocks while the queue is full, pop() while it is empty.
+ * After close(), pop() returns false once the queue has been
+ * drained. After abort(), both return false at once.
+ */
+template<typename T> class stageQueue {
+public:
+    stageQueue() : closed(false), aborted(false) {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&cond, NULL);
+    }
+
+    ~stageQueue() {
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&lock);
+    }
+
+    bool push(const T &item) {
+        pthread_mutex_lock(&lock);
+        while (!aborted && (items.size() >= PIPE_PAGES))
+            pthread_cond_wait(&cond, &lock);
+        bool ret = !aborted;
+        if (ret) {
+            items.push_back(item);
+            pthread_cond_broadcast(&cond);
+        }
+        pthread_mutex_unlock(&lock);
+        return ret;
+    }
+
+    bool pop(T &item) {
+        pthread_mutex_lock(&lock);
+        while (!aborted && !closed && items.empty())
+            pthread_cond_wait(&cond, &lock);
+        bool ret = !aborted && !items.empty();
+        if (ret) {
+            item = items.front();
+            items.pop_front();
+            pthread_cond_broadcast(&cond);
+        }
+        pthread_mutex_unlock(&lock);
+        return ret;
+    }
+
+    void close() {
+        pthread_mutex_lock(&lock);
+        closed = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+    }
+
+    void abort() {
+        pthread_mutex_lock(&lock);
+        aborted = true;
+        items.clear();
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+    }
+
+private:
+    deque<T> items;
+    bool closed;
+    bool aborted;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct pageData {
+    bufferStore data;
+    bool last;
+};
+
+/**
+ * A print job on its way from the Psion to the printer.
+ *
+ * The service loop receives the pages from the Psion and hands each
+ * complete page to the converter thread, which turns it into
+ * PostScript. The sink thread writes the PostScript straight into
+ * the print command, or into a spool file if there is none. So the
+ * Psion can send the next page while the previous ones are converted,
+ * and printing starts while the rest of the job is still arriving.
+ */
+class printJob {
+public:
+    printJob() : fd(-1), pid(-1), pageCount(0), failed(false) { }
+
+    /**
+    * Starts the print command or creates the spool file, and
+    * starts the converter and sink threads.
+    */
+    bool start();
+
+    /**
+    * Queues a complete page for conversion. Blocks while
+    * @ref PIPE_PAGES pages are waiting.
+    *
+    * @returns false if the job has failed.
+    */
+    bool addPage(const bufferStore &page, bool last);
+
+    /**
+    * Waits until all pages have been printed.
+    */
+    void finish();
+
+    /**
+    * Discards the job. The print command is killed before it
+    * sees the end of its input, so nothing gets printed.
+    */
+    void cancel();
+
+private:
+    static void *converter(void *arg);
+    static void *sink(void *arg);
+    void discard();
+
+    stageQueue<pageData> pages;
+    stageQueue<string> output;
+    pthread_t convThread;
+    pthread_t sinkThread;
+    string jname;
+    int fd;
+    pid_t pid;
+    int pageCount;
+    bool failed;
+};
+
+void *printJob::
+converter(void *arg)
+{
+    printJob *job = (printJob *)arg;
+    pageData p;
+    int page = 0;
+
+    while (job->pages.pop(p)) {
+        char *ps = nullptr;
+        size_t len = 0;
+        FILE *f = open_memstream(&ps, &len);
+        if (!f) {
+            errorlog("Could not convert page %d: %m", page + 1);
+            job->pages.abort();
+            break;
+        }
+        convertPage(f, page++, p.last, p.data);
+        fclose(f);
+        bool ok = job->output.push(string(ps, len));
+        free(ps);
+        if (!ok) {
+            job->pages.abort();
+            break;
+        }
+    }
+    job->output.close();
+    return nullptr;
+}
+
+void *printJob::
+sink(void *arg)
+{
+    printJob *job = (printJob *)arg;
+    string chunk;
+
+    while (job->output.pop(chunk)) {
+        const char *p = chunk.data();
+        size_t left = chunk.size();
+        while (left > 0) {
+            ssize_t n = write(job->fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                errorlog("Could not write print data: %m");
+                job->failed = true;
+                job->output.abort();
+                job->pages.abort();
+                return nullptr;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+    return nullptr;
+}
+
+bool printJob::
+start()
+{
+    if (printcmd) {
+        int p[2];
+
+        if (pipe(p) != 0) {
+            errorlog("Could not create pipe: %m");
+            return false;
+        }
+        if ((pid = fork()) == 0) {
+            // A process group of its own, so cancel() can kill
+            // the shell together with the command it runs.
+            setpgid(0, 0);
+            signal(SIGPIPE, SIG_DFL);
+            dup2(p[0], STDIN_FILENO);
+            close(p[0]);
+            close(p[1]);
+            execl("/bin/sh", "sh", "-c", printcmd, (char *)nullptr);
+            _exit(127);
+        }
+        close(p[0]);
+        if (pid == -1) {
+            errorlog("Could not execute %s: %m", printcmd);
+            close(p[1]);
+            return false;
+        }
+        // Also done here, so that the group exists before any kill().
+        setpgid(pid, pid);
+        fd = p[1];
+        infolog("Receiving new job for %s", printcmd);
+    } else {
+        jname = string(spooldir) + "/" TEMPLATE;
+        if ((fd = mkstemp(&jname[0])) == -1) {
+            errorlog("Could not create spool file.");
+            jname.clear();
+            return false;
+        }
+        infolog("Receiving new job %s", jname.c_str());
+    }
+    if (pthread_create(&sinkThread, NULL, sink, this) != 0) {
+        discard();
+        return false;
+    }
+    if (pthread_create(&convThread, NULL, converter, this) != 0) {
+        output.abort();
+        pthread_join(sinkThread, NULL);
+        discard();
+        return false;
+    }
+    return true;
+}
+
+bool printJob::
+addPage(const bufferStore &page, bool last)
+{
+    pageData p;
+
+    p.data = page;
+    p.last = last;
+    if (!pages.push(p))
+        return false;
+    pageCount++;
+    return true;
+}
+
+/**
+ * waitpid(), restarted when interrupted.
+ */
+static pid_t
+reap(pid_t pid, int *status, int options)
+{
+    pid_t r;
+
+    while (((r = waitpid(pid, status, options)) == -1) && (errno == EINTR))
+        ;
+    return r;
+}
+
+void printJob::
+discard()
+{
+    if (pid > 0)
+        kill(-pid, SIGTERM);
+    if (fd != -1)
+        close(fd);
+    fd = -1;
+    if (pid > 0) {
+        int i;
+
+        // A command which ignores SIGTERM gets SIGKILL eventually.
+        for (i = 0; i < KILL_TIMEOUT * 10; i++) {
+            if (reap(pid, NULL, WNOHANG) != 0)
+                break;
+            usleep(100000);
+        }
+        if (i == KILL_TIMEOUT * 10) {
+            errorlog("%s did not exit, killing it", printcmd);
+            kill(-pid, SIGKILL);
+            reap(pid, NULL, 0);
+        }
+        pid = -1;
+    }
+    if (!jname.empty())
+        unlink(jname.c_str());
+}
+
+void printJob::
+cancel()
+{
+    pages.abort();
+    output.abort();
+    pthread_join(convThread, NULL);
+    pthread_join(sinkThread, NULL);
+    discard();
+}
+
+void printJob::
+finish()
+{
+    if (pageCount == 0) {
+        cancel();
+        return;
+    }
+    pages.close();
+    pthread_join(convThread, NULL);
+    pthread_join(sinkThread, NULL);
+    if (failed) {
+        discard();
+        return;
+    }
+    if (close(fd) != 0) {
+        errorlog("Could not write print data: %m");
+        fd = -1;
+        discard();
+        return;
+    }
+    fd = -1;
+    if (pid > 0) {
+        int status;
+
+        if (reap(pid, &status, 0) != pid) {
+            errorlog("Could not wait for %s: %m", printcmd);
+            pid = -1;
+            return;
+        }
+        pid = -1;
+        if (WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+            infolog("Printed %d pages", pageCount);
+        else
+            errorlog("%s failed", printcmd);
+    } else
+        infolog("Output stored in %s", jname.c_str());
+}
+
 static unsigned char fakePage[15] = {
     0x2a, 0x2a, 0x09, 0x00, 0x00, 0x00, 0x82, 0x2e,
     0x00, 0x00, 0xc6, 0x41, 0x00, 0x00, 0x00,
 };
 
-const
+static void
+cancel_job(printJob *&job, bool &cancelled)
+{
+    if (job) {
+        job->cancel();
+        delete job;
+        job = nullptr;
+    }
+    cancelled = true;
+    wPrt->cancelJob();
+}
+
 static void
 service_loop()
 {
-    bool jobLoop = true;
-    while (jobLoop) {
-        bool spoolOpen = false;
-        bool pageStart = true;
-        bool cancelled = false;
-        bool jobEnd;
-        unsigned long plen;
-        int pageCount = 0;
-        bufferStore buf;
-        bufferStore pageBuf;
-        int fd;
-        FILE *f = nullptr;
-        unsigned char b;
-        char *jname =
-            (char *)malloc(strlen(spooldir) +
-                           strlen(TEMPLATE) + 2);
-
-        while (jobLoop) {
-            /* Job loop */
-            buf.init();
-            switch (wPrt->getData(buf)) {
-                case rfsv::E_PSI_FILE_DISC:
-                    jobLoop = false;
-                    break;
-                case rfsv::E_PSI_GEN_NONE:
-                    if ((buf.getLen() == 15) &&
-                        (!memcmp(buf.getString(0), fakePage, 15))) {
-                        cancelled = false;
-                        if (spoolOpen) {
-                            fclose(f);
-                            infolog("Cancelled job %s", jname);
-                            unlink(jname);
-                            break;
-                        }
-                        continue;
-                    }
-                    if (!spoolOpen && !cancelled) {
-                        sprintf(jname, "%s/%s", spooldir, TEMPLATE);
-                        if ((fd = mkstemp(jname)) != -1) {
-                            infolog("Receiving new job %s", jname);
-                            spoolOpen = true;
-                            pageStart = true;
-                            pageCount = 0;
-                        } else {
-                            errorlog("Could not create spool file.");
-                            cancelled = true;
-                            wPrt->cancelJob();
-                        }
-                        f = fdopen(fd, "w");
-                        plen = 0;
-                    }
-                    b = buf.getByte(0);
-                    if ((b != 0x2a) && (b != 0xff)) {
-                        errorlog("Invalid packet type 0x%02x.", b);
-                        cancelled = true;
-                        wPrt->cancelJob();
-                    }
-                    jobEnd = (b == 0xff);
-                    if (!cancelled) {
-                        buf.discardFirstBytes(1);
-                        if (pageStart) {
-                            b = buf.getByte(0);
-                            plen = buf.getDWord(1) - 8;
-                            buf.discardFirstBytes(5+8);
-                            pageStart = false;
-                            pageBuf.init();
-                        }
-                        pageBuf.addBuff(buf);
-                        plen -= buf.getLen();
-                        if (plen <= 0) {
-                            convertPage(f, pageCount++, jobEnd, pageBuf);
-                            pageBuf.init();
-                            pageStart = true;
-                        }
-                    }
-                    if (jobEnd) {
-                        if (spoolOpen)
-                            fclose(f);
-                        if (!cancelled) {
-                            if (pageCount > 0) {
-                                if (!printcmd)
-                                    infolog("Output stored in %s", jname);
-                                else {
-                                    int r;
-                                    char cbuf[4096];
-
-                                    infolog("Spooling %d pages", pageCount);
-                                    FILE *pipe = popen(printcmd, "w");
-                                    if (!pipe) {
-                                        errorlog("Could not execute %s: %m",
-                                                 printcmd);
-                                        unlink(jname);
-                                    }
-                                    f = fopen(jname, "r");
-                                    if (!f) {
-                                        errorlog("Could not read %s: %m",
-                                                 jname);
-                                        pclose(pipe);
-                                        unlink(jname);
-                                    }
-                                    while ((r = fread(cbuf, 1,
-                                                      sizeof(cbuf), f)) > 0)
-                                        fwrite(cbuf, 1, r, pipe);
-                                    pclose(pipe);
-                                    fclose(f);
-                                    unlink(jname);
-                                }
-                            }
-                        } else
-                            unlink(jname);
-                        spoolOpen = false;
-                    }
-                    break;
+    printJob *job = nullptr;
+    bool cancelled = false;
+    bool pageStart = true;
+    long plen = 0;
+    bufferStore buf;
+    bufferStore pageBuf;
+    unsigned char b;
+
+    while (true) {
+        buf.init();
+        Enum<rfsv::errs> res = wPrt->getData(buf);
+        if (res == rfsv::E_PSI_FILE_DISC) {
+            if (job) {
+                infolog("Connection lost, cancelled job");
+                job->cancel();
+                delete job;
+            }
+            return;
+        }
+        if (res != rfsv::E_PSI_GEN_NONE)
+            continue;
+        if ((buf.getLen() == 15) &&
+            (!memcmp(buf.getString(0), fakePage, 15))) {
+            if (job) {
+                job->cancel();
+                delete job;
+                job = nullptr;
+                infolog("Cancelled job");
+            }
+            cancelled = false;
+            pageStart = true;
+            continue;
+        }
+        b = buf.getByte(0);
+        if ((b != 0x2a) && (b != 0xff)) {
+            if (!cancelled) {
+                errorlog("Invalid packet type 0x%02x.", b);
+                cancel_job(job, cancelled);
+            }
+            continue;
+        }
+        bool jobEnd = (b == 0xff);
+        if (!cancelled && !job) {
+            job = new printJob();
+            if (!job->start()) {
+                delete job;
+                job = nullptr;
+                cancel_job(job, cancelled);
+            }
+            pageStart = true;
+        }
+        if (!cancelled) {
+            buf.discardFirstBytes(1);
+            if (pageStart) {
+                plen = (long)buf.getDWord(1) - 8;
+                buf.discardFirstBytes(5+8);
+                pageStart = false;
+                pageBuf.init();
+            }
+            pageBuf.addBuff(buf);
+            plen -= buf.getLen();
+            if (plen <= 0) {
+                pageStart = true;
+                if (!job->addPage(pageBuf, jobEnd))
+                    cancel_job(job, cancelled);
+                pageBuf.init();
+            }
+        }
+        if (jobEnd) {
+            if (job) {
+                job->finish();
+                delete job;
+                job = nullptr;
             }
+            cancelled = false;
+            pageStart = true;
         }
-        free(jname);
     }
 }
 
@@ -1023,6 +1463,7 @@ main(int argc, char **argv)
                         close(devnull);
                 }
             }
+            signal(SIGPIPE, SIG_IGN);
             init_fontmap();
             infolog("started, waiting for requests.");
             serviceLoop = true;
@@ -0,0 +1,234 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include <rfsv.h>
+#include <rfsvfactory.h>
+#include <plpintl.h>
+#include <ppsocket.h>
+
+#include <iostream>
+#include <string>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <netdb.h>
+
+#include "plpsync.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <getopt.h>
+
+using namespace std;
+
+static void
+help()
+{
+    cout << _(
+	"Usage: plpsync [OPTIONS]... PSIONDIR LOCALDIR\n"
+	"\n"
+	"Synchronise the directory PSIONDIR on the Psion with the\n"
+	"local directory LOCALDIR, transferring only files which have\n"
+	"changed since the last run.\n"
+	"\n"
+	"Supported options:\n"
+	"\n"
+	" -h, --help              Display this text.\n"
+	" -V, --version           Print version and exit.\n"
+	" -p, --port=[HOST:]PORT  Connect to port PORT on host HOST.\n"
+	"                         Default for HOST is 127.0.0.1\n"
+	"                         Default for PORT is "
+	) << DPORT << "\n" << _(
+	" -m, --manifest=FILE     Keep the sync state in FILE.\n"
+	"                         Default is LOCALDIR/.plpsync\n"
+	" -n, --dry-run           Show what would be done, change nothing.\n"
+	" -d, --delete            Propagate deletions.\n"
+	"     --pull              Only copy from the Psion.\n"
+	"     --push              Only copy to the Psion.\n"
+	" -c, --conflict=POLICY   Resolve conflicts: skip (default),\n"
+	"                         psion, local or newer.\n"
+	" -v, --verbose           Also list unchanged files.\n"
+	) << "\n";
+}
+
+static void
+usage() {
+    cerr << _("Try `plpsync --help' for more information") << endl;
+}
+
+enum {
+    OPT_PULL = 256,
+    OPT_PUSH
+};
+
+static struct option opts[] = {
+    {"help",     no_argument,       0, 'h'},
+    {"version",  no_argument,       0, 'V'},
+    {"port",     required_argument, 0, 'p'},
+    {"manifest", required_argument, 0, 'm'},
+    {"dry-run",  no_argument,       0, 'n'},
+    {"delete",   no_argument,       0, 'd'},
+    {"pull",     no_argument,       0, OPT_PULL},
+    {"push",     no_argument,       0, OPT_PUSH},
+    {"conflict", required_argument, 0, 'c'},
+    {"verbose",  no_argument,       0, 'v'},
+    {NULL,       0,                 0,  0 }
+};
+
+static void
+parse_destination(const char *arg, const char **host, int *port)
+{
+    if (!arg)
+	return;
+    // We don't want to modify argv, therefore copy it first ...
+    char *argcpy = strdup(arg);
+    char *pp = strchr(argcpy, ':');
+
+    if (pp) {
+	// host.domain:400
+	// 10.0.0.1:400
+	*pp ++= '\0';
+	*host = argcpy;
+    } else {
+	// 400
+	// host.domain
+	// host
+	// 10.0.0.1
+	if (strchr(argcpy, '.') || !isdigit(argcpy[0])) {
+	    *host = argcpy;
+	    pp = 0L;
+	} else
+	    pp = argcpy;
+    }
+    if (pp)
+	*port = atoi(pp);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    int sockNum = DPORT;
+    const char *manifest = NULL;
+    PlpSync::direction dir = PlpSync::SYNC_BOTH;
+    PlpSync::conflict_policy policy = PlpSync::CONFLICT_SKIP;
+    bool dryRun = false;
+    bool deleteFiles = false;
+    bool verbose = false;
+
+    setlocale (LC_ALL, "");
+    textdomain(PACKAGE);
+
+    struct servent *se = getservbyname("psion", "tcp");
+    endservent();
+    if (se != 0L)
+	sockNum = ntohs(se->s_port);
+
+    while (1) {
+	int c = getopt_long(argc, argv, "hVp:m:ndc:v", opts, NULL);
+	if (c == -1)
+	    break;
+	switch (c) {
+	    case '?':
+		usage();
+		return 2;
+	    case 'V':
+		cout << _("plpsync Version ") << VERSION << endl;
+		return 0;
+	    case 'h':
+		help();
+		return 0;
+	    case 'p':
+		parse_destination(optarg, &host, &sockNum);
+		break;
+	    case 'm':
+		manifest = optarg;
+		break;
+	    case 'n':
+		dryRun = true;
+		break;
+	    case 'd':
+		deleteFiles = true;
+		break;
+	    case OPT_PULL:
+		dir = PlpSync::SYNC_PULL;
+		break;
+	    case OPT_PUSH:
+		dir = PlpSync::SYNC_PUSH;
+		break;
+	    case 'c':
+		if (!strcmp(optarg, "skip"))
+		    policy = PlpSync::CONFLICT_SKIP;
+		else if (!strcmp(optarg, "psion"))
+		    policy = PlpSync::CONFLICT_PSION;
+		else if (!strcmp(optarg, "local"))
+		    policy = PlpSync::CONFLICT_LOCAL;
+		else if (!strcmp(optarg, "newer"))
+		    policy = PlpSync::CONFLICT_NEWER;
+		else {
+		    cerr << _("plpsync: unknown conflict policy ") << optarg << endl;
+		    usage();
+		    return 2;
+		}
+		break;
+	    case 'v':
+		verbose = true;
+		break;
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	return 2;
+    }
+
+    string localDir = argv[optind + 1];
+    while (localDir.size() > 1 && localDir[localDir.size() - 1] == '/')
+	localDir.erase(localDir.size() - 1);
+    string manifestFile = manifest ? string(manifest) : localDir + "/.plpsync";
+
+    ppsocket *skt = new ppsocket();
+    if (!skt->connect(host, sockNum)) {
+	cerr << _("plpsync: could not connect to ncpd") << endl;
+	return 2;
+    }
+    rfsvfactory *rf = new rfsvfactory(skt);
+    rfsv *a = rf->create(false);
+    int status;
+    if (a != NULL) {
+	PlpSync s(*a, argv[optind], localDir.c_str(), manifestFile.c_str());
+	s.setDirection(dir);
+	s.setConflictPolicy(policy);
+	s.setDryRun(dryRun);
+	s.setDelete(deleteFiles);
+	s.setVerbose(verbose);
+	status = s.run();
+	delete a;
+    } else {
+	cerr << "plpsync: " << rf->getError() << endl;
+	status = 2;
+    }
+    delete rf;
+    delete skt;
+    return status;
+}
@@ -0,0 +1,405 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include "plpsync.h"
+
+#include <plpintl.h>
+
+#include <iostream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+using namespace std;
+
+/**
+ * Suffix of the temporary files downloads are written to.
+ * They are renamed into place only when complete, so an
+ * interrupted download never looks like a local change.
+ */
+#define PARTIAL_SUFFIX ".plpsync-part"
+
+/**
+ * Tolerance in seconds when comparing modification times.
+ * Some Psion media only store even seconds.
+ */
+#define MTIME_SLOP 2
+
+PlpSync::PlpSync(rfsv &_a, const char *_psionRoot, const char *_localRoot,
+		 const char *_manifestFile)
+    : a(_a), psionRoot(_psionRoot), localRoot(_localRoot),
+      manifestFile(_manifestFile), dir(SYNC_BOTH), policy(CONFLICT_SKIP),
+      dryRun(false), deleteFiles(false), verbose(false), transferred(0),
+      deleted(0), conflicts(0), skipped(0), failed(0)
+{
+    if (!localRoot.empty() && localRoot[localRoot.size() - 1] == '/')
+	localRoot.erase(localRoot.size() - 1);
+}
+
+string PlpSync::
+localPath(const string &path)
+{
+    return localRoot + "/" + path;
+}
+
+void PlpSync::
+report(const char *action, const string &path)
+{
+    cout << action << " " << path << endl;
+}
+
+static string
+parentOf(const string &path)
+{
+    size_t p = path.rfind('/');
+    return (p == string::npos) ? string() : path.substr(0, p);
+}
+
+bool PlpSync::
+scanLocal(const string &rel, localMap &files)
+{
+    string dname = rel.empty() ? localRoot : localPath(rel);
+    DIR *d = opendir(dname.c_str());
+    struct dirent *de;
+
+    if (d == NULL) {
+	cerr << _("Could not read directory ") << dname << ": "
+	     << strerror(errno) << endl;
+	return false;
+    }
+    while ((de = readdir(d)) != NULL) {
+	struct stat st;
+
+	if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+	    continue;
+	size_t nlen = strlen(de->d_name);
+	if ((nlen > strlen(PARTIAL_SUFFIX)) &&
+	    !strcmp(de->d_name + nlen - strlen(PARTIAL_SUFFIX), PARTIAL_SUFFIX))
+	    continue;
+	string path = rel.empty() ? string(de->d_name) : rel + "/" + de->d_name;
+	string full = localPath(path);
+	if (full == manifestFile || full == manifestFile + ".tmp")
+	    continue;
+	if (lstat(full.c_str(), &st) != 0)
+	    continue;
+	if (S_ISDIR(st.st_mode)) {
+	    if (!scanLocal(path, files)) {
+		closedir(d);
+		return false;
+	    }
+	} else if (S_ISREG(st.st_mode)) {
+	    localEntry l;
+	    l.size = st.st_size;
+	    l.mtime = st.st_mtime;
+	    files[path] = l;
+	}
+    }
+    closedir(d);
+    return true;
+}
+
+bool PlpSync::
+sameFile(const localEntry &l, const PlpManifestEntry &e)
+{
+    if (l.size != (off_t)e.size)
+	return false;
+    time_t t = e.getPsiTime().getTime();
+    return (l.mtime >= t - MTIME_SLOP) && (l.mtime <= t + MTIME_SLOP);
+}
+
+bool PlpSync::
+makeLocalDir(const string &path)
+{
+    if (path.empty())
+	return true;
+    string full = localPath(path);
+    struct stat st;
+    if (stat(full.c_str(), &st) == 0)
+	return S_ISDIR(st.st_mode);
+    if (!makeLocalDir(parentOf(path)))
+	return false;
+    return (::mkdir(full.c_str(), 0777) == 0) || (errno == EEXIST);
+}
+
+bool PlpSync::
+makePsionDir(const string &path)
+{
+    if (path.empty() || psionDirs.count(path))
+	return true;
+    string pdir = PlpManifest::psionPath(psionRoot, path) + "\\";
+    Enum<rfsv::errs> res = a.mkdir(pdir.c_str());
+    if (res != rfsv::E_PSI_GEN_NONE && res != rfsv::E_PSI_FILE_EXIST) {
+	cerr << _("Could not create ") << pdir << ": " << res << endl;
+	return false;
+    }
+    // MK_DIR_ALL creates all missing parents as well.
+    for (string p = path; !p.empty(); p = parentOf(p))
+	psionDirs.insert(p);
+    return true;
+}
+
+bool PlpSync::
+get(const string &path, const PlpManifestEntry &e)
+{
+    string from = PlpManifest::psionPath(psionRoot, path);
+    string to = localPath(path);
+    string part = to + PARTIAL_SUFFIX;
+
+    if (!makeLocalDir(parentOf(path))) {
+	cerr << _("Could not create directory for ") << to << endl;
+	return false;
+    }
+    Enum<rfsv::errs> res = a.copyFromPsion(from.c_str(), part.c_str(), NULL, NULL);
+    if (res != rfsv::E_PSI_GEN_NONE) {
+	cerr << _("Could not get ") << from << ": " << res << endl;
+	unlink(part.c_str());
+	return false;
+    }
+    struct utimbuf ut;
+    ut.actime = ut.modtime = e.getPsiTime().getTime();
+    if (utime(part.c_str(), &ut) != 0 || ::rename(part.c_str(), to.c_str()) != 0) {
+	cerr << _("Could not update ") << to << ": " << strerror(errno) << endl;
+	unlink(part.c_str());
+	return false;
+    }
+    return true;
+}
+
+bool PlpSync::
+put(const string &path, const localEntry &l, PlpManifestEntry &e)
+{
+    string from = localPath(path);
+    string to = PlpManifest::psionPath(psionRoot, path);
+
+    if (!makePsionDir(parentOf(path)))
+	return false;
+    PlpDirent de;
+    bool existed = (a.fgeteattr(to.c_str(), de) == rfsv::E_PSI_GEN_NONE);
+    PlpManifestEntry before(de);
+    Enum<rfsv::errs> res = a.copyToPsion(from.c_str(), to.c_str(), NULL, NULL);
+    if (res != rfsv::E_PSI_GEN_NONE) {
+	cerr << _("Could not put ") << to << ": " << res << endl;
+	// Never leave a truncated copy behind, it would be
+	// mistaken for a change made on the Psion. A file the
+	// copy failed before touching is left alone.
+	if ((a.fgeteattr(to.c_str(), de) == rfsv::E_PSI_GEN_NONE) &&
+	    (!existed || PlpManifestEntry(de) != before))
+	    a.remove(to.c_str());
+	return false;
+    }
+    res = a.fsetmtime(to.c_str(), PsiTime(l.mtime));
+    if (res == rfsv::E_PSI_GEN_NONE)
+	res = a.fgeteattr(to.c_str(), de);
+    if (res != rfsv::E_PSI_GEN_NONE) {
+	// The copy itself is complete, so it is kept.
+	cerr << _("Could not put ") << to << ": " << res << endl;
+	return false;
+    }
+    e = PlpManifestEntry(de);
+    return true;
+}
+
+bool PlpSync::
+removePsion(const string &path)
+{
+    string name = PlpManifest::psionPath(psionRoot, path);
+    Enum<rfsv::errs> res = a.remove(name.c_str());
+    if (res != rfsv::E_PSI_GEN_NONE && res != rfsv::E_PSI_FILE_NXIST) {
+	cerr << _("Could not delete ") << name << ": " << res << endl;
+	return false;
+    }
+    return true;
+}
+
+bool PlpSync::
+removeLocal(const string &path)
+{
+    string name = localPath(path);
+    if (unlink(name.c_str()) != 0 && errno != ENOENT) {
+	cerr << _("Could not delete ") << name << ": " << strerror(errno) << endl;
+	return false;
+    }
+    return true;
+}
+
+int PlpSync::
+run()
+{
+    PlpManifest old;
+    PlpManifest remote;
+    PlpManifest next;
+    localMap local;
+    set<string> paths;
+
+    if (!old.load(manifestFile.c_str()) && verbose)
+	cout << _("No manifest found, doing a full comparison") << endl;
+
+    Enum<rfsv::errs> res = remote.scan(a, psionRoot.c_str());
+    if (res != rfsv::E_PSI_GEN_NONE) {
+	cerr << _("Could not read ") << psionRoot << ": " << res << endl;
+	return 2;
+    }
+    if (!scanLocal("", local))
+	return 2;
+
+    psionDirs.clear();
+    for (PlpManifest::iterator i = remote.begin(); i != remote.end(); i++) {
+	if (i->second.isDir()) {
+	    psionDirs.insert(i->first);
+	    next.set(i->first, i->second);
+	} else
+	    paths.insert(i->first);
+    }
+    for (localMap::iterator i = local.begin(); i != local.end(); i++)
+	paths.insert(i->first);
+    for (PlpManifest::iterator i = old.begin(); i != old.end(); i++)
+	if (!i->second.isDir())
+	    paths.insert(i->first);
+
+    for (set<string>::iterator p = paths.begin(); p != paths.end(); p++) {
+	const string &path = *p;
+	PlpManifest::iterator R = remote.find(path);
+	PlpManifest::iterator M = old.find(path);
+	localMap::iterator L = local.find(path);
+	bool inR = (R != remote.end());
+	bool inM = (M != old.end());
+	bool inL = (L != local.end());
+	bool rChanged = inR ? (!inM || (R->second != M->second)) : inM;
+	bool lChanged = inL ? (!inM || !sameFile(L->second, M->second)) : inM;
+	bool pull = false;
+	bool push = false;
+
+	if (!rChanged && !lChanged) {
+	    if (inR) {
+		if (verbose)
+		    report(_("same    "), path);
+		next.set(path, R->second);
+	    }
+	    continue;
+	}
+	if (rChanged && lChanged) {
+	    if (!inR && !inL)
+		continue;
+	    if (inR && inL && sameFile(L->second, R->second)) {
+		next.set(path, R->second);
+		continue;
+	    }
+	    if (inR && inL) {
+		switch (policy) {
+		    case CONFLICT_SKIP:
+			report(_("conflict"), path);
+			conflicts++;
+			if (inM)
+			    next.set(path, M->second);
+			continue;
+		    case CONFLICT_PSION:
+			pull = true;
+			break;
+		    case CONFLICT_LOCAL:
+			push = true;
+			break;
+		    case CONFLICT_NEWER:
+			if (L->second.mtime > R->second.getPsiTime().getTime())
+			    push = true;
+			else
+			    pull = true;
+			break;
+		}
+	    } else {
+		// Deleted on one side, modified on the other:
+		// the modified copy wins.
+		pull = inR;
+		push = inL;
+	    }
+	} else {
+	    pull = rChanged;
+	    push = lChanged;
+	}
+
+	if ((pull && dir == SYNC_PUSH) || (push && dir == SYNC_PULL)) {
+	    if (verbose)
+		report(_("skip    "), path);
+	    skipped++;
+	    if (inM)
+		next.set(path, M->second);
+	    continue;
+	}
+
+	if (pull && inR) {
+	    report(_("get     "), path);
+	    if (dryRun || get(path, R->second)) {
+		next.set(path, R->second);
+		transferred++;
+	    } else {
+		failed++;
+		if (inM)
+		    next.set(path, M->second);
+	    }
+	} else if (push && inL) {
+	    PlpManifestEntry e;
+	    report(_("put     "), path);
+	    if (dryRun) {
+		transferred++;
+	    } else if (put(path, L->second, e)) {
+		next.set(path, e);
+		transferred++;
+	    } else
+		failed++;
+	} else if (!deleteFiles) {
+	    report(_("keep    "), path);
+	    skipped++;
+	    if (inM)
+		next.set(path, M->second);
+	} else if (pull) {
+	    report(_("rm local"), path);
+	    if (dryRun || removeLocal(path))
+		deleted++;
+	    else {
+		failed++;
+		next.set(path, M->second);
+	    }
+	} else {
+	    report(_("rm Psion"), path);
+	    if (dryRun || removePsion(path))
+		deleted++;
+	    else {
+		failed++;
+		next.set(path, M->second);
+	    }
+	}
+    }
+
+    cout << transferred << _(" transferred, ") << deleted << _(" deleted, ")
+	 << conflicts << _(" conflicts, ") << skipped << _(" skipped, ")
+	 << failed << _(" failed") << endl;
+
+    if (!dryRun && !next.save(manifestFile.c_str())) {
+	cerr << _("Could not write manifest ") << manifestFile << endl;
+	return 2;
+    }
+    return (failed || conflicts) ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _PLPSYNC_H_
+#define _PLPSYNC_H_
+
+#include "config.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <rfsv.h>
+#include <plpmanifest.h>
+
+/**
+ * Incremental synchronisation of a directory tree on the Psion
+ * with a directory on the local machine.
+ *
+ * The manifest holds the state of the Psion tree as of the last
+ * successful sync. After every transfer, both copies of a file
+ * have the same size and modification time, so the same manifest
+ * entry also describes the local copy. A file has changed on
+ * the Psion if its directory entry no longer matches the
+ * manifest, and has changed locally if its size or mtime do not.
+ */
+class PlpSync {
+public:
+    enum direction {
+	SYNC_BOTH,
+	SYNC_PULL,
+	SYNC_PUSH
+    };
+
+    enum conflict_policy {
+	CONFLICT_SKIP,
+	CONFLICT_PSION,
+	CONFLICT_LOCAL,
+	CONFLICT_NEWER
+    };
+
+    PlpSync(rfsv &a, const char *psionRoot, const char *localRoot, const char *manifestFile);
+
+    void setDirection(direction d) { dir = d; }
+    void setConflictPolicy(conflict_policy p) { policy = p; }
+    void setDryRun(bool f) { dryRun = f; }
+    void setDelete(bool f) { deleteFiles = f; }
+    void setVerbose(bool f) { verbose = f; }
+
+    /**
+    * Runs one sync pass.
+    *
+    * @returns 0 on success, 1 if some files could not be
+    *          synchronised, 2 on fatal errors.
+    */
+    int run();
+
+private:
+    /**
+    * The state of a file in the local directory.
+    */
+    struct localEntry {
+	off_t size;
+	time_t mtime;
+    };
+    typedef std::map<std::string, localEntry> localMap;
+
+    bool scanLocal(const std::string &rel, localMap &files);
+    bool sameFile(const localEntry &l, const PlpManifestEntry &e);
+
+    bool get(const std::string &path, const PlpManifestEntry &e);
+    bool put(const std::string &path, const localEntry &l, PlpManifestEntry &e);
+    bool removePsion(const std::string &path);
+    bool removeLocal(const std::string &path);
+    bool makePsionDir(const std::string &path);
+    bool makeLocalDir(const std::string &path);
+
+    void report(const char *action, const std::string &path);
+    std::string localPath(const std::string &path);
+
+    rfsv &a;
+    std::string psionRoot;
+    std::string localRoot;
+    std::string manifestFile;
+    direction dir;
+    conflict_policy policy;
+    bool dryRun;
+    bool deleteFiles;
+    bool verbose;
+
+    std::set<std::string> psionDirs;
+    int transferred;
+    int deleted;
+    int conflicts;
+    int skipped;
+    int failed;
+};
+
+#endif
@@ -29,7 +29,7 @@ FakePsion::~FakePsion()
 }
 
 bool
-FakePsion::connect()
+FakePsion::connect(const char*)
 {
 	return true;
 }
@@ -43,6 +43,15 @@ FakePsion::copyToPsion(const char * const from, const char * const to,
 	return rfsv::E_PSI_GEN_NONE;
 }
 
+Enum<rfsv::errs>
+FakePsion::copyToPsion(const uint8_t *, size_t len, const char * const to,
+				   void *, cpCallback_t)
+{
+	if (logLevel >= 1)
+		printf(" -- Not really copying %zu bytes to %s\n", len, to);
+	return rfsv::E_PSI_GEN_NONE;
+}
+
 Enum<rfsv::errs>
 FakePsion::devinfo(const char drive, PlpDrive& plpDrive)
 {
@@ -72,6 +81,12 @@ FakePsion::disconnect()
 {
 }
 
+bool
+FakePsion::getMachineUID(uint64_t& uid)
+{
+	return false;
+}
+
 Enum<rfsv::errs>
 FakePsion::mkdir(const char* dir)
 {
@@ -31,11 +31,14 @@ public:
 
 	virtual ~FakePsion();
 
-	virtual bool connect();
+	virtual bool connect(const char* device);
 
     virtual Enum<rfsv::errs> copyToPsion(const char * const from,
 										 const char * const to,
 										 void *, cpCallback_t func);
+    virtual Enum<rfsv::errs> copyToPsion(const uint8_t *buf, size_t len,
+										 const char * const to,
+										 void *, cpCallback_t func);
 
 	virtual Enum<rfsv::errs> devinfo(const char drive, PlpDrive& plpDrive);
 
@@ -47,6 +50,8 @@ public:
 
 	virtual void disconnect();
 
+	virtual bool getMachineUID(uint64_t& uid);
+
 	virtual Enum<rfsv::errs> mkdir(const char* dir);
 
 	virtual void remove(const char* name);
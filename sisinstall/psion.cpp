@@ -41,7 +41,7 @@ Psion::~Psion()
 }
 
 bool
-Psion::connect()
+Psion::connect(const char* device)
 {
 	int sockNum = DPORT;
 
@@ -73,8 +73,8 @@ Psion::connect()
 	if (!m_skt2->connect(NULL, sockNum)) {
 		return false;
 	}
-	m_rfsvFactory = new rfsvfactory(m_skt);
-	m_rpcsFactory = new rpcsfactory(m_skt2);
+	m_rfsvFactory = new rfsvfactory(m_skt, device);
+	m_rpcsFactory = new rpcsfactory(m_skt2, device);
 	m_rfsv = m_rfsvFactory->create(true);
 	m_rpcs = m_rpcsFactory->create(true);
 	if ((m_rfsv != NULL) && (m_rpcs != NULL))
@@ -89,6 +89,23 @@ Psion::copyFromPsion(const char * const from, int fd,
 	return m_rfsv->copyFromPsion(from, fd, func);
 }
 
+Enum<rfsv::errs>
+Psion::copyFromPsion(const char * const from, uint8_t *buf, uint32_t len)
+{
+	Enum<rfsv::errs> res;
+	uint32_t handle;
+	uint32_t count;
+	res = m_rfsv->fopen(m_rfsv->opMode(rfsv::PSI_O_RDONLY | rfsv::PSI_O_SHARE),
+						from, handle);
+	if (res != rfsv::E_PSI_GEN_NONE)
+		return res;
+	res = m_rfsv->freadPipelined(handle, buf, len, count, 4);
+	m_rfsv->fclose(handle);
+	if ((res == rfsv::E_PSI_GEN_NONE) && (count != len))
+		res = rfsv::E_PSI_FILE_EOF;
+	return res;
+}
+
 Enum<rfsv::errs>
 Psion::copyToPsion(const char * const from, const char * const to,
 				   void *, cpCallback_t func)
@@ -99,6 +116,13 @@ Psion::copyToPsion(const char * const from, const char * const to,
 	return res;
 }
 
+Enum<rfsv::errs>
+Psion::copyToPsion(const uint8_t *buf, size_t len, const char * const to,
+				   void *, cpCallback_t func)
+{
+	return m_rfsv->copyToPsion(buf, len, to, NULL, func);
+}
+
 Enum<rfsv::errs>
 Psion::devinfo(const char drive, PlpDrive& plpDrive)
 {
@@ -143,6 +167,16 @@ Psion::disconnect()
 	delete m_rpcsFactory;
 }
 
+bool
+Psion::getMachineUID(uint64_t& uid)
+{
+	rpcs::machineInfo mi;
+	if (m_rpcs->getMachineInfo(mi) != rfsv::E_PSI_GEN_NONE)
+		return false;
+	uid = mi.machineUID;
+	return true;
+}
+
 Enum<rfsv::errs>
 Psion::mkdir(const char* dir)
 {
@@ -38,14 +38,29 @@ public:
 
 	virtual ~Psion();
 
-	virtual bool connect();
+	/**
+	 * Connect to ncpd.
+	 *
+	 * @param device The Psion to talk to, on an ncpd serving more
+	 *               than one, or NULL for its default one.
+	 */
+	virtual bool connect(const char* device);
 
 	virtual Enum<rfsv::errs> copyFromPsion(const char * const from, int fd,
 										   cpCallback_t func);
 
+	/**
+	 * Read a whole file into memory.
+	 */
+	virtual Enum<rfsv::errs> copyFromPsion(const char * const from,
+										   uint8_t *buf, uint32_t len);
+
     virtual Enum<rfsv::errs> copyToPsion(const char * const from,
 										 const char * const to,
 										 void *, cpCallback_t func);
+    virtual Enum<rfsv::errs> copyToPsion(const uint8_t *buf, size_t len,
+										 const char * const to,
+										 void *, cpCallback_t func);
 
 	virtual Enum<rfsv::errs> devinfo(const char drive, PlpDrive& plpDrive);
 
@@ -57,6 +72,13 @@ public:
 
 	virtual void disconnect();
 
+	/**
+	 * Get the unique id of the machine.
+	 *
+	 * @return false if the machine does not tell.
+	 */
+	virtual bool getMachineUID(uint64_t& uid);
+
 	virtual Enum<rfsv::errs> mkdir(const char* dir);
 
 	virtual void remove(const char* name);
@@ -0,0 +1,159 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "config.h"
+
+#include "siscache.h"
+#include "sistypes.h"
+
+#include <plpdirent.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static bool
+makeDir(const string& dir)
+{
+	if ((::mkdir(dir.c_str(), 0700) == 0) || (errno == EEXIST))
+		return true;
+	if (errno != ENOENT)
+		return false;
+	size_t slash = dir.rfind('/', dir.size() - 2);
+	if ((slash == string::npos) || (slash == 0))
+		return false;
+	if (!makeDir(dir.substr(0, slash)))
+		return false;
+	return (::mkdir(dir.c_str(), 0700) == 0) || (errno == EEXIST);
+}
+
+/**
+ * The index key of a file. EPOC file names are case insensitive.
+ */
+static string
+keyOf(PlpDirent& e)
+{
+	string key(e.getName());
+	for (size_t i = 0; i < key.size(); i++)
+		key[i] = (key[i] == '/') ? '_' : tolower(key[i]);
+	return key;
+}
+
+SISCache::SISCache()
+{
+}
+
+bool
+SISCache::open(uint64_t machineUID)
+{
+	const char* base = getenv("XDG_CACHE_HOME");
+	string dir;
+	if (base && *base)
+		dir = base;
+	else if ((base = getenv("HOME")) && *base)
+		dir = string(base) + "/.cache";
+	else
+		return false;
+	char uid[20];
+	snprintf(uid, sizeof(uid), "%016llx", (unsigned long long)machineUID);
+	dir += "/plptools/sis/";
+	dir += uid;
+	dir += "/";
+	if (!makeDir(dir))
+		{
+		if (logLevel >= 1)
+			fprintf(stderr, "Not using the cache in %s\n", dir.c_str());
+		return false;
+		}
+	m_dir = dir;
+	m_index.load((m_dir + "index").c_str());
+	m_seen.clear();
+	return true;
+}
+
+string
+SISCache::dataFile(const char* key)
+{
+	return m_dir + key;
+}
+
+uint8_t*
+SISCache::lookup(PlpDirent& e, off_t& len)
+{
+	if (m_dir.empty())
+		return 0;
+	string key = keyOf(e);
+	PlpManifest::iterator i = m_index.find(key);
+	PlpManifestEntry current(e);
+	if ((i == m_index.end()) || (i->second != current))
+		return 0;
+	int fd = ::open(dataFile(key.c_str()).c_str(), O_RDONLY);
+	if (fd == -1)
+		return 0;
+	len = current.size;
+	uint8_t* buf = new uint8_t[len];
+	ssize_t rc = read(fd, buf, len);
+	close(fd);
+	if (rc != len)
+		{
+		delete[] buf;
+		return 0;
+		}
+	m_seen.set(key, current);
+	return buf;
+}
+
+void
+SISCache::store(PlpDirent& e, const uint8_t* buf, off_t len)
+{
+	if (m_dir.empty())
+		return;
+	string key = keyOf(e);
+	string name = dataFile(key.c_str());
+	string tmp = name + ".tmp";
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		return;
+	ssize_t rc = write(fd, buf, len);
+	if ((close(fd) != 0) || (rc != len) ||
+		(rename(tmp.c_str(), name.c_str()) != 0))
+		{
+		unlink(tmp.c_str());
+		return;
+		}
+	m_seen.set(key, PlpManifestEntry(e));
+}
+
+void
+SISCache::save()
+{
+	if (m_dir.empty())
+		return;
+	for (PlpManifest::iterator i = m_index.begin(); i != m_index.end(); i++)
+		if (m_seen.find(i->first) == m_seen.end())
+			unlink(dataFile(i->first.c_str()).c_str());
+	if (m_seen.save((m_dir + "index").c_str()))
+		m_index = m_seen;
+}
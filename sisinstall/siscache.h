@@ -0,0 +1,91 @@
+/*
+ * This file is part of plptools.
+ *
+ *  Copyright (C) 2026 The plptools developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _SISCACHE_H
+#define _SISCACHE_H
+
+#include <plpmanifest.h>
+
+#include <string>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+class PlpDirent;
+
+/**
+ * A cache of the residual sis files of one Psion on the local machine.
+ *
+ * The residual files in C:\System\Install only hold the header,
+ * language, requisite, component name and file records of an
+ * installed package, so they are stored as they are. An entry is
+ * valid as long as the size and modification time of the file on
+ * the Psion are unchanged; this is tracked with a @ref PlpManifest .
+ *
+ * The cache lives in $XDG_CACHE_HOME/plptools/sis/<machine uid>/,
+ * or ~/.cache/plptools/sis/<machine uid>/.
+ */
+class SISCache
+{
+public:
+
+	SISCache();
+
+	/**
+	 * Select the cache of a machine, creating it if needed.
+	 *
+	 * @return false if there is no usable cache directory.
+	 */
+	bool open(uint64_t machineUID);
+
+	/**
+	 * Look up a residual sis file.
+	 *
+	 * @param e The directory entry of the file on the Psion.
+	 * @param len Returns the length of the data.
+	 * @return The data, allocated with new[], or 0 if the file is
+	 *         not in the cache or has changed since it was stored.
+	 */
+	uint8_t* lookup(PlpDirent& e, off_t& len);
+
+	/**
+	 * Store the contents of a residual sis file.
+	 */
+	void store(PlpDirent& e, const uint8_t* buf, off_t len);
+
+	/**
+	 * Write the index. Entries which have not been found by
+	 * @ref lookup or written by @ref store since @ref open are
+	 * gone from the Psion, and are removed.
+	 */
+	void save();
+
+private:
+
+	std::string m_dir;
+
+	PlpManifest m_index;
+
+	PlpManifest m_seen;
+
+	std::string dataFile(const char* name);
+
+};
+
+#endif
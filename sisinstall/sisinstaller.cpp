@@ -22,6 +22,7 @@
 
 #include "sisinstaller.h"
 
+#include "siscache.h"
 #include "sisfile.h"
 #include "sisfilelink.h"
 #include "sisfilerecord.h"
@@ -29,6 +30,7 @@
 #include "psion.h"
 
 #include <cstdlib>
+#include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -57,6 +59,10 @@ SISInstaller::SISInstaller()
 {
         m_installed = nullptr;
         m_ownInstalled = false;
+        m_loaded = false;
+        m_useCache = true;
+        m_sessionDrive = 0;
+        m_dirs = &m_knownDirs;
 }
 
 SISInstaller::~SISInstaller()
@@ -72,6 +78,41 @@ SISInstaller::~SISInstaller()
                         curr = next;
                         }
                 }
+        for (size_t i = 0; i < m_packages.size(); i++)
+                delete m_packages[i].file;
+}
+
+void
+SISInstaller::addInstalled(SISFile* file)
+{
+        // Forget the versions which have been uninstalled.
+        //
+        SISFileLink** prev = &m_installed;
+        while (*prev)
+                {
+                SISFileLink* curr = *prev;
+                if (curr->m_file->m_header.m_uid1 == file->m_header.m_uid1)
+                        {
+                        *prev = curr->m_next;
+                        delete curr->m_file;
+                        delete curr;
+                        }
+                else
+                        prev = &curr->m_next;
+                }
+        SISFileLink* link = new SISFileLink(file);
+        link->m_next = m_installed;
+        m_installed = link;
+}
+
+void
+SISInstaller::addPackage(SISFile* file, uint8_t* buf, off_t len)
+{
+        package p;
+        p.file = file;
+        p.buf = buf;
+        p.len = len;
+        m_packages.push_back(p);
 }
 
 void
@@ -84,21 +125,35 @@ SISInstaller::createDirs(char* filename)
                 if ((ch == '/') || (ch == '\\'))
                         {
                         *end = 0;
+                        std::string dir(filename);
+                        *end = ch;
+                        for (size_t i = 0; i < dir.size(); i++)
+                                dir[i] = tolower(dir[i]);
+                        if (m_dirs->count(dir))
+                                return;
                         if (logLevel >= 1)
-                                fprintf(stderr, "Checking for existance of %s\n", filename);
-//			if (!m_psion->dirExists(filename))
+                                fprintf(stderr, "Creating dir %.*s\n",
+                                        (int)(end - filename), filename);
+                        Enum<rfsv::errs> res;
+                        *end = 0;
+                        res = m_psion->mkdir(filename);
+                        *end = ch;
+                        if ((res != rfsv::E_PSI_GEN_NONE) &&
+                                (res != rfsv::E_PSI_FILE_EXIST))
                                 {
-                                if (logLevel >= 1)
-                                        fprintf(stderr, "Creating dir %s\n", filename);
-                                Enum<rfsv::errs> res;
-                                res = m_psion->mkdir(filename);
-                                if ((res != rfsv::E_PSI_GEN_NONE) &&
-                                        (res != rfsv::E_PSI_FILE_EXIST))
-                                        {
-                                                fprintf(stderr, " -> Failed: %s\n", (const char*)res);
-                                        }
+                                        fprintf(stderr, " -> Failed: %s\n", (const char*)res);
+                                        return;
+                                }
+                        // mkdir creates the parents as well.
+                        //
+                        while (!dir.empty() && !m_dirs->count(dir))
+                                {
+                                m_dirs->insert(dir);
+                                size_t sep = dir.find_last_of("/\\");
+                                if (sep == std::string::npos)
+                                        break;
+                                dir.erase(sep);
                                 }
-                        *end = ch;
                         return;
                         }
                 }
@@ -146,26 +201,10 @@ void
 SISInstaller::copyBuf(const uint8_t* buf, int len, char* name)
 {
         createDirs(name);
-        char srcName[32];
-        strcpy(srcName, "/tmp/plptools-sis-XXXXXX");
-        int fd = mkstemp(srcName);
-        if (-1 == fd)
-                {
-                        fprintf(stderr,
-                                        "Couldn't create temp file: %s\n", strerror(errno));
-                return;
-                }
         Enum<rfsv::errs> res;
-        if (logLevel >= 2)
-                fprintf(stderr, "Storing in %s\n", srcName);
-        ssize_t written = write(fd, buf, len);
-        int close_res = close(fd);
-        bool write_ok = written == len && close_res == 0;
-        if (write_ok) {
-                continueRunning = 1;
-                res = m_psion->copyToPsion(srcName, name, NULL, checkAbortHash);
-        }
-        if (write_ok && res == rfsv::E_PSI_GEN_NONE)
+        continueRunning = 1;
+        res = m_psion->copyToPsion(buf, len, name, NULL, checkAbortHash);
+        if (res == rfsv::E_PSI_GEN_NONE)
                 {
                 if (logLevel >= 1)
                         fprintf(stderr, " -> Success.\n");
@@ -174,7 +213,6 @@ SISInstaller::copyBuf(const uint8_t* buf, int len, char* name)
                 {
                         fprintf(stderr, " -> Fail: %s\n", (const char*)res);
                 }
-        unlink(srcName);
 }
 
 int
@@ -241,6 +279,8 @@ SISInstaller::installFile(SISFileRecord* fileRecord)
                         SISInstaller installer;
                         installer.setPsion(m_psion);
                         installer.setInstalled(m_installed);
+                        installer.setUseCache(m_useCache);
+                        installer.setKnownDirs(m_dirs);
                         rc = installer.run(&sisFile, buf2, len, m_file);
                         if (0 == m_drive)
                                 {
@@ -275,74 +315,81 @@ SISInstaller::loadInstalled()
         PlpDir files;
         Enum<rfsv::errs> res;
 
+        m_loaded = true;
+        m_ownInstalled = true;
         if ((res = m_psion->dir(SYSTEMINSTALL, files)) != rfsv::E_PSI_GEN_NONE)
                 {
                 return SIS_FAILED;
                 }
         else
                 {
+                // Only residual files which have changed since the last
+                // run are fetched from the Psion.
+                //
+                SISCache cache;
+                uint64_t uid;
+                if (m_useCache && m_psion->getMachineUID(uid))
+                        cache.open(uid);
                 while (!files.empty())
                         {
                         PlpDirent file = files[0];
                         if (logLevel >= 1)
                                 fprintf(stderr, "Loading sis file `%s'\n", file.getName());
-                        char sisname[256];
-                        sprintf(sisname, "%s%s", SYSTEMINSTALL, file.getName());
-                        loadPsionSis(sisname);
+                        loadPsionSis(file, cache);
                         files.pop_front();
                         }
+                cache.save();
                 return SIS_OK;
                 }
 }
 
 void
-SISInstaller::loadPsionSis(const char* name)
+SISInstaller::loadPsionSis(PlpDirent& file, SISCache& cache)
 {
-        char srcName[32];
-        strcpy(srcName, "/tmp/plptools-sis-XXXXXX");
-        int fd = mkstemp(srcName);
-        if (-1 == fd)
+        char name[256];
+        snprintf(name, sizeof(name), "%s%s", SYSTEMINSTALL, file.getName());
+        off_t fileLen = file.getSize();
+        uint8_t* sisbuf = cache.lookup(file, fileLen);
+        if (sisbuf)
                 {
-                fprintf(stderr, "Couldn't create temp file: %s\n", strerror(errno));
-                return;
+                if (logLevel >= 2)
+                        fprintf(stderr, "Using cached copy of %s\n", name);
                 }
-        Enum<rfsv::errs> res;
-        continueRunning = 1;
-        if (logLevel >= 2)
-                fprintf(stderr, "Copying from %s to temp file %s\n", name, srcName);
-        res = m_psion->copyFromPsion(name, fd, checkAbortHash);
-        if (res == rfsv::E_PSI_GEN_NONE)
+        else
                 {
-                off_t fileLen = lseek(fd, 0, SEEK_END);
                 if (logLevel >= 2)
-                        fprintf(stderr, "Read %d bytes from the Psion file %s\n",
+                        fprintf(stderr, "Reading %d bytes from the Psion file %s\n",
                                    (int)fileLen, name);
-                lseek(fd, SEEK_SET, 0);
-                uint8_t* sisbuf = new uint8_t[fileLen];
-                int rc = read(fd, sisbuf, fileLen);
-                if (rc == fileLen)
+                sisbuf = new uint8_t[fileLen];
+                Enum<rfsv::errs> res = m_psion->copyFromPsion(name, sisbuf, fileLen);
+                if (res != rfsv::E_PSI_GEN_NONE)
                         {
-                        SISFile* sisFile = new SISFile();
-                        SisRC rc2 = sisFile->fillFrom(sisbuf, fileLen);
-                        if (rc2 == SIS_OK)
-                                {
-                                if (logLevel >= 1)
-                                        fprintf(stderr, " Ok.\n");
-                                SISFileLink* link = new SISFileLink(sisFile);
-                                link->m_next = m_installed;
-                                m_ownInstalled = true;
-                                m_installed = link;
-                                sisFile->ownBuffer();
-                                }
-                        else
-                                {
-                                delete sisFile;
-                                delete[] sisbuf;
-                                }
+                        delete[] sisbuf;
+                        return;
                         }
+                cache.store(file, sisbuf, fileLen);
+                }
+
+        // The other records are parsed on demand, when a file
+        // really has to be uninstalled.
+        //
+        SISFile* sisFile = new SISFile();
+        SisRC rc2 = sisFile->fillHeader(sisbuf, fileLen);
+        if (rc2 == SIS_OK)
+                {
+                if (logLevel >= 1)
+                        fprintf(stderr, " Ok.\n");
+                SISFileLink* link = new SISFileLink(sisFile);
+                link->m_next = m_installed;
+                m_ownInstalled = true;
+                m_installed = link;
+                sisFile->ownBuffer();
+                }
+        else
+                {
+                delete sisFile;
+                delete[] sisbuf;
                 }
-        close(fd);
-        unlink(srcName);
 }
 
 void
@@ -363,6 +410,76 @@ SISInstaller::run(SISFile* file, uint8_t* buf, off_t len)
         return run(file, buf, len, 0);
 }
 
+/**
+ * Does package a list package b as a requisite?
+ */
+static bool
+needsPackage(SISFile* a, SISFile* b)
+{
+        for (int i = 0; i < a->m_header.m_nreqs; ++i)
+                if (a->m_reqRecords[i].m_uid == b->m_header.m_uid1)
+                        return true;
+        return false;
+}
+
+void
+SISInstaller::orderPackages()
+{
+        // Keep the given order, except that a package goes after
+        // the ones it requires. Cycles are broken in the given order.
+        //
+        size_t n = m_packages.size();
+        std::vector<package> ordered;
+        std::vector<bool> done(n, false);
+        while (ordered.size() < n)
+                {
+                size_t next = n;
+                size_t first = n;
+                for (size_t i = 0; (i < n) && (next == n); ++i)
+                        {
+                        if (done[i])
+                                continue;
+                        if (first == n)
+                                first = i;
+                        bool waiting = false;
+                        for (size_t j = 0; (j < n) && !waiting; ++j)
+                                waiting = !done[j] && (j != i) &&
+                                        needsPackage(m_packages[i].file, m_packages[j].file);
+                        if (!waiting)
+                                next = i;
+                        }
+                if (next == n)
+                        next = first;
+                done[next] = true;
+                ordered.push_back(m_packages[next]);
+                }
+        m_packages.swap(ordered);
+}
+
+int
+SISInstaller::runAll()
+{
+        int failed = 0;
+        if (!m_loaded)
+                loadInstalled();
+        orderPackages();
+        for (size_t i = 0; i < m_packages.size(); ++i)
+                {
+                package& p = m_packages[i];
+                if (run(p.file, p.buf, p.len) == SIS_OK)
+                        {
+                        // Later packages may require this one, or
+                        // replace it.
+                        //
+                        addInstalled(p.file);
+                        p.file = 0;
+                        }
+                else
+                        ++failed;
+                }
+        return failed;
+}
+
 SisRC
 SISInstaller::run(SISFile* file, uint8_t* buf, off_t len, SISFile* parent)
 {
@@ -411,7 +528,7 @@ SISInstaller::run(SISFile* file, uint8_t* buf, off_t len, SISFile* parent)
         // library has been loaded, since the sis file names could be just
         // about anything.
         //
-        if (m_installed == 0)
+        if (!m_loaded)
                 loadInstalled();
 
         // Check Requisites.
@@ -426,6 +543,12 @@ SISInstaller::run(SISFile* file, uint8_t* buf, off_t len, SISFile* parent)
                         fprintf(stderr,
                                 " Check if app with uid %08x exists with version >= %d.%d\n",
                                 reqRecord->m_uid, reqRecord->m_major, reqRecord->m_minor);
+                SISFileLink* curr = m_installed;
+                while (curr && (curr->m_file->m_header.m_uid1 != reqRecord->m_uid))
+                        curr = curr->m_next;
+                if (curr == 0)
+                        printf(_("Warning: required component %08x is not installed.\n"),
+                               reqRecord->m_uid);
                 }
 
         // Check previous version.
@@ -486,7 +609,7 @@ SISInstaller::run(SISFile* file, uint8_t* buf, off_t len, SISFile* parent)
         n = m_file->m_header.m_nfiles;
         if (logLevel >= 1)
                 fprintf(stderr, "Found %d files.\n", n);
-        m_drive = (parent == 0) ? 0 : parent->m_header.m_installationDrive;
+        m_drive = (parent == 0) ? m_sessionDrive : parent->m_header.m_installationDrive;
         int nCopiedFiles = 0;
         m_lastSisFile = 0;
         bool skipnext = false;
@@ -518,6 +641,8 @@ SISInstaller::run(SISFile* file, uint8_t* buf, off_t len, SISFile* parent)
                         nCopiedFiles++;
                 }
         m_file->setFiles(nCopiedFiles);
+        if (parent == 0)
+                m_sessionDrive = m_drive;
         if (logLevel >= 1)
                 fprintf(stderr,
                                 "Installed %d files of %d, cutting at offset %u.\n",
@@ -632,6 +757,11 @@ SISInstaller::setPsion(Psion* psion)
 void
 SISInstaller::uninstall(SISFile* file)
 {
+        if (file->fillRecords() != SIS_OK)
+                {
+                fprintf(stderr, "Could not read the installed files list\n");
+                return;
+                }
         int n = file->m_header.m_nfiles;
         int fileix = n - file->m_header.m_installationFiles;
         if (logLevel >= 1)
@@ -683,6 +813,8 @@ SISInstaller::uninstallFile(SISFileRecord* fileRecord)
                         SISInstaller installer;
                         installer.setPsion(m_psion);
                         installer.setInstalled(m_installed);
+                        installer.setUseCache(m_useCache);
+                        installer.setKnownDirs(m_dirs);
                         rc = installer.run(&sisFile, buf2, len, m_file);
                         if (0 == m_drive)
                                 {
@@ -23,9 +23,15 @@
 
 #include "sistypes.h"
 
+#include <set>
+#include <string>
+#include <vector>
+
 #include <sys/types.h>
 
+class PlpDirent;
 class Psion;
+class SISCache;
 class SISFile;
 class SISFileLink;
 class SISFileRecord;
@@ -46,6 +52,23 @@ public:
 
 	SisRC run(SISFile* file, uint8_t* buf, off_t len, SISFile* parent);
 
+	/**
+	 * Queue a package for runAll(). The installer takes over the
+	 * SISFile object, but not the buffer, which has to stay valid
+	 * until the installer is deleted.
+	 */
+	void addPackage(SISFile* file, uint8_t* buf, off_t len);
+
+	/**
+	 * Install all queued packages in one session.
+	 * The installed packages are read only once, a package is
+	 * installed after the packages in the queue which it requires,
+	 * and the drive is asked for only once.
+	 *
+	 * @return The number of packages which were not installed.
+	 */
+	int runAll();
+
 	/**
 	 * Ask the user which drive to install to.
 	 */
@@ -59,6 +82,25 @@ public:
 	void setInstalled(SISFileLink* installed)
 		{
 		m_installed = installed;
+		m_loaded = true;
+		}
+
+	/**
+	 * Share the set of directories known to exist on the Psion
+	 * with another installer.
+	 */
+	void setKnownDirs(std::set<std::string>* dirs)
+		{
+		m_dirs = dirs;
+		}
+
+	/**
+	 * Keep copies of the residual sis files of the Psion on the
+	 * local machine, see SISCache. On by default.
+	 */
+	void setUseCache(bool useCache)
+		{
+		m_useCache = useCache;
 		}
 
 	/**
@@ -84,6 +126,28 @@ private:
 
 	bool m_ownInstalled;
 
+	bool m_loaded;
+
+	bool m_useCache;
+
+	char m_sessionDrive;
+
+	struct package {
+		SISFile* file;
+		uint8_t* buf;
+		off_t len;
+	};
+
+	std::vector<package> m_packages;
+
+	/**
+	 * The directories, in lower case, which have been created or
+	 * found to exist, so each is made only once per session.
+	 */
+	std::set<std::string> m_knownDirs;
+
+	std::set<std::string>* m_dirs;
+
 	enum {
 		FILE_OK,
 		FILE_SKIP,
@@ -102,11 +166,15 @@ private:
 
 	void createDirs(char* filename);
 
+	void addInstalled(SISFile* file);
+
+	void orderPackages();
+
 	int installFile(SISFileRecord* fileRecord);
 
 	SisRC loadInstalled();
 
-	void loadPsionSis(const char* name);
+	void loadPsionSis(PlpDirent& file, SISCache& cache);
 
 	void removeFile(SISFileRecord* fileRecord);
 
@@ -25,14 +25,21 @@
 #include "psion.h"
 #include "fakepsion.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifndef _GNU_SOURCE
@@ -52,13 +59,16 @@ static struct option opts[] = {
         { "version",  no_argument,       0, 'V' },
         { "verbose", required_argument, 0, 'v' },
         { "dry-run",  no_argument,       0, 'n' },
+        { "no-cache", no_argument,       0, 'C' },
+        { "verify-only", no_argument,    0, 't' },
+        { "device",   required_argument, 0, 'D' },
         { NULL,       0,                 0, 0 },
 };
 
 void printHelp()
 {
         printf("%s",
-        _("Usage: sisinstall [OPTIONS]... SISFILE\n"
+        _("Usage: sisinstall [OPTIONS]... SISFILE...\n"
         "\n"
         "Supported options:\n"
         "\n"
@@ -66,14 +76,170 @@ void printHelp()
         " -V, --version           Print version and exit.\n"
         " -v, --verbose=LEVEL     Set the verbosity level, by default 0.\n"
         " -n, --dry-run           Just parse the file.\n"
+        " -C, --no-cache          Don't use the local copies of installed\n"
+        "                         sis files, but read them all again.\n"
+        " -t, --verify-only       Just check the given files, and the sis\n"
+        "                         files in the given directories.\n"
+        " -D, --device=NAME       Talk to the Psion ncpd calls NAME, if it\n"
+        "                         serves more than one.\n"
         ));
 }
 
+/**
+ * The work of --verify-only, shared by all threads.
+ */
+struct verifyQueue {
+        std::vector<std::string> files;
+        std::vector<SisRC> results;
+        size_t next;
+        pthread_mutex_t lock;
+};
+
+static SisRC
+verifyFile(const char* name)
+{
+        int fd = open(name, O_RDONLY);
+        if (-1 == fd)
+                return SIS_FAILED;
+        struct stat st;
+        if ((-1 == fstat(fd, &st)) || (st.st_size == 0))
+                {
+                close(fd);
+                return SIS_TRUNCATED;
+                }
+        uint8_t* buf = (uint8_t*)mmap(NULL, st.st_size, PROT_READ,
+                                      MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (MAP_FAILED == buf)
+                return SIS_FAILED;
+        SISFile sisFile;
+        SisRC rc = sisFile.fillFrom(buf, st.st_size);
+        if (rc == SIS_OK)
+                rc = sisFile.verify();
+        munmap(buf, st.st_size);
+        return rc;
+}
+
+static void*
+verifyWorker(void* arg)
+{
+        verifyQueue* q = (verifyQueue*)arg;
+        while (1)
+                {
+                pthread_mutex_lock(&q->lock);
+                size_t i = q->next++;
+                pthread_mutex_unlock(&q->lock);
+                if (i >= q->files.size())
+                        break;
+                q->results[i] = verifyFile(q->files[i].c_str());
+                }
+        return NULL;
+}
+
+static void
+findSisFiles(const std::string& dir, std::vector<std::string>& files)
+{
+        DIR* d = opendir(dir.c_str());
+        if (d == NULL)
+                {
+                files.push_back(dir);
+                return;
+                }
+        struct dirent* de;
+        size_t first = files.size();
+        while ((de = readdir(d)) != NULL)
+                {
+                if (de->d_name[0] == '.')
+                        continue;
+                std::string name = dir + "/" + de->d_name;
+                struct stat st;
+                if (stat(name.c_str(), &st) != 0)
+                        continue;
+                size_t len = strlen(de->d_name);
+                if (S_ISDIR(st.st_mode))
+                        findSisFiles(name, files);
+                else if ((len > 4) && !strcasecmp(de->d_name + len - 4, ".sis"))
+                        files.push_back(name);
+                }
+        closedir(d);
+        std::sort(files.begin() + first, files.end());
+}
+
+/**
+ * Check a list of sis files and directories, on all processors.
+ *
+ * @return The number of bad files.
+ */
+static int
+verifyAll(char** names, int n)
+{
+        verifyQueue q;
+        for (int i = 0; i < n; i++)
+                {
+                struct stat st;
+                if ((stat(names[i], &st) == 0) && S_ISDIR(st.st_mode))
+                        findSisFiles(names[i], q.files);
+                else
+                        q.files.push_back(names[i]);
+                }
+        q.results.resize(q.files.size(), SIS_OK);
+        q.next = 0;
+        pthread_mutex_init(&q.lock, NULL);
+
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t nthreads = (ncpu > 0) ? ncpu : 1;
+        if (nthreads > q.files.size())
+                nthreads = q.files.size();
+        std::vector<pthread_t> threads(nthreads);
+        size_t started = 0;
+        for (; started < nthreads; started++)
+                if (pthread_create(&threads[started], NULL, verifyWorker, &q) != 0)
+                        break;
+        if (started == 0)
+                verifyWorker(&q);
+        for (size_t i = 0; i < started; i++)
+                pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&q.lock);
+
+        int bad = 0;
+        for (size_t i = 0; i < q.files.size(); i++)
+                {
+                const char* what;
+                switch (q.results[i])
+                        {
+                        case SIS_OK:
+                                what = _("OK");
+                                break;
+                        case SIS_BADCRC:
+                                what = _("bad checksum");
+                                break;
+                        case SIS_TRUNCATED:
+                        case SIS_TRUNCATEDDATA:
+                                what = _("truncated");
+                                break;
+                        case SIS_FAILED:
+                                what = _("could not be read");
+                                break;
+                        default:
+                                what = _("corrupted");
+                        }
+                if (q.results[i] != SIS_OK)
+                        bad++;
+                if ((q.results[i] != SIS_OK) || (logLevel >= 1))
+                        printf("%s: %s\n", q.files[i].c_str(), what);
+                }
+        printf(_("%d of %d files are bad.\n"), bad, (int)q.files.size());
+        return bad;
+}
+
 int main(int argc, char* argv[])
 {
         char* filename = 0;
         char option;
         bool dryrun = false;
+        bool usecache = true;
+        bool verifyonly = false;
+        const char* device = NULL;
 
 #ifdef LC_ALL
         setlocale(LC_ALL, "");
@@ -83,7 +249,7 @@ int main(int argc, char* argv[])
         while (1)
                 {
                 option = getopt_long(argc, argv,
-                                                         "hnv:V"
+                                                         "hnCtv:VD:"
                                                          , opts, NULL);
                 if (option == -1)
                         break;
@@ -99,59 +265,98 @@ int main(int argc, char* argv[])
                         case 'n':
                                 dryrun = true;
                                 break;
+                        case 'C':
+                                usecache = false;
+                                break;
+                        case 't':
+                                verifyonly = true;
+                                break;
+                        case 'D':
+                                device = optarg;
+                                break;
                         case 'V':
                                 printf("%s", _("sisinstall version 0.1\n"));
                                 exit(0);
                         }
                 }
-        if (optind < argc)
-        {
-                filename = argv[optind];
-                printf(_("Installing sis file %s%s.\n"), filename,
-                       dryrun ? _(", not really") : "");
-        }
-        else
+        if (optind >= argc)
         {
                 fprintf(stderr, "%s", _("Missing SIS filename\n"));
                 exit(1);
         }
-        struct stat st;
-        if (-1 == stat(filename, &st))
-                error(__LINE__);
-        off_t len = st.st_size;
-        if (logLevel >= 2)
-                printf(_("File is %jd bytes long\n"), (intmax_t)len);
-        uint8_t* buf = new uint8_t[len];
-        int fd = open(filename, O_RDONLY);
-        if (-1 == fd)
-                error(__LINE__);
-        if (-1 == read(fd, buf, len))
-                error(__LINE__);
-        close(fd);
+        createCRCTable();
+        if (verifyonly)
+                return verifyAll(argv + optind, argc - optind) ? 1 : 0;
+        int nfiles = argc - optind;
+        uint8_t** bufs = new uint8_t*[nfiles];
+        off_t* lens = new off_t[nfiles];
+        for (int i = 0; i < nfiles; i++)
+        {
+                filename = argv[optind + i];
+                printf(_("Installing sis file %s%s.\n"), filename,
+                       dryrun ? _(", not really") : "");
+                int fd = open(filename, O_RDONLY);
+                if (-1 == fd)
+                        error(__LINE__);
+                struct stat st;
+                if (-1 == fstat(fd, &st))
+                        error(__LINE__);
+                lens[i] = st.st_size;
+                if (logLevel >= 2)
+                        printf(_("File is %jd bytes long\n"), (intmax_t)lens[i]);
+                // The embedded files are sent straight from the mapping. It is
+                // private and writable because the installation drive gets
+                // patched into the copy which is stored on the Psion.
+                bufs[i] = (uint8_t*)mmap(NULL, lens[i], PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE, fd, 0);
+                if (MAP_FAILED == bufs[i])
+                        error(__LINE__);
+                close(fd);
+        }
+        int failed = 0;
         Psion* psion;
         if (dryrun)
                 psion = new FakePsion();
         else
                 psion = new Psion();
-        if (!psion->connect())
+        if (!psion->connect(device))
                 {
                         printf("%s", _("Couldn't connect with the Psion\n"));
+                        failed = nfiles;
                 }
         else
                 {
-                createCRCTable();
-                SISFile sisFile;
-                SisRC rc = sisFile.fillFrom(buf, len);
-                if (rc == SIS_OK)
+                // All packages go through one installer, which reads
+                // the installed packages and creates each directory
+                // only once.
+                SISInstaller installer;
+                installer.setPsion(psion);
+                installer.setUseCache(usecache);
+                for (int i = 0; i < nfiles; i++)
                         {
-                                SISInstaller installer;
-                                installer.setPsion(psion);
-                                installer.run(&sisFile, buf, len);
+                        SISFile* sisFile = new SISFile();
+                        SisRC rc = sisFile->fillFrom(bufs[i], lens[i]);
+                        if (rc == SIS_OK)
+                                rc = sisFile->verify();
+                        if (rc == SIS_OK)
+                                installer.addPackage(sisFile, bufs[i], lens[i]);
+                        else
+                                {
+                                printf(_("Skipping the damaged sis file %s.\n"),
+                                       argv[optind + i]);
+                                delete sisFile;
+                                failed++;
+                                }
                         }
-                else
-                        printf("%s", _("Could not parse the sis file.\n"));
+                failed += installer.runAll();
                 psion->disconnect();
                 }
+        for (int i = 0; i < nfiles; i++)
+                munmap(bufs[i], lens[i]);
+        delete[] bufs;
+        delete[] lens;
+        if ((nfiles > 1) && failed)
+                printf(_("%d of %d packages were not installed.\n"), failed, nfiles);
 
-        return 0;
+        return failed ? 1 : 0;
 }